@@ -0,0 +1,43 @@
+#include "BinaryFrame.h"
+#include <string.h>
+
+uint16_t crc16Ccitt(const uint8_t *data, size_t len)
+{
+  uint16_t crc = 0xFFFF;
+  for (size_t i = 0; i < len; i++)
+  {
+    crc ^= (uint16_t)data[i] << 8;
+    for (int bit = 0; bit < 8; bit++)
+      crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+int encodeBinaryFrame(uint8_t *out, uint8_t type, uint8_t seq, const void *payload, uint8_t payloadLen)
+{
+  BinaryFrameHeader header = {BINARY_FRAME_MAGIC, BINARY_FRAME_VERSION, type, seq, payloadLen};
+  memcpy(out, &header, sizeof(header));
+  memcpy(out + sizeof(header), payload, payloadLen);
+  int len = sizeof(header) + payloadLen;
+  uint16_t crc = crc16Ccitt(out, len);
+  out[len] = crc & 0xFF;
+  out[len + 1] = crc >> 8;
+  return len + 2;
+}
+
+BinaryFrameCheck checkBinaryFrame(const uint8_t *data, int len, uint8_t type, size_t payloadLen)
+{
+  BinaryFrameHeader header;
+  if (len < (int)sizeof(header) + 2)
+    return BINARY_FRAME_MALFORMED;
+  memcpy(&header, data, sizeof(header));
+  if (header.version != BINARY_FRAME_VERSION || header.type != type || header.length != payloadLen ||
+      len != (int)(sizeof(header) + payloadLen + 2))
+  {
+    return BINARY_FRAME_MALFORMED;
+  }
+  uint16_t crc = data[len - 2] | (data[len - 1] << 8);
+  if (crc != crc16Ccitt(data, len - 2))
+    return BINARY_FRAME_BAD_CRC;
+  return BINARY_FRAME_OK;
+}
@@ -0,0 +1,59 @@
+#ifndef BINARY_FRAME_H
+#define BINARY_FRAME_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// --- Binary Frames (wire format shared with the controller) ---
+// Frame layout: BinaryFrameHeader | payload | CRC16-CCITT over header and payload (little endian).
+// Kept free of Arduino calls so the native test environment can round-trip frames on the host
+const uint8_t BINARY_FRAME_MAGIC = 0xB5;
+const uint8_t BINARY_FRAME_VERSION = 1;
+enum BinaryMessageType : uint8_t
+{
+  MSG_TELEMETRY = 1,
+  MSG_FRAGMENT = 2
+};
+
+struct __attribute__((packed)) BinaryFrameHeader
+{
+  uint8_t magic;
+  uint8_t version;
+  uint8_t type;
+  uint8_t seq;
+  uint8_t length; // payload bytes
+};
+
+enum BinaryFrameCheck : uint8_t
+{
+  BINARY_FRAME_OK,
+  BINARY_FRAME_MALFORMED,
+  BINARY_FRAME_BAD_CRC
+};
+
+#define TELEMETRY_FLAG_PUMP 0x01
+#define TELEMETRY_FLAG_HEATER 0x02
+#define TELEMETRY_FLAG_LEVER 0x04
+#define TELEMETRY_FLAG_PUMP_START 0x08
+
+// Fixed-point: temperatures in 0.1 C, pressure in 0.01 bar, weight in 0.01 g, flow in 0.01 g/s
+struct __attribute__((packed)) TelemetryPayload
+{
+  int16_t boilerTempDeci;
+  int16_t hxTempDeci;
+  int16_t pressureCenti;
+  int32_t weightCenti;
+  int16_t flowRateCenti;
+  uint8_t flags;
+  uint32_t timestampMs; // controller clock, 0 when not provided
+  uint32_t pumpStartMs; // controller clock, valid with TELEMETRY_FLAG_PUMP_START
+};
+const int TELEMETRY_FRAME_LEN = sizeof(BinaryFrameHeader) + sizeof(TelemetryPayload) + 2;
+
+uint16_t crc16Ccitt(const uint8_t *data, size_t len);
+// Writes header, payload and CRC to out; returns the frame length
+int encodeBinaryFrame(uint8_t *out, uint8_t type, uint8_t seq, const void *payload, uint8_t payloadLen);
+// Checks version, type, lengths and CRC; the magic byte is checked by whoever routed the frame here
+BinaryFrameCheck checkBinaryFrame(const uint8_t *data, int len, uint8_t type, size_t payloadLen);
+
+#endif
@@ -0,0 +1,94 @@
+#include "FragmentTransfer.h"
+#include <string.h>
+
+int encodeFragmentFrame(uint8_t *out, uint8_t seq, uint8_t transferId, const char *data, uint16_t len, uint8_t index)
+{
+  FragmentPayload fragment;
+  memset(&fragment, 0, sizeof(fragment));
+  fragment.transferId = transferId;
+  fragment.index = index;
+  fragment.count = fragmentCount(len);
+  fragment.totalLen = len;
+  size_t offset = (size_t)index * FRAGMENT_DATA_BYTES;
+  size_t chunk = len - offset;
+  memcpy(fragment.data, data + offset, chunk < FRAGMENT_DATA_BYTES ? chunk : FRAGMENT_DATA_BYTES);
+  return encodeBinaryFrame(out, MSG_FRAGMENT, seq, &fragment, sizeof(fragment));
+}
+
+char *reassembleFragment(IncomingTransfer *slots, const FragmentPayload &fragment, unsigned long nowMs,
+                         FragmentStats &stats)
+{
+  // count must match totalLen exactly, so every index in range has its offset inside the transfer
+  if (fragment.totalLen == 0 || fragment.totalLen > FRAGMENT_MAX_TRANSFER ||
+      fragment.count != fragmentCount(fragment.totalLen) || fragment.index >= fragment.count)
+  {
+    stats.rejected++;
+    return nullptr;
+  }
+  stats.fragmentsReceived++;
+  expireIncomingTransfers(slots, nowMs, stats);
+
+  IncomingTransfer *transfer = nullptr;
+  IncomingTransfer *freeSlot = nullptr;
+  for (int i = 0; i < FRAGMENT_TRANSFER_SLOTS; i++)
+  {
+    IncomingTransfer &candidate = slots[i];
+    if (candidate.used && candidate.transferId == fragment.transferId)
+      transfer = &candidate;
+    else if (!candidate.used && freeSlot == nullptr)
+      freeSlot = &candidate;
+  }
+  if (transfer == nullptr)
+  {
+    if (freeSlot == nullptr)
+    {
+      stats.rejected++;
+      return nullptr;
+    }
+    transfer = freeSlot;
+    transfer->used = true;
+    transfer->transferId = fragment.transferId;
+    transfer->count = fragment.count;
+    transfer->totalLen = fragment.totalLen;
+    transfer->receivedMask = 0;
+    transfer->startedMs = nowMs;
+  }
+  if (transfer->count != fragment.count || transfer->totalLen != fragment.totalLen)
+  {
+    stats.rejected++;
+    return nullptr;
+  }
+
+  size_t offset = (size_t)fragment.index * FRAGMENT_DATA_BYTES;
+  if (offset >= transfer->totalLen)
+  {
+    stats.rejected++;
+    return nullptr;
+  }
+  size_t chunk = transfer->totalLen - offset;
+  memcpy(transfer->data + offset, fragment.data, chunk < FRAGMENT_DATA_BYTES ? chunk : FRAGMENT_DATA_BYTES);
+  transfer->receivedMask |= (1UL << fragment.index);
+  uint32_t completeMask = (transfer->count == 32) ? 0xFFFFFFFFUL : ((1UL << transfer->count) - 1);
+  if (transfer->receivedMask != completeMask)
+  {
+    return nullptr;
+  }
+
+  transfer->data[transfer->totalLen] = '\0';
+  transfer->used = false;
+  stats.transfersReceived++;
+  return transfer->data;
+}
+
+void expireIncomingTransfers(IncomingTransfer *slots, unsigned long nowMs, FragmentStats &stats)
+{
+  for (int i = 0; i < FRAGMENT_TRANSFER_SLOTS; i++)
+  {
+    IncomingTransfer &transfer = slots[i];
+    if (transfer.used && nowMs - transfer.startedMs > FRAGMENT_REASSEMBLY_TIMEOUT_MS)
+    {
+      transfer.used = false;
+      stats.timeouts++;
+    }
+  }
+}
@@ -0,0 +1,57 @@
+#ifndef FRAGMENT_TRANSFER_H
+#define FRAGMENT_TRANSFER_H
+
+#include "BinaryFrame.h"
+
+// --- Fragmented Transfers (text messages too long for one frame) ---
+// Every fragment frame has the same length; totalLen tells the receiver where the message ends.
+// Kept free of Arduino calls so the native test environment can split and reassemble transfers on the host
+#define FRAGMENT_DATA_BYTES 200
+#define FRAGMENT_MAX_TRANSFER 3584
+#define FRAGMENT_TRANSFER_SLOTS 2
+struct __attribute__((packed)) FragmentPayload
+{
+  uint8_t transferId;
+  uint8_t index;
+  uint8_t count;
+  uint16_t totalLen;
+  uint8_t data[FRAGMENT_DATA_BYTES];
+};
+const int FRAGMENT_FRAME_LEN = sizeof(BinaryFrameHeader) + sizeof(FragmentPayload) + 2;
+const unsigned long FRAGMENT_REASSEMBLY_TIMEOUT_MS = 2000;
+
+struct IncomingTransfer
+{
+  bool used;
+  uint8_t transferId;
+  uint8_t count;
+  uint16_t totalLen;
+  uint32_t receivedMask;
+  unsigned long startedMs;
+  char data[FRAGMENT_MAX_TRANSFER + 1];
+};
+
+struct FragmentStats
+{
+  uint32_t transfersSent;
+  uint32_t fragmentsSent;
+  uint32_t transfersReceived;
+  uint32_t fragmentsReceived;
+  uint32_t timeouts;
+  uint32_t rejected;
+};
+
+inline uint8_t fragmentCount(size_t len)
+{
+  return (len + FRAGMENT_DATA_BYTES - 1) / FRAGMENT_DATA_BYTES;
+}
+
+// Writes fragment index of data as one binary frame; returns FRAGMENT_FRAME_LEN
+int encodeFragmentFrame(uint8_t *out, uint8_t seq, uint8_t transferId, const char *data, uint16_t len, uint8_t index);
+// Files a fragment whose frame already passed checkBinaryFrame; returns the NUL-terminated message once its last
+// fragment arrives, otherwise nullptr
+char *reassembleFragment(IncomingTransfer *slots, const FragmentPayload &fragment, unsigned long nowMs,
+                         FragmentStats &stats);
+void expireIncomingTransfers(IncomingTransfer *slots, unsigned long nowMs, FragmentStats &stats);
+
+#endif
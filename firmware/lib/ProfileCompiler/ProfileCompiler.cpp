@@ -0,0 +1,131 @@
+#include "ProfileCompiler.h"
+
+// Walks the steps on every call; the compiled lookups below must return the same bits
+float getProfileTargetAt(const ProfileStep *steps, int numSteps, bool isStepped, float currentX)
+{
+  if (numSteps == 0)
+    return 0.0f;
+
+  float stepStartX = 0.0f;
+  float prevTargetY = 0.0f;
+
+  for (int i = 0; i < numSteps; i++)
+  {
+    float duration = steps[i].control;
+    float targetY = steps[i].target;
+
+    if (duration <= 0.001f)
+    {
+      prevTargetY = targetY;
+      continue;
+    }
+
+    float stepEndX = stepStartX + duration;
+
+    if (currentX <= stepEndX)
+    {
+      if (isStepped)
+      {
+        return targetY;
+      }
+      else
+      {
+        return (currentX - stepStartX) * (targetY - prevTargetY) / duration + prevTargetY;
+      }
+    }
+
+    stepStartX = stepEndX;
+    prevTargetY = targetY;
+  }
+
+  return prevTargetY;
+}
+
+// Mirrors the walk in getProfileTargetAt() once, so lookups only need a binary search
+void compileProfile(CompiledProfile &compiled, const ProfileStep *steps, int numSteps, bool isStepped)
+{
+  compiled.numSegments = 0;
+  compiled.finalY = 0.0f;
+  compiled.isStepped = isStepped;
+
+  float stepStartX = 0.0f;
+  float prevTargetY = 0.0f;
+  for (int i = 0; i < numSteps && i < MAX_PROFILE_STEPS; i++)
+  {
+    float duration = steps[i].control;
+    float targetY = steps[i].target;
+
+    if (duration <= 0.001f)
+    {
+      prevTargetY = targetY;
+      continue;
+    }
+
+    ProfileSegment &segment = compiled.segments[compiled.numSegments++];
+    segment.startX = stepStartX;
+    segment.endX = stepStartX + duration;
+    segment.prevY = prevTargetY;
+    segment.deltaY = targetY - prevTargetY;
+    segment.duration = duration;
+    segment.targetY = targetY;
+    segment.stepIndex = i;
+
+    stepStartX = segment.endX;
+    prevTargetY = targetY;
+  }
+  compiled.finalY = prevTargetY;
+}
+
+// First segment whose end is at or past currentX; numSegments once the profile is over
+int findCompiledSegment(const CompiledProfile &compiled, float currentX)
+{
+  int lo = 0;
+  int hi = compiled.numSegments;
+  while (lo < hi)
+  {
+    int mid = (lo + hi) / 2;
+    if (currentX <= compiled.segments[mid].endX)
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+float getCompiledProfileTargetAt(const CompiledProfile &compiled, float currentX)
+{
+  int index = findCompiledSegment(compiled, currentX);
+  if (index >= compiled.numSegments)
+  {
+    return compiled.finalY;
+  }
+  const ProfileSegment &segment = compiled.segments[index];
+  if (compiled.isStepped)
+  {
+    return segment.targetY;
+  }
+  return (currentX - segment.startX) * segment.deltaY / segment.duration + segment.prevY;
+}
+
+// Targets of a time-based profile at every shot sample, walking the segments once
+void fillTimeTargetTable(const CompiledProfile &compiled, float *table, int count, int intervalMs)
+{
+  int segment = 0;
+  for (int i = 0; i < count; i++)
+  {
+    float sampleX = i * intervalMs / 1000.0f;
+    while (segment < compiled.numSegments && sampleX > compiled.segments[segment].endX)
+    {
+      segment++;
+    }
+    if (segment >= compiled.numSegments)
+    {
+      table[i] = compiled.finalY;
+    }
+    else
+    {
+      const ProfileSegment &seg = compiled.segments[segment];
+      table[i] = compiled.isStepped ? seg.targetY : (sampleX - seg.startX) * seg.deltaY / seg.duration + seg.prevY;
+    }
+  }
+}
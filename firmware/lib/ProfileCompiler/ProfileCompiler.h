@@ -0,0 +1,39 @@
+#ifndef PROFILE_COMPILER_H
+#define PROFILE_COMPILER_H
+
+// --- Profile Targets (reference walk and compiled segment index) ---
+// Kept free of Arduino calls so the native test environment can check both lookups against each other
+#define MAX_PROFILE_STEPS 128
+
+struct ProfileStep
+{
+  float target;
+  float control; // seconds or grams the step lasts; steps of 0.001 or less only set the starting value
+};
+
+struct ProfileSegment
+{
+  float startX;
+  float endX;
+  float prevY;
+  float deltaY;
+  float duration;
+  float targetY;
+  int stepIndex;
+};
+
+struct CompiledProfile
+{
+  bool isStepped;
+  int numSegments;
+  float finalY;
+  ProfileSegment segments[MAX_PROFILE_STEPS];
+};
+
+float getProfileTargetAt(const ProfileStep *steps, int numSteps, bool isStepped, float currentX);
+void compileProfile(CompiledProfile &compiled, const ProfileStep *steps, int numSteps, bool isStepped);
+int findCompiledSegment(const CompiledProfile &compiled, float currentX);
+float getCompiledProfileTargetAt(const CompiledProfile &compiled, float currentX);
+void fillTimeTargetTable(const CompiledProfile &compiled, float *table, int count, int intervalMs);
+
+#endif
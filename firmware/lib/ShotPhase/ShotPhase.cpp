@@ -0,0 +1,101 @@
+#include "ShotPhase.h"
+#include <math.h>
+
+const char *SHOT_PHASE_NAMES[] = {"none", "fill", "pre-infusion", "ramp", "main", "decline", "drip"};
+
+static void recordPhaseEvent(PhaseDetector &d, ShotPhase phase, unsigned long timeMs, float weight)
+{
+  d.phase = phase;
+  d.phasePeakPressure = d.smoothPressure;
+  if (d.eventCount >= MAX_PHASE_EVENTS)
+  {
+    return;
+  }
+  PhaseEvent &event = d.events[d.eventCount++];
+  event.phase = phase;
+  event.timeMs = timeMs;
+  event.weight = weight;
+}
+
+void startPhaseDetector(PhaseDetector &d, unsigned long shotStartMs, unsigned long nowMs, float weight)
+{
+  d = {};
+  d.active = true;
+  d.startMs = shotStartMs;
+  d.lastFeedMs = nowMs;
+  d.pending = PHASE_NONE;
+  recordPhaseEvent(d, PHASE_FILL, 0, weight);
+}
+
+void stepPhaseDetector(PhaseDetector &d, unsigned long nowMs, float pressure, float flowRate, float weight, bool pumpOn)
+{
+  if (!d.active || d.phase == PHASE_DRIP)
+  {
+    return;
+  }
+  if (!pumpOn)
+  {
+    recordPhaseEvent(d, PHASE_DRIP, nowMs - d.startMs, weight);
+    return;
+  }
+
+  unsigned long gapMs = nowMs - d.lastFeedMs;
+  float dt = (gapMs < PHASE_MAX_FRAME_GAP_MS ? gapMs : PHASE_MAX_FRAME_GAP_MS) / 1000.0f;
+  d.lastFeedMs = nowMs;
+  if (dt > 0.0f)
+  {
+    float previousPressure = d.smoothPressure;
+    float previousFlow = d.smoothFlow;
+    float alpha = 1.0f - expf(-dt / PHASE_SMOOTHING_TAU_S);
+    float slopeAlpha = 1.0f - expf(-dt / PHASE_SLOPE_TAU_S);
+    d.smoothPressure += alpha * (pressure - d.smoothPressure);
+    d.smoothFlow += alpha * (flowRate - d.smoothFlow);
+    d.pressureSlope += slopeAlpha * ((d.smoothPressure - previousPressure) / dt - d.pressureSlope);
+    d.flowSlope += slopeAlpha * ((d.smoothFlow - previousFlow) / dt - d.flowSlope);
+  }
+  if (d.smoothPressure > d.phasePeakPressure)
+  {
+    d.phasePeakPressure = d.smoothPressure;
+  }
+
+  ShotPhase next = d.phase;
+  switch (d.phase)
+  {
+  case PHASE_FILL:
+    if (d.smoothPressure >= PHASE_FILL_END_BAR)
+      next = PHASE_PREINFUSION;
+    break;
+  case PHASE_PREINFUSION:
+    if (d.pressureSlope > PHASE_RAMP_SLOPE_BAR_S || d.smoothPressure >= PHASE_PREINFUSION_END_BAR)
+      next = PHASE_RAMP;
+    break;
+  case PHASE_RAMP:
+    if ((d.smoothPressure >= PHASE_PREINFUSION_END_BAR || weight >= PHASE_FIRST_DROP_G) &&
+        d.pressureSlope < PHASE_PLATEAU_SLOPE_BAR_S)
+      next = PHASE_MAIN;
+    break;
+  case PHASE_MAIN:
+    if ((d.smoothPressure < d.phasePeakPressure - PHASE_DECLINE_DROP_BAR && d.pressureSlope < 0.0f) ||
+        (d.flowSlope < -PHASE_FLOW_DECLINE_SLOPE_GS2 && d.pressureSlope <= 0.0f))
+      next = PHASE_DECLINE;
+    break;
+  default:
+    break;
+  }
+
+  // A transition must hold for the dwell time so pump noise cannot bounce between phases
+  if (next == d.phase)
+  {
+    d.pending = PHASE_NONE;
+  }
+  else if (next != d.pending)
+  {
+    d.pending = next;
+    d.pendingSinceMs = nowMs;
+  }
+  else if (nowMs - d.pendingSinceMs >= PHASE_DWELL_MS)
+  {
+    recordPhaseEvent(d, next, d.pendingSinceMs - d.startMs, weight);
+    d.pending = PHASE_NONE;
+  }
+}
@@ -0,0 +1,60 @@
+#ifndef SHOT_PHASE_H
+#define SHOT_PHASE_H
+
+#include <stdint.h>
+
+// --- Shot Phases (threshold and slope state machine, one step per telemetry frame) ---
+// Kept free of Arduino calls so the native test environment can drive it with simulated shots
+enum ShotPhase : uint8_t
+{
+  PHASE_NONE,
+  PHASE_FILL,
+  PHASE_PREINFUSION,
+  PHASE_RAMP,
+  PHASE_MAIN,
+  PHASE_DECLINE,
+  PHASE_DRIP
+};
+extern const char *SHOT_PHASE_NAMES[];
+#define MAX_PHASE_EVENTS 12
+
+struct PhaseEvent
+{
+  uint8_t phase;
+  uint32_t timeMs;
+  float weight;
+};
+
+struct PhaseDetector
+{
+  bool active;
+  unsigned long startMs;
+  unsigned long lastFeedMs;
+  ShotPhase phase;
+  ShotPhase pending;
+  unsigned long pendingSinceMs;
+  float smoothPressure;
+  float pressureSlope;
+  float smoothFlow;
+  float flowSlope;
+  float phasePeakPressure;
+  int eventCount;
+  PhaseEvent events[MAX_PHASE_EVENTS];
+};
+
+const float PHASE_FILL_END_BAR = 1.5;
+const float PHASE_PREINFUSION_END_BAR = 5.0;
+const float PHASE_FIRST_DROP_G = 0.3;
+const float PHASE_RAMP_SLOPE_BAR_S = 1.5;
+const float PHASE_PLATEAU_SLOPE_BAR_S = 0.5;
+const float PHASE_DECLINE_DROP_BAR = 0.8;
+const float PHASE_FLOW_DECLINE_SLOPE_GS2 = 0.15;
+const float PHASE_SMOOTHING_TAU_S = 0.25;
+const float PHASE_SLOPE_TAU_S = 0.5;
+const unsigned long PHASE_DWELL_MS = 300;
+const unsigned long PHASE_MAX_FRAME_GAP_MS = 500;
+
+void startPhaseDetector(PhaseDetector &d, unsigned long shotStartMs, unsigned long nowMs, float weight);
+void stepPhaseDetector(PhaseDetector &d, unsigned long nowMs, float pressure, float flowRate, float weight, bool pumpOn);
+
+#endif
@@ -0,0 +1,159 @@
+#include "ShotSimulator.h"
+
+// --- TIMING CONFIGURATION ---
+static const float pumpDurationS = 34.5;
+static const float flowStartS = 4.0;  // First drips
+static const float rampStartS = 14.0; // Start of the high-flow "Mountain"
+
+// --- TARGETS ---
+static const float targetYield = 40.0;
+static const float finalDripYield = 44.5;
+
+// Pressure Profile Targets
+static const float maxPressure = 9.0; // Peak pressure during the "Shelf"
+static const float endPressure = 7.5; // Target pressure at 34.5s (User request: 7-8 bar)
+
+// Flow Configuration
+static const float shelfFlowRate = 0.6;
+
+// Longer gaps between steps are integrated as this much time
+static const float maxStepS = 0.5;
+
+static float lerp(float x, float inMin, float inMax, float outMin, float outMax)
+{
+  return (x - inMin) * (outMax - outMin) / (inMax - inMin) + outMin;
+}
+
+// Same contract as Arduino's random(min, max), drawn from the shot's own xorshift state
+static long simRandom(SimulatedShot &sim, long minVal, long maxVal)
+{
+  uint32_t x = sim.noiseState;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  sim.noiseState = x;
+  return minVal + (long)(x % (uint32_t)(maxVal - minVal));
+}
+
+void startSimulatedShot(SimulatedShot &sim, unsigned long nowMs, uint32_t seed)
+{
+  sim = {};
+  sim.active = true;
+  sim.startMs = nowMs;
+  sim.lastStepMs = nowMs;
+  sim.noiseState = seed ? seed : 1;
+}
+
+void stepSimulatedShot(SimulatedShot &sim, unsigned long nowMs)
+{
+  if (!sim.active)
+  {
+    return;
+  }
+
+  // --- DYNAMIC FLOW CALCULATION (Same as before) ---
+  const float durationShelf = rampStartS - flowStartS;
+  const float durationRamp = pumpDurationS - rampStartS;
+  const float weightAccumulatedOnShelf = durationShelf * shelfFlowRate;
+  const float weightNeededInRamp = targetYield - weightAccumulatedOnShelf;
+  const float peakFlowRate = (2.0f * weightNeededInRamp / durationRamp) - shelfFlowRate;
+
+  float t = (nowMs - sim.startMs) / 1000.0f;
+
+  // ============================================================
+  // 1. PRESSURE (Physics-Based Decay)
+  // ============================================================
+  if (t <= pumpDurationS)
+  {
+    sim.pumpOn = true;
+    float baseP = 0.0f;
+
+    if (t < 2.0)
+    {
+      // Phase 0: Chaotic fill
+      baseP = t + (simRandom(sim, -20, 20) / 100.0f);
+    }
+    else if (t < 5.0)
+    {
+      // Phase 1: Ramp to Max
+      baseP = lerp(t, 2.0, 5.0, 2.0, maxPressure);
+    }
+    else if (t < rampStartS)
+    {
+      // Phase 2: The "Shelf" -> High resistance, maintain Max Pressure
+      baseP = maxPressure;
+    }
+    else
+    {
+      // Phase 3: The "Mountain" -> Resistance drops, Pressure decays
+      // Linearly interpolate from 9.0 down to 7.5 over the ramp duration
+      baseP = lerp(t, rampStartS, pumpDurationS, maxPressure, endPressure);
+    }
+
+    // Add vibratory pump noise
+    sim.pressure = baseP + (simRandom(sim, -15, 15) / 100.0f);
+    if (sim.pressure < 0.0f)
+      sim.pressure = 0.0f;
+  }
+  else
+  {
+    // Pump Cutoff
+    sim.pumpOn = false;
+    sim.pressure = sim.pressure * 0.85f; // Solenoid release
+  }
+
+  // ============================================================
+  // 2. FLOW PROFILE ("Mara X" Shape)
+  // ============================================================
+  float intendedFlow = 0.0f;
+
+  if (t < flowStartS)
+  {
+    intendedFlow = 0.0f;
+  }
+  else if (t < rampStartS)
+  {
+    // The "Shelf"
+    intendedFlow = shelfFlowRate + (simRandom(sim, -5, 6) / 100.0f);
+  }
+  else if (t <= pumpDurationS)
+  {
+    // The "Mountain"
+    float progress = (t - rampStartS) / durationRamp;
+    float currentRampFlow = shelfFlowRate + (progress * (peakFlowRate - shelfFlowRate));
+
+    // Stair-step effect
+    int steps = (int)(currentRampFlow * 10);
+    intendedFlow = (float)steps / 10.0f;
+    intendedFlow += (simRandom(sim, -5, 6) / 200.0f);
+  }
+  else
+  {
+    // Post-Pump Decay
+    float dripTime = t - pumpDurationS;
+    if (dripTime < 3.0)
+    {
+      intendedFlow = peakFlowRate * (1.0 - (dripTime / 3.0));
+    }
+    else
+    {
+      intendedFlow = 0.0f;
+      sim.active = false;
+    }
+  }
+
+  sim.flowRate = intendedFlow > 0.0f ? intendedFlow : 0.0f;
+
+  // ============================================================
+  // 3. WEIGHT INTEGRATION
+  // ============================================================
+  float dt = (nowMs - sim.lastStepMs) / 1000.0f;
+  if (dt > maxStepS)
+    dt = maxStepS;
+  sim.lastStepMs = nowMs;
+
+  sim.weight += sim.flowRate * dt;
+
+  if (t > pumpDurationS && sim.weight > finalDripYield)
+    sim.weight = finalDripYield;
+}
@@ -0,0 +1,23 @@
+#ifndef SHOT_SIMULATOR_H
+#define SHOT_SIMULATOR_H
+
+#include <stdint.h>
+
+// --- Simulated Shot (Mara X style pressure and flow, seeded noise) ---
+// Time is passed in by the caller, so the same seed and timestamps always give the same shot
+struct SimulatedShot
+{
+  bool active;
+  bool pumpOn;
+  unsigned long startMs;
+  unsigned long lastStepMs;
+  uint32_t noiseState;
+  float pressure;
+  float flowRate;
+  float weight;
+};
+
+void startSimulatedShot(SimulatedShot &sim, unsigned long nowMs, uint32_t seed);
+void stepSimulatedShot(SimulatedShot &sim, unsigned long nowMs);
+
+#endif
@@ -0,0 +1,125 @@
+#include "TopicKeys.h"
+#include <string.h>
+
+const char *const INCOMING_TOPIC_KEYS[TOPIC_COUNT] = {
+    "",
+    mqtt_topic_boiler_temp,
+    mqtt_topic_hx_temp,
+    mqtt_topic_pressure,
+    mqtt_topic_heater,
+    mqtt_topic_pump,
+    mqtt_topic_timestamp,
+    mqtt_topic_frame_seq,
+    mqtt_topic_pong,
+    mqtt_topic_pump_start,
+    mqtt_topic_caps,
+    mqtt_topic_snapshot,
+    "ack",
+    mqtt_topic_active_profile_id,
+    mqtt_topic_import_profile,
+    mqtt_topic_profile_delta,
+    mqtt_topic_profile_resync,
+    "profile_sync",
+    mqtt_topic_brew_mode,
+    mqtt_topic_steam_boost_status,
+    mqtt_topic_state,
+    mqtt_topic_lever,
+    mqtt_topic_setpoint,
+    mqtt_topic_set_profiling_mode,
+    mqtt_topic_set_profiling_source,
+    mqtt_topic_set_profiling_target,
+    mqtt_topic_set_profiling_flat,
+    mqtt_topic_weight,
+    mqtt_topic_flow_rate,
+    mqtt_topic_mqtt_server,
+    mqtt_topic_mqtt_port,
+    mqtt_topic_mqtt_user,
+    mqtt_topic_mqtt_pass,
+    "raw_weight",
+    "filtered_weight",
+    "filtered_flow",
+};
+
+static IncomingTopic confirmTopic(const char *key, IncomingTopic topic)
+{
+  return strcmp(key, INCOMING_TOPIC_KEYS[topic]) == 0 ? topic : TOPIC_UNKNOWN;
+}
+
+IncomingTopic lookupIncomingTopic(const char *key)
+{
+  switch (topicHash(key))
+  {
+  case topicHash(mqtt_topic_boiler_temp):
+    return confirmTopic(key, TOPIC_BOILER_TEMP);
+  case topicHash(mqtt_topic_hx_temp):
+    return confirmTopic(key, TOPIC_HX_TEMP);
+  case topicHash(mqtt_topic_pressure):
+    return confirmTopic(key, TOPIC_PRESSURE);
+  case topicHash(mqtt_topic_heater):
+    return confirmTopic(key, TOPIC_HEATER);
+  case topicHash(mqtt_topic_pump):
+    return confirmTopic(key, TOPIC_PUMP);
+  case topicHash(mqtt_topic_timestamp):
+    return confirmTopic(key, TOPIC_TIMESTAMP);
+  case topicHash(mqtt_topic_frame_seq):
+    return confirmTopic(key, TOPIC_FRAME_SEQ);
+  case topicHash(mqtt_topic_pong):
+    return confirmTopic(key, TOPIC_PONG);
+  case topicHash(mqtt_topic_pump_start):
+    return confirmTopic(key, TOPIC_PUMP_START);
+  case topicHash(mqtt_topic_caps):
+    return confirmTopic(key, TOPIC_CAPS);
+  case topicHash(mqtt_topic_snapshot):
+    return confirmTopic(key, TOPIC_SNAPSHOT);
+  case topicHash("ack"):
+    return confirmTopic(key, TOPIC_ACK);
+  case topicHash(mqtt_topic_active_profile_id):
+    return confirmTopic(key, TOPIC_ACTIVE_PROFILE_ID);
+  case topicHash(mqtt_topic_import_profile):
+    return confirmTopic(key, TOPIC_IMPORT_PROFILE);
+  case topicHash(mqtt_topic_profile_delta):
+    return confirmTopic(key, TOPIC_PROFILE_DELTA);
+  case topicHash(mqtt_topic_profile_resync):
+    return confirmTopic(key, TOPIC_PROFILE_RESYNC);
+  case topicHash("profile_sync"):
+    return confirmTopic(key, TOPIC_PROFILE_SYNC);
+  case topicHash(mqtt_topic_brew_mode):
+    return confirmTopic(key, TOPIC_BREW_MODE);
+  case topicHash(mqtt_topic_steam_boost_status):
+    return confirmTopic(key, TOPIC_STEAM_BOOST_STATUS);
+  case topicHash(mqtt_topic_state):
+    return confirmTopic(key, TOPIC_STATE);
+  case topicHash(mqtt_topic_lever):
+    return confirmTopic(key, TOPIC_LEVER);
+  case topicHash(mqtt_topic_setpoint):
+    return confirmTopic(key, TOPIC_SETPOINT);
+  case topicHash(mqtt_topic_set_profiling_mode):
+    return confirmTopic(key, TOPIC_SET_PROFILING_MODE);
+  case topicHash(mqtt_topic_set_profiling_source):
+    return confirmTopic(key, TOPIC_SET_PROFILING_SOURCE);
+  case topicHash(mqtt_topic_set_profiling_target):
+    return confirmTopic(key, TOPIC_SET_PROFILING_TARGET);
+  case topicHash(mqtt_topic_set_profiling_flat):
+    return confirmTopic(key, TOPIC_SET_PROFILING_FLAT);
+  case topicHash(mqtt_topic_weight):
+    return confirmTopic(key, TOPIC_WEIGHT);
+  case topicHash(mqtt_topic_flow_rate):
+    return confirmTopic(key, TOPIC_FLOW_RATE);
+  case topicHash(mqtt_topic_mqtt_server):
+    return confirmTopic(key, TOPIC_MQTT_SERVER);
+  case topicHash(mqtt_topic_mqtt_port):
+    return confirmTopic(key, TOPIC_MQTT_PORT);
+  case topicHash(mqtt_topic_mqtt_user):
+    return confirmTopic(key, TOPIC_MQTT_USER);
+  case topicHash(mqtt_topic_mqtt_pass):
+    return confirmTopic(key, TOPIC_MQTT_PASS);
+  case topicHash("raw_weight"):
+    return confirmTopic(key, TOPIC_RAW_WEIGHT);
+  case topicHash("filtered_weight"):
+    return confirmTopic(key, TOPIC_FILTERED_WEIGHT);
+  case topicHash("filtered_flow"):
+    return confirmTopic(key, TOPIC_FILTERED_FLOW);
+  default:
+    return TOPIC_UNKNOWN;
+  }
+}
@@ -0,0 +1,93 @@
+#ifndef TOPIC_KEYS_H
+#define TOPIC_KEYS_H
+
+#include <stdint.h>
+
+// --- MQTT Topics ---
+// Kept free of Arduino calls so the native test environment can check the hash dispatch against plain strcmp
+constexpr const char *mqtt_topic_state = "state";
+constexpr const char *mqtt_topic_boiler_temp = "boiler_temp";
+constexpr const char *mqtt_topic_hx_temp = "hx_temp";
+constexpr const char *mqtt_topic_pressure = "pressure";
+constexpr const char *mqtt_topic_heater = "heater";
+constexpr const char *mqtt_topic_pump = "pump";
+constexpr const char *mqtt_topic_brew_mode = "brew_mode";
+constexpr const char *mqtt_topic_lever = "lever";
+constexpr const char *mqtt_topic_setpoint = "tempsetbrew";
+constexpr const char *mqtt_topic_weight = "weight";
+constexpr const char *mqtt_topic_flow_rate = "flow_rate";
+constexpr const char *mqtt_topic_steam_boost_status = "steam_boost";
+constexpr const char *mqtt_topic_set_profiling_mode = "profiling_mode";
+constexpr const char *mqtt_topic_set_profiling_source = "profiling_source";
+constexpr const char *mqtt_topic_set_profiling_target = "profiling_target";
+constexpr const char *mqtt_topic_set_profiling_flat = "profiling_flat_value";
+constexpr const char *mqtt_topic_mqtt_server = "mqtt_server";
+constexpr const char *mqtt_topic_mqtt_port = "mqtt_port";
+constexpr const char *mqtt_topic_mqtt_user = "mqtt_user";
+constexpr const char *mqtt_topic_mqtt_pass = "mqtt_pass";
+constexpr const char *mqtt_topic_import_profile = "profile_data";
+constexpr const char *mqtt_topic_active_profile_id = "active_profile_id";
+constexpr const char *mqtt_topic_timestamp = "ts";
+constexpr const char *mqtt_topic_pump_start = "pump_start";
+constexpr const char *mqtt_topic_caps = "caps";
+constexpr const char *mqtt_topic_profile_delta = "profile_delta";
+constexpr const char *mqtt_topic_profile_resync = "profile_resync";
+constexpr const char *mqtt_topic_snapshot = "snapshot";
+constexpr const char *mqtt_topic_frame_seq = "fseq";
+constexpr const char *mqtt_topic_ping = "ping";
+constexpr const char *mqtt_topic_pong = "pong";
+constexpr const char *mqtt_topic_subscribe = "subscribe";
+
+// --- Incoming Keys (one per case in handleIncomingMessage) ---
+enum IncomingTopic : uint8_t
+{
+  TOPIC_UNKNOWN,
+  TOPIC_BOILER_TEMP,
+  TOPIC_HX_TEMP,
+  TOPIC_PRESSURE,
+  TOPIC_HEATER,
+  TOPIC_PUMP,
+  TOPIC_TIMESTAMP,
+  TOPIC_FRAME_SEQ,
+  TOPIC_PONG,
+  TOPIC_PUMP_START,
+  TOPIC_CAPS,
+  TOPIC_SNAPSHOT,
+  TOPIC_ACK,
+  TOPIC_ACTIVE_PROFILE_ID,
+  TOPIC_IMPORT_PROFILE,
+  TOPIC_PROFILE_DELTA,
+  TOPIC_PROFILE_RESYNC,
+  TOPIC_PROFILE_SYNC,
+  TOPIC_BREW_MODE,
+  TOPIC_STEAM_BOOST_STATUS,
+  TOPIC_STATE,
+  TOPIC_LEVER,
+  TOPIC_SETPOINT,
+  TOPIC_SET_PROFILING_MODE,
+  TOPIC_SET_PROFILING_SOURCE,
+  TOPIC_SET_PROFILING_TARGET,
+  TOPIC_SET_PROFILING_FLAT,
+  TOPIC_WEIGHT,
+  TOPIC_FLOW_RATE,
+  TOPIC_MQTT_SERVER,
+  TOPIC_MQTT_PORT,
+  TOPIC_MQTT_USER,
+  TOPIC_MQTT_PASS,
+  TOPIC_RAW_WEIGHT,
+  TOPIC_FILTERED_WEIGHT,
+  TOPIC_FILTERED_FLOW,
+  TOPIC_COUNT
+};
+extern const char *const INCOMING_TOPIC_KEYS[TOPIC_COUNT]; // key text by IncomingTopic, "" for TOPIC_UNKNOWN
+
+// FNV-1a over the key. Used in case labels, so two topics that hash alike fail to compile
+constexpr uint32_t topicHash(const char *key, uint32_t hash = 2166136261u)
+{
+  return *key ? topicHash(key + 1, (hash ^ (uint8_t)*key) * 16777619u) : hash;
+}
+
+// Switches on the hash, then confirms with one strcmp so unknown keys that hash alike are still rejected
+IncomingTopic lookupIncomingTopic(const char *key);
+
+#endif
@@ -0,0 +1,111 @@
+#include "YieldPredictor.h"
+#include "ShotPhase.h"
+#include <math.h>
+
+void startYieldPredictor(YieldPredictor &p, unsigned long startMs)
+{
+  p = {};
+  p.active = true;
+  p.startMs = startMs;
+  p.etaS = -1.0f;
+  p.targetReachedS = -1.0f;
+  for (int i = 0; i < 3; i++)
+    p.checkpointPredictionS[i] = -1.0f;
+}
+
+bool stepYieldPredictor(YieldPredictor &p, float t, float weight, float flowRate, bool pumpOn, float target,
+                        float dripPerFlow)
+{
+  if (!p.active || p.pumpOff)
+    return false;
+
+  float dt = fmaxf(t - p.lastT, 0.0f);
+  p.lastT = t;
+
+  // Shift the time origin to the newest frame, then decay and add the frame at t = 0
+  p.stt = p.stt - 2.0f * dt * p.st + dt * dt * p.s0;
+  p.st -= dt * p.s0;
+  p.stw -= dt * p.sw;
+  p.stf -= dt * p.sf;
+  float decay = expf(-dt / YIELD_REGRESSION_TAU_S);
+  p.s0 = p.s0 * decay + 1.0f;
+  p.st *= decay;
+  p.stt *= decay;
+  p.sw = p.sw * decay + weight;
+  p.stw *= decay;
+  p.sf = p.sf * decay + flowRate;
+  p.stf *= decay;
+
+  float det = p.s0 * p.stt - p.st * p.st;
+  if (p.s0 >= 3.0f && det > 1e-6f)
+  {
+    float weightSlope = (p.s0 * p.stw - p.st * p.sw) / det;
+    p.fittedWeight = (p.stt * p.sw - p.st * p.stw) / det;
+    p.flowTrend = (p.s0 * p.stf - p.st * p.sf) / det;
+    p.fittedFlow = 0.5f * (weightSlope + (p.stt * p.sf - p.st * p.stf) / det);
+  }
+  else
+  {
+    p.fittedWeight = weight;
+    p.fittedFlow = flowRate;
+    p.flowTrend = 0.0f;
+  }
+
+  float remaining = target - p.fittedWeight;
+  p.etaS = -1.0f;
+  if (remaining <= 0.0f)
+  {
+    p.etaS = 0.0f;
+  }
+  else if (weight >= PHASE_FIRST_DROP_G && p.fittedFlow > 0.05f)
+  {
+    // Solve remaining = q*x + b/2*x^2 for the time x until the target yield
+    float a = 0.5f * p.flowTrend;
+    if (fabsf(a) < 1e-4f)
+    {
+      p.etaS = remaining / p.fittedFlow;
+    }
+    else
+    {
+      float disc = p.fittedFlow * p.fittedFlow + 4.0f * a * remaining;
+      if (disc >= 0.0f)
+        p.etaS = (-p.fittedFlow + sqrtf(disc)) / (2.0f * a);
+    }
+  }
+  float flowAtTarget = (p.etaS >= 0.0f) ? fmaxf(p.fittedFlow + p.flowTrend * p.etaS, 0.0f) : p.fittedFlow;
+  p.predictedFinal = fmaxf(target, weight) + dripPerFlow * flowAtTarget;
+
+  for (int i = 0; i < 3; i++)
+  {
+    if (p.checkpointPredictionS[i] < 0.0f && p.etaS >= 0.0f && weight >= target * YIELD_CHECKPOINTS[i])
+      p.checkpointPredictionS[i] = t + p.etaS;
+  }
+  bool reached = false;
+  if (p.targetReachedS < 0.0f && weight >= target)
+  {
+    p.targetReachedS = t;
+    reached = true;
+  }
+
+  if (!pumpOn)
+  {
+    p.pumpOff = true;
+    p.pumpOffFlow = flowRate;
+    p.etaS = -1.0f;
+    p.predictedFinal = weight + dripPerFlow * flowRate;
+  }
+  return reached;
+}
+
+bool finishYieldPredictor(YieldPredictor &p, float drip, float minShotS, float &dripPerFlow)
+{
+  bool updated = false;
+  if (p.active && !p.learned && p.pumpOffFlow > YIELD_LEARN_MIN_FLOW_GS && p.lastT > minShotS)
+  {
+    dripPerFlow = 0.7f * dripPerFlow + 0.3f * (drip / p.pumpOffFlow);
+    updated = true;
+  }
+  p.learned = true;
+  p.active = false;
+  return updated;
+}
@@ -0,0 +1,35 @@
+#ifndef YIELD_PREDICTOR_H
+#define YIELD_PREDICTOR_H
+
+// --- Yield Prediction (exponentially weighted regression, re-centred on the newest frame) ---
+// Kept free of Arduino calls so the native test environment can score it against simulated shots
+struct YieldPredictor
+{
+  bool active;
+  bool pumpOff;
+  unsigned long startMs;
+  float lastT;
+  float s0, st, stt, sw, stw, sf, stf;
+  float fittedWeight;
+  float fittedFlow;
+  float flowTrend;
+  float etaS;
+  float predictedFinal;
+  float pumpOffFlow;
+  float targetReachedS;
+  float checkpointPredictionS[3];
+  bool learned;
+};
+
+const float YIELD_REGRESSION_TAU_S = 3.0;
+const float YIELD_CHECKPOINTS[3] = {0.25f, 0.5f, 0.75f};
+const float YIELD_LEARN_MIN_FLOW_GS = 0.3; // pump-off flow below this says too little about the drip
+
+void startYieldPredictor(YieldPredictor &p, unsigned long startMs);
+// Feeds one frame, t seconds into the shot; returns true on the frame that first reaches the target yield
+bool stepYieldPredictor(YieldPredictor &p, float t, float weight, float flowRate, bool pumpOn, float target,
+                        float dripPerFlow);
+// Ends the shot; returns true when the drip after pump-off updated dripPerFlow
+bool finishYieldPredictor(YieldPredictor &p, float drip, float minShotS, float &dripPerFlow);
+
+#endif
@@ -2,8 +2,16 @@
 // --- LIBRARIES ---
 // =================================================================
 #include <WiFi.h>
+#include <WiFiUdp.h>
 #include <ESP32RotaryEncoder.h>
 #include "NextionX2.h"
+#include "ShotPhase.h"
+#include "ShotSimulator.h"
+#include "ProfileCompiler.h"
+#include "YieldPredictor.h"
+#include "BinaryFrame.h"
+#include "TopicKeys.h"
+#include "FragmentTransfer.h"
 #include <ArduinoOTA.h>
 #include <ArduinoJson.h>
 #include <esp_now.h>
@@ -14,11 +22,15 @@
 #include <esp_pm.h>
 #include <esp_wifi.h>
 #include <esp_wifi_types.h>
+#include <LittleFS.h>
+#include <Preferences.h>
+#include <atomic>
 
 // =================================================================
 // --- CONFIGURATION & DEFINES ---
 // =================================================================
 bool SIMULATION_MODE = false;
+uint32_t simulationSeed = 1;
 const bool OFFLINE_MODE = false;
 const float TEMP_SETPOINT_SCALE = 10.0f;
 const int SHOT_RETENTION_TIME_MS = 10000;
@@ -66,29 +78,6 @@ WebServer server(80);
 bool portalRunning = false;
 bool mqttSettingsPending = false;
 
-// --- MQTT Topics ---
-const char *mqtt_topic_state = "state";
-const char *mqtt_topic_boiler_temp = "boiler_temp";
-const char *mqtt_topic_hx_temp = "hx_temp";
-const char *mqtt_topic_pressure = "pressure";
-const char *mqtt_topic_heater = "heater";
-const char *mqtt_topic_pump = "pump";
-const char *mqtt_topic_brew_mode = "brew_mode";
-const char *mqtt_topic_lever = "lever";
-const char *mqtt_topic_setpoint = "tempsetbrew";
-const char *mqtt_topic_weight = "weight";
-const char *mqtt_topic_flow_rate = "flow_rate";
-const char *mqtt_topic_steam_boost_status = "steam_boost";
-const char *mqtt_topic_set_profiling_mode = "profiling_mode";
-const char *mqtt_topic_set_profiling_source = "profiling_source";
-const char *mqtt_topic_set_profiling_target = "profiling_target";
-const char *mqtt_topic_set_profiling_flat = "profiling_flat_value";
-const char *mqtt_topic_mqtt_server = "mqtt_server";
-const char *mqtt_topic_mqtt_port = "mqtt_port";
-const char *mqtt_topic_mqtt_user = "mqtt_user";
-const char *mqtt_topic_mqtt_pass = "mqtt_pass";
-const char *mqtt_topic_import_profile = "profile_data";
-const char *mqtt_topic_active_profile_id = "active_profile_id";
 // =================================================================
 // --- SYSTEM & LIBRARY OBJECTS ---
 // =================================================================
@@ -103,12 +92,10 @@ NextionComPort nextion;
 // --- ESP-NOW Auto-Pairing ---
 #define PAIR_REQUEST 1
 #define PAIR_RESPONSE 2
-char espNowMessageBuffer[250] = "";
 uint8_t broadcastAddress[] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 uint8_t mainControllerMac[6] = {0x00, 0x00, 0x00, 0x00, 0x00, 0x00};
 int myChannel = 0;
 esp_now_peer_info_t peerInfo;
-volatile bool espNowBusy = false;
 
 // Define a structure for ESP-NOW messages
 typedef struct struct_message
@@ -126,6 +113,230 @@ const char *espIdentifier = "espresso";
 
 struct_message myData;
 struct_pairing pairingData;
+
+// --- ESP-NOW Transmit Queue (loop-owned; OnDataSent only reports completion) ---
+#define TX_QUEUE_SLOTS 8
+enum TxLane : uint8_t
+{
+  TX_LANE_ACK,  // acknowledgements, never sequenced
+  TX_LANE_HIGH, // settings, profile writes, commands; sequenced when the controller acknowledges writes
+  TX_LANE_LOW,  // "request" polls
+  TX_LANE_COUNT
+};
+
+struct TxFrame
+{
+  uint8_t attempts;
+  uint8_t binaryLen; // 0 for text frames
+  char payload[sizeof(struct_message)];
+};
+
+struct TxLaneQueue
+{
+  TxFrame frames[TX_QUEUE_SLOTS];
+  uint8_t head;
+  uint8_t count;
+};
+TxLaneQueue txLanes[TX_LANE_COUNT];
+TxFrame txInFlightFrame;
+bool txInFlight = false;
+unsigned long txSentAtMs = 0;
+volatile bool txCompletionPending = false;
+volatile bool txCompletionOk = false;
+const uint8_t TX_MAX_ATTEMPTS = 3;
+const unsigned long TX_COMPLETION_TIMEOUT_MS = 100;
+
+struct TxStats
+{
+  uint32_t queued;
+  uint32_t coalesced;
+  uint32_t sent;
+  uint32_t delivered;
+  uint32_t retries;
+  uint32_t failures;
+  uint32_t dropped;
+  uint32_t acked;
+  uint32_t ackRetransmits;
+  uint32_t ackExpired;
+  uint32_t ackSuperseded;
+  uint32_t duplicatesDropped;
+  uint8_t maxDepth;
+};
+TxStats txStats = {};
+
+// --- Acknowledged Writes ("seq=N|..." answered by "ack=N") ---
+#define ACK_WINDOW 4
+struct UnackedFrame
+{
+  bool used;
+  uint16_t seq;
+  uint8_t attempts;
+  unsigned long sentMs;
+  char payload[sizeof(struct_message)];
+};
+UnackedFrame unackedFrames[ACK_WINDOW];
+uint16_t nextTxSeq = 1;
+const unsigned long ACK_TIMEOUT_MS = 250;
+const uint8_t ACK_MAX_ATTEMPTS = 5;
+const size_t ACK_SEQ_RESERVE = 11; // "seq=65535|"
+uint16_t rxSeqLatest = 0;
+uint32_t rxSeqSeenMask = 0;
+bool rxSeqValid = false;
+
+// --- ESP-NOW Receive Ring (producer: Wi-Fi task callback, consumer: loop) ---
+#define RX_RING_SLOTS 16
+struct RadioFrame
+{
+  uint8_t mac[6];
+  uint16_t len;
+  unsigned long rxMs;
+  uint8_t data[sizeof(struct_message)];
+};
+RadioFrame rxRing[RX_RING_SLOTS];
+
+// --- Radio Transport (ESP-NOW on the machine; UDP or an in-process queue for a controller stand-in) ---
+// Frames from every transport go through deliverRadioFrame() in loop() context.
+enum RadioTransport : uint8_t
+{
+  TRANSPORT_ESPNOW,
+  TRANSPORT_UDP,     // tools/controller_sim.py: datagrams are <6-byte sender MAC><frame>
+  TRANSPORT_LOOPBACK // frames queued by queueLoopbackFrame(); transmissions are counted and dropped
+};
+volatile RadioTransport radioTransport = TRANSPORT_ESPNOW;
+WiFiUDP transportUdp;
+IPAddress udpPeerIp(255, 255, 255, 255);
+const uint16_t UDP_TRANSPORT_HMI_PORT = 4210;
+const uint16_t UDP_TRANSPORT_CONTROLLER_PORT = 4211;
+RadioFrame loopbackQueue[RX_RING_SLOTS];
+uint8_t loopbackHead = 0;
+uint8_t loopbackCount = 0;
+uint32_t loopbackFramesSent = 0;
+
+enum FrameKind : uint8_t
+{
+  FRAME_KIND_PAIRING,
+  FRAME_KIND_TEXT,
+  FRAME_KIND_BINARY,
+  FRAME_KIND_COUNT
+};
+struct FrameCostStats
+{
+  uint32_t frames[FRAME_KIND_COUNT];
+  uint32_t totalUs[FRAME_KIND_COUNT];
+  uint32_t maxUs[FRAME_KIND_COUNT];
+  uint32_t renderPasses; // loop passes that processed frames, timed across updateDisplay() + updateChart()
+  uint32_t renderTotalUs;
+  uint32_t renderMaxUs;
+};
+FrameCostStats frameCost = {};
+uint32_t framesThisPass = 0;
+std::atomic<uint32_t> rxRingHead(0);
+std::atomic<uint32_t> rxRingTail(0);
+
+struct RxRingStats
+{
+  volatile uint32_t received;
+  volatile uint32_t overruns;
+  volatile uint32_t oversized;
+  volatile uint32_t callbackMaxUs;
+  volatile uint32_t callbackTotalUs;
+  uint32_t maxDepth;
+  uint32_t processed;
+};
+RxRingStats rxStats = {};
+unsigned long currentFrameRxMs = 0;
+
+// --- Binary Telemetry Protocol (frame format in lib/BinaryFrame) ---
+// Frame lengths never match sizeof(struct_pairing) or sizeof(struct_message), so frames are told apart by size.
+// The controller only switches to binary telemetry after both sides advertised the capability with "caps=<mask>".
+#define PROTOCOL_CAP_BINARY_TELEMETRY 0x01
+#define PROTOCOL_CAP_ACKED_WRITES 0x02
+#define PROTOCOL_CAP_FRAGMENTS 0x04
+#define PROTOCOL_CAP_PROFILE_DELTA 0x08
+#define PROTOCOL_CAP_SNAPSHOT 0x10
+#define PROTOCOL_CAP_LINK_PING 0x20
+#define PROTOCOL_CAP_SUBSCRIBE 0x40
+#define PROTOCOL_CAP_SHORT_TEXT 0x80
+const uint8_t HMI_PROTOCOL_CAPS = PROTOCOL_CAP_BINARY_TELEMETRY | PROTOCOL_CAP_ACKED_WRITES | PROTOCOL_CAP_FRAGMENTS |
+                                  PROTOCOL_CAP_PROFILE_DELTA | PROTOCOL_CAP_SNAPSHOT | PROTOCOL_CAP_LINK_PING |
+                                  PROTOCOL_CAP_SUBSCRIBE | PROTOCOL_CAP_SHORT_TEXT;
+uint8_t controllerProtocolCaps = 0;
+// With PROTOCOL_CAP_SHORT_TEXT a text frame ends at its NUL instead of filling struct_message. It stays longer than
+// struct_pairing and never starts with BINARY_FRAME_MAGIC, so the first byte and length still tell the kinds apart.
+const size_t SHORT_TEXT_MIN_LEN = sizeof(struct_pairing) + 1;
+
+// --- Fragmented Transfers (text messages too long for one frame, wire format in FragmentTransfer.h) ---
+#define PROFILE_JSON_MAX 3072
+struct OutgoingTransfer
+{
+  bool used;
+  bool awaitingAck;
+  uint8_t transferId;
+  uint8_t nextIndex;
+  uint8_t count;
+  uint8_t attempts;
+  uint16_t seq; // 0 when the write is not acknowledged
+  uint16_t len;
+  unsigned long sentMs;
+  char data[FRAGMENT_MAX_TRANSFER];
+};
+OutgoingTransfer outgoingTransfers[FRAGMENT_TRANSFER_SLOTS];
+uint8_t nextTransferId = 1;
+uint8_t binaryTxSeq = 0;
+
+IncomingTransfer incomingTransfers[FRAGMENT_TRANSFER_SLOTS];
+FragmentStats fragmentStats = {};
+
+// --- Link Quality (per-frame sequence numbers, sender timestamps and RSSI) ---
+struct SeqTracker
+{
+  uint32_t last;
+  bool valid;
+  uint32_t frames;
+  uint32_t lost;
+  uint32_t outOfOrder;
+  uint32_t duplicates;
+};
+
+#define LINK_HIST_BUCKETS 12 // log2 buckets: <1, 1-2, 2-4, ... ms, last one open-ended
+struct LinkStats
+{
+  SeqTracker textSeq;
+  uint32_t latencyHist[LINK_HIST_BUCKETS];
+  uint32_t rttHist[LINK_HIST_BUCKETS];
+  float jitterMs;
+  int32_t lastTransitMs;
+  bool haveTransit;
+  int32_t pingOffsetMs; // local millis() minus controller millis(), from the fastest recent ping
+  uint32_t pingBestRttMs;
+  uint8_t pingWindowCount;
+  bool pingOffsetValid;
+  unsigned long lastPingMs;
+  uint32_t pongs;
+  float rssiAvg;
+  int8_t rssiMin;
+  int8_t rssiMax;
+  uint32_t rssiSamples;
+};
+LinkStats linkStats = {};
+volatile int8_t lastRssi = 0;
+volatile uint32_t rssiSampleCount = 0;
+// Promiscuous mode hands every management frame on the channel to the Wi-Fi task, which costs CPU there and
+// can delay STA and ESP-NOW traffic, so RSSI is only sampled while page 3 shows it or after "rssi=on"
+bool rssiSamplingRequested = false;
+bool rssiSamplingActive = false;
+const unsigned long LINK_PING_INTERVAL_MS = 2000;
+const uint8_t LINK_PING_WINDOW = 8;
+const unsigned long LINK_DISPLAY_INTERVAL_MS = 1000;
+
+struct BinaryProtocolStats
+{
+  uint32_t framesDecoded;
+  uint32_t crcErrors;
+  uint32_t malformed;
+  SeqTracker seq;
+};
+BinaryProtocolStats binaryStats = {};
 // =================================================================
 // --- GLOBAL STATE & CONTROL VARIABLES ---
 // =================================================================
@@ -157,9 +368,60 @@ unsigned long chartStopTime = 0;
 unsigned long lastPairingRequestTime = 0;
 const long PAIRING_REQUEST_INTERVAL_MS = 10000;
 bool isPaired = false;
+
+// --- Persisted Controller Peer (skips broadcast pairing when the last controller still answers) ---
+Preferences peerPrefs;
+const char *PEER_PREFS_NAMESPACE = "espnow_peer";
+enum PeerProbeState : uint8_t
+{
+  PEER_PROBE_IDLE,
+  PEER_PROBE_SENT
+};
+PeerProbeState peerProbeState = PEER_PROBE_IDLE;
+volatile bool peerProbeResultPending = false;
+volatile bool peerProbeOk = false;
+unsigned long peerProbeSentMs = 0;
+uint8_t peerProbeAttempts = 0;
+const uint8_t PEER_PROBE_MAX_ATTEMPTS = 2;
+const unsigned long PEER_PROBE_TIMEOUT_MS = 200;
+const char *pairedVia = "";
+bool firstTelemetryLogged = false;
 unsigned long lastControllerMessageTime = 0;
 const long CONTROLLER_TIMEOUT_MS = 10000;
 
+// --- Link Health (loss declared from the learned frame interval, well before CONTROLLER_TIMEOUT_MS) ---
+float frameIntervalEwmaMs = 0.0f;
+uint16_t frameIntervalSamples = 0;
+unsigned long lastFrameRxMs = 0;
+bool linkLost = false;
+unsigned long linkLostAtMs = 0;
+unsigned long lastLinkProbeMs = 0;
+const int LINK_LOSS_INTERVALS = 4;
+const unsigned long LINK_LOSS_MIN_MS = 300;
+const unsigned long LINK_LOSS_DEFAULT_MS = 2000; // until enough intervals are learned
+const unsigned long LINK_INTERVAL_MAX_SAMPLE_MS = 2000;
+const uint16_t LINK_INTERVAL_MIN_SAMPLES = 8;
+const unsigned long LINK_LOST_PROBE_INTERVAL_MS = 500;
+const uint16_t STALE_TEXT_COLOR = 33808;
+
+// --- Channel Recovery (the controller follows its AP; ESP-NOW only works on a shared channel) ---
+#define WIFI_CHANNEL_COUNT 13
+bool channelScanActive = false;
+uint8_t channelScanOrder[WIFI_CHANNEL_COUNT];
+uint8_t channelScanIndex = 0;
+uint8_t channelScanPass = 0;
+uint16_t channelScanProbes = 0;
+unsigned long channelScanStartedMs = 0;
+uint8_t consecutiveTxFailures = 0;
+uint8_t consecutiveProbeFailures = 0;
+unsigned long lastChannelCheckMs = 0;
+const unsigned long CHANNEL_CHECK_INTERVAL_MS = 1000;
+const uint8_t CHANNEL_RECOVERY_TX_FAILURES = 5;
+const uint8_t CHANNEL_RECOVERY_PROBE_FAILURES = 3;
+const unsigned long CHANNEL_PROBE_TIMEOUT_MS = 30;
+const uint8_t CHANNEL_SCAN_MAX_PASSES = 2;
+const unsigned long CHANNEL_RECOVERY_MAX_MS = 2000;
+
 // --- Display & UI State ---
 volatile int currentPage = 0;
 int lastPageForSelection = 0;
@@ -178,11 +440,314 @@ const int SETTING_ID_PROFILING_VALUE = 101;
 const long PUBLISH_TIMEOUT = 1000;
 
 // --- Shot & Flow Tracking ---
-int shotTime = 0;
+unsigned long shotTimeMs = 0;
 unsigned long shotStartTimeMillis = 0;
 const int SHOT_START_THRESHOLD_S = 1;
 bool shotIsActive = false;
-const int MAX_SHOT_TIME_S = 50;
+const int MAX_SHOT_TIME_S = 160;
+
+// --- Controller Clock Alignment ---
+int32_t controllerClockOffsetMs = 0; // local millis() minus controller millis()
+bool controllerClockSynced = false;
+const int CLOCK_OFFSET_WINDOW_FRAMES = 64;
+unsigned long controllerPumpStartMs = 0; // controller pump-on time in local millis()
+bool controllerPumpStartValid = false;
+const unsigned long PUMP_START_MAX_AGE_MS = 3000;
+
+// --- Shot Sample Buffer (source for chart re-rendering) ---
+struct ShotSample
+{
+  float pressure;
+  float flowRate;
+  float weight;
+  float target; // NAN when no target line is drawn
+  float resistance;
+};
+const int SHOT_SAMPLE_INTERVAL_MS = 100;
+const int MAX_SHOT_SAMPLES = MAX_SHOT_TIME_S * 1000 / SHOT_SAMPLE_INTERVAL_MS;
+ShotSample shotSamples[MAX_SHOT_SAMPLES];
+int shotSampleCount = 0;
+
+// --- Shot Metrics (updated incrementally from every telemetry frame) ---
+struct ShotMetrics
+{
+  bool active;
+  bool complete;
+  unsigned long startMs;
+  unsigned long lastFeedMs;
+  unsigned long pumpOffMs;
+  unsigned long preinfusionMs;
+  unsigned long firstDropMs;
+  float peakPressure;
+  float pressureTimeSum;
+  float pumpOnTimeS;
+  float peakFlow;
+  float flowTimeSum;
+  float flowingTimeS;
+  float pumpOffWeight;
+  float yield;
+  float brewRatio;
+  float drip;
+  float boilerTempAtStart;
+  float hxTempAtStart;
+  float peakResistance;
+  float minResistance;
+  bool archived;
+};
+ShotMetrics shotMetrics = {};
+float doseWeight = 18.0f;
+const float PREINFUSION_END_PRESSURE_BAR = PHASE_PREINFUSION_END_BAR;
+const float FIRST_DROP_WEIGHT_G = PHASE_FIRST_DROP_G;
+const unsigned long METRICS_MAX_FRAME_GAP_MS = 500;
+
+// --- Shot Phases (detector in lib/ShotPhase, fed one step per telemetry frame) ---
+PhaseDetector phaseDetector = {};
+int phaseMarkersDrawn = 0;
+const uint16_t PHASE_MARKER_COLOR = 50712;
+
+// --- Puck Resistance (pressure / flow^2, exponentially smoothed) ---
+struct PuckResistanceFilter
+{
+  bool valid;
+  float value;
+  unsigned long lastFeedMs;
+};
+PuckResistanceFilter puckResistance = {};
+const float RESISTANCE_MIN_FLOW_GS = 0.5;
+const float RESISTANCE_MAX = 20.0;
+const float RESISTANCE_SMOOTHING_TAU_S = 0.45; // about the former 0.2 per frame at 10 Hz telemetry
+const float RESISTANCE_AXIS_MAX = 8.0;
+
+enum ChartAuxMode
+{
+  CHART_AUX_TARGET,
+  CHART_AUX_RESISTANCE
+};
+ChartAuxMode chartAuxMode = CHART_AUX_TARGET;
+
+// --- Yield Prediction (see lib/YieldPredictor) ---
+YieldPredictor yieldPredictor = {};
+float targetYieldSetting = 36.0f;
+float dripPerFlow = 1.0f; // grams of drip per g/s of flow at pump-off, learned per shot
+
+// --- Profile Adherence (time-weighted error against the flat or profile target) ---
+struct ProfileAdherence
+{
+  bool active;
+  bool complete;
+  unsigned long startMs;
+  unsigned long lastFeedMs;
+  float trackedS;
+  float sqErrorSum;
+  float maxDeviation;
+  float outsideBandS;
+  float stepTrackedS[128];
+  float stepSqErrorSum[128];
+};
+ProfileAdherence adherence = {};
+const float ADHERENCE_PRESSURE_BAND_BAR = 0.5;
+const float ADHERENCE_FLOW_BAND_GS = 0.3;
+
+// --- Shot History (compressed records appended to segment files on LittleFS) ---
+// Records are only ever appended; the oldest segment is deleted whole when its id range comes round again
+#define HISTORY_SLOTS 128
+const int HISTORY_SEGMENTS = 8;
+const int HISTORY_SHOTS_PER_SEGMENT = HISTORY_SLOTS / HISTORY_SEGMENTS;
+const char *HISTORY_PARTITION_LABEL = "ffat";
+const uint32_t SHOT_RECORD_MAGIC = 0x5453584D;
+const uint8_t SHOT_RECORD_VERSION = 4;
+const int HISTORY_CHANNELS = 3;
+const float HISTORY_CHANNEL_SCALE[HISTORY_CHANNELS] = {10.0f, 20.0f, 10.0f}; // 0.1 bar, 0.05 g/s, 0.1 g
+const size_t HISTORY_MAX_ENCODED_BYTES = MAX_SHOT_SAMPLES * HISTORY_CHANNELS * 3 + 16;
+const size_t HISTORY_WRITE_CHUNK = 512;
+
+struct __attribute__((packed)) ShotRecordMetrics
+{
+  uint32_t preinfusionMs;
+  uint32_t firstDropMs;
+  float pumpOnTimeS;
+  float peakPressure;
+  float peakFlow;
+  float yield;
+  float brewRatio;
+  float drip;
+  float boilerTempAtStart;
+  float hxTempAtStart;
+  float peakResistance;
+  float minResistance;
+};
+
+struct __attribute__((packed)) ShotRecordPhase
+{
+  uint8_t phase;
+  uint32_t timeMs;
+  float weight;
+};
+
+struct __attribute__((packed)) ShotRecordHeader
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t channelOrders;
+  uint16_t sampleIntervalMs;
+  uint32_t shotId;
+  uint16_t sampleCount;
+  uint16_t encodedBytes;
+  int8_t profileIndex;
+  char profileName[65];
+  char profilingMode[20];
+  float dose;
+  float brewTempSetPoint;
+  ShotRecordMetrics metrics;
+  uint8_t phaseEventCount;
+  ShotRecordPhase phaseEvents[MAX_PHASE_EVENTS];
+};
+
+struct HistoryIndexEntry
+{
+  uint32_t shotId;
+  uint32_t offset;
+  uint16_t sampleCount;
+  uint16_t recordBytes;
+};
+
+// A record is encoded once the chart stops, but only written after its drip weight is final
+struct HistoryWriter
+{
+  bool pending;
+  bool metricsFinal;
+  bool fileOpen;
+  uint32_t shotId;
+  uint32_t offset;
+  size_t written;
+  size_t total;
+  File file;
+};
+
+bool historyAvailable = false;
+HistoryIndexEntry historyIndex[HISTORY_SLOTS];
+uint32_t nextShotId = 1;
+uint8_t historyRecordBuffer[sizeof(ShotRecordHeader) + HISTORY_MAX_ENCODED_BYTES];
+HistoryWriter historyWriter;
+
+// --- Record and Replay (ESP-NOW frames and Nextion returns in a binary log next to the shot history) ---
+const char *REPLAY_LOG_PATH = "/replay.bin";
+const uint32_t REPLAY_LOG_MAGIC = 0x594C5052; // "RPLY"
+const uint8_t REPLAY_LOG_VERSION = 2;
+const size_t REPLAY_LOG_MAX_BYTES = 256 * 1024;
+const size_t REPLAY_WRITE_BUFFER_BYTES = 8192;
+const size_t REPLAY_WRITE_CHUNK = 512;
+const size_t REPLAY_NEXTION_MAX_BYTES = 128;
+
+enum ReplayRecordKind : uint8_t
+{
+  REPLAY_RADIO,      // <sender MAC><frame>
+  REPLAY_RADIO_TEXT, // <sender MAC><text up to its NUL>, padded back to sizeof(struct_message) on replay
+  REPLAY_NEXTION     // one display return including its 0xFF 0xFF 0xFF terminator
+};
+
+struct __attribute__((packed)) ReplayLogHeader
+{
+  uint32_t magic;
+  uint8_t version;
+  uint8_t paired;
+  uint8_t controllerMac[6];
+  uint8_t controllerCaps;
+  uint8_t page;
+  // HMI state when recording started; a replay restores it first. Recording only starts between shots.
+  int8_t profileIndex;
+  float brewTempSetPoint;
+  float flatValue;
+  char profilingMode[20];
+  char profilingSource[20];
+  char profilingTarget[20];
+  char machineState[64];
+  float dose;
+  float targetYield;
+  float dripPerFlow;
+  float boilerTemp;
+  float hxTemp;
+  float pressure;
+  float flowRate;
+  float weight;
+  uint8_t leverLifted;
+  uint8_t chartAuxMode;
+};
+
+struct __attribute__((packed)) ReplayRecordHeader
+{
+  uint8_t kind;
+  uint16_t deltaMs; // since the previous record; idle gaps over 65 s are shortened
+  uint16_t len;
+};
+
+enum ReplayMode : uint8_t
+{
+  REPLAY_OFF,
+  REPLAY_RECORDING,
+  REPLAY_PLAYING
+};
+
+struct ReplayState
+{
+  ReplayMode mode;
+  File file;
+  uint32_t records;
+  // Recording
+  uint8_t writeBuffer[REPLAY_WRITE_BUFFER_BYTES];
+  size_t writeLen;
+  size_t fileBytes;
+  bool logFull;
+  uint32_t droppedRecords;
+  unsigned long lastRecordMs;
+  uint8_t nextionBytes[REPLAY_NEXTION_MAX_BYTES];
+  uint16_t nextionLen;
+  uint8_t nextionTerminators;
+  // Playback
+  uint16_t speed; // 0: one record per loop pass, as fast as the loop runs
+  RadioTransport previousTransport;
+  ReplayRecordHeader next;
+  uint8_t nextData[6 + sizeof(struct_message)];
+  bool nextValid;
+  uint32_t dueMs; // log time of the next record
+  uint32_t clockMs; // log time the firmware logic sees through hmiMillis()
+  bool clockAtNext;
+  unsigned long startMs;
+  uint8_t nextionReplay[REPLAY_NEXTION_MAX_BYTES];
+  uint16_t nextionReplayLen;
+  uint16_t nextionReplayPos;
+  uint8_t pendingQueries; // "get" commands the recorded display has not answered yet
+  char commandPrefix[4];
+  uint8_t commandLen;
+  uint8_t commandTerminators;
+  uint32_t passes;
+  uint32_t maxPassUs;
+  unsigned long lastPassUs;
+};
+ReplayState replay;
+
+// Sits between NextionX2 and Serial1: records display returns, or serves the recorded ones during a replay
+// Returns that arrive while waitReturn() waits for a handshake are held here and served first to nextion.update()
+const uint8_t NEXTION_HELD_MAX_BYTES = 32;
+class NextionTapStream : public Stream
+{
+public:
+  void begin(unsigned long baud) { Serial1.begin(baud); }
+  int available() override;
+  int read() override;
+  int peek() override;
+  size_t write(uint8_t byte) override;
+  void flush() override { Serial1.flush(); }
+  using Print::write;
+  bool waitReturn(uint8_t code, unsigned long timeoutMs);
+
+private:
+  void hold(const uint8_t *data, uint8_t len);
+  uint8_t held[NEXTION_HELD_MAX_BYTES];
+  uint8_t heldLen;
+  uint8_t heldPos;
+};
+NextionTapStream nextionStream;
 
 // --- Flow Rate Calculation ---
 float flowRate = 0.0f;
@@ -194,6 +759,32 @@ float filteredFlow = 0.0f;
 unsigned long lastDebugDataTime = 0;
 const long DEBUG_PLOT_TIMEOUT_MS = 2000;
 
+// --- Telemetry Subscription (channels and rates the controller should stream for the current view) ---
+// Channels: temps (boiler_temp, hx_temp, heater), pressure, flow (flow_rate), weight,
+// debug (raw_weight, filtered_weight, filtered_flow). State, pump and lever changes are always sent.
+// A channel left out of the subscription stays at the controller's discretion.
+struct TelemetrySubscription
+{
+  uint8_t tempsHz;
+  uint8_t pressureHz;
+  uint8_t flowHz;
+  uint8_t weightHz;
+};
+const TelemetrySubscription SUBSCRIPTION_SHOT = {2, 20, 20, 20};
+const TelemetrySubscription SUBSCRIPTION_MAIN_IDLE = {2, 4, 2, 5};
+const TelemetrySubscription SUBSCRIPTION_SETTINGS = {1, 0, 0, 0};
+const uint8_t SUBSCRIPTION_DEBUG_HZ = 10;
+const uint8_t SUBSCRIPTION_CALIBRATION_WEIGHT_HZ = 5;
+const unsigned long SUBSCRIPTION_MIN_INTERVAL_MS = 200;
+enum DebugPlotMode : uint8_t
+{
+  DEBUG_PLOT_AUTO, // debug channels are not subscribed; the plot comes up whenever the controller sends them
+  DEBUG_PLOT_ON,
+  DEBUG_PLOT_OFF
+};
+DebugPlotMode debugPlotMode = DEBUG_PLOT_AUTO;
+char lastSubscription[64] = "";
+
 // --- New scales for the debug plot mode ---
 const float DEBUG_WEIGHT_MAX = 200.0;
 const float DEBUG_WEIGHT_MIN = 0.0;
@@ -201,7 +792,7 @@ const float DEBUG_FLOW_MAX = 10.0;
 const float DEBUG_FLOW_MIN = 0.0;
 
 // --- Value Caching for Display Optimization ---
-int lastShotTime_sent = -1;
+long lastShotTime_sent = -1;
 float lastHxTemp_sent = -1.0f;
 float lastBoilerTemp_sent = -1.0f;
 float lastPressure_sent = -1.0f;
@@ -213,11 +804,15 @@ char lastMachineState_sent[64] = "";
 unsigned long lastSettingsRequestTime = 0;
 const long SETTINGS_REQUEST_INTERVAL_MS = 10000;
 
-struct ProfileStep
-{
-  float target;
-  float control;
-};
+// --- Settings Snapshot (all settings in one reply, skipped when the digest still matches) ---
+uint32_t settingsDigest = 0; // digest of the last snapshot applied, 0 = none
+bool snapshotPending = false;
+uint8_t snapshotAttempts = 0;
+unsigned long snapshotRequestTime = 0;
+unsigned long pairedAtMs = 0;
+const unsigned long CAPS_WAIT_MS = 300;
+const unsigned long SNAPSHOT_RETRY_MS = 500;
+const uint8_t SNAPSHOT_MAX_ATTEMPTS = 3;
 
 struct EspressoProfile
 {
@@ -225,6 +820,9 @@ struct EspressoProfile
   bool isStepped;
   int numSteps;
   ProfileStep steps[128];
+  uint16_t version;       // bumped on every publish; a delta applies only on top of the same version
+  uint32_t dirtySteps[4]; // cells edited since the last publish
+  bool fullSyncPending;   // name, mode or step count changed: deltas cannot describe it
 };
 
 EspressoProfile *currentProfile = nullptr;
@@ -232,6 +830,22 @@ EspressoProfile *currentProfile = nullptr;
 EspressoProfile profiles[MAX_PROFILES];
 int currentProfileIndex = 0;
 
+// --- Compiled Profile (segment index for target lookups, see lib/ProfileCompiler) ---
+CompiledProfile compiledProfile = {false, 0, 0.0f, {}};
+const EspressoProfile *compiledProfileSource = nullptr;
+bool compiledProfileValid = false;
+float timeTargetLut[MAX_SHOT_SAMPLES];
+
+enum ProfilingModeId
+{
+  PROFILING_MODE_MANUAL,
+  PROFILING_MODE_FLAT,
+  PROFILING_MODE_PROFILE
+};
+ProfilingModeId profilingModeId = PROFILING_MODE_MANUAL;
+bool profilingSourceIsPressure = true;
+bool profilingTargetIsTime = true;
+
 bool currentProfileDirty = false;
 unsigned long profileIndexSettleTime = 0;
 bool profileIndexPendingSave = false;
@@ -339,14 +953,62 @@ int sltHeight = 0;
 // =================================================================
 // --- CHART & PLOTTING CONFIGURATION ---
 // =================================================================
-float const PRESSURE_MAX = 15;
 float const PRESSURE_MIN = 0;
-float const FLOW_RATE_MAX = 5.0;
+float const PRESSURE_AXIS_START = 10.0;
+float const PRESSURE_AXIS_LIMIT = 16.0;
 float const FLOW_RATE_MIN = 0.0;
-
+float const FLOW_RATE_AXIS_START = 3.0;
+float const FLOW_RATE_AXIS_LIMIT = 10.0;
+float const CHART_AXIS_GROWTH = 1.5;
+const int CHART_INITIAL_WINDOW_S = 20;
+const int CHART_MAX_WIDTH = 480;
+const unsigned long NEXTION_ADDT_READY_TIMEOUT_MS = 50;
+const unsigned long NEXTION_ADDT_DONE_TIMEOUT_MS = 100;
+const uint8_t NEXTION_RETURN_ADDT_READY = 0xFE;
+const uint8_t NEXTION_RETURN_ADDT_DONE = 0xFD;
+const uint8_t CHART_RENDER_CHANNELS = 3;
+
+int chartX = 0;
+int chartY = 0;
 int chartWidth = 0;
 int chartHeight = 0;
 int plotPointsAdded = 0;
+int chartWindowS = CHART_INITIAL_WINDOW_S;
+float chartPressureMax = PRESSURE_AXIS_START;
+float chartFlowMax = FLOW_RATE_AXIS_START;
+
+// A re-render sends one channel per loop pass, so no pass blocks for more than one 480-byte transfer (~42 ms at 115200)
+struct ChartRender
+{
+  bool pending;
+  uint8_t nextChannel;
+  int pixelCount;
+  unsigned long startUs;
+  unsigned long longestPassUs;
+};
+ChartRender chartRender;
+
+// --- Reference Shot Overlay ---
+// The display's waveform only has three channels, so a pinned reference takes over channel 2 from the aux trace
+const uint8_t REFERENCE_CHANNEL = 2;
+const int REFERENCE_MAX_POINTS = 400;
+const float REFERENCE_WEIGHT_STEP_G = 0.5;
+const int REFERENCE_WEIGHT_BUCKETS = 200;
+
+struct ReferenceShot
+{
+  bool valid;
+  int numPoints;
+  int pointIntervalMs;
+  float pressure[REFERENCE_MAX_POINTS];
+  float flowRate[REFERENCE_MAX_POINTS];
+  float pressureByWeight[REFERENCE_WEIGHT_BUCKETS];
+  float flowByWeight[REFERENCE_WEIGHT_BUCKETS];
+};
+ReferenceShot referenceShot;
+bool referenceAlignByWeight = false;
+bool referenceShowsFlow = false;
+uint8_t referencePixels[CHART_MAX_WIDTH];
 
 // =================================================================
 // --- FORWARD DECLARATIONS ---
@@ -358,16 +1020,68 @@ void loop();
 // --- Network & MQTT Functions ---
 void setup_wifi();
 void OnDataRecv(const uint8_t *mac_addr, const uint8_t *incomingData, int len);
+void processRadioFrame(const uint8_t *mac_addr, const uint8_t *incomingData, int len);
+void drainRadioFrames();
+void printRxStats();
+void deliverRadioFrame(const uint8_t *mac, const uint8_t *data, int len, unsigned long rxMs);
+esp_err_t transportSend(const uint8_t *mac, const uint8_t *data, size_t len);
+void pollTransport();
+void setRadioTransport(RadioTransport transport);
+bool queueLoopbackFrame(const uint8_t *mac, const uint8_t *data, int len);
+void printFrameCost();
+void appendReplayRecord(uint8_t kind, const uint8_t *mac, const uint8_t *data, size_t len, unsigned long atMs);
+void recordRadioFrame(const uint8_t *mac, const uint8_t *data, int len, unsigned long rxMs);
+void recordNextionByte(uint8_t byte);
+void flushReplayWriteBuffer(size_t maxBytes);
+void startReplayRecording();
+void stopReplayRecording();
+void startReplay(uint16_t speed);
+void applyReplayState(const ReplayLogHeader &header);
+unsigned long hmiMillis();
+bool readNextReplayRecord();
+bool loadReplayResponse();
+void serviceReplay();
+void finishReplay();
 void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status);
 void publishData(const char *key, const char *value, bool esNowSendNow = true);
 bool parseBool(const char *value);
 void handleIncomingMessage(char *message);
 void publishSetting();
 void checkEncoderPublish();
-void sendEspNowBuffer();
+void serviceTxQueue();
+void transmitFrame(TxFrame &frame);
+void clearTxQueue();
+void printTxStats();
+bool ackedWritesEnabled();
+bool serviceUnackedFrames();
+void handleAck(uint16_t seq);
+bool isDuplicateRxSeq(uint16_t seq);
+void supersedeUnackedWrites(const char *payload);
+bool payloadHasKey(const char *payload, const char *key, size_t keyLen);
 void sendPendingMqttSettings();
 void resetPairing();
+void sendPairingRequest(const uint8_t *destination);
+bool completePairing(const uint8_t *controllerMac);
+bool loadStoredPeer(uint8_t *mac, uint8_t &channel);
+void storePeer(const uint8_t *mac, uint8_t channel);
+void startPeerProbe();
+void servicePeerProbe();
+void startBroadcastPairing();
+void noteControllerFrame();
+unsigned long linkLossThresholdMs();
+void checkLinkHealth();
+void buildSubscription(char *buffer, size_t size);
+void serviceSubscription();
+void applyStaleStyle(bool stale);
+void checkChannel();
+void startChannelRecovery(const char *reason, uint8_t firstChannel);
+void addScanCandidate(uint8_t &count, uint8_t channel);
+void probeNextChannel();
+void handleChannelProbeResult(bool ok);
 void manageSettingsRequests();
+void requestSettingsSnapshot();
+void requestSettingsResync();
+void handleSnapshot(const char *value);
 
 // --- Display & UI Functions ---
 void updateDisplay();
@@ -375,15 +1089,39 @@ void cacheSliderData();
 void cacheEntriesData();
 void cleanCurrentPage();
 void updateChart();
+void recordShotSample(unsigned long elapsedMs);
+float getChartTarget(int sampleIndex);
+bool growChartScales(unsigned long elapsedMs);
+void renderChartFromSamples();
+bool serviceChartRender();
+void plotChartPixel(int pixel);
+bool sendWaveformBulk(uint8_t channel, const uint8_t *data, int count);
+int chartPixelToSample(int pixel);
+uint8_t scaleToChart(float value, float minVal, float maxVal);
+bool pinReferenceShot(const ShotSample *samples, int sampleCount);
+void buildReferencePixels();
+uint8_t getReferencePixel(int pixel, float sampleWeight);
 void parseProfilingData();
 void updateProfilingDisplay();
 void updateFullProfileUI();
 void saveCurrentProfileIndex();
 void saveProfile(int index);
+bool publishProfileDelta(int index);
+void applyProfileDelta(char *value);
+void markProfileStepDirty(EspressoProfile &profile, int step);
+void clearProfileDirty(EspressoProfile &profile);
 void importProfileJson(const char *json);
 void deleteProfile(int index);
 bool isSlotFree(int index);
 float getTargetAt(float currentX);
+void refreshProfilingFlags();
+void invalidateCompiledProfile();
+void ensureCompiledProfile();
+void compileCurrentProfile();
+int findProfileSegment(float currentX);
+float getCompiledTargetAt(float currentX);
+float getTimeTargetForSample(int sampleIndex);
+void checkCompiledProfile();
 
 // --- Input Handling (Encoder & Button) ---
 void knobCallback(long value);
@@ -418,6 +1156,7 @@ void handleApiGetProfiles();
 void handleApiSaveProfile();
 void handleApiDeleteProfile();
 void handleApiSetActiveProfile();
+void handleApiReplayLog();
 void handleRoot();
 void setupWebRoutes();
 void handleGlobalRoot();
@@ -425,7 +1164,66 @@ void stopConfigurationPortal();
 
 // --- Machine Logic & Simulation ---
 void simulateShot();
-int getShotTime(bool pumpStatus);
+unsigned long getShotTimeMs(bool pumpStatus);
+void updateControllerClock(uint32_t controllerMs);
+void noteLinkSeq(SeqTracker &tracker, uint32_t seq, uint32_t modulus);
+void noteLinkTimestamp(uint32_t controllerMs);
+void notePong(const char *value);
+void serviceLinkProbe();
+void OnPromiscuousRx(void *buf, wifi_promiscuous_pkt_type_t type);
+uint8_t linkHistBucket(uint32_t ms);
+uint32_t linkHistPercentile(const uint32_t *hist, float fraction);
+void printLinkStats();
+void updateLinkStatsDisplay();
+void serviceRssiSampling();
+void applyControllerPumpStart(uint32_t controllerStartMs);
+bool isBinaryFrame(const uint8_t *data, int len);
+bool isTextFrame(const uint8_t *data, int len);
+bool validateBinaryFrame(const uint8_t *data, int len, uint8_t type, size_t payloadLen);
+bool parseTelemetryFrame(const uint8_t *data, int len, TelemetryPayload &payload);
+void dispatchTextPayload(char *payload);
+bool queueFragmentedTransfer(const char *topic, const char *payload);
+int buildFragmentFrame(uint8_t *out, const OutgoingTransfer &transfer, uint8_t index);
+bool serviceOutgoingTransfers();
+char *handleFragmentFrame(const uint8_t *data, int len);
+void benchmarkFragmentLoopback(int steps);
+void applyTelemetryPayload(const TelemetryPayload &payload);
+int buildTelemetryFrame(uint8_t *out, uint8_t seq);
+void benchmarkTelemetryDecode();
+void benchmarkKeyDispatch();
+void feedShotAnalytics();
+void feedShotMetrics();
+void feedYieldPredictor();
+void feedProfileAdherence();
+float stepPuckResistance(PuckResistanceFilter &filter, float pressureBar, float flowGs, float dt);
+void feedPuckResistance();
+void feedPhaseDetector();
+void drawPhaseMarkers();
+void printPhaseEvents(const PhaseEvent *events, int count);
+bool chartAuxVisible();
+uint8_t scaleChartAux(const ShotSample &sample);
+int getAdherenceScore();
+void printProfileAdherence();
+float getTargetYield();
+bool formatYieldPrediction(char *buffer, size_t size);
+void printShotMetrics();
+void formatShotSummary(char *buffer, size_t size);
+
+// --- Shot History ---
+void initShotHistory();
+void archiveCompletedShot();
+void finalizeShotRecord();
+void serviceShotHistory();
+int historySegment(uint32_t shotId);
+void historySegmentPath(int segment, char *path, size_t size);
+void scanHistorySegment(int segment, bool &torn);
+bool openHistorySegment(uint32_t shotId);
+size_t encodeShotSamples(const ShotSample *samples, int count, uint8_t *out, size_t capacity, uint8_t &channelOrders);
+bool decodeShotSamples(const uint8_t *data, size_t size, int count, uint8_t channelOrders, ShotSample *out);
+bool loadShotRecord(uint32_t shotId, ShotRecordHeader &header, ShotSample *samples);
+void printShotHistory();
+void printShotRecord(uint32_t shotId);
+bool pinReferenceFromHistory(uint32_t shotId);
 
 // --- Utility Functions ---
 float mapf(float x, float in_min, float in_max, float out_min, float out_max);
@@ -438,6 +1236,7 @@ float mapf(float x, float in_min, float in_max, float out_min, float out_max);
 void setup()
 {
   Serial.begin(115200);
+  initShotHistory();
   setupWebRoutes();
   rotaryEncoder.setEncoderType(EncoderType::FLOATING);
   rotaryEncoder.setBoundaries(ROTARY_MIN_BOUND, ROTARY_MAX_BOUND, true); // Example: Set target brew temp
@@ -447,14 +1246,14 @@ void setup()
   lastEncoderValue = rotaryEncoder.getEncoderValue();
 
   Serial1.begin(9600, SERIAL_8N1, SERIAL_RX, SERIAL_TX);
-  nextion.begin(Serial1, 9600);
+  nextion.begin(nextionStream, 9600);
   nextion.command("baud=115200");
   pinMode(ENCODER_PIN_A, INPUT_PULLUP);
   pinMode(ENCODER_PIN_B, INPUT_PULLUP);
   delay(2500);
 
   Serial1.begin(115200, SERIAL_8N1, SERIAL_RX, SERIAL_TX);
-  nextion.begin(Serial1, 115200);
+  nextion.begin(nextionStream, 115200);
   currentProfile = &profiles[0];
   if (!OFFLINE_MODE)
   {
@@ -477,26 +1276,16 @@ void setup()
     esp_wifi_set_ps(WIFI_PS_NONE);
     esp_now_register_recv_cb(OnDataRecv);
     esp_now_register_send_cb(OnDataSent);
-    memset(&peerInfo, 0, sizeof(peerInfo));
-    memcpy(peerInfo.peer_addr, broadcastAddress, 6);
-    peerInfo.channel = 0;
-    peerInfo.encrypt = false;
-    peerInfo.ifidx = WIFI_IF_STA;
-    if (esp_now_add_peer(&peerInfo) != ESP_OK)
-    {
-      Serial.println("Failed to add broadcast peer");
-    }
-    else
+    // The ESP-NOW receive callback carries no RSSI; sniff it from the controller's action frames instead.
+    // serviceRssiSampling() switches promiscuous mode on only while the figures are wanted.
+    wifi_promiscuous_filter_t rssiFilter = {WIFI_PROMIS_FILTER_MASK_MGMT};
+    esp_wifi_set_promiscuous_filter(&rssiFilter);
+    esp_wifi_set_promiscuous_rx_cb(OnPromiscuousRx);
+    startPeerProbe();
+    if (peerProbeState == PEER_PROBE_IDLE)
     {
-      Serial.println("Broadcast peer added for pairing.");
+      startBroadcastPairing();
     }
-    pairingData.id = PAIR_REQUEST;
-    pairingData.channel = myChannel;
-    WiFi.macAddress(pairingData.macAddr);
-    strcpy(pairingData.identifier, espIdentifier);
-    esp_now_send(broadcastAddress, (uint8_t *)&pairingData, sizeof(pairingData));
-    Serial.println("Sent auto-pairing request...");
-    lastPairingRequestTime = millis();
 
     ArduinoOTA.setHostname(OTA_HOSTNAME);
     ArduinoOTA.setPassword(OTA_PASSWORD);
@@ -561,6 +1350,11 @@ void loop()
 
         Serial.println(">>> Simulation Mode ENABLED & Shot STARTED");
       }
+      else if (strncmp(cmdBuffer, "sim_seed=", 9) == 0)
+      {
+        simulationSeed = strtoul(cmdBuffer + 9, NULL, 10);
+        Serial.printf("Simulation noise seeded with %lu\n", (unsigned long)simulationSeed);
+      }
       else if (strcmp(cmdBuffer, "sim_off") == 0)
       {
         SIMULATION_MODE = false;
@@ -583,6 +1377,153 @@ void loop()
       {
         startProfilePortal();
       }
+      else if (strcmp(cmdBuffer, "history") == 0)
+      {
+        printShotHistory();
+      }
+      else if (strncmp(cmdBuffer, "history_show=", 13) == 0)
+      {
+        printShotRecord(strtoul(cmdBuffer + 13, NULL, 10));
+      }
+      else if (strncmp(cmdBuffer, "ref_pin=", 8) == 0)
+      {
+        if (!pinReferenceFromHistory(strtoul(cmdBuffer + 8, NULL, 10)))
+        {
+          Serial.println("Shot not found in history.");
+        }
+      }
+      else if (strcmp(cmdBuffer, "ref_pin") == 0)
+      {
+        if (shotIsActive || !pinReferenceShot(shotSamples, shotSampleCount))
+        {
+          Serial.println("No completed shot to pin as reference.");
+        }
+      }
+      else if (strcmp(cmdBuffer, "ref_clear") == 0)
+      {
+        referenceShot.valid = false;
+        Serial.println("Reference shot cleared.");
+        if (shotIsActive)
+          renderChartFromSamples();
+      }
+      else if (strncmp(cmdBuffer, "ref_align=", 10) == 0)
+      {
+        referenceAlignByWeight = (strcmp(cmdBuffer + 10, "weight") == 0);
+        Serial.printf("Reference aligned by %s\n", referenceAlignByWeight ? "weight" : "time");
+      }
+      else if (strncmp(cmdBuffer, "ref_channel=", 12) == 0)
+      {
+        referenceShowsFlow = (strcmp(cmdBuffer + 12, "flow") == 0);
+        buildReferencePixels();
+        Serial.printf("Reference shows %s\n", referenceShowsFlow ? "flow" : "pressure");
+      }
+      else if (strcmp(cmdBuffer, "shot_metrics") == 0)
+      {
+        printShotMetrics();
+      }
+      else if (strcmp(cmdBuffer, "tx_stats") == 0)
+      {
+        printTxStats();
+        Serial.printf("Fragments: %lu transfers / %lu fragments sent, %lu transfers / %lu fragments received, %lu timeouts, %lu rejected\n",
+                      (unsigned long)fragmentStats.transfersSent, (unsigned long)fragmentStats.fragmentsSent,
+                      (unsigned long)fragmentStats.transfersReceived, (unsigned long)fragmentStats.fragmentsReceived,
+                      (unsigned long)fragmentStats.timeouts, (unsigned long)fragmentStats.rejected);
+      }
+      else if (strncmp(cmdBuffer, "frag_loopback=", 14) == 0)
+      {
+        benchmarkFragmentLoopback(atoi(cmdBuffer + 14));
+      }
+      else if (strcmp(cmdBuffer, "link_stats") == 0)
+      {
+        printLinkStats();
+      }
+      else if (strncmp(cmdBuffer, "rssi=", 5) == 0)
+      {
+        rssiSamplingRequested = (strcmp(cmdBuffer + 5, "on") == 0);
+        Serial.printf("RSSI sampling %s.\n", rssiSamplingRequested ? "on" : "only while page 3 is shown");
+      }
+      else if (strcmp(cmdBuffer, "link_reset") == 0)
+      {
+        SeqTracker binarySeq = binaryStats.seq;
+        linkStats = {};
+        binaryStats.seq = {binarySeq.last, binarySeq.valid};
+        Serial.println("Link statistics reset.");
+      }
+      else if (strncmp(cmdBuffer, "transport=", 10) == 0)
+      {
+        const char *name = cmdBuffer + 10;
+        if (strcmp(name, "udp") == 0)
+          setRadioTransport(TRANSPORT_UDP);
+        else if (strcmp(name, "loopback") == 0)
+          setRadioTransport(TRANSPORT_LOOPBACK);
+        else
+          setRadioTransport(TRANSPORT_ESPNOW);
+      }
+      else if (strcmp(cmdBuffer, "frame_cost") == 0)
+      {
+        printFrameCost();
+      }
+      else if (strncmp(cmdBuffer, "record=", 7) == 0)
+      {
+        if (strcmp(cmdBuffer + 7, "on") == 0)
+          startReplayRecording();
+        else if (replay.mode == REPLAY_RECORDING)
+          stopReplayRecording();
+      }
+      else if (strncmp(cmdBuffer, "replay=", 7) == 0)
+      {
+        startReplay(strcmp(cmdBuffer + 7, "max") == 0 ? 0 : max(1, atoi(cmdBuffer + 7)));
+      }
+      else if (strcmp(cmdBuffer, "replay_stop") == 0)
+      {
+        if (replay.mode == REPLAY_PLAYING)
+          finishReplay();
+      }
+      else if (strcmp(cmdBuffer, "frame_cost_reset") == 0)
+      {
+        frameCost = {};
+        Serial.println("Frame cost statistics reset.");
+      }
+      else if (strcmp(cmdBuffer, "rx_stats") == 0)
+      {
+        printRxStats();
+      }
+      else if (strcmp(cmdBuffer, "dispatch_bench") == 0)
+      {
+        benchmarkKeyDispatch();
+      }
+      else if (strcmp(cmdBuffer, "proto_bench") == 0)
+      {
+        benchmarkTelemetryDecode();
+      }
+      else if (strncmp(cmdBuffer, "debug_plot=", 11) == 0)
+      {
+        const char *mode = cmdBuffer + 11;
+        debugPlotMode = strcmp(mode, "on") == 0 ? DEBUG_PLOT_ON : strcmp(mode, "off") == 0 ? DEBUG_PLOT_OFF : DEBUG_PLOT_AUTO;
+        static const char *modeNames[] = {"left to the controller", "requested on the main page", "turned off"};
+        Serial.printf("Debug plot channels: %s.\n", modeNames[debugPlotMode]);
+      }
+      else if (strncmp(cmdBuffer, "chart_ch2=", 10) == 0)
+      {
+        chartAuxMode = (strcmp(cmdBuffer + 10, "resistance") == 0) ? CHART_AUX_RESISTANCE : CHART_AUX_TARGET;
+        Serial.printf("Chart channel 2 shows %s\n", chartAuxMode == CHART_AUX_RESISTANCE ? "puck resistance" : "target");
+        if (shotIsActive)
+          renderChartFromSamples();
+      }
+      else if (strncmp(cmdBuffer, "target_yield=", 13) == 0)
+      {
+        targetYieldSetting = atof(cmdBuffer + 13);
+        Serial.printf("Target yield set to %.1fg\n", targetYieldSetting);
+      }
+      else if (strncmp(cmdBuffer, "dose=", 5) == 0)
+      {
+        doseWeight = atof(cmdBuffer + 5);
+        Serial.printf("Dose set to %.1fg\n", doseWeight);
+      }
+      else if (strcmp(cmdBuffer, "profile_check") == 0)
+      {
+        checkCompiledProfile();
+      }
       else if (strncmp(cmdBuffer, "request", 7) == 0)
       {
         publishData("request", "settings", true);
@@ -606,6 +1547,8 @@ void loop()
   if (chartWidth <= 0 || chartHeight <= 0)
   {
     Serial.println("Attempting to fetch chart dimensions...");
+    chartX = wf_pressure.attributeValue("x");
+    chartY = wf_pressure.attributeValue("y");
     chartWidth = wf_pressure.attributeValue("w");
     chartHeight = wf_pressure.attributeValue("h");
     if (chartWidth > 0)
@@ -670,7 +1613,20 @@ void loop()
     systemMessageClearTime = millis() + 5000;
   }
 
-  if (isPaired && (millis() - lastControllerMessageTime > CONTROLLER_TIMEOUT_MS))
+  servicePeerProbe();
+  framesThisPass = 0;
+  drainRadioFrames();
+  serviceReplay();
+  pollTransport();
+  serviceTxQueue();
+  serviceLinkProbe();
+  serviceSubscription();
+  updateLinkStatsDisplay();
+  serviceRssiSampling();
+  checkLinkHealth();
+  checkChannel();
+
+  if (isPaired && (hmiMillis() - lastControllerMessageTime > CONTROLLER_TIMEOUT_MS))
   {
     resetPairing();
   }
@@ -691,25 +1647,19 @@ void loop()
   {
     stopConfigurationPortal();
   }
-  if (!OFFLINE_MODE && !isPaired && !SIMULATION_MODE)
+  if (!OFFLINE_MODE && !isPaired && !SIMULATION_MODE && peerProbeState == PEER_PROBE_IDLE)
   {
     if (millis() - lastPairingRequestTime > PAIRING_REQUEST_INTERVAL_MS)
     {
       Serial.println("Not paired. Retrying auto-pairing request...");
-
-      pairingData.id = PAIR_REQUEST;
-      pairingData.channel = myChannel;
-      strcpy(pairingData.identifier, espIdentifier);
-      WiFi.macAddress(pairingData.macAddr);
-
-      esp_now_send(broadcastAddress, (uint8_t *)&pairingData, sizeof(pairingData));
-
+      sendPairingRequest(broadcastAddress);
       lastPairingRequestTime = millis();
     }
   }
   if (SIMULATION_MODE)
   {
     simulateShot();
+    feedShotAnalytics();
   }
   if (!OFFLINE_MODE)
   {
@@ -720,10 +1670,19 @@ void loop()
   handleEncoder();
   handleButton();
   checkEncoderPublish();
-  shotTime = getShotTime(pumpIsOn);
+  shotTimeMs = getShotTimeMs(pumpIsOn);
 
+  unsigned long renderStart = micros();
   updateDisplay();
   updateChart();
+  if (framesThisPass > 0)
+  {
+    uint32_t renderUs = micros() - renderStart;
+    frameCost.renderPasses++;
+    frameCost.renderTotalUs += renderUs;
+    frameCost.renderMaxUs = max(frameCost.renderMaxUs, renderUs);
+  }
+  serviceShotHistory();
   newCurrentPage = nextion.getCurrentPageID();
   if (newCurrentPage != currentPage)
   {
@@ -934,6 +1893,7 @@ void setupWebRoutes()
   server.on("/api/profile", HTTP_POST, handleApiSaveProfile);
   server.on("/api/delete", HTTP_POST, handleApiDeleteProfile);
   server.on("/api/setactive", HTTP_POST, handleApiSetActiveProfile);
+  server.on("/api/replay_log", HTTP_GET, handleApiReplayLog);
 }
 
 void startConfigurationPortal()
@@ -972,2153 +1932,5607 @@ void stopConfigurationPortal()
   }
 }
 
+// Runs in the Wi-Fi task: only copies the frame, everything else happens in loop()
 void OnDataRecv(const uint8_t *mac_addr, const uint8_t *incomingData, int len)
 {
-  if (len == sizeof(struct_pairing))
+  if (radioTransport != TRANSPORT_ESPNOW)
   {
-    memcpy(&pairingData, incomingData, sizeof(pairingData));
+    return;
+  }
+  unsigned long start = micros();
+  rxStats.received++;
+  if (len <= 0 || len > (int)sizeof(rxRing[0].data))
+  {
+    rxStats.oversized++;
+    return;
+  }
+  uint32_t head = rxRingHead.load(std::memory_order_relaxed);
+  if (head - rxRingTail.load(std::memory_order_acquire) >= RX_RING_SLOTS)
+  {
+    rxStats.overruns++;
+    return;
+  }
+  RadioFrame &frame = rxRing[head % RX_RING_SLOTS];
+  memcpy(frame.mac, mac_addr, 6);
+  memcpy(frame.data, incomingData, len);
+  frame.len = len;
+  frame.rxMs = millis();
+  rxRingHead.store(head + 1, std::memory_order_release);
+
+  uint32_t elapsed = micros() - start;
+  rxStats.callbackTotalUs += elapsed;
+  if (elapsed > rxStats.callbackMaxUs)
+    rxStats.callbackMaxUs = elapsed;
+}
 
-    if (pairingData.id == PAIR_RESPONSE && !isPaired && strcmp(pairingData.identifier, espIdentifier) == 0)
-    {
-      Serial.print("Pairing response received from: ");
-      char macStr[18];
-      snprintf(macStr, sizeof(macStr), "%02x:%02x:%02x:%02x:%02x:%02x", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
-      Serial.println(macStr);
+void drainRadioFrames()
+{
+  uint32_t tail = rxRingTail.load(std::memory_order_relaxed);
+  uint32_t head = rxRingHead.load(std::memory_order_acquire);
+  rxStats.maxDepth = max(rxStats.maxDepth, head - tail);
+  while (tail != head)
+  {
+    const RadioFrame &frame = rxRing[tail % RX_RING_SLOTS];
+    deliverRadioFrame(frame.mac, frame.data, frame.len, frame.rxMs);
+    rxStats.processed++;
+    tail++;
+    rxRingTail.store(tail, std::memory_order_release);
+  }
+}
 
-      memcpy(mainControllerMac, pairingData.macAddr, 6);
-      int controllerChannel = pairingData.channel;
-      esp_now_del_peer(broadcastAddress);
+void deliverRadioFrame(const uint8_t *mac, const uint8_t *data, int len, unsigned long rxMs)
+{
+  FrameKind kind = (len == sizeof(struct_pairing)) ? FRAME_KIND_PAIRING : isTextFrame(data, len) ? FRAME_KIND_TEXT : FRAME_KIND_BINARY;
+  if (replay.mode == REPLAY_RECORDING)
+  {
+    recordRadioFrame(mac, data, len, rxMs);
+  }
+  currentFrameRxMs = rxMs;
+  unsigned long start = micros();
+  processRadioFrame(mac, data, len);
+  uint32_t elapsed = micros() - start;
+  frameCost.frames[kind]++;
+  frameCost.totalUs[kind] += elapsed;
+  frameCost.maxUs[kind] = max(frameCost.maxUs[kind], elapsed);
+  framesThisPass++;
+}
 
-      memset(&peerInfo, 0, sizeof(peerInfo));
-      memcpy(peerInfo.peer_addr, mainControllerMac, 6);
-      peerInfo.channel = 0;
-      peerInfo.encrypt = false;
+// Sends over the active transport. UDP and loopback report completion at once through OnDataSent().
+esp_err_t transportSend(const uint8_t *mac, const uint8_t *data, size_t len)
+{
+  switch (radioTransport)
+  {
+  case TRANSPORT_UDP:
+  {
+    bool ok = transportUdp.beginPacket(udpPeerIp, UDP_TRANSPORT_CONTROLLER_PORT) && transportUdp.write(data, len) == len &&
+              transportUdp.endPacket();
+    OnDataSent(mac, ok ? ESP_NOW_SEND_SUCCESS : ESP_NOW_SEND_FAIL);
+    return ok ? ESP_OK : ESP_FAIL;
+  }
+  case TRANSPORT_LOOPBACK:
+    loopbackFramesSent++;
+    OnDataSent(mac, ESP_NOW_SEND_SUCCESS);
+    return ESP_OK;
+  default:
+    return esp_now_send(mac, data, len);
+  }
+}
 
-      if (esp_now_add_peer(&peerInfo) != ESP_OK)
+void pollTransport()
+{
+  if (radioTransport == TRANSPORT_UDP)
+  {
+    uint8_t datagram[6 + sizeof(struct_message)];
+    int packetLen;
+    while ((packetLen = transportUdp.parsePacket()) > 0)
+    {
+      int len = transportUdp.read(datagram, sizeof(datagram));
+      if (len <= 6 || packetLen > (int)sizeof(datagram))
       {
-        Serial.println("Failed to add main controller peer");
-        return;
+        rxStats.oversized++;
+        continue;
       }
-
-      Serial.println("Successfully paired with main controller!");
-      isPaired = true;
-
-      sendPendingMqttSettings();
-
-      Serial.println("Requesting current settings...");
-
-      lastSettingsRequestTime = millis();
+      udpPeerIp = transportUdp.remoteIP();
+      rxStats.received++;
+      deliverRadioFrame(datagram, datagram + 6, len - 6, millis());
+      rxStats.processed++;
     }
   }
-  else if (len == sizeof(struct_message))
+  else if (radioTransport == TRANSPORT_LOOPBACK)
   {
-    if (!isPaired)
-    {
-      return;
-    }
-
-    if (memcmp(mac_addr, mainControllerMac, 6) != 0)
-    {
-      Serial.println("Data received from unknown MAC. Ignoring.");
-      return;
-    }
-    lastControllerMessageTime = millis();
-    if (SIMULATION_MODE)
-    {
-      return;
-    }
-    memcpy(&myData, incomingData, sizeof(myData));
-    myData.payload[sizeof(myData.payload) - 1] = '\0';
-
-    char *token = strtok(myData.payload, "|");
-    while (token != NULL)
+    while (loopbackCount > 0)
     {
-      handleIncomingMessage(token);
-      token = strtok(NULL, "|");
+      RadioFrame &frame = loopbackQueue[loopbackHead];
+      loopbackHead = (loopbackHead + 1) % RX_RING_SLOTS;
+      loopbackCount--;
+      deliverRadioFrame(frame.mac, frame.data, frame.len, frame.rxMs);
     }
   }
 }
 
-void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status)
+bool queueLoopbackFrame(const uint8_t *mac, const uint8_t *data, int len)
 {
-  espNowBusy = false;
+  if (loopbackCount >= RX_RING_SLOTS || len <= 0 || len > (int)sizeof(loopbackQueue[0].data))
+  {
+    return false;
+  }
+  RadioFrame &frame = loopbackQueue[(loopbackHead + loopbackCount) % RX_RING_SLOTS];
+  memcpy(frame.mac, mac, 6);
+  memcpy(frame.data, data, len);
+  frame.len = len;
+  frame.rxMs = hmiMillis();
+  loopbackCount++;
+  return true;
 }
 
-void resetPairing()
+void setRadioTransport(RadioTransport transport)
 {
-  if (!isPaired)
+  if (transport == radioTransport)
+  {
     return;
+  }
+  resetPairing();
+  if (radioTransport == TRANSPORT_UDP)
+  {
+    transportUdp.stop();
+  }
+  radioTransport = transport;
+  loopbackCount = 0;
+  if (transport == TRANSPORT_UDP)
+  {
+    udpPeerIp = IPAddress(255, 255, 255, 255);
+    transportUdp.begin(UDP_TRANSPORT_HMI_PORT);
+    Serial.printf("Transport: UDP, listening on port %u.\n", UDP_TRANSPORT_HMI_PORT);
+  }
+  else
+  {
+    Serial.printf("Transport: %s.\n", transport == TRANSPORT_LOOPBACK ? "loopback queue" : "ESP-NOW");
+  }
+  lastPairingRequestTime = 0;
+}
 
-  Serial.println("Resetting ESP-NOW pairing due to timeout or request.");
-  isPaired = false;
-  lastControllerMessageTime = 0;
-
-  esp_now_del_peer(mainControllerMac);
-  memset(mainControllerMac, 0, 6);
-
-  memset(&peerInfo, 0, sizeof(peerInfo));
-  memcpy(peerInfo.peer_addr, broadcastAddress, 6);
-  peerInfo.channel = 0;
-  peerInfo.encrypt = false;
-
-  esp_err_t addStatus = esp_now_add_peer(&peerInfo);
-  if (addStatus != ESP_OK && addStatus != ESP_ERR_ESPNOW_EXIST)
+void printFrameCost()
+{
+  static const char *kindNames[FRAME_KIND_COUNT] = {"pairing", "text", "binary"};
+  Serial.println("--- Per-Frame Processing Cost ---");
+  for (int kind = 0; kind < FRAME_KIND_COUNT; kind++)
   {
-    Serial.printf("Error re-adding broadcast peer after reset: %s\n", esp_err_to_name(addStatus));
+    uint32_t frames = frameCost.frames[kind];
+    Serial.printf("%-8s %8lu frames, %8.1f us mean, %6lu us max\n", kindNames[kind], (unsigned long)frames,
+                  frames > 0 ? (float)frameCost.totalUs[kind] / frames : 0.0f, (unsigned long)frameCost.maxUs[kind]);
   }
-  else
+  Serial.printf("Render after frames: %lu passes, %.1f us mean, %lu us max (updateDisplay + updateChart)\n",
+                (unsigned long)frameCost.renderPasses,
+                frameCost.renderPasses > 0 ? (float)frameCost.renderTotalUs / frameCost.renderPasses : 0.0f,
+                (unsigned long)frameCost.renderMaxUs);
+  if (radioTransport == TRANSPORT_LOOPBACK)
   {
-    Serial.println("Broadcast peer active for re-pairing.");
+    Serial.printf("Loopback: %lu frames transmitted\n", (unsigned long)loopbackFramesSent);
   }
-
-  lastPairingRequestTime = 0;
 }
 
-void manageSettingsRequests()
+// --- Record and Replay ---
+// Recording runs in loop() context only: deliverRadioFrame() and NextionX2's reads
+void appendReplayRecord(uint8_t kind, const uint8_t *mac, const uint8_t *data, size_t len, unsigned long atMs)
 {
-  static unsigned long lastRequestTime = 0;
-  if (millis() - lastRequestTime < 500)
-    return;
-
-  if (!isPaired)
-    return;
-
-  if (!currentProfileReceived)
+  size_t macLen = mac != nullptr ? 6 : 0;
+  size_t total = sizeof(ReplayRecordHeader) + macLen + len;
+  if (replay.fileBytes + replay.writeLen + total > REPLAY_LOG_MAX_BYTES)
   {
-    Serial.println("Requesting Profile...");
-    publishData("request", "profile", true);
-    lastRequestTime = millis();
+    replay.logFull = true;
     return;
   }
-
-  if (!tempsetReceived)
+  if (replay.writeLen + total > sizeof(replay.writeBuffer))
   {
-    publishData("request", "tempsetbrew", true);
-    lastRequestTime = millis();
+    replay.droppedRecords++;
     return;
   }
-  if (!brewModeReceived)
+  ReplayRecordHeader header;
+  header.kind = kind;
+  long deltaMs = (long)(atMs - replay.lastRecordMs);
+  header.deltaMs = deltaMs > 0 ? min(deltaMs, 65535L) : 0;
+  header.len = macLen + len;
+  if (deltaMs > 0)
+    replay.lastRecordMs = atMs;
+
+  uint8_t *out = replay.writeBuffer + replay.writeLen;
+  memcpy(out, &header, sizeof(header));
+  if (mac != nullptr)
+    memcpy(out + sizeof(header), mac, 6);
+  memcpy(out + sizeof(header) + macLen, data, len);
+  replay.writeLen += total;
+  replay.records++;
+}
+
+void recordRadioFrame(const uint8_t *mac, const uint8_t *data, int len, unsigned long rxMs)
+{
+  if (isTextFrame(data, len))
   {
-    publishData("request", "brewmode", true);
-    lastRequestTime = millis();
-    return;
+    appendReplayRecord(REPLAY_RADIO_TEXT, mac, data, strnlen((const char *)data, len), rxMs);
   }
-  if (!steamBoostReceived)
+  else
   {
-    publishData("request", "steamboost", true);
-    lastRequestTime = millis();
-    return;
+    appendReplayRecord(REPLAY_RADIO, mac, data, len, rxMs);
   }
+}
 
-  if (!profilingModeReceived)
+void recordNextionByte(uint8_t byte)
+{
+  if (replay.nextionLen < REPLAY_NEXTION_MAX_BYTES)
+    replay.nextionBytes[replay.nextionLen] = byte;
+  replay.nextionLen++;
+  replay.nextionTerminators = (byte == 0xFF) ? replay.nextionTerminators + 1 : 0;
+  if (replay.nextionTerminators < 3)
+    return;
+
+  if (replay.nextionLen <= REPLAY_NEXTION_MAX_BYTES)
+    appendReplayRecord(REPLAY_NEXTION, nullptr, replay.nextionBytes, replay.nextionLen, millis());
+  else
+    replay.droppedRecords++;
+  replay.nextionLen = 0;
+  replay.nextionTerminators = 0;
+}
+
+void flushReplayWriteBuffer(size_t maxBytes)
+{
+  size_t chunk = min(maxBytes, replay.writeLen);
+  replay.file.write(replay.writeBuffer, chunk);
+  replay.fileBytes += chunk;
+  replay.writeLen -= chunk;
+  memmove(replay.writeBuffer, replay.writeBuffer + chunk, replay.writeLen);
+}
+
+void startReplayRecording()
+{
+  if (replay.mode != REPLAY_OFF || !historyAvailable)
   {
-    publishData("request", "prof_mode", true);
-    lastRequestTime = millis();
+    Serial.println(historyAvailable ? "Recording or replay already running." : "Recording unavailable: LittleFS not mounted.");
     return;
   }
-  if (!profilingSourceReceived)
+  if (shotIsActive || pumpIsOn)
   {
-    publishData("request", "prof_src", true);
-    lastRequestTime = millis();
+    Serial.println("Recording starts between shots; wait for the shot to end.");
     return;
   }
-  if (!profilingTargetReceived)
+  replay.file = LittleFS.open(REPLAY_LOG_PATH, FILE_WRITE);
+  if (!replay.file)
   {
-    publishData("request", "prof_trg", true);
-    lastRequestTime = millis();
+    Serial.println("Failed to open replay log for writing.");
     return;
   }
-  if (!flatValueReceived)
+  ReplayLogHeader header = {};
+  header.magic = REPLAY_LOG_MAGIC;
+  header.version = REPLAY_LOG_VERSION;
+  header.paired = isPaired;
+  memcpy(header.controllerMac, mainControllerMac, 6);
+  header.controllerCaps = controllerProtocolCaps;
+  header.page = currentPage;
+  header.profileIndex = currentProfileIndex;
+  header.brewTempSetPoint = brewTempSetPoint;
+  header.flatValue = flatValue;
+  strlcpy(header.profilingMode, profilingMode, sizeof(header.profilingMode));
+  strlcpy(header.profilingSource, profilingSource, sizeof(header.profilingSource));
+  strlcpy(header.profilingTarget, profilingTarget, sizeof(header.profilingTarget));
+  strlcpy(header.machineState, machineState, sizeof(header.machineState));
+  header.dose = doseWeight;
+  header.targetYield = targetYieldSetting;
+  header.dripPerFlow = dripPerFlow;
+  header.boilerTemp = boilerTemp;
+  header.hxTemp = hxTemp;
+  header.pressure = pressure;
+  header.flowRate = flowRate;
+  header.weight = weight;
+  header.leverLifted = brewLeverLifted;
+  header.chartAuxMode = chartAuxMode;
+  replay.file.write((const uint8_t *)&header, sizeof(header));
+
+  replay.fileBytes = sizeof(header);
+  replay.writeLen = 0;
+  replay.logFull = false;
+  replay.records = 0;
+  replay.droppedRecords = 0;
+  replay.lastRecordMs = millis();
+  replay.nextionLen = 0;
+  replay.nextionTerminators = 0;
+  replay.mode = REPLAY_RECORDING;
+  Serial.printf("Recording ESP-NOW frames and Nextion returns to %s.\n", REPLAY_LOG_PATH);
+}
+
+void stopReplayRecording()
+{
+  while (replay.writeLen > 0)
   {
-    publishData("request", "prof_flat", true);
-    lastRequestTime = millis();
-    return;
+    flushReplayWriteBuffer(REPLAY_WRITE_CHUNK);
   }
+  replay.file.close();
+  replay.mode = REPLAY_OFF;
+  Serial.printf("Recording stopped: %lu records, %u bytes, %lu dropped (write buffer full)%s.\n", (unsigned long)replay.records,
+                (unsigned)replay.fileBytes, (unsigned long)replay.droppedRecords, replay.logFull ? ", log full" : "");
 }
 
-void sendPendingMqttSettings()
+// Frames go through the loopback transport and the display returns through nextionStream, so the
+// replay exercises the same paths as live traffic. Input from the real display and radio is ignored meanwhile.
+void startReplay(uint16_t speed)
 {
-  if (!mqttSettingsPending)
+  if (replay.mode != REPLAY_OFF)
   {
+    Serial.println("Recording or replay already running.");
     return;
   }
-
-  if (!isPaired)
+  if (shotIsActive || pumpIsOn)
   {
-    Serial.println("Have pending MQTT settings, but not paired. Will wait.");
+    Serial.println("Replay starts between shots; wait for the shot to end.");
+    return;
+  }
+  ReplayLogHeader header;
+  replay.file = LittleFS.open(REPLAY_LOG_PATH, FILE_READ);
+  if (!replay.file || replay.file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) || header.magic != REPLAY_LOG_MAGIC ||
+      header.version != REPLAY_LOG_VERSION)
+  {
+    Serial.println("No replay log recorded.");
+    if (replay.file)
+      replay.file.close();
     return;
   }
 
-  Serial.println("Sending pending MQTT config via ESP-NOW...");
+  replay.previousTransport = radioTransport;
+  if (radioTransport == TRANSPORT_LOOPBACK)
+    resetPairing();
+  else
+    setRadioTransport(TRANSPORT_LOOPBACK);
+  if (header.paired)
+  {
+    pairedVia = "replay";
+    completePairing(header.controllerMac);
+    controllerProtocolCaps = header.controllerCaps;
+  }
+  char cmdBuffer[12];
+  snprintf(cmdBuffer, sizeof(cmdBuffer), "page %u", header.page);
+  nextion.command(cmdBuffer);
+  nextion.setCurrentPageID(header.page);
+  currentPage = header.page;
+  applyReplayState(header);
+
+  frameCost = {};
+  replay.speed = speed;
+  replay.records = 0;
+  replay.dueMs = 0;
+  replay.nextionReplayLen = 0;
+  replay.nextionReplayPos = 0;
+  replay.pendingQueries = 0;
+  replay.commandLen = 0;
+  replay.commandTerminators = 0;
+  replay.passes = 0;
+  replay.maxPassUs = 0;
+  replay.clockMs = 0;
+  replay.clockAtNext = false;
+  replay.startMs = millis();
+  replay.mode = REPLAY_PLAYING;
+  readNextReplayRecord();
+  replay.lastPassUs = micros();
+  if (speed == 0)
+    Serial.println("Replaying one record per loop pass.");
+  else
+    Serial.printf("Replaying at %ux.\n", speed);
+}
 
-  publishData("mqtt_server", form_mqtt_server, false);
-  publishData("mqtt_port", form_mqtt_port_str, false);
-  publishData("mqtt_user", form_mqtt_user, false);
-  publishData("mqtt_password", form_mqtt_password, true);
+// Restores what the recording started from; shot, chart and clock-sync state start idle as they were then
+void applyReplayState(const ReplayLogHeader &header)
+{
+  currentProfileIndex = constrain(header.profileIndex, 0, MAX_PROFILES - 1);
+  currentProfile = &profiles[currentProfileIndex];
+  brewTempSetPoint = header.brewTempSetPoint;
+  flatValue = header.flatValue;
+  strlcpy(profilingMode, header.profilingMode, sizeof(profilingMode));
+  strlcpy(profilingSource, header.profilingSource, sizeof(profilingSource));
+  strlcpy(profilingTarget, header.profilingTarget, sizeof(profilingTarget));
+  refreshProfilingFlags();
+  strlcpy(machineState, header.machineState, sizeof(machineState));
+  doseWeight = header.dose;
+  targetYieldSetting = header.targetYield;
+  dripPerFlow = header.dripPerFlow;
+  boilerTemp = header.boilerTemp;
+  hxTemp = header.hxTemp;
+  pressure = header.pressure;
+  flowRate = header.flowRate;
+  weight = header.weight;
+  brewLeverLifted = header.leverLifted;
+  chartAuxMode = (ChartAuxMode)header.chartAuxMode;
+
+  shotStartTimeMillis = 0;
+  shotSampleCount = 0;
+  plotPointsAdded = 0;
+  shotMetrics = {};
+  phaseDetector = {};
+  phaseMarkersDrawn = 0;
+  puckResistance = {};
+  adherence = {};
+  yieldPredictor = {};
+  chartRender.pending = false;
+  chartWindowS = CHART_INITIAL_WINDOW_S;
+  chartPressureMax = PRESSURE_AXIS_START;
+  chartFlowMax = FLOW_RATE_AXIS_START;
+  referenceShot.valid = false;
+  controllerClockSynced = false;
+  controllerPumpStartValid = false;
+  updateFullProfileUI();
+}
 
-  mqttSettingsPending = false;
-  Serial.println("Pending MQTT config sent.");
+// Logic that depends on frame timing reads this clock; during a replay it follows the log, so every run sees the same times
+unsigned long hmiMillis()
+{
+  return replay.mode == REPLAY_PLAYING ? replay.startMs + replay.clockMs : millis();
+}
+
+bool readNextReplayRecord()
+{
+  replay.nextValid = replay.file.read((uint8_t *)&replay.next, sizeof(replay.next)) == sizeof(replay.next) &&
+                     replay.next.len <= sizeof(replay.nextData) &&
+                     replay.file.read(replay.nextData, replay.next.len) == replay.next.len;
+  if (replay.nextValid)
+    replay.dueMs += replay.next.deltaMs;
+  return replay.nextValid;
+}
+
+// A recorded answer to a "get" is handed out as soon as the firmware asks, not at its recorded time,
+// so value() and text() see it within their timeout at any replay speed
+bool loadReplayResponse()
+{
+  if (!replay.nextValid || replay.next.kind != REPLAY_NEXTION || replay.nextData[0] == 0x65 || replay.nextData[0] == 0x66)
+    return false;
+  memcpy(replay.nextionReplay, replay.nextData, replay.next.len);
+  replay.nextionReplayLen = replay.next.len;
+  replay.nextionReplayPos = 0;
+  replay.pendingQueries--;
+  replay.records++;
+  readNextReplayRecord();
+  return true;
 }
 
-void sendEspNowBuffer()
+void serviceReplay()
 {
-  if (strlen(espNowMessageBuffer) == 0)
+  if (replay.mode == REPLAY_RECORDING)
+  {
+    if (replay.logFull)
+    {
+      stopReplayRecording();
+      return;
+    }
+    // Like shot history, flash writes wait out a shot unless the buffer is filling up
+    if (replay.writeLen >= REPLAY_WRITE_CHUNK && (!shotIsActive || replay.writeLen > sizeof(replay.writeBuffer) / 2))
+      flushReplayWriteBuffer(REPLAY_WRITE_CHUNK);
     return;
-  if (!isPaired)
+  }
+  if (replay.mode != REPLAY_PLAYING)
     return;
 
-  if (espNowBusy)
+  unsigned long nowUs = micros();
+  replay.maxPassUs = max(replay.maxPassUs, (uint32_t)(nowUs - replay.lastPassUs));
+  replay.lastPassUs = nowUs;
+  replay.passes++;
+
+  // One record at a time, each only after the previous one was consumed, so the interleaving never depends on loop timing
+  uint32_t logNowMs = (millis() - replay.startMs) * replay.speed;
+  bool due = replay.nextValid && (replay.speed == 0 || replay.dueMs <= logNowMs) &&
+             replay.nextionReplayPos >= replay.nextionReplayLen && loopbackCount == 0;
+  if (due && !replay.clockAtNext)
   {
-    delay(50);
-    unsigned long waitStart = millis();
-    while (espNowBusy)
+    // The clock runs up to just before the record for one whole pass first, so timeouts in the gap fire at every speed
+    replay.clockMs = max(replay.clockMs, replay.dueMs > 0 ? replay.dueMs - 1 : 0);
+    replay.clockAtNext = true;
+  }
+  else if (due)
+  {
+    replay.clockMs = replay.dueMs;
+    replay.clockAtNext = false;
+    if (replay.next.kind == REPLAY_NEXTION)
     {
-      if (millis() - waitStart > 50)
+      if (replay.nextData[0] == 0x66 && replay.next.len > 1)
       {
-        espNowBusy = false; // Safety timeout
-        break;
+        char cmdBuffer[12];
+        snprintf(cmdBuffer, sizeof(cmdBuffer), "page %u", replay.nextData[1]);
+        nextion.command(cmdBuffer);
+      }
+      memcpy(replay.nextionReplay, replay.nextData, replay.next.len);
+      replay.nextionReplayLen = replay.next.len;
+      replay.nextionReplayPos = 0;
+      replay.pendingQueries = 0;
+    }
+    else if (replay.next.len > 6)
+    {
+      uint8_t frame[sizeof(struct_message)];
+      const uint8_t *data = replay.nextData + 6;
+      int len = replay.next.len - 6;
+      if (replay.next.kind == REPLAY_RADIO_TEXT)
+      {
+        memset(frame, 0, sizeof(frame));
+        memcpy(frame, data, min(len, (int)sizeof(frame) - 1));
+        data = frame;
+        len = sizeof(frame);
       }
-      yield();
+      queueLoopbackFrame(replay.nextData, data, len);
     }
+    replay.records++;
+    readNextReplayRecord();
   }
 
-  struct_message espnow_message;
-
-  strncpy(espnow_message.payload, espNowMessageBuffer, sizeof(espnow_message.payload));
-  espnow_message.payload[sizeof(espnow_message.payload) - 1] = '\0';
-  espNowBusy = true;
-  esp_err_t result = esp_now_send(mainControllerMac, (uint8_t *)&espnow_message, sizeof(espnow_message));
-
-  if (result != ESP_OK)
+  if (!replay.nextValid && replay.nextionReplayPos >= replay.nextionReplayLen && loopbackCount == 0)
   {
-    espNowBusy = false;
-    Serial.print("ERROR: ESP-NOW send failed: ");
-    Serial.println(result);
+    finishReplay();
   }
-  espNowMessageBuffer[0] = '\0';
 }
 
-void publishData(const char *topic, const char *payload, bool espNowSendNow)
+void finishReplay()
 {
-  if (OFFLINE_MODE || !isPaired)
-  {
-    return;
-  }
-  char newEntry[250];
-  snprintf(newEntry, sizeof(newEntry), "%s=%s", topic, payload);
-  size_t currentLen = strlen(espNowMessageBuffer);
-  size_t newEntryLen = strlen(newEntry);
+  unsigned long elapsedMs = millis() - replay.startMs;
+  replay.file.close();
+  replay.mode = REPLAY_OFF;
+  Serial.printf("Replay finished: %lu records covering %lu ms of log in %lu ms, %lu loop passes, %lu us max pass\n",
+                (unsigned long)replay.records, (unsigned long)replay.dueMs, elapsedMs, (unsigned long)replay.passes,
+                (unsigned long)replay.maxPassUs);
+  printFrameCost();
+  setRadioTransport(replay.previousTransport);
+}
 
-  if (currentLen + newEntryLen + 2 > sizeof(myData.payload))
+int NextionTapStream::available()
+{
+  if (replay.mode != REPLAY_PLAYING)
+    return (heldLen - heldPos) + Serial1.available();
+  heldLen = 0;
+  heldPos = 0;
+  while (Serial1.available())
   {
-    Serial.println("ESP-NOW buffer full, flushing automatically.");
-    sendEspNowBuffer();
-    currentLen = 0;
+    Serial1.read();
   }
-  if (currentLen > 0)
+  if (replay.nextionReplayPos >= replay.nextionReplayLen && replay.pendingQueries > 0)
+    loadReplayResponse();
+  return replay.nextionReplayLen - replay.nextionReplayPos;
+}
+
+int NextionTapStream::read()
+{
+  if (replay.mode == REPLAY_PLAYING)
+    return available() > 0 ? replay.nextionReplay[replay.nextionReplayPos++] : -1;
+  int byte;
+  if (heldPos < heldLen)
   {
-    strcat(espNowMessageBuffer, "|");
+    byte = held[heldPos++];
+    if (heldPos == heldLen)
+      heldLen = heldPos = 0;
   }
-  strcat(espNowMessageBuffer, newEntry);
-
-  if (espNowSendNow)
+  else
   {
-    sendEspNowBuffer();
+    byte = Serial1.read();
   }
+  if (byte >= 0 && replay.mode == REPLAY_RECORDING)
+    recordNextionByte(byte);
+  return byte;
 }
 
-bool parseBool(const char *value)
+int NextionTapStream::peek()
 {
-  return (strcmp(value, "ON") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+  if (replay.mode == REPLAY_PLAYING)
+    return available() > 0 ? replay.nextionReplay[replay.nextionReplayPos] : -1;
+  if (heldPos < heldLen)
+    return held[heldPos];
+  return Serial1.peek();
 }
 
-void handleIncomingMessage(char *message)
+size_t NextionTapStream::write(uint8_t byte)
 {
-  char *separator = strchr(message, '=');
-
-  if (separator == NULL)
+  if (replay.mode == REPLAY_PLAYING)
   {
-    return;
+    if (byte == 0xFF)
+    {
+      if (++replay.commandTerminators == 3)
+      {
+        if (replay.commandLen >= 4 && memcmp(replay.commandPrefix, "get ", 4) == 0)
+          replay.pendingQueries++;
+        replay.commandLen = 0;
+        replay.commandTerminators = 0;
+      }
+    }
+    else
+    {
+      if (replay.commandLen < sizeof(replay.commandPrefix))
+        replay.commandPrefix[replay.commandLen] = byte;
+      if (replay.commandLen < 255)
+        replay.commandLen++;
+      replay.commandTerminators = 0;
+    }
   }
-  *separator = '\0';
-  char *key = message;
-  char *value = separator + 1;
+  return Serial1.write(byte);
+}
 
-  if (strcmp(key, mqtt_topic_boiler_temp) == 0)
-  {
-    boilerTemp = atof(value);
-  }
-  else if (strcmp(key, mqtt_topic_hx_temp) == 0)
-  {
-    hxTemp = atof(value);
-  }
-  else if (strcmp(key, mqtt_topic_pressure) == 0)
-  {
-    pressure = atof(value);
-  }
-  else if (strcmp(key, mqtt_topic_heater) == 0)
-  {
-    isHeaterOn = parseBool(value);
+// Reads whole returns until code followed by the 0xFF 0xFF 0xFF terminator. The handshake reply itself is not
+// recorded: a replay issues its own addt and gets its own answer. Every other return is held for nextion.update().
+bool NextionTapStream::waitReturn(uint8_t code, unsigned long timeoutMs)
+{
+  uint8_t pending[NEXTION_HELD_MAX_BYTES];
+  uint8_t len = 0;
+  uint8_t terminators = 0;
+  unsigned long start = millis();
+  while (millis() - start < timeoutMs)
+  {
+    int c = Serial1.read();
+    if (c < 0)
+    {
+      continue;
+    }
+    if (len == sizeof(pending))
+    {
+      hold(pending, len);
+      len = 0;
+    }
+    pending[len++] = c;
+    terminators = (c == 0xFF) ? terminators + 1 : 0;
+    if (terminators < 3)
+    {
+      continue;
+    }
+    if (len == 4 && pending[0] == code)
+    {
+      return true;
+    }
+    hold(pending, len);
+    len = 0;
+    terminators = 0;
   }
-  else if (strcmp(key, mqtt_topic_pump) == 0)
+  hold(pending, len);
+  return false;
+}
+
+// Live display input is discarded during a replay, so nothing is held then
+void NextionTapStream::hold(const uint8_t *data, uint8_t len)
+{
+  if (replay.mode == REPLAY_PLAYING || len == 0)
+    return;
+  if (heldPos > 0)
   {
-    pumpIsOn = parseBool(value);
+    memmove(held, held + heldPos, heldLen - heldPos);
+    heldLen -= heldPos;
+    heldPos = 0;
   }
-  else if (strcmp(key, mqtt_topic_active_profile_id) == 0)
+  uint8_t room = sizeof(held) - heldLen;
+  memcpy(held + heldLen, data, min(len, room));
+  heldLen += min(len, room);
+}
+
+void printRxStats()
+{
+  uint32_t received = rxStats.received;
+  Serial.println("--- ESP-NOW Receive Ring ---");
+  Serial.printf("Frames: %lu received, %lu processed, %lu overruns, %lu oversized\n",
+                (unsigned long)received, (unsigned long)rxStats.processed,
+                (unsigned long)rxStats.overruns, (unsigned long)rxStats.oversized);
+  Serial.printf("Queue depth: %lu now, %lu max of %d slots\n",
+                (unsigned long)(rxRingHead.load() - rxRingTail.load()), (unsigned long)rxStats.maxDepth, RX_RING_SLOTS);
+  Serial.printf("Callback time: %lu us max, %.1f us mean\n", (unsigned long)rxStats.callbackMaxUs,
+                received > 0 ? (float)rxStats.callbackTotalUs / received : 0.0f);
+}
+
+void processRadioFrame(const uint8_t *mac_addr, const uint8_t *incomingData, int len)
+{
+  if (len == sizeof(struct_pairing))
   {
-    int newIndex = atoi(value);
-    if (newIndex >= 0 && newIndex < MAX_PROFILES)
+    memcpy(&pairingData, incomingData, sizeof(pairingData));
+
+    bool reRegistered = isPaired && linkLost && memcmp(pairingData.macAddr, mainControllerMac, 6) == 0;
+    if (pairingData.id == PAIR_RESPONSE && (!isPaired || reRegistered) && strcmp(pairingData.identifier, espIdentifier) == 0)
     {
-      currentProfileIndex = newIndex;
-      currentProfile = &profiles[currentProfileIndex];
-      updateFullProfileUI();
+      Serial.print("Pairing response received from: ");
+      char macStr[18];
+      snprintf(macStr, sizeof(macStr), "%02x:%02x:%02x:%02x:%02x:%02x", mac_addr[0], mac_addr[1], mac_addr[2], mac_addr[3], mac_addr[4], mac_addr[5]);
+      Serial.println(macStr);
+
+      uint8_t controllerMac[6];
+      memcpy(controllerMac, pairingData.macAddr, 6);
+      uint8_t controllerChannel = pairingData.channel;
+      esp_now_del_peer(broadcastAddress);
+      pairedVia = reRegistered ? "re-registration" : "broadcast";
+      if (completePairing(controllerMac) && radioTransport == TRANSPORT_ESPNOW)
+      {
+        storePeer(controllerMac, controllerChannel);
+      }
     }
   }
-  else if (strcmp(key, mqtt_topic_import_profile) == 0)
+  else if (isTextFrame(incomingData, len) || isBinaryFrame(incomingData, len))
   {
-    currentProfileReceived = true;
-    importProfileJson(value);
+    if (!isPaired)
+    {
+      return;
+    }
+
+    if (memcmp(mac_addr, mainControllerMac, 6) != 0)
+    {
+      Serial.println("Data received from unknown MAC. Ignoring.");
+      return;
+    }
+    if (!firstTelemetryLogged)
+    {
+      firstTelemetryLogged = true;
+      Serial.printf("First controller frame %lu ms after boot (paired via %s).\n", currentFrameRxMs, pairedVia);
+    }
+    lastControllerMessageTime = currentFrameRxMs;
+    noteControllerFrame();
+    if (SIMULATION_MODE)
+    {
+      return;
+    }
+    if (!isTextFrame(incomingData, len))
+    {
+      if (incomingData[2] == MSG_FRAGMENT)
+      {
+        char *message = handleFragmentFrame(incomingData, len);
+        if (message != nullptr)
+        {
+          dispatchTextPayload(message);
+          feedShotAnalytics();
+        }
+        return;
+      }
+      TelemetryPayload telemetry;
+      if (parseTelemetryFrame(incomingData, len, telemetry))
+      {
+        applyTelemetryPayload(telemetry);
+        feedShotAnalytics();
+      }
+      return;
+    }
+    memcpy(&myData, incomingData, len);
+    myData.payload[len - 1] = '\0';
+    dispatchTextPayload(myData.payload);
+    feedShotAnalytics();
   }
-  else if (strcmp(key, "profile_sync") == 0)
-  {
-    if (strcmp(value, "complete") == 0)
+}
+
+void dispatchTextPayload(char *payload)
+{
+  // State changes from the controller lead with "seq=N": acknowledge every copy, apply only the first
+  if (strncmp(payload, "seq=", 4) == 0)
+  {
+    uint16_t seq = (uint16_t)strtoul(payload + 4, NULL, 10);
+    char ackBuffer[8];
+    snprintf(ackBuffer, sizeof(ackBuffer), "%u", seq);
+    publishData("ack", ackBuffer, true);
+    if (isDuplicateRxSeq(seq))
     {
-      currentProfileReceived = true;
+      txStats.duplicatesDropped++;
+      return;
     }
   }
-  else if (strcmp(key, mqtt_topic_brew_mode) == 0)
+
+  char *token = strtok(payload, "|");
+  while (token != NULL)
   {
-    brewModeReceived = true;
-    bool isCoffee = (strcmp(value, "COFFEE") == 0);
-    btn_brewModeCoffee.value(isCoffee ? 1 : 0);
-    btn_brewModeSteam.value(isCoffee ? 0 : 1);
+    handleIncomingMessage(token);
+    token = strtok(NULL, "|");
   }
-  else if (strcmp(key, mqtt_topic_steam_boost_status) == 0)
+}
+
+void OnDataSent(const uint8_t *mac_addr, esp_now_send_status_t status)
+{
+  if (memcmp(mac_addr, mainControllerMac, 6) != 0)
   {
-    steamBoostReceived = true;
-    bool boostOn = (strcmp(value, "true") == 0);
-    btn_steamBoost.value(boostOn ? 1 : 0);
+    return;
   }
-  else if (strcmp(key, mqtt_topic_state) == 0)
+  if (peerProbeState == PEER_PROBE_SENT)
   {
-    strncpy(machineState, value, sizeof(machineState) - 1);
-    machineState[sizeof(machineState) - 1] = '\0';
+    peerProbeOk = (status == ESP_NOW_SEND_SUCCESS);
+    peerProbeResultPending = true;
+    return;
+  }
+  txCompletionOk = (status == ESP_NOW_SEND_SUCCESS);
+  txCompletionPending = true;
+}
 
-    static char previousState[64] = "";
-    char msgBuffer[250];
+void sendPairingRequest(const uint8_t *destination)
+{
+  pairingData.id = PAIR_REQUEST;
+  pairingData.channel = myChannel;
+  WiFi.macAddress(pairingData.macAddr);
+  strcpy(pairingData.identifier, espIdentifier);
+  transportSend(destination, (uint8_t *)&pairingData, sizeof(pairingData));
+}
 
-    if (strcmp(value, "CLEANING_START") == 0)
-    {
-      t_systemMessage.text("Cleaning Cycle:\r\nAdd detergent\r\nPull lever to start");
-      cleaningCycleActive = true;
-      cleaningCycleCount = 1;
-      systemMessageClearTime = 0;
-      cleaningRequestTime = 0;
-    }
-    else if (strcmp(value, "CLEANING_PUMPING") == 0)
-    {
-      if (strcmp(previousState, "CLEANING_PAUSE") == 0)
-      {
-        cleaningCycleCount++;
-      }
-      snprintf(msgBuffer, sizeof(msgBuffer), "Pumping... (Cycle %d)\r\nLower lever when buzzing", cleaningCycleCount);
-      t_systemMessage.text(msgBuffer);
-      cleaningCycleActive = true;
-      systemMessageClearTime = 0;
-      cleaningRequestTime = 0;
-    }
-    else if (strcmp(value, "CLEANING_PAUSE") == 0)
-    {
-      if (cleaningCycleCount < 5)
-      {
-        snprintf(msgBuffer, sizeof(msgBuffer), "Cleaning... (Cycle %d)\r\nLift lever", cleaningCycleCount);
-      }
-      else if (cleaningCycleCount == 5)
-      {
-        snprintf(msgBuffer, sizeof(msgBuffer), "Flushing... (Cycle %d)\r\nRemove detergent, lift lever", cleaningCycleCount);
-      }
-      else
-      {
-        snprintf(msgBuffer, sizeof(msgBuffer), "Flushing... (Cycle %d)\r\nLift lever", cleaningCycleCount);
-      }
-      t_systemMessage.text(msgBuffer);
-      cleaningCycleActive = true;
-      systemMessageClearTime = 0;
-      cleaningRequestTime = 0;
-    }
-    else if (cleaningCycleActive && strstr(value, "CLEANING") == NULL && cleaningRequestTime == 0)
-    {
-      t_systemMessage.text("Cleaning Complete");
-      cleaningCycleActive = false;
-      cleaningCycleCount = 0;
-      systemMessageClearTime = millis() + 5000;
-    }
-    else if (strcmp(value, "CALIBRATION_EMPTY") == 0)
+// Registers the controller as the unicast peer and starts the post-pairing handshake
+bool completePairing(const uint8_t *controllerMac)
+{
+  memcpy(mainControllerMac, controllerMac, 6);
+  if (!esp_now_is_peer_exist(mainControllerMac))
+  {
+    memset(&peerInfo, 0, sizeof(peerInfo));
+    memcpy(peerInfo.peer_addr, mainControllerMac, 6);
+    peerInfo.channel = 0;
+    peerInfo.encrypt = false;
+
+    if (esp_now_add_peer(&peerInfo) != ESP_OK)
     {
-      if (calibrationStep == 10)
-        return;
-      calibrationRequestTime = 0;
-      calibrationStep = 1;
-      t_systemMessage.text("Calibration Started:\r\nEnsure scale is empty.\r\nPress button to tare");
+      Serial.println("Failed to add main controller peer");
+      return false;
     }
-    else if (strcmp(value, "CALIBRATION_TEST_WEIGHT") == 0)
-    {
-      if (calibrationStep == 20)
-        return;
-      calibrationStep = 2;
-      calibrationRequestTime = 0;
-      t_systemMessage.text("Tare Complete.\r\nPlace weight on scale.\r\nPress button to weigh");
+  }
 
-      char cmdBuffer[20];
-      sprintf(cmdBuffer, "vis %d,1", referenceWeightID);
-      nextion.command(cmdBuffer);
-      sprintf(cmdBuffer, "vis %d,1", referenceWeightUnitID);
-      nextion.command(cmdBuffer);
-      nextion.command(cmdBuffer);
-      delay(100);
-      if (referenceWeight <= 0.1f)
-      {
-        referenceWeight = 100.0f;
-      }
-      x_referenceWeight.value((int)(referenceWeight * 10.0f));
+  Serial.printf("Successfully paired with main controller (%s) %lu ms after boot!\n", pairedVia, millis());
+  isPaired = true;
+  controllerProtocolCaps = 0;
+  pairedAtMs = millis();
+  snapshotPending = true;
+  snapshotAttempts = 0;
 
-      Serial.printf("Entered Calibration Step 2. Reference Weight: %.1fg\n", referenceWeight);
-    }
-    else if (calibrationStep != 0)
-    {
-      if (calibrationRequestTime > 0)
-      {
-        return;
-      }
-      else
-      {
-        if (strstr(previousState, "CALIBRATION") != NULL)
-        {
-          t_systemMessage.text("Calibration Complete");
-        }
-        else
-        {
-          t_systemMessage.text("Calibration Cancelled");
-        }
+  sendPendingMqttSettings();
 
-        calibrationStep = 0;
-        char cmdBuffer[20];
-        sprintf(cmdBuffer, "vis %d,0", referenceWeightID);
-        nextion.command(cmdBuffer);
-        sprintf(cmdBuffer, "vis %d,0", referenceWeightUnitID);
-        nextion.command(cmdBuffer);
-        systemMessageClearTime = millis() + 5000;
-      }
-    }
-    else if (cleaningCycleActive == false && portalRunning == false && calibrationRequestTime == 0 && cleaningRequestTime == 0)
-    {
-      if (systemMessageClearTime == 0)
-      {
-        t_systemMessage.text("");
-      }
-    }
-    strncpy(previousState, value, sizeof(previousState) - 1);
-    previousState[sizeof(previousState) - 1] = '\0';
-  }
-  else if (strcmp(key, mqtt_topic_lever) == 0)
-  {
-    brewLeverLifted = (strcmp(value, "LIFTED") == 0);
-  }
-  else if (strcmp(key, mqtt_topic_setpoint) == 0)
-  {
-    brewTempSetPoint = atof(value) * TEMP_SETPOINT_SCALE;
-    int tempSetPointInt = (int)brewTempSetPoint;
-    tempsetReceived = true;
-    slider_brewTemp.value(tempSetPointInt);
-    x_brewTemp.value(tempSetPointInt);
-    page1_cachedValues[0] = tempSetPointInt;
-  }
-  else if (strcmp(key, mqtt_topic_set_profiling_mode) == 0)
-  {
-    profilingModeReceived = true;
-    btn_ModeManual.value((strcmp(value, "manual") == 0) ? 1 : 0);
-    btn_ModeFlat.value((strcmp(value, "flat") == 0) ? 1 : 0);
-    btn_ModeProfile.value((strcmp(value, "profile") == 0) ? 1 : 0);
+  char capsBuffer[8];
+  snprintf(capsBuffer, sizeof(capsBuffer), "%u", HMI_PROTOCOL_CAPS);
+  publishData(mqtt_topic_caps, capsBuffer, true);
 
-    strncpy(profilingMode, value, sizeof(profilingMode) - 1);
-    profilingMode[sizeof(profilingMode) - 1] = '\0';
+  Serial.println("Requesting current settings...");
 
-    if (strcmp(value, "manual") == 0)
-    {
-      nextion.command("click bt0,0");
-      stopProfilePortal();
-    }
-    else if (strcmp(value, "flat") == 0)
-    {
-      nextion.command("click bt1,0");
-      stopProfilePortal();
-    }
-    else if (strcmp(value, "profile") == 0)
-    {
-      nextion.command("click bt2,0");
-      startProfilePortal();
-    }
-  }
-  else if (strcmp(key, mqtt_topic_set_profiling_source) == 0)
+  lastSettingsRequestTime = millis();
+  return true;
+}
+
+bool loadStoredPeer(uint8_t *mac, uint8_t &channel)
+{
+  peerPrefs.begin(PEER_PREFS_NAMESPACE, true);
+  bool found = peerPrefs.getBytesLength("mac") == 6 && peerPrefs.getBytes("mac", mac, 6) == 6;
+  channel = peerPrefs.getUChar("chan", 0);
+  peerPrefs.end();
+  return found;
+}
+
+// Written only when something changed, to spare the flash
+void storePeer(const uint8_t *mac, uint8_t channel)
+{
+  uint8_t storedMac[6];
+  uint8_t storedChannel;
+  if (loadStoredPeer(storedMac, storedChannel) && memcmp(storedMac, mac, 6) == 0 && storedChannel == channel)
   {
-    profilingSourceReceived = true;
-    strncpy(profilingSource, value, sizeof(profilingSource) - 1);
-    profilingSource[sizeof(profilingSource) - 1] = '\0';
-    bool isPressure = (strcmp(value, "pressure") == 0);
-    btn_SourcePressure.value(isPressure ? 1 : 0);
-    btn_SourceFlow.value(isPressure ? 0 : 1);
+    return;
   }
-  else if (strcmp(key, mqtt_topic_set_profiling_target) == 0)
+  peerPrefs.begin(PEER_PREFS_NAMESPACE, false);
+  peerPrefs.putBytes("mac", mac, 6);
+  peerPrefs.putUChar("chan", channel);
+  peerPrefs.end();
+  Serial.println("Controller peer saved.");
+}
+
+// A unicast pairing request to the last known controller; the link-layer ack alone proves it is there
+void startPeerProbe()
+{
+  uint8_t storedMac[6];
+  uint8_t storedChannel;
+  if (!loadStoredPeer(storedMac, storedChannel))
   {
-    profilingTargetReceived = true;
-    strncpy(profilingTarget, value, sizeof(profilingTarget) - 1);
-    profilingTarget[sizeof(profilingTarget) - 1] = '\0';
-    bool isTime = (strcmp(value, "time") == 0);
-    btn_TargetTime.value(isTime ? 1 : 0);
-    btn_TargetWeight.value(isTime ? 0 : 1);
+    return;
   }
-  else if (strcmp(key, mqtt_topic_set_profiling_flat) == 0)
+  if (storedChannel != 0 && myChannel != 0 && storedChannel != myChannel)
   {
-    flatValue = atof(value);
-    flatValueReceived = true;
-    char newValStr[16];
-    dtostrf(flatValue, 4, 1, newValStr);
-    slt_flat.text(newValStr);
+    Serial.printf("Stored controller was on channel %u, we are on %d; using broadcast pairing.\n", storedChannel, myChannel);
+    return;
   }
-  else if (strcmp(key, mqtt_topic_weight) == 0)
+
+  memcpy(mainControllerMac, storedMac, 6);
+  memset(&peerInfo, 0, sizeof(peerInfo));
+  memcpy(peerInfo.peer_addr, mainControllerMac, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+  peerInfo.ifidx = WIFI_IF_STA;
+  if (esp_now_add_peer(&peerInfo) != ESP_OK && !esp_now_is_peer_exist(mainControllerMac))
   {
-    weight = atof(value);
+    memset(mainControllerMac, 0, 6);
+    return;
   }
-  else if (strcmp(key, mqtt_topic_flow_rate) == 0)
+
+  Serial.printf("Probing stored controller %02x:%02x:%02x:%02x:%02x:%02x...\n", storedMac[0], storedMac[1], storedMac[2],
+                storedMac[3], storedMac[4], storedMac[5]);
+  peerProbeAttempts = 1;
+  peerProbeResultPending = false;
+  peerProbeState = PEER_PROBE_SENT;
+  peerProbeSentMs = millis();
+  sendPairingRequest(mainControllerMac);
+}
+
+void servicePeerProbe()
+{
+  if (peerProbeState != PEER_PROBE_SENT)
   {
-    flowRate = atof(value);
+    return;
   }
-  else if (strcmp(key, mqtt_topic_mqtt_server) == 0)
+  bool timedOut = millis() - peerProbeSentMs > (channelScanActive ? CHANNEL_PROBE_TIMEOUT_MS : PEER_PROBE_TIMEOUT_MS);
+  if (!peerProbeResultPending && !timedOut)
   {
-    strncpy(form_mqtt_server, value, sizeof(form_mqtt_server) - 1);
-    form_mqtt_server[sizeof(form_mqtt_server) - 1] = '\0';
+    return;
   }
-  else if (strcmp(key, mqtt_topic_mqtt_port) == 0)
+  bool ok = peerProbeResultPending && peerProbeOk;
+  peerProbeResultPending = false;
+
+  if (channelScanActive)
   {
-    strncpy(form_mqtt_port_str, value, sizeof(form_mqtt_port_str) - 1);
-    form_mqtt_port_str[sizeof(form_mqtt_port_str) - 1] = '\0';
+    peerProbeState = PEER_PROBE_IDLE;
+    handleChannelProbeResult(ok);
+    return;
   }
-  else if (strcmp(key, mqtt_topic_mqtt_user) == 0)
+  if (isPaired)
   {
-    strncpy(form_mqtt_user, value, sizeof(form_mqtt_user) - 1);
-    form_mqtt_user[sizeof(form_mqtt_user) - 1] = '\0';
+    // Background probe while the link is lost: a pairing request also re-registers us on a restarted controller
+    peerProbeState = PEER_PROBE_IDLE;
+    if (ok == (consecutiveProbeFailures > 0))
+    {
+      Serial.printf("Link probe: controller %s.\n", ok ? "reachable again" : "not answering");
+    }
+    consecutiveProbeFailures = ok ? 0 : consecutiveProbeFailures + 1;
+    // While associated the AP channel check catches a move; failing probes then just mean the controller is down
+    if (consecutiveProbeFailures >= CHANNEL_RECOVERY_PROBE_FAILURES && WiFi.status() != WL_CONNECTED)
+    {
+      startChannelRecovery("link probes failing", myChannel);
+    }
+    return;
   }
-  else if (strcmp(key, mqtt_topic_mqtt_pass) == 0)
+  if (ok)
   {
-    strncpy(form_mqtt_password, value, sizeof(form_mqtt_password) - 1);
-    form_mqtt_password[sizeof(form_mqtt_password) - 1] = '\0';
+    peerProbeState = PEER_PROBE_IDLE;
+    pairedVia = "stored peer";
+    uint8_t controllerMac[6];
+    memcpy(controllerMac, mainControllerMac, 6);
+    completePairing(controllerMac);
+    return;
   }
-  else if (strcmp(key, "raw_weight") == 0)
+  if (peerProbeAttempts < PEER_PROBE_MAX_ATTEMPTS)
   {
-    rawWeight = atof(value);
-    lastDebugDataTime = millis();
+    peerProbeAttempts++;
+    peerProbeSentMs = millis();
+    sendPairingRequest(mainControllerMac);
+    return;
   }
-  else if (strcmp(key, "filtered_weight") == 0)
+
+  Serial.println("Stored controller did not answer; falling back to broadcast pairing.");
+  peerProbeState = PEER_PROBE_IDLE;
+  esp_now_del_peer(mainControllerMac);
+  memset(mainControllerMac, 0, 6);
+  startBroadcastPairing();
+}
+
+void startBroadcastPairing()
+{
+  memset(&peerInfo, 0, sizeof(peerInfo));
+  memcpy(peerInfo.peer_addr, broadcastAddress, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+  peerInfo.ifidx = WIFI_IF_STA;
+  esp_err_t addStatus = esp_now_add_peer(&peerInfo);
+  if (addStatus != ESP_OK && addStatus != ESP_ERR_ESPNOW_EXIST)
   {
-    filteredWeight = atof(value);
-    weight = filteredWeight;
-    lastDebugDataTime = millis();
+    Serial.println("Failed to add broadcast peer");
   }
-  else if (strcmp(key, "filtered_flow") == 0)
+  else
   {
-    filteredFlow = atof(value);
-    flowRate = filteredFlow;
-    lastDebugDataTime = millis();
+    Serial.println("Broadcast peer added for pairing.");
   }
+  sendPairingRequest(broadcastAddress);
+  Serial.println("Sent auto-pairing request...");
+  lastPairingRequestTime = millis();
 }
 
-void publishSetting()
+void resetPairing()
 {
-  if (pendingSettingIndex < 0)
+  if (!isPaired)
     return;
 
-  int value = page1_cachedValues[pendingSettingIndex];
-  char numBuffer[10];
-
-  switch (pendingSettingIndex)
-  {
-  case 0:
+  Serial.println("Resetting ESP-NOW pairing due to timeout or request.");
+  isPaired = false;
+  controllerProtocolCaps = 0;
+  lastControllerMessageTime = 0;
+  clearTxQueue();
+  memset(unackedFrames, 0, sizeof(unackedFrames));
+  for (int i = 0; i < FRAGMENT_TRANSFER_SLOTS; i++)
   {
-    float valueF = (float)value / 10.0;
-    dtostrf(valueF, 4, 3, numBuffer);
-    publishData("tempsetbrew", numBuffer, true);
-    break;
+    outgoingTransfers[i].used = false;
+    incomingTransfers[i].used = false;
   }
-  case SETTING_ID_FLAT_VALUE:
+  rxSeqValid = false;
+  if (linkLost)
   {
-    dtostrf(flatValue, 4, 1, numBuffer);
-    Serial.print("Publishing flat value: ");
-    Serial.println(numBuffer);
-    publishData("profiling_flat_value", numBuffer, true);
-    break;
+    linkLost = false;
+    applyStaleStyle(false);
   }
-  case SETTING_ID_PROFILING_VALUE:
+  frameIntervalSamples = 0;
+  lastFrameRxMs = 0;
+  lastSubscription[0] = '\0';
+  peerProbeState = PEER_PROBE_IDLE;
+  channelScanActive = false;
+  consecutiveTxFailures = 0;
+  consecutiveProbeFailures = 0;
+
+  esp_now_del_peer(mainControllerMac);
+  memset(mainControllerMac, 0, 6);
+
+  memset(&peerInfo, 0, sizeof(peerInfo));
+  memcpy(peerInfo.peer_addr, broadcastAddress, 6);
+  peerInfo.channel = 0;
+  peerInfo.encrypt = false;
+
+  esp_err_t addStatus = esp_now_add_peer(&peerInfo);
+  if (addStatus != ESP_OK && addStatus != ESP_ERR_ESPNOW_EXIST)
   {
-    saveProfile(currentProfileIndex);
-    break;
+    Serial.printf("Error re-adding broadcast peer after reset: %s\n", esp_err_to_name(addStatus));
   }
+  else
+  {
+    Serial.println("Broadcast peer active for re-pairing.");
   }
 
-  pendingSettingIndex = -1;
+  lastPairingRequestTime = 0;
 }
 
-void checkEncoderPublish()
+void requestSettingsSnapshot()
 {
-  if (pendingSettingIndex != -1 && (millis() - lastEncoderActivityTime > PUBLISH_TIMEOUT))
-  {
-    publishSetting();
-  }
+  char requestBuffer[20];
+  snprintf(requestBuffer, sizeof(requestBuffer), "snapshot:%08lx", (unsigned long)settingsDigest);
+  publishData("request", requestBuffer, true);
+  snapshotAttempts++;
+  snapshotRequestTime = millis();
 }
 
-// --- Display & UI Functions ---
-void updateDisplay()
+// A write that was never acknowledged may or may not have landed: pull every setting back from the controller
+void requestSettingsResync()
 {
-  char buffer[10];
-  static bool hasForcedUpdate = false;
-  bool forceUpdate = false;
+  settingsDigest = 0; // the local values changed since the last snapshot, so always ask for the full set
+  snapshotPending = true;
+  snapshotAttempts = 0;
+  currentProfileReceived = tempsetReceived = brewModeReceived = steamBoostReceived = false;
+  profilingModeReceived = profilingSourceReceived = profilingTargetReceived = flatValueReceived = false;
+  Serial.println("Resynchronizing settings from the controller.");
+}
 
-  if (setupFinished && !hasForcedUpdate)
+// The controller answers "snapshot=unchanged" or "snapshot=<digest>" followed by every setting key in the same message
+void handleSnapshot(const char *value)
+{
+  snapshotPending = false;
+  if (strcmp(value, "unchanged") != 0)
   {
-    forceUpdate = true;
-    hasForcedUpdate = true;
+    settingsDigest = strtoul(value, NULL, 16);
   }
+  currentProfileReceived = tempsetReceived = brewModeReceived = steamBoostReceived = true;
+  profilingModeReceived = profilingSourceReceived = profilingTargetReceived = flatValueReceived = true;
+  Serial.printf("Settings snapshot %s %lu ms after pairing.\n", strcmp(value, "unchanged") == 0 ? "unchanged" : "applied",
+                millis() - pairedAtMs);
+}
+
+void manageSettingsRequests()
+{
+  static unsigned long lastRequestTime = 0;
+  if (!isPaired)
+    return;
 
-  if (shotTime != lastShotTime_sent)
+  if (snapshotPending)
   {
-    if (shotTime == 0)
+    if (controllerProtocolCaps & PROTOCOL_CAP_SNAPSHOT)
     {
-      t_shotTime.text("");
-      char cmdBuffer[32];
-      sprintf(cmdBuffer, "cle %d,255", waveformID);
-      nextion.command(cmdBuffer);
+      if (snapshotAttempts == 0 || millis() - snapshotRequestTime >= SNAPSHOT_RETRY_MS)
+      {
+        if (snapshotAttempts < SNAPSHOT_MAX_ATTEMPTS)
+        {
+          requestSettingsSnapshot();
+          return;
+        }
+        Serial.println("No settings snapshot received, requesting settings one by one.");
+        snapshotPending = false;
+      }
+      else
+      {
+        return;
+      }
+    }
+    else if (millis() - pairedAtMs < CAPS_WAIT_MS)
+    {
+      return;
     }
     else
     {
-      sprintf(buffer, "%d", shotTime);
-      t_shotTime.text(buffer);
+      snapshotPending = false;
     }
-    lastShotTime_sent = shotTime;
   }
-  const int num_entries = 38;
 
-  if ((abs(hxTemp - lastHxTemp_sent) > 0.1) || forceUpdate)
+  if (millis() - lastRequestTime < 500)
+    return;
+
+  if (!currentProfileReceived)
   {
-    dtostrf(hxTemp, 4, 1, buffer);
-    int hxPic = (int)round(mapf(hxTemp, 20, 100, 0, num_entries - 1));
-    hxPic = constrain(hxPic, 0, num_entries - 1);
-    t_hxTemp.text(buffer);
-    pic_brew.attribute("pic", (int)hxPic);
-    t_hxTemp2.text(buffer);
-    pic_brew2.attribute("pic", (int)hxPic);
-    t_hxTemp3.text(buffer);
-    pic_brew3.attribute("pic", (int)hxPic);
-    t_hxTemp4.text(buffer);
-    pic_brew4.attribute("pic", (int)hxPic);
-    lastHxTemp_sent = hxTemp;
+    Serial.println("Requesting Profile...");
+    publishData("request", "profile", true);
+    lastRequestTime = millis();
+    return;
   }
-  delay(30);
-  if ((abs(boilerTemp - lastBoilerTemp_sent) > 0.1) || forceUpdate)
+
+  if (!tempsetReceived)
   {
-    dtostrf(boilerTemp, 4, 1, buffer);
-    int blPic = (int)round(mapf(boilerTemp, 20, 140, num_entries, 2 * num_entries - 1));
-    blPic = constrain(blPic, num_entries, 2 * num_entries - 1);
-    t_boilerTemp.text(buffer);
-    pic_boiler.attribute("pic", (int)blPic);
-    t_boilerTemp2.text(buffer);
-    pic_boiler2.attribute("pic", (int)blPic);
-    t_boilerTemp3.text(buffer);
-    pic_boiler3.attribute("pic", (int)blPic);
-    t_boilerTemp4.text(buffer);
-    pic_boiler4.attribute("pic", (int)blPic);
-    lastBoilerTemp_sent = boilerTemp;
+    publishData("request", "tempsetbrew", true);
+    lastRequestTime = millis();
+    return;
   }
-  delay(30);
-  if ((abs(brewTempSetPoint - lastTempSetpoint_sent) > 0.1) || forceUpdate)
+  if (!brewModeReceived)
   {
-    lastTempSetpoint_sent = brewTempSetPoint;
-    int arrPic = (int)round(mapf(brewTempSetPoint / 10, 20 - (100 - 20) / (num_entries - 2), 100 + (100 - 20) / (num_entries - 2), 2 * num_entries, 3 * num_entries));
-    arrPic = constrain(arrPic, 2 * num_entries, 3 * num_entries - 1);
-    pic_arrow.attribute("pic", (int)arrPic);
-    pic_arrow2.attribute("pic", (int)arrPic);
-    pic_arrow3.attribute("pic", (int)arrPic);
-    pic_arrow4.attribute("pic", (int)arrPic);
+    publishData("request", "brewmode", true);
+    lastRequestTime = millis();
+    return;
   }
-  delay(30);
-  if ((abs(weight - lastWeight_sent) > 0.01) || forceUpdate)
+  if (!steamBoostReceived)
   {
-    sprintf(buffer, "%.1fg", weight);
-    t_weight.text(buffer);
-    lastWeight_sent = weight;
+    publishData("request", "steamboost", true);
+    lastRequestTime = millis();
+    return;
+  }
+
+  if (!profilingModeReceived)
+  {
+    publishData("request", "prof_mode", true);
+    lastRequestTime = millis();
+    return;
+  }
+  if (!profilingSourceReceived)
+  {
+    publishData("request", "prof_src", true);
+    lastRequestTime = millis();
+    return;
+  }
+  if (!profilingTargetReceived)
+  {
+    publishData("request", "prof_trg", true);
+    lastRequestTime = millis();
+    return;
   }
-  if (strcmp(machineState, lastMachineState_sent) != 0)
+  if (!flatValueReceived)
   {
-    t_machineState.text(machineState);
-    strlcpy(lastMachineState_sent, machineState, sizeof(lastMachineState_sent));
+    publishData("request", "prof_flat", true);
+    lastRequestTime = millis();
+    return;
   }
 }
 
-void cacheSliderData()
+void sendPendingMqttSettings()
 {
-  static bool rowCached[NUM_PAGE1_COMPONENTS] = {0};
-  bool allCached = true;
-
-  Serial.println("Caching slider data from Nextion...");
+  if (!mqttSettingsPending)
+  {
+    return;
+  }
 
-  for (int i = 0; i < NUM_PAGE1_COMPONENTS; i++)
+  if (!isPaired)
   {
-    if (rowCached[i])
-    {
-      continue;
-    }
+    Serial.println("Have pending MQTT settings, but not paired. Will wait.");
+    return;
+  }
 
-    NextionComponent *component1 = page1_components[i][1];
-    NextionComponent *component2 = page1_components[i][2];
-    NextionComponent *component3 = page1_components[i][3];
+  Serial.println("Sending pending MQTT config via ESP-NOW...");
 
-    if (component1 != nullptr && component2 == nullptr && component3 != nullptr)
-    {
+  publishData("mqtt_server", form_mqtt_server, false);
+  publishData("mqtt_port", form_mqtt_port_str, false);
+  publishData("mqtt_user", form_mqtt_user, false);
+  publishData("mqtt_password", form_mqtt_password, true);
 
-      int minVal = component1->attributeValue("minval");
-      delay(10);
-      int maxVal = component1->attributeValue("maxval");
-      delay(10);
-      int curVal = component1->value();
+  mqttSettingsPending = false;
+  Serial.println("Pending MQTT config sent.");
+}
 
-      if (minVal != -1 && maxVal != -1 && curVal != -1)
-      {
-        page1_bounds[i].min = minVal;
-        page1_bounds[i].max = maxVal;
-        page1_cachedValues[i] = curVal;
-        rowCached[i] = true;
-        Serial.printf("Row %d (Slider) cached: min=%d, max=%d, val=%d\n",
-                      i, minVal, maxVal, curVal);
-      }
-      else
-      {
-        allCached = false;
-        Serial.printf("Retrying row %d later (got -1)\n", i);
-      }
-    }
-    else
+void transmitFrame(TxFrame &frame)
+{
+  struct_message espnow_message;
+  const uint8_t *bytes = (const uint8_t *)frame.payload;
+  size_t length = frame.binaryLen;
+  if (frame.binaryLen == 0)
+  {
+    strncpy(espnow_message.payload, frame.payload, sizeof(espnow_message.payload));
+    espnow_message.payload[sizeof(espnow_message.payload) - 1] = '\0';
+    bytes = (const uint8_t *)&espnow_message;
+    length = sizeof(espnow_message);
+    if (controllerProtocolCaps & PROTOCOL_CAP_SHORT_TEXT)
     {
-      rowCached[i] = true;
+      length = max(strlen(espnow_message.payload) + 1, SHORT_TEXT_MIN_LEN);
     }
   }
 
-  if (!allCached)
-  {
-    delay(50);
-    cacheSliderData();
-  }
-  else
+  frame.attempts++;
+  txCompletionPending = false;
+  txInFlight = true;
+  txSentAtMs = millis();
+  txStats.sent++;
+  esp_err_t result = transportSend(mainControllerMac, bytes, length);
+  if (result != ESP_OK)
   {
-    Serial.println("All slider data successfully cached.");
+    Serial.print("ERROR: ESP-NOW send failed: ");
+    Serial.println(result);
+    txCompletionOk = false;
+    txCompletionPending = true;
   }
 }
 
-void cacheEntriesData()
+// Completes the frame in flight, then starts the next one; high lane first
+void serviceTxQueue()
 {
-  static bool valueStringLoaded = false;
-  static bool flatValueLoaded = false;
-  static bool profilingNameLoaded = false;
-  static bool isProfilingSteppedLoaded = false;
-  static bool selectedItemPage2Loaded = false;
-  static bool rowPage2Loaded = false;
-  static bool columnPage2Loaded = false;
-  static bool sltHeightLoaded = false;
-
-  Serial.println("Caching entries data from Nextion...");
-
-  if (!valueStringLoaded)
+  if (txInFlight)
   {
-    const char *pValueString = slt_Values.text();
-    delay(100);
-    if (strcmp(pValueString, "Error") != 0)
+    bool timedOut = !txCompletionPending && millis() - txSentAtMs > TX_COMPLETION_TIMEOUT_MS;
+    if (!txCompletionPending && !timedOut)
     {
-      strncpy(valueString, pValueString, sizeof(valueString) - 1);
-      valueString[sizeof(valueString) - 1] = '\0';
-      valueStringLoaded = true;
-      parseProfilingData();
+      return;
     }
-    else
+    bool delivered = txCompletionPending && txCompletionOk;
+    txCompletionPending = false;
+    txInFlight = false;
+    if (delivered)
     {
-      delay(50);
+      txStats.delivered++;
+      consecutiveTxFailures = 0;
     }
-  }
-
-  if (!flatValueLoaded)
-  {
-    const char *pFlatString = slt_flat.text();
-    delay(100);
-    if (strcmp(pFlatString, "Error") != 0)
+    else if (txInFlightFrame.attempts < TX_MAX_ATTEMPTS && isPaired)
     {
-      flatValue = atof(pFlatString);
-      flatValueLoaded = true;
+      txStats.retries++;
+      transmitFrame(txInFlightFrame);
+      return;
     }
     else
     {
-      delay(50);
+      txStats.failures++;
+      consecutiveTxFailures++;
+      Serial.printf("ESP-NOW frame dropped after %u attempts.\n", txInFlightFrame.attempts);
     }
   }
 
-  if (!profilingNameLoaded)
+  if (!isPaired || peerProbeState == PEER_PROBE_SENT)
   {
-    const char *pProfilingName = t_profile.text();
-    delay(100);
-    if (strcmp(pProfilingName, "Error") != 0)
+    return;
+  }
+  if (serviceUnackedFrames())
+  {
+    return;
+  }
+  for (int lane = 0; lane < TX_LANE_COUNT; lane++)
+  {
+    // Fragmented transfers share the high lane's priority and go out ahead of its queued frames
+    if (lane == TX_LANE_HIGH && serviceOutgoingTransfers())
     {
-      strncpy(profilingName, pProfilingName, sizeof(profilingName) - 1);
-      profilingName[sizeof(profilingName) - 1] = '\0';
-      profilingNameLoaded = true;
+      return;
+    }
+    TxLaneQueue &queue = txLanes[lane];
+    if (queue.count == 0)
+    {
+      continue;
+    }
+    UnackedFrame *slot = nullptr;
+    if (lane == TX_LANE_HIGH && ackedWritesEnabled())
+    {
+      for (int i = 0; i < ACK_WINDOW && slot == nullptr; i++)
+      {
+        if (!unackedFrames[i].used)
+          slot = &unackedFrames[i];
+      }
+      if (slot == nullptr)
+      {
+        continue; // window full, writes wait for acknowledgements
+      }
+    }
+    TxFrame &next = queue.frames[queue.head];
+    txInFlightFrame.attempts = 0;
+    txInFlightFrame.binaryLen = 0;
+    if (slot != nullptr)
+    {
+      supersedeUnackedWrites(next.payload);
+      slot->used = true;
+      slot->seq = nextTxSeq++;
+      if (nextTxSeq == 0)
+        nextTxSeq = 1;
+      slot->attempts = 1;
+      slot->sentMs = millis();
+      snprintf(slot->payload, sizeof(slot->payload), "seq=%u|%s", slot->seq, next.payload);
+      strlcpy(txInFlightFrame.payload, slot->payload, sizeof(txInFlightFrame.payload));
     }
     else
     {
-      delay(50);
+      txInFlightFrame = next;
     }
+    queue.head = (queue.head + 1) % TX_QUEUE_SLOTS;
+    queue.count--;
+    transmitFrame(txInFlightFrame);
+    return;
   }
+}
 
-  if (!isProfilingSteppedLoaded)
+bool ackedWritesEnabled()
+{
+  return controllerProtocolCaps & PROTOCOL_CAP_ACKED_WRITES;
+}
+
+// Retransmits the oldest write whose acknowledgement timed out; returns true when a frame was sent
+bool serviceUnackedFrames()
+{
+  unsigned long now = millis();
+  for (int i = 0; i < ACK_WINDOW; i++)
   {
-    int val = sel_mode.value();
-    delay(100);
-    if (val != -1)
+    UnackedFrame &frame = unackedFrames[i];
+    if (!frame.used || now - frame.sentMs < ACK_TIMEOUT_MS)
     {
-      isProfilingStepped = (val == 1);
-      isProfilingSteppedLoaded = true;
+      continue;
+    }
+    if (frame.attempts >= ACK_MAX_ATTEMPTS)
+    {
+      txStats.ackExpired++;
+      Serial.printf("Write seq=%u was never acknowledged, giving up.\n", frame.seq);
+      frame.used = false;
+      requestSettingsResync();
+      continue;
+    }
+    frame.attempts++;
+    frame.sentMs = now;
+    txStats.ackRetransmits++;
+    txInFlightFrame.attempts = 0;
+    txInFlightFrame.binaryLen = 0;
+    strlcpy(txInFlightFrame.payload, frame.payload, sizeof(txInFlightFrame.payload));
+    transmitFrame(txInFlightFrame);
+    return true;
+  }
+  return false;
+}
+
+// A newer write to the same key makes the older one obsolete. Dropping it from the unacked frames keeps a
+// late retransmission from overwriting the newer value on the controller. Profile deltas chain on the
+// profile version and full profiles differ per id, so those keep their entries; "profile_resync" orders them.
+void supersedeUnackedWrites(const char *payload)
+{
+  for (int i = 0; i < ACK_WINDOW; i++)
+  {
+    UnackedFrame &frame = unackedFrames[i];
+    if (!frame.used)
+      continue;
+    char kept[sizeof(frame.payload)];
+    size_t keptLen = 0;
+    int keptEntries = 0;
+    const char *entry = frame.payload;
+    while (*entry)
+    {
+      const char *end = strchr(entry, '|');
+      size_t entryLen = end ? (size_t)(end - entry) : strlen(entry);
+      const char *equals = (const char *)memchr(entry, '=', entryLen);
+      size_t keyLen = equals ? (size_t)(equals - entry) : entryLen;
+      bool isSeq = keyLen == 3 && strncmp(entry, "seq", 3) == 0;
+      bool ordered = strncmp(entry, "profile_", 8) == 0;
+      if (isSeq || ordered || !payloadHasKey(payload, entry, keyLen))
+      {
+        if (keptLen > 0)
+          kept[keptLen++] = '|';
+        memcpy(kept + keptLen, entry, entryLen);
+        keptLen += entryLen;
+        keptEntries += !isSeq;
+      }
+      if (end == nullptr)
+        break;
+      entry = end + 1;
+    }
+    kept[keptLen] = '\0';
+    if (keptEntries == 0)
+    {
+      frame.used = false;
+      txStats.ackSuperseded++;
     }
     else
     {
-      delay(50);
+      strlcpy(frame.payload, kept, sizeof(frame.payload));
     }
   }
+}
 
-  if (!selectedItemPage2Loaded)
+bool payloadHasKey(const char *payload, const char *key, size_t keyLen)
+{
+  const char *entry = payload;
+  while (entry != nullptr && *entry)
   {
-    int val = var_sel.value();
-    delay(100);
-    if (val != -1)
+    if (strncmp(entry, key, keyLen) == 0 && entry[keyLen] == '=')
+      return true;
+    entry = strchr(entry, '|');
+    if (entry != nullptr)
+      entry++;
+  }
+  return false;
+}
+
+void handleAck(uint16_t seq)
+{
+  for (int i = 0; i < FRAGMENT_TRANSFER_SLOTS; i++)
+  {
+    OutgoingTransfer &transfer = outgoingTransfers[i];
+    if (transfer.used && transfer.seq == seq)
     {
-      selectedItemPage2 = val;
-      selectedItemPage2Loaded = true;
+      transfer.used = false;
+      txStats.acked++;
+      return;
     }
-    else
+  }
+  for (int i = 0; i < ACK_WINDOW; i++)
+  {
+    if (unackedFrames[i].used && unackedFrames[i].seq == seq)
     {
-      delay(50);
+      unackedFrames[i].used = false;
+      txStats.acked++;
+      return;
     }
   }
+}
 
-  if (!rowPage2Loaded)
+// Sliding 32-entry window over the controller's sequence numbers
+bool isDuplicateRxSeq(uint16_t seq)
+{
+  if (!rxSeqValid)
   {
-    int val = var_row.value();
-    delay(100);
-    if (val != -1)
+    rxSeqValid = true;
+    rxSeqLatest = seq;
+    rxSeqSeenMask = 1;
+    return false;
+  }
+  int16_t ahead = (int16_t)(seq - rxSeqLatest);
+  if (ahead > 0)
+  {
+    rxSeqSeenMask = (ahead >= 32) ? 1 : (rxSeqSeenMask << ahead) | 1;
+    rxSeqLatest = seq;
+    return false;
+  }
+  int behind = -ahead;
+  if (behind >= 32)
+  {
+    return true;
+  }
+  bool seen = rxSeqSeenMask & (1UL << behind);
+  rxSeqSeenMask |= (1UL << behind);
+  return seen;
+}
+
+void clearTxQueue()
+{
+  for (int lane = 0; lane < TX_LANE_COUNT; lane++)
+  {
+    txLanes[lane].head = 0;
+    txLanes[lane].count = 0;
+  }
+  txInFlight = false;
+  txCompletionPending = false;
+}
+
+void printTxStats()
+{
+  Serial.println("--- ESP-NOW Transmit Queue ---");
+  Serial.printf("Entries: %lu queued, %lu coalesced into earlier frames, %lu dropped (queue full)\n",
+                (unsigned long)txStats.queued, (unsigned long)txStats.coalesced, (unsigned long)txStats.dropped);
+  Serial.printf("Frames: %lu sent, %lu delivered, %lu retries, %lu failures\n",
+                (unsigned long)txStats.sent, (unsigned long)txStats.delivered,
+                (unsigned long)txStats.retries, (unsigned long)txStats.failures);
+  Serial.printf("Queue depth: ack %u, high %u, low %u, max %u of %d\n", txLanes[TX_LANE_ACK].count,
+                txLanes[TX_LANE_HIGH].count, txLanes[TX_LANE_LOW].count, txStats.maxDepth, TX_QUEUE_SLOTS);
+  int unacked = 0;
+  for (int i = 0; i < ACK_WINDOW; i++)
+    unacked += unackedFrames[i].used;
+  Serial.printf("Acknowledged writes %s: %lu acked, %lu retransmits, %lu expired, %lu superseded, %d awaiting ack, %lu duplicates dropped\n",
+                ackedWritesEnabled() ? "on" : "off", (unsigned long)txStats.acked, (unsigned long)txStats.ackRetransmits,
+                (unsigned long)txStats.ackExpired, (unsigned long)txStats.ackSuperseded, unacked,
+                (unsigned long)txStats.duplicatesDropped);
+}
+
+// Never blocks: the entry joins the newest unsent frame of its lane when it fits, otherwise a new frame.
+// espNowSendNow kicks the transmit pump right away instead of waiting for the next loop pass.
+void publishData(const char *topic, const char *payload, bool espNowSendNow)
+{
+  if (OFFLINE_MODE || !isPaired)
+  {
+    return;
+  }
+  TxLane lane = TX_LANE_HIGH;
+  if (strcmp(topic, "request") == 0 || strcmp(topic, mqtt_topic_ping) == 0)
+    lane = TX_LANE_LOW;
+  else if (strcmp(topic, "ack") == 0)
+    lane = TX_LANE_ACK;
+  TxLaneQueue &queue = txLanes[lane];
+  size_t reserve = (lane == TX_LANE_HIGH) ? ACK_SEQ_RESERVE : 0;
+
+  size_t fullLen = snprintf(NULL, 0, "%s=%s", topic, payload);
+  if (fullLen + 1 + reserve > sizeof(queue.frames[0].payload) && (controllerProtocolCaps & PROTOCOL_CAP_FRAGMENTS))
+  {
+    if (queueFragmentedTransfer(topic, payload) && espNowSendNow)
     {
-      rowPage2 = val;
-      rowPage2Loaded = true;
+      serviceTxQueue();
     }
-    else
+    return;
+  }
+  char newEntry[250];
+  snprintf(newEntry, sizeof(newEntry), "%s=%s", topic, payload);
+  size_t newEntryLen = strlen(newEntry);
+  if (newEntryLen < fullLen)
+  {
+    Serial.printf("ESP-NOW entry '%s' truncated to %u of %u bytes (controller cannot reassemble).\n", topic, newEntryLen, fullLen);
+  }
+  txStats.queued++;
+  if (queue.count > 0)
+  {
+    TxFrame &tail = queue.frames[(queue.head + queue.count - 1) % TX_QUEUE_SLOTS];
+    size_t currentLen = strlen(tail.payload);
+    if (currentLen + newEntryLen + 2 + reserve <= sizeof(tail.payload))
     {
-      delay(50);
+      tail.payload[currentLen] = '|';
+      memcpy(tail.payload + currentLen + 1, newEntry, newEntryLen + 1);
+      txStats.coalesced++;
+      newEntryLen = 0;
+    }
+  }
+  if (newEntryLen > 0)
+  {
+    if (queue.count >= TX_QUEUE_SLOTS)
+    {
+      txStats.dropped++;
+      Serial.printf("ESP-NOW transmit queue full, dropped '%s'.\n", topic);
+      return;
     }
+    TxFrame &frame = queue.frames[(queue.head + queue.count) % TX_QUEUE_SLOTS];
+    frame.attempts = 0;
+    frame.binaryLen = 0;
+    memcpy(frame.payload, newEntry, newEntryLen + 1);
+    queue.count++;
+    txStats.maxDepth = max(txStats.maxDepth, queue.count);
   }
 
-  if (!columnPage2Loaded)
+  if (espNowSendNow)
+  {
+    serviceTxQueue();
+  }
+}
+
+bool parseBool(const char *value)
+{
+  return (strcmp(value, "ON") == 0 || strcmp(value, "true") == 0 || strcmp(value, "1") == 0);
+}
+
+void handleIncomingMessage(char *message)
+{
+  char *separator = strchr(message, '=');
+
+  if (separator == NULL)
+  {
+    return;
+  }
+  *separator = '\0';
+  char *key = message;
+  char *value = separator + 1;
+
+  switch (lookupIncomingTopic(key))
+  {
+  case TOPIC_BOILER_TEMP:
+  {
+    boilerTemp = atof(value);
+    break;
+  }
+  case TOPIC_HX_TEMP:
+  {
+    hxTemp = atof(value);
+    break;
+  }
+  case TOPIC_PRESSURE:
+  {
+    pressure = atof(value);
+    break;
+  }
+  case TOPIC_HEATER:
+  {
+    isHeaterOn = parseBool(value);
+    break;
+  }
+  case TOPIC_PUMP:
+  {
+    pumpIsOn = parseBool(value);
+    break;
+  }
+  case TOPIC_TIMESTAMP:
+  {
+    uint32_t controllerMs = strtoul(value, NULL, 10);
+    updateControllerClock(controllerMs);
+    noteLinkTimestamp(controllerMs);
+    break;
+  }
+  case TOPIC_FRAME_SEQ:
+  {
+    noteLinkSeq(linkStats.textSeq, strtoul(value, NULL, 10), 65536);
+    break;
+  }
+  case TOPIC_PONG:
+  {
+    notePong(value);
+    break;
+  }
+  case TOPIC_PUMP_START:
+  {
+    applyControllerPumpStart(strtoul(value, NULL, 10));
+    break;
+  }
+  case TOPIC_CAPS:
+  {
+    controllerProtocolCaps = (uint8_t)atoi(value);
+    Serial.printf("Controller protocol capabilities: 0x%02x (binary telemetry %s, acknowledged writes %s)\n", controllerProtocolCaps,
+                  (controllerProtocolCaps & HMI_PROTOCOL_CAPS & PROTOCOL_CAP_BINARY_TELEMETRY) ? "on" : "off",
+                  ackedWritesEnabled() ? "on" : "off");
+    if (snapshotPending && snapshotAttempts == 0 && (controllerProtocolCaps & PROTOCOL_CAP_SNAPSHOT))
+    {
+      requestSettingsSnapshot();
+    }
+    lastSubscription[0] = '\0';
+    break;
+  }
+  case TOPIC_SNAPSHOT:
+  {
+    handleSnapshot(value);
+    break;
+  }
+  case TOPIC_ACK:
+  {
+    handleAck((uint16_t)strtoul(value, NULL, 10));
+    break;
+  }
+  case TOPIC_ACTIVE_PROFILE_ID:
+  {
+    int newIndex = atoi(value);
+    if (newIndex >= 0 && newIndex < MAX_PROFILES)
+    {
+      currentProfileIndex = newIndex;
+      currentProfile = &profiles[currentProfileIndex];
+      updateFullProfileUI();
+    }
+    break;
+  }
+  case TOPIC_IMPORT_PROFILE:
+  {
+    currentProfileReceived = true;
+    importProfileJson(value);
+    break;
+  }
+  case TOPIC_PROFILE_DELTA:
+  {
+    applyProfileDelta(value);
+    break;
+  }
+  case TOPIC_PROFILE_RESYNC:
+  {
+    saveProfile(atoi(value));
+    break;
+  }
+  case TOPIC_PROFILE_SYNC:
+  {
+    if (strcmp(value, "complete") == 0)
+    {
+      currentProfileReceived = true;
+    }
+    break;
+  }
+  case TOPIC_BREW_MODE:
+  {
+    brewModeReceived = true;
+    bool isCoffee = (strcmp(value, "COFFEE") == 0);
+    btn_brewModeCoffee.value(isCoffee ? 1 : 0);
+    btn_brewModeSteam.value(isCoffee ? 0 : 1);
+    break;
+  }
+  case TOPIC_STEAM_BOOST_STATUS:
+  {
+    steamBoostReceived = true;
+    bool boostOn = (strcmp(value, "true") == 0);
+    btn_steamBoost.value(boostOn ? 1 : 0);
+    break;
+  }
+  case TOPIC_STATE:
+  {
+    strncpy(machineState, value, sizeof(machineState) - 1);
+    machineState[sizeof(machineState) - 1] = '\0';
+
+    static char previousState[64] = "";
+    char msgBuffer[250];
+
+    if (strcmp(value, "CLEANING_START") == 0)
+    {
+      t_systemMessage.text("Cleaning Cycle:\r\nAdd detergent\r\nPull lever to start");
+      cleaningCycleActive = true;
+      cleaningCycleCount = 1;
+      systemMessageClearTime = 0;
+      cleaningRequestTime = 0;
+    }
+    else if (strcmp(value, "CLEANING_PUMPING") == 0)
+    {
+      if (strcmp(previousState, "CLEANING_PAUSE") == 0)
+      {
+        cleaningCycleCount++;
+      }
+      snprintf(msgBuffer, sizeof(msgBuffer), "Pumping... (Cycle %d)\r\nLower lever when buzzing", cleaningCycleCount);
+      t_systemMessage.text(msgBuffer);
+      cleaningCycleActive = true;
+      systemMessageClearTime = 0;
+      cleaningRequestTime = 0;
+    }
+    else if (strcmp(value, "CLEANING_PAUSE") == 0)
+    {
+      if (cleaningCycleCount < 5)
+      {
+        snprintf(msgBuffer, sizeof(msgBuffer), "Cleaning... (Cycle %d)\r\nLift lever", cleaningCycleCount);
+      }
+      else if (cleaningCycleCount == 5)
+      {
+        snprintf(msgBuffer, sizeof(msgBuffer), "Flushing... (Cycle %d)\r\nRemove detergent, lift lever", cleaningCycleCount);
+      }
+      else
+      {
+        snprintf(msgBuffer, sizeof(msgBuffer), "Flushing... (Cycle %d)\r\nLift lever", cleaningCycleCount);
+      }
+      t_systemMessage.text(msgBuffer);
+      cleaningCycleActive = true;
+      systemMessageClearTime = 0;
+      cleaningRequestTime = 0;
+    }
+    else if (cleaningCycleActive && strstr(value, "CLEANING") == NULL && cleaningRequestTime == 0)
+    {
+      t_systemMessage.text("Cleaning Complete");
+      cleaningCycleActive = false;
+      cleaningCycleCount = 0;
+      systemMessageClearTime = millis() + 5000;
+    }
+    else if (strcmp(value, "CALIBRATION_EMPTY") == 0)
+    {
+      if (calibrationStep == 10)
+        return;
+      calibrationRequestTime = 0;
+      calibrationStep = 1;
+      t_systemMessage.text("Calibration Started:\r\nEnsure scale is empty.\r\nPress button to tare");
+    }
+    else if (strcmp(value, "CALIBRATION_TEST_WEIGHT") == 0)
+    {
+      if (calibrationStep == 20)
+        return;
+      calibrationStep = 2;
+      calibrationRequestTime = 0;
+      t_systemMessage.text("Tare Complete.\r\nPlace weight on scale.\r\nPress button to weigh");
+
+      char cmdBuffer[20];
+      sprintf(cmdBuffer, "vis %d,1", referenceWeightID);
+      nextion.command(cmdBuffer);
+      sprintf(cmdBuffer, "vis %d,1", referenceWeightUnitID);
+      nextion.command(cmdBuffer);
+      nextion.command(cmdBuffer);
+      delay(100);
+      if (referenceWeight <= 0.1f)
+      {
+        referenceWeight = 100.0f;
+      }
+      x_referenceWeight.value((int)(referenceWeight * 10.0f));
+
+      Serial.printf("Entered Calibration Step 2. Reference Weight: %.1fg\n", referenceWeight);
+    }
+    else if (calibrationStep != 0)
+    {
+      if (calibrationRequestTime > 0)
+      {
+        return;
+      }
+      else
+      {
+        if (strstr(previousState, "CALIBRATION") != NULL)
+        {
+          t_systemMessage.text("Calibration Complete");
+        }
+        else
+        {
+          t_systemMessage.text("Calibration Cancelled");
+        }
+
+        calibrationStep = 0;
+        char cmdBuffer[20];
+        sprintf(cmdBuffer, "vis %d,0", referenceWeightID);
+        nextion.command(cmdBuffer);
+        sprintf(cmdBuffer, "vis %d,0", referenceWeightUnitID);
+        nextion.command(cmdBuffer);
+        systemMessageClearTime = millis() + 5000;
+      }
+    }
+    else if (cleaningCycleActive == false && portalRunning == false && calibrationRequestTime == 0 && cleaningRequestTime == 0)
+    {
+      if (systemMessageClearTime == 0)
+      {
+        t_systemMessage.text("");
+      }
+    }
+    strncpy(previousState, value, sizeof(previousState) - 1);
+    previousState[sizeof(previousState) - 1] = '\0';
+    break;
+  }
+  case TOPIC_LEVER:
+  {
+    brewLeverLifted = (strcmp(value, "LIFTED") == 0);
+    break;
+  }
+  case TOPIC_SETPOINT:
+  {
+    brewTempSetPoint = atof(value) * TEMP_SETPOINT_SCALE;
+    int tempSetPointInt = (int)brewTempSetPoint;
+    tempsetReceived = true;
+    slider_brewTemp.value(tempSetPointInt);
+    x_brewTemp.value(tempSetPointInt);
+    page1_cachedValues[0] = tempSetPointInt;
+    break;
+  }
+  case TOPIC_SET_PROFILING_MODE:
+  {
+    profilingModeReceived = true;
+    btn_ModeManual.value((strcmp(value, "manual") == 0) ? 1 : 0);
+    btn_ModeFlat.value((strcmp(value, "flat") == 0) ? 1 : 0);
+    btn_ModeProfile.value((strcmp(value, "profile") == 0) ? 1 : 0);
+
+    strncpy(profilingMode, value, sizeof(profilingMode) - 1);
+    profilingMode[sizeof(profilingMode) - 1] = '\0';
+    refreshProfilingFlags();
+
+    if (strcmp(value, "manual") == 0)
+    {
+      nextion.command("click bt0,0");
+      stopProfilePortal();
+    }
+    else if (strcmp(value, "flat") == 0)
+    {
+      nextion.command("click bt1,0");
+      stopProfilePortal();
+    }
+    else if (strcmp(value, "profile") == 0)
+    {
+      nextion.command("click bt2,0");
+      startProfilePortal();
+    }
+    break;
+  }
+  case TOPIC_SET_PROFILING_SOURCE:
+  {
+    profilingSourceReceived = true;
+    strncpy(profilingSource, value, sizeof(profilingSource) - 1);
+    profilingSource[sizeof(profilingSource) - 1] = '\0';
+    refreshProfilingFlags();
+    bool isPressure = (strcmp(value, "pressure") == 0);
+    btn_SourcePressure.value(isPressure ? 1 : 0);
+    btn_SourceFlow.value(isPressure ? 0 : 1);
+    break;
+  }
+  case TOPIC_SET_PROFILING_TARGET:
+  {
+    profilingTargetReceived = true;
+    strncpy(profilingTarget, value, sizeof(profilingTarget) - 1);
+    profilingTarget[sizeof(profilingTarget) - 1] = '\0';
+    refreshProfilingFlags();
+    bool isTime = (strcmp(value, "time") == 0);
+    btn_TargetTime.value(isTime ? 1 : 0);
+    btn_TargetWeight.value(isTime ? 0 : 1);
+    break;
+  }
+  case TOPIC_SET_PROFILING_FLAT:
+  {
+    flatValue = atof(value);
+    flatValueReceived = true;
+    char newValStr[16];
+    dtostrf(flatValue, 4, 1, newValStr);
+    slt_flat.text(newValStr);
+    break;
+  }
+  case TOPIC_WEIGHT:
+  {
+    weight = atof(value);
+    break;
+  }
+  case TOPIC_FLOW_RATE:
+  {
+    flowRate = atof(value);
+    break;
+  }
+  case TOPIC_MQTT_SERVER:
+  {
+    strncpy(form_mqtt_server, value, sizeof(form_mqtt_server) - 1);
+    form_mqtt_server[sizeof(form_mqtt_server) - 1] = '\0';
+    break;
+  }
+  case TOPIC_MQTT_PORT:
+  {
+    strncpy(form_mqtt_port_str, value, sizeof(form_mqtt_port_str) - 1);
+    form_mqtt_port_str[sizeof(form_mqtt_port_str) - 1] = '\0';
+    break;
+  }
+  case TOPIC_MQTT_USER:
+  {
+    strncpy(form_mqtt_user, value, sizeof(form_mqtt_user) - 1);
+    form_mqtt_user[sizeof(form_mqtt_user) - 1] = '\0';
+    break;
+  }
+  case TOPIC_MQTT_PASS:
+  {
+    strncpy(form_mqtt_password, value, sizeof(form_mqtt_password) - 1);
+    form_mqtt_password[sizeof(form_mqtt_password) - 1] = '\0';
+    break;
+  }
+  case TOPIC_RAW_WEIGHT:
+  {
+    rawWeight = atof(value);
+    lastDebugDataTime = hmiMillis();
+    break;
+  }
+  case TOPIC_FILTERED_WEIGHT:
+  {
+    filteredWeight = atof(value);
+    weight = filteredWeight;
+    lastDebugDataTime = hmiMillis();
+    break;
+  }
+  case TOPIC_FILTERED_FLOW:
+  {
+    filteredFlow = atof(value);
+    flowRate = filteredFlow;
+    lastDebugDataTime = hmiMillis();
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void publishSetting()
+{
+  if (pendingSettingIndex < 0)
+    return;
+
+  int value = page1_cachedValues[pendingSettingIndex];
+  char numBuffer[10];
+
+  switch (pendingSettingIndex)
+  {
+  case 0:
+  {
+    float valueF = (float)value / 10.0;
+    dtostrf(valueF, 4, 3, numBuffer);
+    publishData("tempsetbrew", numBuffer, true);
+    break;
+  }
+  case SETTING_ID_FLAT_VALUE:
+  {
+    dtostrf(flatValue, 4, 1, numBuffer);
+    Serial.print("Publishing flat value: ");
+    Serial.println(numBuffer);
+    publishData("profiling_flat_value", numBuffer, true);
+    break;
+  }
+  case SETTING_ID_PROFILING_VALUE:
+  {
+    if (!publishProfileDelta(currentProfileIndex))
+    {
+      saveProfile(currentProfileIndex);
+    }
+    break;
+  }
+  }
+
+  pendingSettingIndex = -1;
+}
+
+void checkEncoderPublish()
+{
+  if (pendingSettingIndex != -1 && (millis() - lastEncoderActivityTime > PUBLISH_TIMEOUT))
+  {
+    publishSetting();
+  }
+}
+
+// --- Display & UI Functions ---
+void updateDisplay()
+{
+  char buffer[10];
+  static bool hasForcedUpdate = false;
+  bool forceUpdate = false;
+
+  if (setupFinished && !hasForcedUpdate)
+  {
+    forceUpdate = true;
+    hasForcedUpdate = true;
+  }
+
+  long shotTimeTenths = shotTimeMs / 100;
+  if (shotTimeTenths != lastShotTime_sent)
+  {
+    if (shotTimeTenths == 0)
+    {
+      t_shotTime.text("");
+      char cmdBuffer[32];
+      sprintf(cmdBuffer, "cle %d,255", waveformID);
+      nextion.command(cmdBuffer);
+    }
+    else
+    {
+      sprintf(buffer, "%ld.%ld", shotTimeTenths / 10, shotTimeTenths % 10);
+      t_shotTime.text(buffer);
+    }
+    lastShotTime_sent = shotTimeTenths;
+  }
+  const int num_entries = 38;
+
+  if ((abs(hxTemp - lastHxTemp_sent) > 0.1) || forceUpdate)
+  {
+    dtostrf(hxTemp, 4, 1, buffer);
+    int hxPic = (int)round(mapf(hxTemp, 20, 100, 0, num_entries - 1));
+    hxPic = constrain(hxPic, 0, num_entries - 1);
+    t_hxTemp.text(buffer);
+    pic_brew.attribute("pic", (int)hxPic);
+    t_hxTemp2.text(buffer);
+    pic_brew2.attribute("pic", (int)hxPic);
+    t_hxTemp3.text(buffer);
+    pic_brew3.attribute("pic", (int)hxPic);
+    t_hxTemp4.text(buffer);
+    pic_brew4.attribute("pic", (int)hxPic);
+    lastHxTemp_sent = hxTemp;
+  }
+  delay(30);
+  if ((abs(boilerTemp - lastBoilerTemp_sent) > 0.1) || forceUpdate)
+  {
+    dtostrf(boilerTemp, 4, 1, buffer);
+    int blPic = (int)round(mapf(boilerTemp, 20, 140, num_entries, 2 * num_entries - 1));
+    blPic = constrain(blPic, num_entries, 2 * num_entries - 1);
+    t_boilerTemp.text(buffer);
+    pic_boiler.attribute("pic", (int)blPic);
+    t_boilerTemp2.text(buffer);
+    pic_boiler2.attribute("pic", (int)blPic);
+    t_boilerTemp3.text(buffer);
+    pic_boiler3.attribute("pic", (int)blPic);
+    t_boilerTemp4.text(buffer);
+    pic_boiler4.attribute("pic", (int)blPic);
+    lastBoilerTemp_sent = boilerTemp;
+  }
+  delay(30);
+  if ((abs(brewTempSetPoint - lastTempSetpoint_sent) > 0.1) || forceUpdate)
+  {
+    lastTempSetpoint_sent = brewTempSetPoint;
+    int arrPic = (int)round(mapf(brewTempSetPoint / 10, 20 - (100 - 20) / (num_entries - 2), 100 + (100 - 20) / (num_entries - 2), 2 * num_entries, 3 * num_entries));
+    arrPic = constrain(arrPic, 2 * num_entries, 3 * num_entries - 1);
+    pic_arrow.attribute("pic", (int)arrPic);
+    pic_arrow2.attribute("pic", (int)arrPic);
+    pic_arrow3.attribute("pic", (int)arrPic);
+    pic_arrow4.attribute("pic", (int)arrPic);
+  }
+  delay(30);
+  if ((abs(weight - lastWeight_sent) > 0.01) || forceUpdate)
+  {
+    char weightBuffer[16];
+    snprintf(weightBuffer, sizeof(weightBuffer), "%.1fg", weight);
+    t_weight.text(weightBuffer);
+    lastWeight_sent = weight;
+  }
+  // The yield prediction shares the wide state line; the weight field only fits the weight itself
+  const char *stateText = machineState;
+  char summaryBuffer[64];
+  if (linkLost)
+  {
+    stateText = "Controller lost, reconnecting...";
+  }
+  else if (shotTimeMs > 0 && shotMetrics.complete)
+  {
+    formatShotSummary(summaryBuffer, sizeof(summaryBuffer));
+    stateText = summaryBuffer;
+  }
+  else if (formatYieldPrediction(summaryBuffer, sizeof(summaryBuffer)))
+  {
+    stateText = summaryBuffer;
+  }
+  if (strcmp(stateText, lastMachineState_sent) != 0)
+  {
+    t_machineState.text(stateText);
+    strlcpy(lastMachineState_sent, stateText, sizeof(lastMachineState_sent));
+  }
+}
+
+void cacheSliderData()
+{
+  static bool rowCached[NUM_PAGE1_COMPONENTS] = {0};
+  bool allCached = true;
+
+  Serial.println("Caching slider data from Nextion...");
+
+  for (int i = 0; i < NUM_PAGE1_COMPONENTS; i++)
+  {
+    if (rowCached[i])
+    {
+      continue;
+    }
+
+    NextionComponent *component1 = page1_components[i][1];
+    NextionComponent *component2 = page1_components[i][2];
+    NextionComponent *component3 = page1_components[i][3];
+
+    if (component1 != nullptr && component2 == nullptr && component3 != nullptr)
+    {
+
+      int minVal = component1->attributeValue("minval");
+      delay(10);
+      int maxVal = component1->attributeValue("maxval");
+      delay(10);
+      int curVal = component1->value();
+
+      if (minVal != -1 && maxVal != -1 && curVal != -1)
+      {
+        page1_bounds[i].min = minVal;
+        page1_bounds[i].max = maxVal;
+        page1_cachedValues[i] = curVal;
+        rowCached[i] = true;
+        Serial.printf("Row %d (Slider) cached: min=%d, max=%d, val=%d\n",
+                      i, minVal, maxVal, curVal);
+      }
+      else
+      {
+        allCached = false;
+        Serial.printf("Retrying row %d later (got -1)\n", i);
+      }
+    }
+    else
+    {
+      rowCached[i] = true;
+    }
+  }
+
+  if (!allCached)
+  {
+    delay(50);
+    cacheSliderData();
+  }
+  else
+  {
+    Serial.println("All slider data successfully cached.");
+  }
+}
+
+void cacheEntriesData()
+{
+  static bool valueStringLoaded = false;
+  static bool flatValueLoaded = false;
+  static bool profilingNameLoaded = false;
+  static bool isProfilingSteppedLoaded = false;
+  static bool selectedItemPage2Loaded = false;
+  static bool rowPage2Loaded = false;
+  static bool columnPage2Loaded = false;
+  static bool sltHeightLoaded = false;
+
+  Serial.println("Caching entries data from Nextion...");
+
+  if (!valueStringLoaded)
+  {
+    const char *pValueString = slt_Values.text();
+    delay(100);
+    if (strcmp(pValueString, "Error") != 0)
+    {
+      strncpy(valueString, pValueString, sizeof(valueString) - 1);
+      valueString[sizeof(valueString) - 1] = '\0';
+      valueStringLoaded = true;
+      parseProfilingData();
+    }
+    else
+    {
+      delay(50);
+    }
+  }
+
+  if (!flatValueLoaded)
+  {
+    const char *pFlatString = slt_flat.text();
+    delay(100);
+    if (strcmp(pFlatString, "Error") != 0)
+    {
+      flatValue = atof(pFlatString);
+      flatValueLoaded = true;
+    }
+    else
+    {
+      delay(50);
+    }
+  }
+
+  if (!profilingNameLoaded)
+  {
+    const char *pProfilingName = t_profile.text();
+    delay(100);
+    if (strcmp(pProfilingName, "Error") != 0)
+    {
+      strncpy(profilingName, pProfilingName, sizeof(profilingName) - 1);
+      profilingName[sizeof(profilingName) - 1] = '\0';
+      profilingNameLoaded = true;
+    }
+    else
+    {
+      delay(50);
+    }
+  }
+
+  if (!isProfilingSteppedLoaded)
+  {
+    int val = sel_mode.value();
+    delay(100);
+    if (val != -1)
+    {
+      isProfilingStepped = (val == 1);
+      isProfilingSteppedLoaded = true;
+    }
+    else
+    {
+      delay(50);
+    }
+  }
+
+  if (!selectedItemPage2Loaded)
+  {
+    int val = var_sel.value();
+    delay(100);
+    if (val != -1)
+    {
+      selectedItemPage2 = val;
+      selectedItemPage2Loaded = true;
+    }
+    else
+    {
+      delay(50);
+    }
+  }
+
+  if (!rowPage2Loaded)
+  {
+    int val = var_row.value();
+    delay(100);
+    if (val != -1)
+    {
+      rowPage2 = val;
+      rowPage2Loaded = true;
+    }
+    else
+    {
+      delay(50);
+    }
+  }
+
+  if (!columnPage2Loaded)
+  {
+    int val = var_col.value();
+    delay(100);
+    if (val != -1)
+    {
+      columnPage2 = val;
+      columnPage2Loaded = true;
+    }
+    else
+    {
+      delay(50);
+    }
+  }
+
+  if (!sltHeightLoaded)
+  {
+    int val = slt_Values.attributeValue("h");
+    delay(100);
+    if (val != -1)
+    {
+      sltHeight = val;
+      sltHeightLoaded = true;
+      Serial.print("slt height loaded: ");
+      Serial.println(sltHeight);
+    }
+    else
+    {
+      delay(50);
+    }
+  }
+
+  if (!valueStringLoaded || !flatValueLoaded || !profilingNameLoaded || !isProfilingSteppedLoaded || !selectedItemPage2Loaded || !rowPage2Loaded || !columnPage2Loaded || !sltHeightLoaded)
+  {
+    cacheEntriesData();
+  }
+  else
+  {
+    Serial.println("All entries data successfully cached.");
+  }
+}
+
+void cleanCurrentPage()
+{
+  switch (currentPage)
+  {
+  case 0:
+    // The waveform comes back empty after a page change, phase markers included
+    if (shotIsActive)
+      renderChartFromSamples();
+    break;
+  case 1:
+    for (int i = 0; i < NUM_PAGE1_COMPONENTS; i++)
+    {
+      page1_components[i][0]->attribute("font", 6);
+    }
+    break;
+  case 3:
+    if (calibrationStep == 0 && !cleaningCycleActive)
+    {
+      t_systemMessage.text("");
+    }
+    x_referenceWeight.value(1000);
+    if (calibrationStep != 2)
+    {
+      char cmdBuffer[10];
+      sprintf(cmdBuffer, "vis %d,0", referenceWeightID);
+      nextion.command(cmdBuffer);
+      sprintf(cmdBuffer, "vis %d,0", referenceWeightUnitID);
+      nextion.command(cmdBuffer);
+    }
+  default:
+    break;
+  }
+  isItemSelected = false;
+}
+
+void updateChart()
+{
+  char cmdBuffer[32];
+  if (chartHeight <= 0 || chartWidth <= 0)
+  {
+    return;
+  }
+  if (serviceChartRender())
+  {
+    return;
+  }
+  if (shotStartTimeMillis > 0 && (chartStopTime == 0 || hmiMillis() < chartStopTime))
+  {
+    if (!shotIsActive)
+    {
+      shotIsActive = true;
+      plotPointsAdded = 0;
+      shotSampleCount = 0;
+      chartWindowS = CHART_INITIAL_WINDOW_S;
+      chartPressureMax = PRESSURE_AXIS_START;
+      chartFlowMax = FLOW_RATE_AXIS_START;
+      buildReferencePixels();
+      sprintf(cmdBuffer, "cle %d,255", waveformID);
+      nextion.command(cmdBuffer);
+    }
+    unsigned long elapsedShotMillis = hmiMillis() - shotStartTimeMillis;
+    recordShotSample(elapsedShotMillis);
+
+    if (growChartScales(elapsedShotMillis))
+    {
+      renderChartFromSamples();
+      return;
+    }
+
+    int targetPixelCount = mapf(elapsedShotMillis, 0, chartWindowS * 1000.0f, 0, chartWidth);
+    targetPixelCount = constrain(targetPixelCount, 0, chartWidth);
+
+    while (plotPointsAdded < targetPixelCount)
+    {
+      plotChartPixel(plotPointsAdded);
+      plotPointsAdded++;
+    }
+    drawPhaseMarkers();
+  }
+  else
+  {
+    if (shotIsActive)
+    {
+      shotIsActive = false;
+      shotStartTimeMillis = 0;
+    }
+
+    bool isDebugActive = (hmiMillis() - lastDebugDataTime < DEBUG_PLOT_TIMEOUT_MS);
+
+    if (isDebugActive)
+    {
+      static unsigned long lastIdlePlotTime = 0;
+      if (millis() - lastIdlePlotTime > 100)
+      {
+        lastIdlePlotTime = millis();
+
+        uint8_t scaledRawWeight = round(mapf(rawWeight, DEBUG_WEIGHT_MIN, DEBUG_WEIGHT_MAX, 0, (float)chartHeight));
+        sprintf(cmdBuffer, "add %d,0,%d", waveformID, (int)scaledRawWeight);
+        nextion.command(cmdBuffer);
+
+        uint8_t scaledFilteredWeight = round(mapf(filteredWeight, DEBUG_WEIGHT_MIN, DEBUG_WEIGHT_MAX, 0, (float)chartHeight));
+        sprintf(cmdBuffer, "add %d,1,%d", waveformID, (int)scaledFilteredWeight);
+        nextion.command(cmdBuffer);
+
+        uint8_t scaledFilteredFlow = round(mapf(filteredFlow, DEBUG_FLOW_MIN, DEBUG_FLOW_MAX, 0, (float)chartHeight));
+        sprintf(cmdBuffer, "add %d,2,%d", waveformID, (int)scaledFilteredFlow);
+        nextion.command(cmdBuffer);
+      }
+    }
+  }
+}
+
+void recordShotSample(unsigned long elapsedMs)
+{
+  unsigned long wantedSamples = elapsedMs / SHOT_SAMPLE_INTERVAL_MS + 1;
+  while (shotSampleCount < MAX_SHOT_SAMPLES && (unsigned long)shotSampleCount < wantedSamples)
+  {
+    ShotSample &sample = shotSamples[shotSampleCount];
+    sample.pressure = pressure;
+    sample.flowRate = flowRate;
+    sample.weight = weight;
+    sample.target = getChartTarget(shotSampleCount);
+    sample.resistance = puckResistance.value;
+    shotSampleCount++;
+  }
+}
+
+float getChartTarget(int sampleIndex)
+{
+  if (profilingModeId == PROFILING_MODE_FLAT)
+  {
+    return flatValue;
+  }
+  if (profilingModeId == PROFILING_MODE_PROFILE)
+  {
+    return profilingTargetIsTime ? getTimeTargetForSample(sampleIndex) : getCompiledTargetAt(weight);
+  }
+  return NAN;
+}
+
+bool growChartScales(unsigned long elapsedMs)
+{
+  bool rescaled = false;
+  while (elapsedMs > chartWindowS * 1000UL && chartWindowS < MAX_SHOT_TIME_S)
+  {
+    chartWindowS = min(chartWindowS * 2, MAX_SHOT_TIME_S);
+    rescaled = true;
+  }
+  if (shotSampleCount == 0)
+  {
+    return rescaled;
+  }
+
+  const ShotSample &latest = shotSamples[shotSampleCount - 1];
+  bool targetIsPressure = profilingSourceIsPressure;
+  float pressurePeak = latest.pressure;
+  float flowPeak = latest.flowRate;
+  if (!isnan(latest.target) && chartAuxMode == CHART_AUX_TARGET)
+  {
+    if (targetIsPressure)
+      pressurePeak = max(pressurePeak, latest.target);
+    else
+      flowPeak = max(flowPeak, latest.target);
+  }
+  while (pressurePeak > chartPressureMax && chartPressureMax < PRESSURE_AXIS_LIMIT)
+  {
+    chartPressureMax = min(chartPressureMax * CHART_AXIS_GROWTH, PRESSURE_AXIS_LIMIT);
+    rescaled = true;
+  }
+  while (flowPeak > chartFlowMax && chartFlowMax < FLOW_RATE_AXIS_LIMIT)
+  {
+    chartFlowMax = min(chartFlowMax * CHART_AXIS_GROWTH, FLOW_RATE_AXIS_LIMIT);
+    rescaled = true;
+  }
+  if (rescaled)
+  {
+    Serial.printf("Chart rescaled: %ds, %.1f bar, %.1f g/s\n", chartWindowS, chartPressureMax, chartFlowMax);
+  }
+  return rescaled;
+}
+
+int chartPixelToSample(int pixel)
+{
+  int index = (int)((long)pixel * chartWindowS * 1000L / chartWidth / SHOT_SAMPLE_INTERVAL_MS);
+  return constrain(index, 0, shotSampleCount - 1);
+}
+
+uint8_t scaleToChart(float value, float minVal, float maxVal)
+{
+  int scaled = round(mapf(value, minVal, maxVal, 0, (float)chartHeight));
+  return (uint8_t)constrain(scaled, 0, min(chartHeight, 255));
+}
+
+void plotChartPixel(int pixel)
+{
+  if (shotSampleCount == 0)
+  {
+    return;
+  }
+  char cmdBuffer[32];
+  const ShotSample &sample = shotSamples[chartPixelToSample(pixel)];
+
+  sprintf(cmdBuffer, "add %d,0,%d", waveformID, (int)scaleToChart(sample.pressure, PRESSURE_MIN, chartPressureMax));
+  nextion.command(cmdBuffer);
+
+  sprintf(cmdBuffer, "add %d,1,%d", waveformID, (int)scaleToChart(sample.flowRate, FLOW_RATE_MIN, chartFlowMax));
+  nextion.command(cmdBuffer);
+
+  if (chartAuxVisible())
+  {
+    sprintf(cmdBuffer, "add %d,2,%d", waveformID, (int)scaleChartAux(sample));
+    nextion.command(cmdBuffer);
+  }
+
+  if (referenceShot.valid)
+  {
+    sprintf(cmdBuffer, "add %d,%d,%d", waveformID, REFERENCE_CHANNEL, (int)getReferencePixel(pixel, sample.weight));
+    nextion.command(cmdBuffer);
+  }
+}
+
+// Channel 2 shows either the profile target or the puck resistance, unless a reference shot is pinned
+bool chartAuxVisible()
+{
+  if (referenceShot.valid)
+  {
+    return false;
+  }
+  if (chartAuxMode == CHART_AUX_RESISTANCE)
+  {
+    return true;
+  }
+  return shotSampleCount > 0 && !isnan(shotSamples[shotSampleCount - 1].target);
+}
+
+uint8_t scaleChartAux(const ShotSample &sample)
+{
+  if (chartAuxMode == CHART_AUX_RESISTANCE)
+  {
+    return scaleToChart(sample.resistance, 0.0f, RESISTANCE_AXIS_MAX);
+  }
+  float target = isnan(sample.target) ? 0.0f : sample.target;
+  return profilingSourceIsPressure ? scaleToChart(target, PRESSURE_MIN, chartPressureMax)
+                                   : scaleToChart(target, FLOW_RATE_MIN, chartFlowMax);
+}
+
+void renderChartFromSamples()
+{
+  char cmdBuffer[32];
+
+  unsigned long elapsedShotMillis = (unsigned long)shotSampleCount * SHOT_SAMPLE_INTERVAL_MS;
+  int pixelCount = mapf(elapsedShotMillis, 0, chartWindowS * 1000.0f, 0, chartWidth);
+  pixelCount = constrain(pixelCount, 0, min(chartWidth, CHART_MAX_WIDTH));
+
+  sprintf(cmdBuffer, "cle %d,255", waveformID);
+  nextion.command(cmdBuffer);
+  plotPointsAdded = pixelCount;
+  phaseMarkersDrawn = 0;
+
+  chartRender.pending = pixelCount > 0 && shotSampleCount > 0;
+  chartRender.nextChannel = 0;
+  chartRender.pixelCount = pixelCount;
+  chartRender.startUs = micros();
+  chartRender.longestPassUs = 0;
+  if (chartRender.pending && referenceShot.valid)
+  {
+    buildReferencePixels();
+  }
+  serviceChartRender();
+}
+
+// Sends the next channel of a pending re-render; returns false once nothing is left to send
+bool serviceChartRender()
+{
+  static uint8_t channelData[CHART_MAX_WIDTH];
+  if (!chartRender.pending)
+  {
+    return false;
+  }
+
+  unsigned long passStart = micros();
+  uint8_t channel = chartRender.nextChannel++;
+  int pixelCount = chartRender.pixelCount;
+  bool hasData = true;
+  for (int i = 0; i < pixelCount; i++)
+  {
+    const ShotSample &sample = shotSamples[chartPixelToSample(i)];
+    if (channel == 0)
+      channelData[i] = scaleToChart(sample.pressure, PRESSURE_MIN, chartPressureMax);
+    else if (channel == 1)
+      channelData[i] = scaleToChart(sample.flowRate, FLOW_RATE_MIN, chartFlowMax);
+    else if (channel == REFERENCE_CHANNEL && referenceShot.valid)
+      channelData[i] = getReferencePixel(i, sample.weight);
+    else if (chartAuxVisible())
+      channelData[i] = scaleChartAux(sample);
+    else
+      hasData = false;
+  }
+  if (hasData && !sendWaveformBulk(channel, channelData, pixelCount))
+  {
+    Serial.printf("Chart channel %d bulk transfer not acknowledged\n", channel);
+  }
+  chartRender.longestPassUs = max(chartRender.longestPassUs, micros() - passStart);
+
+  if (chartRender.nextChannel >= CHART_RENDER_CHANNELS)
+  {
+    chartRender.pending = false;
+    drawPhaseMarkers();
+    Serial.printf("Chart re-rendered: %d px in %lu us, longest pass %lu us\n",
+                  pixelCount, micros() - chartRender.startUs, chartRender.longestPassUs);
+  }
+  return true;
+}
+
+// Markers are drawn only over columns the waveform has already plotted, otherwise the next add would paint over them
+void drawPhaseMarkers()
+{
+  char cmdBuffer[40];
+  while (phaseMarkersDrawn < phaseDetector.eventCount)
+  {
+    const PhaseEvent &event = phaseDetector.events[phaseMarkersDrawn];
+    int pixel = (int)((long)event.timeMs * chartWidth / (chartWindowS * 1000L));
+    if (pixel >= plotPointsAdded)
+    {
+      return;
+    }
+    sprintf(cmdBuffer, "line %d,%d,%d,%d,%u", chartX + pixel, chartY, chartX + pixel, chartY + chartHeight - 1, PHASE_MARKER_COLOR);
+    nextion.command(cmdBuffer);
+    phaseMarkersDrawn++;
+  }
+}
+
+bool pinReferenceShot(const ShotSample *samples, int sampleCount)
+{
+  if (sampleCount <= 0)
+  {
+    referenceShot.valid = false;
+    return false;
+  }
+
+  int stride = (sampleCount + REFERENCE_MAX_POINTS - 1) / REFERENCE_MAX_POINTS;
+  referenceShot.pointIntervalMs = stride * SHOT_SAMPLE_INTERVAL_MS;
+  referenceShot.numPoints = 0;
+  for (int i = 0; i < sampleCount && referenceShot.numPoints < REFERENCE_MAX_POINTS; i += stride)
+  {
+    float pressureSum = 0.0f;
+    float flowSum = 0.0f;
+    int count = 0;
+    for (int j = i; j < i + stride && j < sampleCount; j++)
+    {
+      pressureSum += samples[j].pressure;
+      flowSum += samples[j].flowRate;
+      count++;
+    }
+    referenceShot.pressure[referenceShot.numPoints] = pressureSum / count;
+    referenceShot.flowRate[referenceShot.numPoints] = flowSum / count;
+    referenceShot.numPoints++;
+  }
+
+  int sampleIndex = 0;
+  float maxWeight = 0.0f;
+  for (int bucket = 0; bucket < REFERENCE_WEIGHT_BUCKETS; bucket++)
+  {
+    float bucketWeight = bucket * REFERENCE_WEIGHT_STEP_G;
+    while (sampleIndex < sampleCount && maxWeight < bucketWeight)
+    {
+      maxWeight = max(maxWeight, samples[sampleIndex].weight);
+      sampleIndex++;
+    }
+    if (maxWeight < bucketWeight)
+    {
+      referenceShot.pressureByWeight[bucket] = 0.0f;
+      referenceShot.flowByWeight[bucket] = 0.0f;
+    }
+    else
+    {
+      int matched = max(sampleIndex - 1, 0);
+      referenceShot.pressureByWeight[bucket] = samples[matched].pressure;
+      referenceShot.flowByWeight[bucket] = samples[matched].flowRate;
+    }
+  }
+
+  referenceShot.valid = true;
+  buildReferencePixels();
+  Serial.printf("Reference shot pinned: %d samples -> %d points (%d ms)\n",
+                sampleCount, referenceShot.numPoints, referenceShot.pointIntervalMs);
+  return true;
+}
+
+void buildReferencePixels()
+{
+  if (!referenceShot.valid || chartWidth <= 0)
+  {
+    return;
+  }
+  float axisMin = referenceShowsFlow ? FLOW_RATE_MIN : PRESSURE_MIN;
+  float axisMax = referenceShowsFlow ? chartFlowMax : chartPressureMax;
+  const float *values = referenceShowsFlow ? referenceShot.flowRate : referenceShot.pressure;
+  int width = min(chartWidth, CHART_MAX_WIDTH);
+  for (int pixel = 0; pixel < width; pixel++)
+  {
+    long pixelMs = (long)pixel * chartWindowS * 1000L / chartWidth;
+    int index = pixelMs / referenceShot.pointIntervalMs;
+    referencePixels[pixel] = (index < referenceShot.numPoints) ? scaleToChart(values[index], axisMin, axisMax) : 0;
+  }
+}
+
+uint8_t getReferencePixel(int pixel, float sampleWeight)
+{
+  if (!referenceAlignByWeight)
+  {
+    return referencePixels[constrain(pixel, 0, CHART_MAX_WIDTH - 1)];
+  }
+  int bucket = (int)(sampleWeight / REFERENCE_WEIGHT_STEP_G);
+  bucket = constrain(bucket, 0, REFERENCE_WEIGHT_BUCKETS - 1);
+  if (referenceShowsFlow)
+  {
+    return scaleToChart(referenceShot.flowByWeight[bucket], FLOW_RATE_MIN, chartFlowMax);
+  }
+  return scaleToChart(referenceShot.pressureByWeight[bucket], PRESSURE_MIN, chartPressureMax);
+}
+
+// addt answers 0xFE once it accepts raw bytes and 0xFD once it has taken all of them
+bool sendWaveformBulk(uint8_t channel, const uint8_t *data, int count)
+{
+  char cmdBuffer[32];
+  sprintf(cmdBuffer, "addt %d,%d,%d", waveformID, channel, count);
+  nextion.command(cmdBuffer);
+  if (!nextionStream.waitReturn(NEXTION_RETURN_ADDT_READY, NEXTION_ADDT_READY_TIMEOUT_MS))
+  {
+    return false;
+  }
+  Serial1.write(data, count);
+  return nextionStream.waitReturn(NEXTION_RETURN_ADDT_DONE, NEXTION_ADDT_DONE_TIMEOUT_MS);
+}
+
+float getTargetAt(float currentX)
+{
+  if (currentProfile == nullptr)
+    return 0.0f;
+  return getProfileTargetAt(currentProfile->steps, currentProfile->numSteps, currentProfile->isStepped, currentX);
+}
+
+void refreshProfilingFlags()
+{
+  if (strcmp(profilingMode, "flat") == 0)
+    profilingModeId = PROFILING_MODE_FLAT;
+  else if (strcmp(profilingMode, "profile") == 0)
+    profilingModeId = PROFILING_MODE_PROFILE;
+  else
+    profilingModeId = PROFILING_MODE_MANUAL;
+  profilingSourceIsPressure = (strcmp(profilingSource, "pressure") == 0);
+  profilingTargetIsTime = (strcmp(profilingTarget, "time") == 0);
+}
+
+void invalidateCompiledProfile()
+{
+  compiledProfileValid = false;
+}
+
+void compileCurrentProfile()
+{
+  if (currentProfile == nullptr)
+    compileProfile(compiledProfile, nullptr, 0, false);
+  else
+    compileProfile(compiledProfile, currentProfile->steps, currentProfile->numSteps, currentProfile->isStepped);
+  fillTimeTargetTable(compiledProfile, timeTargetLut, MAX_SHOT_SAMPLES, SHOT_SAMPLE_INTERVAL_MS);
+  compiledProfileSource = currentProfile;
+  compiledProfileValid = true;
+}
+
+void ensureCompiledProfile()
+{
+  if (!compiledProfileValid || compiledProfileSource != currentProfile)
+  {
+    compileCurrentProfile();
+  }
+}
+
+int findProfileSegment(float currentX)
+{
+  ensureCompiledProfile();
+  return findCompiledSegment(compiledProfile, currentX);
+}
+
+float getCompiledTargetAt(float currentX)
+{
+  ensureCompiledProfile();
+  return getCompiledProfileTargetAt(compiledProfile, currentX);
+}
+
+float getTimeTargetForSample(int sampleIndex)
+{
+  ensureCompiledProfile();
+  return timeTargetLut[constrain(sampleIndex, 0, MAX_SHOT_SAMPLES - 1)];
+}
+
+void checkCompiledProfile()
+{
+  compileCurrentProfile();
+  float endX = 0.0f;
+  if (compiledProfile.numSegments > 0)
+  {
+    endX = compiledProfile.segments[compiledProfile.numSegments - 1].endX;
+  }
+
+  int checked = 0;
+  int mismatches = 0;
+  unsigned long linearUs = 0;
+  unsigned long compiledUs = 0;
+  for (float x = -1.0f; x <= endX + 5.0f; x += 0.05f)
+  {
+    unsigned long t0 = micros();
+    float expected = getTargetAt(x);
+    unsigned long t1 = micros();
+    float actual = getCompiledTargetAt(x);
+    compiledUs += micros() - t1;
+    linearUs += t1 - t0;
+    if (memcmp(&expected, &actual, sizeof(float)) != 0)
+      mismatches++;
+    checked++;
+  }
+  for (int i = 0; i < compiledProfile.numSegments; i++)
+  {
+    float boundaries[2] = {compiledProfile.segments[i].startX, compiledProfile.segments[i].endX};
+    for (float x : boundaries)
+    {
+      float expected = getTargetAt(x);
+      float actual = getCompiledTargetAt(x);
+      if (memcmp(&expected, &actual, sizeof(float)) != 0)
+        mismatches++;
+      checked++;
+    }
+  }
+  for (int i = 0; i < MAX_SHOT_SAMPLES; i++)
+  {
+    float expected = getTargetAt(i * SHOT_SAMPLE_INTERVAL_MS / 1000.0f);
+    float actual = getTimeTargetForSample(i);
+    if (memcmp(&expected, &actual, sizeof(float)) != 0)
+      mismatches++;
+    checked++;
+  }
+
+  Serial.printf("Profile check: %d segments, %d lookups, %d mismatches (linear %lu us, compiled %lu us)\n",
+                compiledProfile.numSegments, checked, mismatches, linearUs, compiledUs);
+}
+
+// --- Input Handling (Encoder & Button) ---
+void knobCallback(long value)
+{
+  const long range = (ROTARY_MAX_BOUND - ROTARY_MIN_BOUND + 1);
+  const long halfRange = range / 2;
+
+  long diff = value - lastEncoderValue;
+  int direction = 0;
+
+  if (diff > halfRange)
+  {
+    direction = -1;
+  }
+  else if (diff < -halfRange)
+  {
+    direction = 1;
+  }
+  else if (diff > 0)
+  {
+    direction = 1;
+  }
+  else if (diff < 0)
+  {
+    direction = -1;
+  }
+
+  if (direction != 0)
+  {
+    portENTER_CRITICAL(&encoderMux);
+    encoderTicks += direction;
+    portEXIT_CRITICAL(&encoderMux);
+  }
+  lastEncoderValue = value;
+}
+
+void handleEncoder()
+{
+  if (currentPage == 2 && selectedItemPage2 > 1024)
+    return;
+  long ticksToProcess = 0;
+  if (encoderTicks != 0)
+  {
+    portENTER_CRITICAL(&encoderMux);
+    ticksToProcess = encoderTicks;
+    encoderTicks = 0;
+    portEXIT_CRITICAL(&encoderMux);
+  }
+
+  if (ticksToProcess == 0)
+  {
+    return;
+  }
+  int selectedIndex = currentSelectionIndex - 1;
+
+  switch (currentPage)
+  {
+  case 1:
+  {
+    int selectedIndexPage1 = 0;
+    NextionComponent *componentFloat = page1_components[selectedIndexPage1][3];
+    NextionComponent *component1 = page1_components[selectedIndexPage1][1];
+    NextionComponent *component2 = page1_components[selectedIndexPage1][2];
+
+    int currentValue = page1_cachedValues[selectedIndexPage1];
+    int minVal = page1_bounds[selectedIndexPage1].min;
+    int maxVal = page1_bounds[selectedIndexPage1].max;
+
+    int step = 1;
+    int totalChange = ticksToProcess * step;
+    int newValue = constrain(currentValue + totalChange, minVal, maxVal);
+    if (newValue != currentValue)
+    {
+      component1->value(newValue);
+      page1_cachedValues[selectedIndexPage1] = newValue;
+      componentFloat->value(newValue);
+      pendingSettingIndex = selectedIndexPage1;
+      lastEncoderActivityTime = millis();
+    }
+
+    break;
+  }
+  case 2:
+  {
+    if ((strcmp(profilingMode, "flat") == 0) && selectedItemPage2 == 0)
+    {
+      flatValue = flatValue + (ticksToProcess * 0.1f);
+      if (flatValue < 0)
+        flatValue = 0;
+      char newValStr[16];
+      dtostrf(flatValue, 4, 1, newValStr);
+      slt_flat.text(newValStr);
+      pendingSettingIndex = SETTING_ID_FLAT_VALUE;
+      lastEncoderActivityTime = millis();
+    }
+    else if (strcmp(profilingMode, "profile") == 0)
+    {
+      if (selectedItemPage2 == 1024)
+      {
+        if (currentProfileDirty)
+        {
+          Serial.printf("Saving changes to profile %d before switching...\n", currentProfileIndex);
+          saveProfile(currentProfileIndex);
+          currentProfileDirty = false;
+        }
+
+        int direction = (ticksToProcess > 0) ? 1 : -1;
+        int attempts = 0;
+        int nextIndex = currentProfileIndex;
+        do
+        {
+          nextIndex += direction;
+          if (nextIndex >= MAX_PROFILES)
+            nextIndex = 0;
+          if (nextIndex < 0)
+            nextIndex = MAX_PROFILES - 1;
+          attempts++;
+        } while (profiles[nextIndex].numSteps == 0 && attempts < MAX_PROFILES);
+
+        if (profiles[nextIndex].numSteps > 0 && nextIndex != currentProfileIndex)
+        {
+          currentProfileIndex = nextIndex;
+
+          profileIndexSettleTime = millis();
+          profileIndexPendingSave = true;
+
+          currentProfile = &profiles[currentProfileIndex];
+          updateFullProfileUI();
+          currentProfileDirty = false;
+        }
+
+        lastEncoderActivityTime = millis();
+        pendingSettingIndex = SETTING_ID_PROFILING_VALUE;
+      }
+      else if (rowPage2 < currentProfile->numSteps && selectedItemPage2 < 1024)
+      {
+        float change = ticksToProcess * 0.1f;
+
+        if (columnPage2 == 0)
+        {
+          currentProfile->steps[rowPage2].target += change;
+        }
+        else if (columnPage2 == 1)
+        {
+          currentProfile->steps[rowPage2].control += change;
+        }
+        markProfileStepDirty(*currentProfile, rowPage2);
+        currentProfileDirty = true;
+        updateProfilingDisplay();
+        lastEncoderActivityTime = millis();
+        pendingSettingIndex = SETTING_ID_PROFILING_VALUE;
+      }
+    }
+    break;
+  }
+  case 3:
+  {
+    x_referenceWeight.attribute("bco", HIGHLIGHT_COLOR);
+    float currentFloatValue = referenceWeight;
+    float step = 0.5f;
+    float totalChange = (float)ticksToProcess * step;
+    float newFloatValue = currentFloatValue + totalChange;
+    newFloatValue = constrain(newFloatValue, 0.0f, 500.0f);
+
+    if (newFloatValue != currentFloatValue)
+    {
+      referenceWeight = newFloatValue;
+      x_referenceWeight.value((int)(newFloatValue * 10.0f));
+
+      lastEncoderActivityTime = millis();
+    }
+    break;
+  }
+  }
+}
+
+// Re-parsing text that matches the profile changes nothing; edited cells only mark their steps dirty, so the
+// delta path stays open unless the name, mode or step count really changed
+void parseProfilingData()
+{
+  static ProfileStep parsedSteps[128];
+  int parsedCount = 0;
+  char tempString[1024];
+  strncpy(tempString, valueString, sizeof(tempString) - 1);
+  tempString[sizeof(tempString) - 1] = '\0';
+
+  const char *delimiters = " \n\r";
+  char *token = strtok(tempString, delimiters);
+  int floatCount = 0;
+
+  while (token != NULL && parsedCount < 128)
+  {
+    float val = atof(token);
+
+    if (floatCount % 2 == 0)
+    {
+      parsedSteps[parsedCount].target = val;
+    }
+    else
+    {
+      parsedSteps[parsedCount].control = val;
+      parsedCount++;
+    }
+
+    floatCount++;
+    token = strtok(NULL, delimiters);
+  }
+
+  if (strncmp(currentProfile->name, profilingName, sizeof(currentProfile->name) - 1) != 0 ||
+      currentProfile->isStepped != isProfilingStepped || currentProfile->numSteps != parsedCount)
+  {
+    currentProfile->fullSyncPending = true;
+  }
+  else
+  {
+    for (int i = 0; i < parsedCount; i++)
+    {
+      if (parsedSteps[i].target != currentProfile->steps[i].target ||
+          parsedSteps[i].control != currentProfile->steps[i].control)
+      {
+        markProfileStepDirty(*currentProfile, i);
+      }
+    }
+  }
+
+  memcpy(currentProfile->steps, parsedSteps, parsedCount * sizeof(ProfileStep));
+  currentProfile->numSteps = parsedCount;
+  strncpy(currentProfile->name, profilingName, sizeof(currentProfile->name) - 1);
+  currentProfile->isStepped = isProfilingStepped;
+  invalidateCompiledProfile();
+
+  Serial.printf("Profile Parsed: '%s' (%s), %d steps loaded.\n",
+                currentProfile->name,
+                currentProfile->isStepped ? "Stepped" : "Ramped",
+                currentProfile->numSteps);
+}
+
+void deleteProfile(int index)
+{
+  profiles[index].name[0] = '\0';
+  profiles[index].numSteps = 0;
+  profiles[index].version++;
+  clearProfileDirty(profiles[index]);
+  invalidateCompiledProfile();
+
+  char jsonBuffer[64];
+  snprintf(jsonBuffer, sizeof(jsonBuffer), "{\"id\":%d,\"v\":%u,\"n\":\"\"}", index, profiles[index].version);
+
+  publishData(mqtt_topic_import_profile, jsonBuffer, true);
+}
+
+void saveProfile(int index)
+{
+  if (index < 0 || index >= MAX_PROFILES)
+    return;
+
+  profiles[index].version++;
+  clearProfileDirty(profiles[index]);
+
+  JsonDocument doc;
+  doc["id"] = index;
+  doc["v"] = profiles[index].version;
+  doc["n"] = profiles[index].name;
+  doc["m"] = profiles[index].isStepped ? 1 : 0;
+
+  JsonArray steps = doc["s"].to<JsonArray>();
+  for (int i = 0; i < profiles[index].numSteps; i++)
+  {
+    JsonArray step = steps.add<JsonArray>();
+    step.add(profiles[index].steps[i].target);
+    step.add(profiles[index].steps[i].control);
+  }
+
+  static char jsonBuffer[PROFILE_JSON_MAX];
+  serializeJson(doc, jsonBuffer, sizeof(jsonBuffer));
+
+  publishData(mqtt_topic_import_profile, jsonBuffer, true);
+}
+
+void markProfileStepDirty(EspressoProfile &profile, int step)
+{
+  if (step >= 0 && step < 128)
+    profile.dirtySteps[step / 32] |= (1UL << (step % 32));
+}
+
+void clearProfileDirty(EspressoProfile &profile)
+{
+  memset(profile.dirtySteps, 0, sizeof(profile.dirtySteps));
+  profile.fullSyncPending = false;
+}
+
+// Sends only the edited cells as "id,baseVersion,step:target:control;...".
+// Returns false when the edit needs a full profile transfer instead.
+bool publishProfileDelta(int index)
+{
+  if (index < 0 || index >= MAX_PROFILES || !(controllerProtocolCaps & PROTOCOL_CAP_PROFILE_DELTA))
+    return false;
+  EspressoProfile &profile = profiles[index];
+  if (profile.fullSyncPending)
+    return false;
+
+  char deltaBuffer[200];
+  int len = snprintf(deltaBuffer, sizeof(deltaBuffer), "%d,%u", index, profile.version);
+  bool any = false;
+  for (int step = 0; step < profile.numSteps; step++)
+  {
+    if (!(profile.dirtySteps[step / 32] & (1UL << (step % 32))))
+      continue;
+    len += snprintf(deltaBuffer + len, sizeof(deltaBuffer) - len, "%c%d:%.6g:%.6g", any ? ';' : ',', step,
+                    profile.steps[step].target, profile.steps[step].control);
+    if (len >= (int)sizeof(deltaBuffer))
+      return false;
+    any = true;
+  }
+  if (!any)
+    return false;
+
+  profile.version++;
+  clearProfileDirty(profile);
+  publishData(mqtt_topic_profile_delta, deltaBuffer, true);
+  return true;
+}
+
+void applyProfileDelta(char *value)
+{
+  char *cursor = value;
+  int id = strtol(cursor, &cursor, 10);
+  if (*cursor != ',' || id < 0 || id >= MAX_PROFILES)
+    return;
+  uint16_t baseVersion = (uint16_t)strtoul(cursor + 1, &cursor, 10);
+  EspressoProfile &profile = profiles[id];
+  if (*cursor != ',' || baseVersion != profile.version)
+  {
+    Serial.printf("Profile %d delta is for v%u but we have v%u, requesting a full copy.\n", id, baseVersion, profile.version);
+    char idBuffer[4];
+    itoa(id, idBuffer, 10);
+    publishData(mqtt_topic_profile_resync, idBuffer, true);
+    return;
+  }
+
+  while (*cursor == ',' || *cursor == ';')
+  {
+    int step = strtol(cursor + 1, &cursor, 10);
+    if (*cursor != ':')
+      break;
+    float target = strtof(cursor + 1, &cursor);
+    if (*cursor != ':')
+      break;
+    float control = strtof(cursor + 1, &cursor);
+    if (step >= 0 && step < profile.numSteps)
+    {
+      profile.steps[step].target = target;
+      profile.steps[step].control = control;
+    }
+  }
+  profile.version = baseVersion + 1;
+
+  if (id == currentProfileIndex)
+  {
+    invalidateCompiledProfile();
+    updateProfilingDisplay();
+  }
+}
+
+void saveCurrentProfileIndex()
+{
+  char buf[10];
+  itoa(currentProfileIndex, buf, 10);
+  publishData(mqtt_topic_active_profile_id, buf, true);
+}
+
+void updateFullProfileUI()
+{
+  updateProfilingDisplay();
+  t_profile.text(currentProfile->name);
+  sel_mode.value(currentProfile->isStepped ? 1 : 0);
+  strncpy(profilingName, currentProfile->name, sizeof(profilingName) - 1);
+  isProfilingStepped = currentProfile->isStepped;
+}
+
+bool isSlotFree(int index)
+{
+  return (profiles[index].numSteps == 0);
+}
+
+void importProfileJson(const char *json)
+{
+  JsonDocument doc;
+  DeserializationError error = deserializeJson(doc, json);
+
+  if (error)
+  {
+    Serial.print("Profile JSON parsing failed: ");
+    Serial.println(error.c_str());
+    return;
+  }
+
+  int id = doc["id"] | -1;
+
+  if (id < 0 || id >= MAX_PROFILES)
+  {
+    Serial.printf("Error: Received invalid profile ID: %d\n", id);
+    return;
+  }
+
+  Serial.printf("Importing data into Profile Slot %d...\n", id);
+
+  strlcpy(profiles[id].name, doc["n"] | "Unnamed", sizeof(profiles[id].name));
+  profiles[id].isStepped = (doc["m"] == 1);
+  profiles[id].version = doc["v"] | 0;
+  clearProfileDirty(profiles[id]);
+
+  profiles[id].numSteps = 0;
+
+  JsonArray steps = doc["s"];
+  for (JsonVariant step : steps)
+  {
+    if (profiles[id].numSteps >= 128)
+      break;
+
+    if (step.is<JsonArray>())
+    {
+      profiles[id].steps[profiles[id].numSteps].target = step[0].as<float>();
+      profiles[id].steps[profiles[id].numSteps].control = step[1].as<float>();
+    }
+    else if (step.is<JsonObject>())
+    {
+      profiles[id].steps[profiles[id].numSteps].target = step["t"] | 0.0f;
+      profiles[id].steps[profiles[id].numSteps].control = step["c"] | 1.0f;
+    }
+    profiles[id].numSteps++;
+  }
+
+  if (id == currentProfileIndex)
+  {
+    Serial.println("Current active profile updated via network. Refreshing UI.");
+    currentProfile = &profiles[id];
+    updateFullProfileUI();
+  }
+}
+
+void updateProfilingDisplay()
+{
+  char outputBuffer[1024] = "";
+  char floatBuffer[20];
+  invalidateCompiledProfile();
+
+  for (int i = 0; i < currentProfile->numSteps; i++)
+  {
+    if (currentProfile->steps[i].target < 0)
+      currentProfile->steps[i].target = 0;
+    if (currentProfile->steps[i].target > 999.9)
+      currentProfile->steps[i].target = 999.9;
+
+    if (currentProfile->steps[i].target < 9.99)
+    {
+      dtostrf(currentProfile->steps[i].target, 7, 1, floatBuffer);
+    }
+    else if (currentProfile->steps[i].target < 99.99)
+    {
+      dtostrf(currentProfile->steps[i].target, 6, 1, floatBuffer);
+    }
+    else
+    {
+      dtostrf(currentProfile->steps[i].target, 5, 1, floatBuffer);
+    }
+    strcat(outputBuffer, floatBuffer);
+    strcat(outputBuffer, "           ");
+
+    if (currentProfile->steps[i].control < 0)
+      currentProfile->steps[i].control = 0;
+    if (currentProfile->steps[i].control > 999.9)
+      currentProfile->steps[i].control = 999.9;
+
+    if (currentProfile->steps[i].control < 9.99)
+    {
+      dtostrf(currentProfile->steps[i].control, 7, 1, floatBuffer);
+    }
+    else if (currentProfile->steps[i].control < 99.99)
+    {
+      dtostrf(currentProfile->steps[i].control, 6, 1, floatBuffer);
+    }
+    else
+    {
+      dtostrf(currentProfile->steps[i].control, 5, 1, floatBuffer);
+    }
+    strcat(outputBuffer, floatBuffer);
+
+    if (i < currentProfile->numSteps - 1)
+    {
+      strcat(outputBuffer, "\r\n");
+    }
+  }
+
+  strncpy(valueString, outputBuffer, sizeof(valueString) - 1);
+  valueString[sizeof(valueString) - 1] = '\0';
+  slt_Values.text(valueString);
+}
+
+void buttonCallback(unsigned long duration)
+{
+  buttonPressed = true;
+}
+
+void handleButton()
+{
+  if (!buttonPressed)
+  {
+    return;
+  }
+  buttonPressed = false;
+  bool pageChanged = lastPageForSelection != currentPage;
+  if (pageChanged)
+  {
+    currentSelectionIndex = 0;
+  }
+  switch (currentPage)
+  {
+  // case 1:
+  //   currentSelectionIndex = 0;
+  //   if (currentSelectionIndex >= NUM_PAGE1_COMPONENTS) {
+  //     currentSelectionIndex = 0;
+  //   }
+
+  //   for (int i = 0; i < NUM_PAGE1_COMPONENTS; i++) {
+  //     if (i == currentSelectionIndex) {
+  //       page1_components[i][0]->attribute("font", 2);
+  //     } else {
+  //       page1_components[i][0]->attribute("font", 6);
+  //     }
+  //   }
+  //   lastPageForSelection = currentPage;
+  //   currentSelectionIndex++;
+  //   isItemSelected = true;
+  //   break;
+  case 2:
+  {
+    if (strcmp(profilingMode, "manual") == 0)
+    {
+      break;
+    }
+    else if (strcmp(profilingMode, "flat") == 0)
+    {
+      var_row.value(0);
+      var_col.value(0);
+      var_sel.value(0);
+      selectedItemPage2 = 0;
+      rowPage2 = 0;
+      columnPage2 = 0;
+      slt_flat.attribute("bco", HIGHLIGHT_COLOR);
+      break;
+    }
+    else if (strcmp(profilingMode, "profile") == 0)
+    {
+      const int val_y = slt_Values.attributeValue("val_y");
+      delay(50);
+      int maxIndex = (currentProfile->numSteps * 2 - 1);
+      if (selectedItemPage2 >= 1024)
+      {
+        var_col.value(0);
+        var_sel.value(0);
+        var_row.value(0);
+        selectedItemPage2 = 0;
+        columnPage2 = 0;
+        rowPage2 = 0;
+        slt_Values.attribute("val_y", 0);
+        t_profile.attribute("bco", 65536);
+        break;
+      }
+      if (selectedItemPage2 >= maxIndex)
+      {
+        selectedItemPage2 = 1024;
+        columnPage2 = 2;
+        rowPage2 = 0;
+        var_col.value(columnPage2);
+        var_row.value(rowPage2);
+        var_sel.value(selectedItemPage2);
+        t_profile.attribute("bco", HIGHLIGHT_COLOR);
+        break;
+      }
+      t_profile.attribute("bco", 65536);
+      selectedItemPage2++;
+      var_sel.value(selectedItemPage2);
+      if (columnPage2 == 0)
+      {
+        columnPage2 = 1;
+        var_col.value(columnPage2);
+      }
+      else if (columnPage2 == 1)
+      {
+        rowPage2++;
+        columnPage2 = 0;
+        var_col.value(columnPage2);
+        var_row.value(rowPage2);
+      }
+      if ((1 + rowPage2) * 20 - val_y >= sltHeight)
+      {
+        slt_Values.attribute("val_y", (1 + rowPage2) * 12);
+      }
+    }
+    break;
+  }
+  case 3:
+  {
+    if (calibrationStep == 2)
+    {
+      isItemSelected = true;
+      x_referenceWeight.attribute("bco", HIGHLIGHT_COLOR);
+      int screenVal = x_referenceWeight.value();
+      if (screenVal != -1)
+      {
+        referenceWeight = (float)screenVal / 10.0f;
+      }
+    }
+    else
+    {
+      isItemSelected = false;
+    }
+  }
+  break;
+  default:
+    isItemSelected = false;
+    break;
+  }
+}
+
+// --- Nextion Event Callbacks ---
+void brewTempSliderRelease()
+{
+  delay(100);
+  int value = slider_brewTemp.value();
+  float valueF = (float)value / 10.;
+  page1_cachedValues[0] = value;
+  char numBuffer[10];
+  dtostrf(valueF, 4, 3, numBuffer);
+
+  char payloadBuffer[32];
+  sprintf(payloadBuffer, "tempsetbrew=%s", numBuffer);
+
+  Serial.print("Publishing payload: ");
+  Serial.println(payloadBuffer);
+  publishData("tempsetbrew", numBuffer, true);
+}
+
+void brewModeButtonRelease()
+{
+  delay(100);
+  int value = btn_brewModeCoffee.value();
+  char payloadBuffer[32];
+
+  if (value == 0)
+  {
+    sprintf(payloadBuffer, "steam");
+  }
+  else
+  {
+    sprintf(payloadBuffer, "coffee");
+  }
+
+  Serial.print("Publishing payload: ");
+  Serial.println(payloadBuffer);
+  publishData("brewmode", payloadBuffer, true);
+}
+
+void steamBoostButtonRelease()
+{
+  delay(100);
+  int value = btn_steamBoost.value();
+  char payloadBuffer[32];
+  if (value == 1)
+  {
+    sprintf(payloadBuffer, "true");
+  }
+  else
+  {
+    sprintf(payloadBuffer, "false");
+  }
+
+  Serial.print("Publishing payload: ");
+  Serial.println(payloadBuffer);
+  publishData("enablesteamboost", payloadBuffer, true);
+}
+
+void profilingModeManualButtonRelease()
+{
+  char payloadBuffer[32];
+  cleanCurrentPage();
+  strlcpy(profilingMode, "manual", sizeof(profilingMode));
+  refreshProfilingFlags();
+  sprintf(payloadBuffer, "manual");
+  Serial.print("Publishing payload: ");
+  Serial.println(payloadBuffer);
+  publishData("profiling_mode", payloadBuffer, true);
+  stopProfilePortal();
+}
+
+void profilingModeFlatButtonRelease()
+{
+  delay(100);
+  const char *pFlatString = slt_flat.text();
+  delay(100);
+  if (strcmp(pFlatString, "Error") != 0)
+  {
+    flatValue = atof(pFlatString);
+  }
+  char payloadBuffer[32];
+  cleanCurrentPage();
+  strlcpy(profilingMode, "flat", sizeof(profilingMode));
+  refreshProfilingFlags();
+  sprintf(payloadBuffer, "flat");
+  Serial.print("Publishing payload: ");
+  Serial.println(payloadBuffer);
+  publishData("profiling_mode", payloadBuffer, true);
+  stopProfilePortal();
+}
+
+void profilingModeProfilingButtonRelease()
+{
+  delay(100);
+  const char *pValueString = slt_Values.text();
+  delay(100);
+  if (strcmp(pValueString, "Error") != 0)
+  {
+    strncpy(valueString, pValueString, sizeof(valueString) - 1);
+    valueString[sizeof(valueString) - 1] = '\0';
+    parseProfilingData();
+  }
+  char payloadBuffer[32];
+  cleanCurrentPage();
+  strlcpy(profilingMode, "profile", sizeof(profilingMode));
+  refreshProfilingFlags();
+  sprintf(payloadBuffer, "profile");
+  Serial.print("Publishing payload: ");
+  Serial.println(payloadBuffer);
+  publishData("profiling_mode", payloadBuffer, true);
+  pendingSettingIndex = SETTING_ID_PROFILING_VALUE;
+  startProfilePortal();
+}
+
+void profilingSourceButtonRelease()
+{
+  delay(100);
+  char payloadBuffer[32];
+
+  if (btn_SourcePressure.value() == 1)
+  {
+    sprintf(payloadBuffer, "pressure");
+    strlcpy(profilingSource, "pressure", sizeof(profilingSource));
+    refreshProfilingFlags();
+  }
+  else
+  {
+    sprintf(payloadBuffer, "flow");
+    strlcpy(profilingSource, "flow", sizeof(profilingSource));
+    refreshProfilingFlags();
+  }
+
+  Serial.print("Publishing payload: ");
+  Serial.println(payloadBuffer);
+  publishData("profiling_source", payloadBuffer, true);
+}
+
+void systemSettingsButtonRelease()
+{
+  Serial.println("System Settings Button Pressed.");
+  if (calibrationStep != 0 || cleaningCycleActive)
+  {
+    return;
+  }
+
+  if (WiFi.status() == WL_CONNECTED)
+  {
+    Serial.println("WiFi Connected. Starting MQTT Config Portal for Main Controller.");
+
+    char msgBuffer[150];
+    IPAddress ip = WiFi.localIP();
+
+    snprintf(msgBuffer, sizeof(msgBuffer),
+             "Espresso Controller MQTT Config:\r\nhttp://%d.%d.%d.%d\nor\r\nhttp://%s.local",
+             ip[0], ip[1], ip[2], ip[3],
+             OTA_HOSTNAME);
+
+    t_systemMessage.text(msgBuffer);
+    startConfigurationPortal();
+  }
+  else
+  {
+    Serial.println("WiFi Not Connected. Cannot start MQTT portal.");
+    t_systemMessage.text("Error:\r\nWiFi not connected");
+    systemMessageClearTime = millis() + 5000;
+  }
+}
+
+void cleaningCycleButtonRelease()
+{
+  Serial.println("Cleaning Cycle button pressed.");
+
+  if (portalRunning || calibrationStep != 0)
+  {
+    return;
+  }
+
+  if (!isPaired)
+  {
+    t_systemMessage.text("Error:\r\nNot connected to\r\nmain controller");
+    systemMessageClearTime = millis() + 5000;
+    return;
+  }
+
+  if (cleaningCycleActive)
+  {
+    return;
+  }
+
+  t_systemMessage.text("Cleaning cycle requested...");
+  cleaningCycleCount = 0;
+  systemMessageClearTime = 0;
+  cleaningRequestTime = millis();
+
+  Serial.println("Sending cleaning=start command");
+  publishData("start_cleaning", "true", true);
+}
+
+void profilingTextRelease()
+{
+  delay(100);
+  const int row_val = var_row.value();
+  delay(100);
+  const int col_val = var_col.value();
+  delay(100);
+  const int sel_val = var_sel.value();
+  delay(100);
+  const char *xValString = slt_Values.attributeText("txt");
+  bool rerun = false;
+  if (row_val == -1)
+    rerun = true;
+  if (col_val == -1)
+    rerun = true;
+  if (sel_val == -1)
+    rerun = true;
+  if (strcmp(xValString, "Error") == 0)
+    rerun = true;
+  if (rerun)
   {
-    int val = var_col.value();
-    delay(100);
-    if (val != -1)
-    {
-      columnPage2 = val;
-      columnPage2Loaded = true;
-    }
-    else
-    {
-      delay(50);
-    }
+    profilingTextRelease();
+    return;
   }
+  strncpy(valueString, xValString, sizeof(valueString) - 1);
+  parseProfilingData();
+  selectedItemPage2 = sel_val;
+  rowPage2 = row_val;
+  columnPage2 = col_val;
+}
 
-  if (!sltHeightLoaded)
+void profilingFlatRelease()
+{
+  delay(50);
+  const char *xValString = slt_flat.attributeText("txt");
+  delay(100);
+  var_row.value(0);
+  var_col.value(0);
+  var_sel.value(0);
+  selectedItemPage2 = 0;
+  rowPage2 = 0;
+  columnPage2 = 0;
+  flatValue = atof(xValString);
+}
+
+void profileNameRelease()
+{
+  delay(100);
+  var_col.value(2);
+  var_sel.value(1024);
+  selectedItemPage2 = 1024;
+  columnPage2 = 2;
+  strncpy(currentProfile->name, profilingName, sizeof(currentProfile->name) - 1);
+  const char *pProfilingName = t_profile.text();
+  if (strcmp(pProfilingName, "Error") != 0)
   {
-    int val = slt_Values.attributeValue("h");
-    delay(100);
-    if (val != -1)
-    {
-      sltHeight = val;
-      sltHeightLoaded = true;
-      Serial.print("slt height loaded: ");
-      Serial.println(sltHeight);
-    }
-    else
-    {
-      delay(50);
-    }
+    strncpy(profilingName, pProfilingName, sizeof(profilingName) - 1);
+    profilingName[sizeof(profilingName) - 1] = '\0';
+    strncpy(currentProfile->name, profilingName, sizeof(currentProfile->name) - 1);
+    currentProfile->fullSyncPending = true;
+    currentProfileDirty = true;
   }
+}
 
-  if (!valueStringLoaded || !flatValueLoaded || !profilingNameLoaded || !isProfilingSteppedLoaded || !selectedItemPage2Loaded || !rowPage2Loaded || !columnPage2Loaded || !sltHeightLoaded)
+void profileSteppedRelease()
+{
+  delay(100);
+  int val = sel_mode.value();
+  bool oldProfilingIsStepped = isProfilingStepped;
+  if (val != -1)
   {
-    cacheEntriesData();
+    isProfilingStepped = (val == 1);
   }
-  else
+  currentProfile->isStepped = isProfilingStepped;
+  invalidateCompiledProfile();
+  if (oldProfilingIsStepped != isProfilingStepped)
   {
-    Serial.println("All entries data successfully cached.");
+    currentProfile->fullSyncPending = true;
+    currentProfileDirty = true;
+    pendingSettingIndex = SETTING_ID_PROFILING_VALUE;
+    publishSetting();
   }
 }
 
-void cleanCurrentPage()
+void buttonTareRelease()
 {
-  switch (currentPage)
-  {
-  case 1:
-    for (int i = 0; i < NUM_PAGE1_COMPONENTS; i++)
-    {
-      page1_components[i][0]->attribute("font", 6);
-    }
-    break;
-  case 3:
-    if (calibrationStep == 0 && !cleaningCycleActive)
-    {
-      t_systemMessage.text("");
-    }
-    x_referenceWeight.value(1000);
-    if (calibrationStep != 2)
-    {
-      char cmdBuffer[10];
-      sprintf(cmdBuffer, "vis %d,0", referenceWeightID);
-      nextion.command(cmdBuffer);
-      sprintf(cmdBuffer, "vis %d,0", referenceWeightUnitID);
-      nextion.command(cmdBuffer);
-    }
-  default:
-    break;
-  }
-  isItemSelected = false;
+  delay(100);
+  publishData("tare_scale", "true", true);
 }
 
-void updateChart()
+void calibrateScaleButtonRelease()
 {
-  char cmdBuffer[32];
-  if (chartHeight <= 0 || chartWidth <= 0)
+  Serial.println("Calibrate Scale button pressed.");
+  if (portalRunning || cleaningCycleActive)
   {
     return;
   }
-  if (shotStartTimeMillis > 0 && (chartStopTime == 0 || millis() < chartStopTime))
+  if (!isPaired)
   {
-    if (!shotIsActive)
-    {
-      shotIsActive = true;
-      plotPointsAdded = 0;
-      sprintf(cmdBuffer, "cle %d,255", waveformID);
-      nextion.command(cmdBuffer);
-    }
-    unsigned long elapsedShotMillis = millis() - shotStartTimeMillis;
-    int targetPixelCount = mapf(elapsedShotMillis, 0, MAX_SHOT_TIME_S * 1000, 0, chartWidth);
-
-    while (plotPointsAdded < targetPixelCount)
-    {
-      uint8_t scaledPressure = round(mapf(pressure, PRESSURE_MIN, PRESSURE_MAX, 0, (float)chartHeight));
-      sprintf(cmdBuffer, "add %d,0,%d", waveformID, (int)scaledPressure);
-      nextion.command(cmdBuffer);
+    t_systemMessage.text("Error:\r\nNot connected to\r\nmain controller");
+    systemMessageClearTime = millis() + 5000;
+    return;
+  }
 
-      uint8_t scaledFlowRate = round(mapf(flowRate, FLOW_RATE_MIN, FLOW_RATE_MAX, 0, (float)chartHeight));
-      sprintf(cmdBuffer, "add %d,1,%d", waveformID, (int)scaledFlowRate);
-      nextion.command(cmdBuffer);
+  systemMessageClearTime = 0;
+  char cmdBuffer[10];
 
-      bool drawChannel2 = false;
-      int scaledTarget = 0;
-      float targetY = 0.0f;
-      if (strcmp(profilingMode, "flat") == 0)
-      {
-        if (strcmp(profilingSource, "pressure") == 0)
-        {
-          scaledTarget = round(mapf(flatValue, PRESSURE_MIN, PRESSURE_MAX, 0, (float)chartHeight));
-        }
-        else
-        {
-          scaledTarget = round(mapf(flatValue, FLOW_RATE_MIN, FLOW_RATE_MAX, 0, (float)chartHeight));
-        }
-        scaledTarget = constrain(scaledTarget, 0, 255);
-        drawChannel2 = true;
-      }
-      else if (strcmp(profilingMode, "profile") == 0)
-      {
-        float currentX = 0.0f;
-        if (strcmp(profilingTarget, "time") == 0)
-        {
-          float pixelTime = mapf(plotPointsAdded, 0, chartWidth, 0, MAX_SHOT_TIME_S);
-          currentX = pixelTime;
-        }
-        else
-        {
-          currentX = weight;
-        }
+  if (calibrationStep == 0)
+  {
+    Serial.println("Sending calibratescale command");
+    publishData("calibratescale", "", true);
 
-        targetY = getTargetAt(currentX);
-        if (strcmp(profilingSource, "pressure") == 0)
-        {
-          scaledTarget = round(mapf(targetY, PRESSURE_MIN, PRESSURE_MAX, 0, (float)chartHeight));
-        }
-        else
-        {
-          scaledTarget = round(mapf(targetY, FLOW_RATE_MIN, FLOW_RATE_MAX, 0, (float)chartHeight));
-        }
-        drawChannel2 = true;
-      }
-      if (drawChannel2)
-      {
-        sprintf(cmdBuffer, "add %d,2,%d", waveformID, scaledTarget);
-        nextion.command(cmdBuffer);
-      }
+    t_systemMessage.text("Calibration requested...");
+    calibrationRequestTime = millis();
 
-      plotPointsAdded++;
-    }
+    sprintf(cmdBuffer, "vis %d,0", referenceWeightID);
+    nextion.command(cmdBuffer);
+    sprintf(cmdBuffer, "vis %d,0", referenceWeightUnitID);
+    nextion.command(cmdBuffer);
   }
-  else
+  else if (calibrationStep == 1)
   {
-    if (shotIsActive)
+    Serial.println("Sending calibration_step=0.0 (for tare).");
+    publishData("calibration_step", "0.0", true);
+    t_systemMessage.text("Taring scale...\r\nPlease wait...");
+    calibrationStep = 10;
+  }
+  else if (calibrationStep == 2)
+  {
+    float realWeight = referenceWeight;
+    if (realWeight <= 0)
     {
-      shotIsActive = false;
-      shotStartTimeMillis = 0;
+      t_systemMessage.text("Error: Set reference weight\r\nusing encoder first (e.g., 100)");
+      systemMessageClearTime = millis() + 5000;
+      return;
     }
 
-    bool isDebugActive = (millis() - lastDebugDataTime < DEBUG_PLOT_TIMEOUT_MS);
+    char weightBuffer[10];
+    snprintf(weightBuffer, sizeof(weightBuffer), "%.1f", realWeight);
 
-    if (isDebugActive)
-    {
-      static unsigned long lastIdlePlotTime = 0;
-      if (millis() - lastIdlePlotTime > 100)
-      {
-        lastIdlePlotTime = millis();
+    sprintf(cmdBuffer, "vis %d,0", referenceWeightID);
+    nextion.command(cmdBuffer);
+    sprintf(cmdBuffer, "vis %d,0", referenceWeightUnitID);
+    nextion.command(cmdBuffer);
 
-        uint8_t scaledRawWeight = round(mapf(rawWeight, DEBUG_WEIGHT_MIN, DEBUG_WEIGHT_MAX, 0, (float)chartHeight));
-        sprintf(cmdBuffer, "add %d,0,%d", waveformID, (int)scaledRawWeight);
-        nextion.command(cmdBuffer);
+    Serial.printf("Sending calibration_step=%s (for weight)\n", weightBuffer);
+    publishData("calibration_step", weightBuffer, true);
 
-        uint8_t scaledFilteredWeight = round(mapf(filteredWeight, DEBUG_WEIGHT_MIN, DEBUG_WEIGHT_MAX, 0, (float)chartHeight));
-        sprintf(cmdBuffer, "add %d,1,%d", waveformID, (int)scaledFilteredWeight);
-        nextion.command(cmdBuffer);
+    t_systemMessage.text("Weighing... Finishing calibration");
+    calibrationStep = 20;
+  }
+}
 
-        uint8_t scaledFilteredFlow = round(mapf(filteredFlow, DEBUG_FLOW_MIN, DEBUG_FLOW_MAX, 0, (float)chartHeight));
-        sprintf(cmdBuffer, "add %d,2,%d", waveformID, (int)scaledFilteredFlow);
-        nextion.command(cmdBuffer);
-      }
-    }
+void profilingTargetButtonRelease()
+{
+  delay(100);
+  char payloadBuffer[32];
+
+  if (btn_TargetTime.value() == 1)
+  {
+    sprintf(payloadBuffer, "time");
+    strlcpy(profilingTarget, "time", sizeof(profilingTarget));
+    refreshProfilingFlags();
   }
+  else
+  {
+    sprintf(payloadBuffer, "weight");
+    strlcpy(profilingTarget, "weight", sizeof(profilingTarget));
+    refreshProfilingFlags();
+  }
+
+  Serial.print("Publishing payload: ");
+  Serial.println(payloadBuffer);
+  publishData("profiling_target", payloadBuffer, true);
 }
 
-float getTargetAt(float currentX)
+void profilingEntryFieldReleased(uint8_t id)
 {
-  if (currentProfile == nullptr || currentProfile->numSteps == 0)
-    return 0.0f;
+  isItemSelected = true;
+  currentSelectionIndex = id + 1;
+  lastPageForSelection = currentPage;
+}
 
-  float stepStartX = 0.0f;
-  float prevTargetY = 0.0f;
+// --- Machine Logic & Simulation ---
+void simulateShot()
+{
+  static SimulatedShot simulation = {};
+  unsigned long currentTime = millis();
 
-  for (int i = 0; i < currentProfile->numSteps; i++)
+  // Start Logic
+  if (!simulation.active && (pumpIsOn || shotTimeMs > 0))
   {
-    float duration = currentProfile->steps[i].control;
-    float targetY = currentProfile->steps[i].target;
+    startSimulatedShot(simulation, currentTime, simulationSeed);
+    weight = 0.0f;
+    flowRate = 0.0f;
+    pressure = 0.0f;
 
-    if (duration <= 0.001f)
-    {
-      prevTargetY = targetY;
-      continue;
-    }
+    strlcpy(machineState, "BREWING", sizeof(machineState));
+    strlcpy(profilingMode, "profile", sizeof(profilingMode));
+    refreshProfilingFlags();
+  }
+
+  if (simulation.active)
+  {
+    bool wasPumping = simulation.pumpOn;
+    stepSimulatedShot(simulation, currentTime);
+    // Pump Cutoff: release the virtual pump once, then leave it to the lever
+    if (simulation.pumpOn)
+      pumpIsOn = true;
+    else if (wasPumping)
+      pumpIsOn = false;
+    pressure = simulation.pressure;
+    flowRate = simulation.flowRate;
+    weight = simulation.weight;
+  }
+}
 
-    float stepEndX = stepStartX + duration;
+unsigned long getShotTimeMs(bool pumpStatus)
+{
+  static unsigned long pumpStartTime = 0;
+  static unsigned long completedShotTime = 0;
+  static unsigned long leverLoweredTime = 0;
 
-    if (currentX <= stepEndX)
+  unsigned long currentTime = hmiMillis();
+  if (pumpStatus && brewLeverLifted)
+  {
+    leverLoweredTime = 0;
+    chartStopTime = 0;
+    if (pumpStartTime == 0)
     {
-      if (currentProfile->isStepped)
+      pumpStartTime = currentTime;
+      // Prefer the controller's own pump-on timestamp over the moment we noticed it
+      if (controllerPumpStartValid && currentTime - controllerPumpStartMs < PUMP_START_MAX_AGE_MS)
       {
-        return targetY;
+        pumpStartTime = controllerPumpStartMs;
       }
-      else
+      controllerPumpStartValid = false;
+      shotStartTimeMillis = pumpStartTime;
+      completedShotTime = 0;
+    }
+    return currentTime - pumpStartTime;
+  }
+  else
+  {
+    if (pumpStartTime != 0)
+    {
+      unsigned long duration = currentTime - pumpStartTime;
+      completedShotTime = (duration > SHOT_START_THRESHOLD_S * 1000UL) ? duration : 0;
+      pumpStartTime = 0;
+      if (completedShotTime > 0)
       {
-        return (currentX - stepStartX) * (targetY - prevTargetY) / duration + prevTargetY;
+        leverLoweredTime = currentTime;
+        chartStopTime = hmiMillis() + CHART_RETENTION_TIME_MS;
       }
     }
-
-    stepStartX = stepEndX;
-    prevTargetY = targetY;
+    if (leverLoweredTime != 0 && (currentTime - leverLoweredTime > SHOT_RETENTION_TIME_MS))
+    {
+      completedShotTime = 0;
+      leverLoweredTime = 0;
+    }
+    return completedShotTime;
   }
-
-  return prevTargetY;
 }
 
-// --- Input Handling (Encoder & Button) ---
-void knobCallback(long value)
+// The minimum of (local - remote) over a window approximates the offset plus the fastest frame latency
+void applyControllerPumpStart(uint32_t controllerStartMs)
 {
-  const long range = (ROTARY_MAX_BOUND - ROTARY_MIN_BOUND + 1);
-  const long halfRange = range / 2;
-
-  long diff = value - lastEncoderValue;
-  int direction = 0;
-
-  if (diff > halfRange)
-  {
-    direction = -1;
-  }
-  else if (diff < -halfRange)
+  if (controllerClockSynced)
   {
-    direction = 1;
+    unsigned long localStart = controllerStartMs + controllerClockOffsetMs;
+    // Never let a clock estimate place the start in the future
+    controllerPumpStartMs = ((long)(hmiMillis() - localStart) >= 0) ? localStart : hmiMillis();
+    controllerPumpStartValid = true;
   }
-  else if (diff > 0)
+}
+
+void updateControllerClock(uint32_t controllerMs)
+{
+  static int32_t windowMinOffset = 0;
+  static int windowFrames = 0;
+
+  int32_t offset = (int32_t)(currentFrameRxMs - controllerMs);
+  if (!controllerClockSynced || offset < controllerClockOffsetMs)
   {
-    direction = 1;
+    // A fresh sync (new pairing or a replay) also starts a fresh window
+    if (!controllerClockSynced)
+      windowFrames = 0;
+    controllerClockOffsetMs = offset;
+    controllerClockSynced = true;
   }
-  else if (diff < 0)
+  if (windowFrames == 0 || offset < windowMinOffset)
   {
-    direction = -1;
+    windowMinOffset = offset;
   }
-
-  if (direction != 0)
+  if (++windowFrames >= CLOCK_OFFSET_WINDOW_FRAMES)
   {
-    portENTER_CRITICAL(&encoderMux);
-    encoderTicks += direction;
-    portEXIT_CRITICAL(&encoderMux);
+    controllerClockOffsetMs = windowMinOffset;
+    windowFrames = 0;
   }
-  lastEncoderValue = value;
 }
 
-void handleEncoder()
+// --- Telemetry Subscription ---
+// Shots get full rates on every page: history and analytics record them even off the chart page
+void buildSubscription(char *buffer, size_t size)
 {
-  if (currentPage == 2 && selectedItemPage2 > 1024)
-    return;
-  long ticksToProcess = 0;
-  if (encoderTicks != 0)
+  TelemetrySubscription subscription = SUBSCRIPTION_SETTINGS;
+  if (shotIsActive || pumpIsOn)
   {
-    portENTER_CRITICAL(&encoderMux);
-    ticksToProcess = encoderTicks;
-    encoderTicks = 0;
-    portEXIT_CRITICAL(&encoderMux);
+    subscription = SUBSCRIPTION_SHOT;
   }
-
-  if (ticksToProcess == 0)
+  else if (currentPage == 0)
   {
-    return;
+    subscription = SUBSCRIPTION_MAIN_IDLE;
   }
-  int selectedIndex = currentSelectionIndex - 1;
-
-  switch (currentPage)
+  else if (currentPage == 3 && calibrationStep != 0)
   {
-  case 1:
+    subscription.weightHz = SUBSCRIPTION_CALIBRATION_WEIGHT_HZ;
+  }
+  int len = snprintf(buffer, size, "temps:%u,pressure:%u,flow:%u,weight:%u", subscription.tempsHz, subscription.pressureHz,
+                     subscription.flowHz, subscription.weightHz);
+  if (debugPlotMode != DEBUG_PLOT_AUTO && len > 0 && (size_t)len < size)
   {
-    int selectedIndexPage1 = 0;
-    NextionComponent *componentFloat = page1_components[selectedIndexPage1][3];
-    NextionComponent *component1 = page1_components[selectedIndexPage1][1];
-    NextionComponent *component2 = page1_components[selectedIndexPage1][2];
+    uint8_t debugHz = (debugPlotMode == DEBUG_PLOT_ON && currentPage == 0) ? SUBSCRIPTION_DEBUG_HZ : 0;
+    snprintf(buffer + len, size - len, ",debug:%u", debugHz);
+  }
+}
 
-    int currentValue = page1_cachedValues[selectedIndexPage1];
-    int minVal = page1_bounds[selectedIndexPage1].min;
-    int maxVal = page1_bounds[selectedIndexPage1].max;
+// Renegotiates whenever the wanted set changes (page change, shot start or end)
+void serviceSubscription()
+{
+  static unsigned long lastSentMs = 0;
+  if (!isPaired || !(controllerProtocolCaps & PROTOCOL_CAP_SUBSCRIBE) || millis() - lastSentMs < SUBSCRIPTION_MIN_INTERVAL_MS)
+    return;
 
-    int step = 1;
-    int totalChange = ticksToProcess * step;
-    int newValue = constrain(currentValue + totalChange, minVal, maxVal);
-    if (newValue != currentValue)
-    {
-      component1->value(newValue);
-      page1_cachedValues[selectedIndexPage1] = newValue;
-      componentFloat->value(newValue);
-      pendingSettingIndex = selectedIndexPage1;
-      lastEncoderActivityTime = millis();
-    }
+  char subscription[sizeof(lastSubscription)];
+  buildSubscription(subscription, sizeof(subscription));
+  if (strcmp(subscription, lastSubscription) == 0)
+    return;
 
-    break;
-  }
-  case 2:
+  strlcpy(lastSubscription, subscription, sizeof(lastSubscription));
+  lastSentMs = millis();
+  publishData(mqtt_topic_subscribe, subscription, true);
+  // The frame interval is about to change; relearn it instead of declaring a loss
+  frameIntervalSamples = 0;
+}
+
+// --- Link Health ---
+// Called for every data frame from the controller, in loop() context
+void noteControllerFrame()
+{
+  if (lastFrameRxMs != 0)
   {
-    if ((strcmp(profilingMode, "flat") == 0) && selectedItemPage2 == 0)
+    unsigned long interval = currentFrameRxMs - lastFrameRxMs;
+    if (interval <= LINK_INTERVAL_MAX_SAMPLE_MS)
     {
-      flatValue = flatValue + (ticksToProcess * 0.1f);
-      if (flatValue < 0)
-        flatValue = 0;
-      char newValStr[16];
-      dtostrf(flatValue, 4, 1, newValStr);
-      slt_flat.text(newValStr);
-      pendingSettingIndex = SETTING_ID_FLAT_VALUE;
-      lastEncoderActivityTime = millis();
+      frameIntervalEwmaMs = (frameIntervalSamples == 0) ? interval : frameIntervalEwmaMs + (interval - frameIntervalEwmaMs) / 8.0f;
+      if (frameIntervalSamples < LINK_INTERVAL_MIN_SAMPLES)
+        frameIntervalSamples++;
     }
-    else if (strcmp(profilingMode, "profile") == 0)
-    {
-      if (selectedItemPage2 == 1024)
-      {
-        if (currentProfileDirty)
-        {
-          Serial.printf("Saving changes to profile %d before switching...\n", currentProfileIndex);
-          saveProfile(currentProfileIndex);
-          currentProfileDirty = false;
-        }
-
-        int direction = (ticksToProcess > 0) ? 1 : -1;
-        int attempts = 0;
-        int nextIndex = currentProfileIndex;
-        do
-        {
-          nextIndex += direction;
-          if (nextIndex >= MAX_PROFILES)
-            nextIndex = 0;
-          if (nextIndex < 0)
-            nextIndex = MAX_PROFILES - 1;
-          attempts++;
-        } while (profiles[nextIndex].numSteps == 0 && attempts < MAX_PROFILES);
-
-        if (profiles[nextIndex].numSteps > 0 && nextIndex != currentProfileIndex)
-        {
-          currentProfileIndex = nextIndex;
+  }
+  lastFrameRxMs = currentFrameRxMs;
 
-          profileIndexSettleTime = millis();
-          profileIndexPendingSave = true;
+  if (linkLost)
+  {
+    linkLost = false;
+    applyStaleStyle(false);
+    Serial.printf("Controller link restored after %lu ms.\n", currentFrameRxMs - linkLostAtMs);
+  }
+}
 
-          currentProfile = &profiles[currentProfileIndex];
-          updateFullProfileUI();
-          currentProfileDirty = false;
-        }
+unsigned long linkLossThresholdMs()
+{
+  if (frameIntervalSamples < LINK_INTERVAL_MIN_SAMPLES)
+    return LINK_LOSS_DEFAULT_MS;
+  unsigned long threshold = (unsigned long)(frameIntervalEwmaMs * LINK_LOSS_INTERVALS);
+  return constrain(threshold, LINK_LOSS_MIN_MS, (unsigned long)CONTROLLER_TIMEOUT_MS);
+}
 
-        lastEncoderActivityTime = millis();
-        pendingSettingIndex = SETTING_ID_PROFILING_VALUE;
-      }
-      else if (rowPage2 < currentProfile->numSteps && selectedItemPage2 < 1024)
-      {
-        float change = ticksToProcess * 0.1f;
+// Marks the display stale after a few missed frame intervals and probes in the background;
+// resetPairing() stays the last resort at CONTROLLER_TIMEOUT_MS
+void checkLinkHealth()
+{
+  static int styledPage = -1;
+  if (!isPaired || SIMULATION_MODE)
+    return;
 
-        if (columnPage2 == 0)
-        {
-          currentProfile->steps[rowPage2].target += change;
-        }
-        else if (columnPage2 == 1)
-        {
-          currentProfile->steps[rowPage2].control += change;
-        }
-        currentProfileDirty = true;
-        updateProfilingDisplay();
-        lastEncoderActivityTime = millis();
-        pendingSettingIndex = SETTING_ID_PROFILING_VALUE;
-      }
-    }
-    break;
-  }
-  case 3:
+  unsigned long silentMs = hmiMillis() - lastControllerMessageTime;
+  if (!linkLost && lastControllerMessageTime != 0 && silentMs > linkLossThresholdMs())
   {
-    x_referenceWeight.attribute("bco", HIGHLIGHT_COLOR);
-    float currentFloatValue = referenceWeight;
-    float step = 0.5f;
-    float totalChange = (float)ticksToProcess * step;
-    float newFloatValue = currentFloatValue + totalChange;
-    newFloatValue = constrain(newFloatValue, 0.0f, 500.0f);
-
-    if (newFloatValue != currentFloatValue)
-    {
-      referenceWeight = newFloatValue;
-      x_referenceWeight.value((int)(newFloatValue * 10.0f));
+    linkLost = true;
+    linkLostAtMs = lastControllerMessageTime;
+    lastLinkProbeMs = 0;
+    Serial.printf("Controller link lost: silent for %lu ms (usual interval %.0f ms).\n", silentMs, frameIntervalEwmaMs);
+    applyStaleStyle(true);
+    styledPage = currentPage;
+  }
+  if (!linkLost)
+    return;
 
-      lastEncoderActivityTime = millis();
-    }
-    break;
+  // Nextion restores a page's attributes when it is reloaded, so restyle after page changes
+  if (styledPage != currentPage)
+  {
+    applyStaleStyle(true);
+    styledPage = currentPage;
   }
+  if (!channelScanActive && peerProbeState == PEER_PROBE_IDLE && !txInFlight && millis() - lastLinkProbeMs >= LINK_LOST_PROBE_INTERVAL_MS)
+  {
+    lastLinkProbeMs = millis();
+    peerProbeAttempts = PEER_PROBE_MAX_ATTEMPTS;
+    peerProbeResultPending = false;
+    peerProbeState = PEER_PROBE_SENT;
+    peerProbeSentMs = millis();
+    sendPairingRequest(mainControllerMac);
   }
 }
 
-void parseProfilingData()
+void applyStaleStyle(bool stale)
 {
-  currentProfile->numSteps = 0;
-  char tempString[1024];
-  strncpy(tempString, valueString, sizeof(tempString) - 1);
-  tempString[sizeof(tempString) - 1] = '\0';
-
-  const char *delimiters = " \n\r";
-  char *token = strtok(tempString, delimiters);
-  int floatCount = 0;
-
-  while (token != NULL && currentProfile->numSteps < 128)
+  struct StaleField
   {
-    float val = atof(token);
+    NextionComponent *component;
+    uint8_t page;
+    int32_t normalColor; // read from the display the first time it is greyed
+  };
+  static StaleField fields[] = {
+      {&t_hxTemp, 0, -1}, {&t_boilerTemp, 0, -1}, {&t_weight, 0, -1}, {&t_hxTemp2, 1, -1}, {&t_boilerTemp2, 1, -1},
+      {&t_hxTemp3, 2, -1}, {&t_boilerTemp3, 2, -1}, {&t_hxTemp4, 3, -1}, {&t_boilerTemp4, 3, -1}};
 
-    if (floatCount % 2 == 0)
+  for (StaleField &field : fields)
+  {
+    if (field.page != currentPage)
+      continue;
+    if (stale)
     {
-      currentProfile->steps[currentProfile->numSteps].target = val;
+      if (field.normalColor < 0)
+        field.normalColor = field.component->attributeValue("pco");
+      field.component->attribute("pco", STALE_TEXT_COLOR);
     }
-    else
+    else if (field.normalColor >= 0)
     {
-      currentProfile->steps[currentProfile->numSteps].control = val;
-      currentProfile->numSteps++;
+      field.component->attribute("pco", (int)field.normalColor);
     }
-
-    floatCount++;
-    token = strtok(NULL, delimiters);
   }
-
-  strncpy(currentProfile->name, profilingName, sizeof(currentProfile->name) - 1);
-  currentProfile->isStepped = isProfilingStepped;
-
-  Serial.printf("Profile Parsed: '%s' (%s), %d steps loaded.\n",
-                currentProfile->name,
-                currentProfile->isStepped ? "Stepped" : "Ramped",
-                currentProfile->numSteps);
-}
-
-void deleteProfile(int index)
-{
-  profiles[index].name[0] = '\0';
-  profiles[index].numSteps = 0;
-
-  char jsonBuffer[64];
-  snprintf(jsonBuffer, sizeof(jsonBuffer), "{\"id\":%d,\"n\":\"\"}", index);
-
-  publishData(mqtt_topic_import_profile, jsonBuffer, true);
 }
 
-void saveProfile(int index)
+// --- Channel Recovery ---
+void checkChannel()
 {
-  if (index < 0 || index >= MAX_PROFILES)
+  if (!isPaired || channelScanActive || OFFLINE_MODE || SIMULATION_MODE || radioTransport != TRANSPORT_ESPNOW)
     return;
 
-  JsonDocument doc;
-  doc["id"] = index;
-  doc["n"] = profiles[index].name;
-  doc["m"] = profiles[index].isStepped ? 1 : 0;
-
-  JsonArray steps = doc["s"].to<JsonArray>();
-  for (int i = 0; i < profiles[index].numSteps; i++)
+  // Only an unassociated radio can have lost the controller's channel without the AP moving
+  if (consecutiveTxFailures >= CHANNEL_RECOVERY_TX_FAILURES && WiFi.status() != WL_CONNECTED)
   {
-    JsonArray step = steps.add<JsonArray>();
-    step.add(profiles[index].steps[i].target);
-    step.add(profiles[index].steps[i].control);
+    startChannelRecovery("sustained send failures", myChannel);
+    return;
+  }
+  if (millis() - lastChannelCheckMs < CHANNEL_CHECK_INTERVAL_MS)
+    return;
+  lastChannelCheckMs = millis();
+  if (WiFi.status() == WL_CONNECTED)
+  {
+    int apChannel = WiFi.channel();
+    if (apChannel > 0 && apChannel != myChannel)
+    {
+      Serial.printf("Access point moved from channel %d to %d.\n", myChannel, apChannel);
+      myChannel = apChannel;
+      startChannelRecovery("access point changed channel", apChannel);
+    }
   }
-
-  char jsonBuffer[1024];
-  serializeJson(doc, jsonBuffer, sizeof(jsonBuffer));
-
-  publishData(mqtt_topic_import_profile, jsonBuffer, true);
 }
 
-void saveCurrentProfileIndex()
+void addScanCandidate(uint8_t &count, uint8_t channel)
 {
-  char buf[10];
-  itoa(currentProfileIndex, buf, 10);
-  publishData(mqtt_topic_active_profile_id, buf, true);
+  if (channel < 1 || channel > WIFI_CHANNEL_COUNT)
+    return;
+  for (uint8_t i = 0; i < count; i++)
+  {
+    if (channelScanOrder[i] == channel)
+      return;
+  }
+  channelScanOrder[count++] = channel;
 }
 
-void updateFullProfileUI()
+// Probes the controller's MAC channel by channel, most likely channels first.
+// While associated the radio cannot leave the AP channel, so only that one is tried.
+void startChannelRecovery(const char *reason, uint8_t firstChannel)
 {
-  updateProfilingDisplay();
-  t_profile.text(currentProfile->name);
-  sel_mode.value(currentProfile->isStepped ? 1 : 0);
-  strncpy(profilingName, currentProfile->name, sizeof(profilingName) - 1);
-  isProfilingStepped = currentProfile->isStepped;
+  Serial.printf("Channel recovery started: %s.\n", reason);
+  uint8_t storedMac[6];
+  uint8_t storedChannel = 0;
+  loadStoredPeer(storedMac, storedChannel);
+
+  uint8_t count = 0;
+  addScanCandidate(count, firstChannel);
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    addScanCandidate(count, storedChannel);
+    // Non-overlapping channels are where APs usually sit
+    addScanCandidate(count, 1);
+    addScanCandidate(count, 6);
+    addScanCandidate(count, 11);
+    for (uint8_t channel = 1; channel <= WIFI_CHANNEL_COUNT; channel++)
+      addScanCandidate(count, channel);
+  }
+  for (uint8_t i = count; i < WIFI_CHANNEL_COUNT; i++)
+    channelScanOrder[i] = 0;
+
+  channelScanActive = true;
+  channelScanIndex = 0;
+  channelScanPass = 0;
+  channelScanProbes = 0;
+  channelScanStartedMs = millis();
+  consecutiveTxFailures = 0;
+  consecutiveProbeFailures = 0;
+  probeNextChannel();
 }
 
-bool isSlotFree(int index)
+void probeNextChannel()
 {
-  return (profiles[index].numSteps == 0);
+  uint8_t channel = channelScanOrder[channelScanIndex];
+  if (WiFi.status() != WL_CONNECTED)
+  {
+    esp_wifi_set_channel(channel, WIFI_SECOND_CHAN_NONE);
+  }
+  channelScanProbes++;
+  peerProbeResultPending = false;
+  peerProbeState = PEER_PROBE_SENT;
+  peerProbeSentMs = millis();
+  sendPairingRequest(mainControllerMac);
 }
 
-void importProfileJson(const char *json)
+void handleChannelProbeResult(bool ok)
 {
-  JsonDocument doc;
-  DeserializationError error = deserializeJson(doc, json);
-
-  if (error)
-  {
-    Serial.print("Profile JSON parsing failed: ");
-    Serial.println(error.c_str());
+  uint8_t channel = channelScanOrder[channelScanIndex];
+  if (ok)
+  {
+    channelScanActive = false;
+    myChannel = channel;
+    storePeer(mainControllerMac, channel);
+    Serial.printf("Channel recovery: controller found on channel %u after %lu ms (%u probes).\n", channel,
+                  millis() - channelScanStartedMs, channelScanProbes);
     return;
   }
 
-  int id = doc["id"] | -1;
-
-  if (id < 0 || id >= MAX_PROFILES)
+  channelScanIndex++;
+  if (channelScanIndex >= WIFI_CHANNEL_COUNT || channelScanOrder[channelScanIndex] == 0)
   {
-    Serial.printf("Error: Received invalid profile ID: %d\n", id);
+    channelScanIndex = 0;
+    channelScanPass++;
+  }
+  if (channelScanPass >= CHANNEL_SCAN_MAX_PASSES || millis() - channelScanStartedMs > CHANNEL_RECOVERY_MAX_MS)
+  {
+    channelScanActive = false;
+    Serial.printf("Channel recovery failed after %lu ms (%u probes); falling back to broadcast pairing.\n",
+                  millis() - channelScanStartedMs, channelScanProbes);
+    if (WiFi.status() != WL_CONNECTED)
+    {
+      esp_wifi_set_channel(myChannel, WIFI_SECOND_CHAN_NONE);
+    }
+    resetPairing();
     return;
   }
+  probeNextChannel();
+}
 
-  Serial.printf("Importing data into Profile Slot %d...\n", id);
-
-  strlcpy(profiles[id].name, doc["n"] | "Unnamed", sizeof(profiles[id].name));
-  profiles[id].isStepped = (doc["m"] == 1);
-
-  profiles[id].numSteps = 0;
-
-  JsonArray steps = doc["s"];
-  for (JsonVariant step : steps)
+// --- Link Quality ---
+void noteLinkSeq(SeqTracker &tracker, uint32_t seq, uint32_t modulus)
+{
+  tracker.frames++;
+  if (tracker.valid)
   {
-    if (profiles[id].numSteps >= 128)
-      break;
-
-    if (step.is<JsonArray>())
+    uint32_t delta = (seq + modulus - tracker.last) % modulus;
+    if (delta == 0)
     {
-      profiles[id].steps[profiles[id].numSteps].target = step[0].as<float>();
-      profiles[id].steps[profiles[id].numSteps].control = step[1].as<float>();
+      tracker.duplicates++;
+      return;
     }
-    else if (step.is<JsonObject>())
+    if (delta > modulus / 2)
     {
-      profiles[id].steps[profiles[id].numSteps].target = step["t"] | 0.0f;
-      profiles[id].steps[profiles[id].numSteps].control = step["c"] | 1.0f;
+      // Behind the newest frame: it was counted lost when the gap opened
+      tracker.outOfOrder++;
+      if (tracker.lost > 0)
+        tracker.lost--;
+      return;
     }
-    profiles[id].numSteps++;
+    tracker.lost += delta - 1;
   }
+  tracker.last = seq;
+  tracker.valid = true;
+}
 
-  if (id == currentProfileIndex)
+uint8_t linkHistBucket(uint32_t ms)
+{
+  uint8_t bucket = 0;
+  while (ms > 0 && bucket < LINK_HIST_BUCKETS - 1)
   {
-    Serial.println("Current active profile updated via network. Refreshing UI.");
-    currentProfile = &profiles[id];
-    updateFullProfileUI();
+    ms >>= 1;
+    bucket++;
   }
+  return bucket;
 }
 
-void updateProfilingDisplay()
+// Upper edge of the bucket holding the given fraction of samples
+uint32_t linkHistPercentile(const uint32_t *hist, float fraction)
 {
-  char outputBuffer[1024] = "";
-  char floatBuffer[20];
+  uint32_t total = 0;
+  for (int i = 0; i < LINK_HIST_BUCKETS; i++)
+    total += hist[i];
+  if (total == 0)
+    return 0;
+  uint32_t threshold = (uint32_t)ceilf(total * fraction);
+  uint32_t running = 0;
+  for (int i = 0; i < LINK_HIST_BUCKETS; i++)
+  {
+    running += hist[i];
+    if (running >= threshold)
+      return 1UL << i;
+  }
+  return 1UL << (LINK_HIST_BUCKETS - 1);
+}
 
-  for (int i = 0; i < currentProfile->numSteps; i++)
+// Jitter per RFC 3550 (independent of the clock offset); latency needs the ping offset to be absolute
+void noteLinkTimestamp(uint32_t controllerMs)
+{
+  int32_t transit = (int32_t)(currentFrameRxMs - controllerMs);
+  if (linkStats.haveTransit)
   {
-    if (currentProfile->steps[i].target < 0)
-      currentProfile->steps[i].target = 0;
-    if (currentProfile->steps[i].target > 999.9)
-      currentProfile->steps[i].target = 999.9;
+    float delta = fabsf((float)(transit - linkStats.lastTransitMs));
+    linkStats.jitterMs += (delta - linkStats.jitterMs) / 16.0f;
+  }
+  linkStats.lastTransitMs = transit;
+  linkStats.haveTransit = true;
 
-    if (currentProfile->steps[i].target < 9.99)
-    {
-      dtostrf(currentProfile->steps[i].target, 7, 1, floatBuffer);
-    }
-    else if (currentProfile->steps[i].target < 99.99)
-    {
-      dtostrf(currentProfile->steps[i].target, 6, 1, floatBuffer);
-    }
-    else
-    {
-      dtostrf(currentProfile->steps[i].target, 5, 1, floatBuffer);
-    }
-    strcat(outputBuffer, floatBuffer);
-    strcat(outputBuffer, "           ");
+  int32_t offset = linkStats.pingOffsetValid ? linkStats.pingOffsetMs : controllerClockOffsetMs;
+  int32_t latency = transit - offset;
+  linkStats.latencyHist[linkHistBucket(latency > 0 ? latency : 0)]++;
+}
 
-    if (currentProfile->steps[i].control < 0)
-      currentProfile->steps[i].control = 0;
-    if (currentProfile->steps[i].control > 999.9)
-      currentProfile->steps[i].control = 999.9;
+// "pong=<our ping time>,<controller millis()>": offset taken at the midpoint of the fastest round trip in the window
+void notePong(const char *value)
+{
+  char *cursor;
+  uint32_t sentMs = strtoul(value, &cursor, 10);
+  if (*cursor != ',')
+    return;
+  uint32_t controllerMs = strtoul(cursor + 1, NULL, 10);
+  uint32_t rtt = currentFrameRxMs - sentMs;
+  linkStats.pongs++;
+  linkStats.rttHist[linkHistBucket(rtt)]++;
 
-    if (currentProfile->steps[i].control < 9.99)
-    {
-      dtostrf(currentProfile->steps[i].control, 7, 1, floatBuffer);
-    }
-    else if (currentProfile->steps[i].control < 99.99)
-    {
-      dtostrf(currentProfile->steps[i].control, 6, 1, floatBuffer);
-    }
-    else
-    {
-      dtostrf(currentProfile->steps[i].control, 5, 1, floatBuffer);
-    }
-    strcat(outputBuffer, floatBuffer);
+  if (linkStats.pingWindowCount == 0 || rtt <= linkStats.pingBestRttMs)
+  {
+    linkStats.pingBestRttMs = rtt;
+    linkStats.pingOffsetMs = (int32_t)(sentMs + rtt / 2 - controllerMs);
+    linkStats.pingOffsetValid = true;
+  }
+  if (++linkStats.pingWindowCount >= LINK_PING_WINDOW)
+  {
+    linkStats.pingWindowCount = 0;
+  }
+}
 
-    if (i < currentProfile->numSteps - 1)
+void serviceLinkProbe()
+{
+  if (isPaired && (controllerProtocolCaps & PROTOCOL_CAP_LINK_PING) && millis() - linkStats.lastPingMs >= LINK_PING_INTERVAL_MS)
+  {
+    linkStats.lastPingMs = millis();
+    char pingBuffer[12];
+    snprintf(pingBuffer, sizeof(pingBuffer), "%lu", millis());
+    publishData(mqtt_topic_ping, pingBuffer, false);
+  }
+
+  // Fold RSSI samples from the Wi-Fi task into the running figures
+  static uint32_t lastRssiCount = 0;
+  if (rssiSampleCount != lastRssiCount)
+  {
+    lastRssiCount = rssiSampleCount;
+    int8_t rssi = lastRssi;
+    if (linkStats.rssiSamples == 0)
     {
-      strcat(outputBuffer, "\r\n");
+      linkStats.rssiAvg = rssi;
+      linkStats.rssiMin = linkStats.rssiMax = rssi;
     }
+    linkStats.rssiAvg += (rssi - linkStats.rssiAvg) / 8.0f;
+    linkStats.rssiMin = min(linkStats.rssiMin, rssi);
+    linkStats.rssiMax = max(linkStats.rssiMax, rssi);
+    linkStats.rssiSamples++;
   }
+}
 
-  strncpy(valueString, outputBuffer, sizeof(valueString) - 1);
-  valueString[sizeof(valueString) - 1] = '\0';
-  slt_Values.text(valueString);
+// Wi-Fi task context: keep it to a MAC compare and two stores
+void OnPromiscuousRx(void *buf, wifi_promiscuous_pkt_type_t type)
+{
+  if (type != WIFI_PKT_MGMT || !isPaired)
+    return;
+  const wifi_promiscuous_pkt_t *packet = (const wifi_promiscuous_pkt_t *)buf;
+  const uint8_t *frame = packet->payload;
+  // 0xD0 = action frame (ESP-NOW); transmitter address at offset 10
+  if (frame[0] != 0xD0 || memcmp(frame + 10, mainControllerMac, 6) != 0)
+    return;
+  lastRssi = packet->rx_ctrl.rssi;
+  rssiSampleCount++;
 }
 
-void buttonCallback(unsigned long duration)
+void printLinkStats()
 {
-  buttonPressed = true;
+  const SeqTracker &text = linkStats.textSeq;
+  const SeqTracker &binary = binaryStats.seq;
+  uint32_t frames = text.frames + binary.frames;
+  uint32_t lost = text.lost + binary.lost;
+  Serial.println("--- ESP-NOW Link Quality ---");
+  Serial.printf("Frames: %lu, lost %lu (%.2f%%), out of order %lu, duplicates %lu\n", (unsigned long)frames,
+                (unsigned long)lost, frames + lost > 0 ? 100.0f * lost / (frames + lost) : 0.0f,
+                (unsigned long)(text.outOfOrder + binary.outOfOrder), (unsigned long)(text.duplicates + binary.duplicates));
+  Serial.printf("Clock offset: %ld ms (%s), jitter %.2f ms\n",
+                (long)(linkStats.pingOffsetValid ? linkStats.pingOffsetMs : controllerClockOffsetMs),
+                linkStats.pingOffsetValid ? "ping" : "min latency, relative", linkStats.jitterMs);
+  Serial.printf("RSSI: avg %.1f dBm, min %d, max %d (%lu samples)\n", linkStats.rssiAvg, linkStats.rssiMin, linkStats.rssiMax,
+                (unsigned long)linkStats.rssiSamples);
+  Serial.printf("Pings answered: %lu, best RTT %lu ms\n", (unsigned long)linkStats.pongs, (unsigned long)linkStats.pingBestRttMs);
+  Serial.println("Bucket(ms)  latency      RTT");
+  for (int i = 0; i < LINK_HIST_BUCKETS; i++)
+  {
+    Serial.printf("%s%5lu %10lu %8lu\n", i == LINK_HIST_BUCKETS - 1 ? ">=" : "< ", (unsigned long)(1UL << (i == LINK_HIST_BUCKETS - 1 ? i - 1 : i)),
+                  (unsigned long)linkStats.latencyHist[i], (unsigned long)linkStats.rttHist[i]);
+  }
 }
 
-void handleButton()
+// Page 3 shows the link summary whenever its message box is otherwise idle
+void updateLinkStatsDisplay()
 {
-  if (!buttonPressed)
+  static unsigned long lastUpdateMs = 0;
+  if (currentPage != 3 || millis() - lastUpdateMs < LINK_DISPLAY_INTERVAL_MS)
+    return;
+  lastUpdateMs = millis();
+  if (systemMessageClearTime > 0 || calibrationStep != 0 || cleaningCycleActive || calibrationRequestTime > 0 || cleaningRequestTime > 0)
+    return;
+  if (!isPaired)
   {
+    t_systemMessage.text("Link: not paired");
     return;
   }
-  buttonPressed = false;
-  bool pageChanged = lastPageForSelection != currentPage;
-  if (pageChanged)
+
+  uint32_t frames = linkStats.textSeq.frames + binaryStats.seq.frames;
+  uint32_t lost = linkStats.textSeq.lost + binaryStats.seq.lost;
+  char msgBuffer[96];
+  snprintf(msgBuffer, sizeof(msgBuffer), "Link RSSI %d dBm\r\nLatency p50 <%lu p95 <%lu ms\r\nJitter %.1f ms\r\nLoss %.1f%% OOO %lu",
+           (int)roundf(linkStats.rssiAvg), (unsigned long)linkHistPercentile(linkStats.latencyHist, 0.5f),
+           (unsigned long)linkHistPercentile(linkStats.latencyHist, 0.95f), linkStats.jitterMs,
+           frames + lost > 0 ? 100.0f * lost / (frames + lost) : 0.0f,
+           (unsigned long)(linkStats.textSeq.outOfOrder + binaryStats.seq.outOfOrder));
+  t_systemMessage.text(msgBuffer);
+}
+
+void serviceRssiSampling()
+{
+  bool wanted = !OFFLINE_MODE && radioTransport == TRANSPORT_ESPNOW && (currentPage == 3 || rssiSamplingRequested);
+  if (wanted == rssiSamplingActive)
+    return;
+  rssiSamplingActive = wanted;
+  esp_wifi_set_promiscuous(wanted);
+}
+
+void feedShotAnalytics()
+{
+  feedProfileAdherence();
+  feedShotMetrics();
+  feedPuckResistance();
+  feedPhaseDetector();
+  feedYieldPredictor();
+}
+
+void feedShotMetrics()
+{
+  unsigned long now = hmiMillis();
+
+  if (shotStartTimeMillis > 0 && pumpIsOn && shotStartTimeMillis != shotMetrics.startMs)
   {
-    currentSelectionIndex = 0;
+    finalizeShotRecord();
+    shotMetrics = {};
+    shotMetrics.active = true;
+    shotMetrics.startMs = shotStartTimeMillis;
+    shotMetrics.lastFeedMs = now;
+    shotMetrics.boilerTempAtStart = boilerTemp;
+    shotMetrics.hxTempAtStart = hxTemp;
   }
-  switch (currentPage)
+  if (!shotMetrics.active)
   {
-  // case 1:
-  //   currentSelectionIndex = 0;
-  //   if (currentSelectionIndex >= NUM_PAGE1_COMPONENTS) {
-  //     currentSelectionIndex = 0;
-  //   }
+    return;
+  }
 
-  //   for (int i = 0; i < NUM_PAGE1_COMPONENTS; i++) {
-  //     if (i == currentSelectionIndex) {
-  //       page1_components[i][0]->attribute("font", 2);
-  //     } else {
-  //       page1_components[i][0]->attribute("font", 6);
-  //     }
-  //   }
-  //   lastPageForSelection = currentPage;
-  //   currentSelectionIndex++;
-  //   isItemSelected = true;
-  //   break;
-  case 2:
+  unsigned long elapsedMs = now - shotMetrics.startMs;
+  float dt = min(now - shotMetrics.lastFeedMs, METRICS_MAX_FRAME_GAP_MS) / 1000.0f;
+  shotMetrics.lastFeedMs = now;
+
+  if (!shotMetrics.complete)
   {
-    if (strcmp(profilingMode, "manual") == 0)
-    {
-      break;
-    }
-    else if (strcmp(profilingMode, "flat") == 0)
-    {
-      var_row.value(0);
-      var_col.value(0);
-      var_sel.value(0);
-      selectedItemPage2 = 0;
-      rowPage2 = 0;
-      columnPage2 = 0;
-      slt_flat.attribute("bco", HIGHLIGHT_COLOR);
-      break;
-    }
-    else if (strcmp(profilingMode, "profile") == 0)
+    if (pumpIsOn)
     {
-      const int val_y = slt_Values.attributeValue("val_y");
-      delay(50);
-      int maxIndex = (currentProfile->numSteps * 2 - 1);
-      if (selectedItemPage2 >= 1024)
-      {
-        var_col.value(0);
-        var_sel.value(0);
-        var_row.value(0);
-        selectedItemPage2 = 0;
-        columnPage2 = 0;
-        rowPage2 = 0;
-        slt_Values.attribute("val_y", 0);
-        t_profile.attribute("bco", 65536);
-        break;
-      }
-      if (selectedItemPage2 >= maxIndex)
-      {
-        selectedItemPage2 = 1024;
-        columnPage2 = 2;
-        rowPage2 = 0;
-        var_col.value(columnPage2);
-        var_row.value(rowPage2);
-        var_sel.value(selectedItemPage2);
-        t_profile.attribute("bco", HIGHLIGHT_COLOR);
-        break;
-      }
-      t_profile.attribute("bco", 65536);
-      selectedItemPage2++;
-      var_sel.value(selectedItemPage2);
-      if (columnPage2 == 0)
+      shotMetrics.peakPressure = max(shotMetrics.peakPressure, pressure);
+      shotMetrics.pressureTimeSum += pressure * dt;
+      shotMetrics.pumpOnTimeS += dt;
+      if (shotMetrics.preinfusionMs == 0 && pressure >= PREINFUSION_END_PRESSURE_BAR)
       {
-        columnPage2 = 1;
-        var_col.value(columnPage2);
+        shotMetrics.preinfusionMs = elapsedMs;
       }
-      else if (columnPage2 == 1)
+      if (shotMetrics.firstDropMs == 0 && weight >= FIRST_DROP_WEIGHT_G)
       {
-        rowPage2++;
-        columnPage2 = 0;
-        var_col.value(columnPage2);
-        var_row.value(rowPage2);
+        shotMetrics.firstDropMs = elapsedMs;
       }
-      if ((1 + rowPage2) * 20 - val_y >= sltHeight)
+      if (shotMetrics.firstDropMs > 0)
       {
-        slt_Values.attribute("val_y", (1 + rowPage2) * 12);
+        shotMetrics.peakFlow = max(shotMetrics.peakFlow, flowRate);
+        shotMetrics.flowTimeSum += flowRate * dt;
+        shotMetrics.flowingTimeS += dt;
       }
     }
-    break;
-  }
-  case 3:
-  {
-    if (calibrationStep == 2)
+    else
     {
-      isItemSelected = true;
-      x_referenceWeight.attribute("bco", HIGHLIGHT_COLOR);
-      int screenVal = x_referenceWeight.value();
-      if (screenVal != -1)
+      shotMetrics.complete = true;
+      shotMetrics.pumpOffMs = now;
+      shotMetrics.pumpOffWeight = weight;
+      if (elapsedMs > SHOT_START_THRESHOLD_S * 1000UL)
       {
-        referenceWeight = (float)screenVal / 10.0f;
+        printShotMetrics();
       }
     }
-    else
-    {
-      isItemSelected = false;
-    }
   }
-  break;
-  default:
-    isItemSelected = false;
-    break;
+
+  if (shotMetrics.complete && now - shotMetrics.pumpOffMs > SHOT_RETENTION_TIME_MS)
+  {
+    shotMetrics.active = false;
+    return;
+  }
+  shotMetrics.yield = weight;
+  shotMetrics.drip = shotMetrics.complete ? weight - shotMetrics.pumpOffWeight : 0.0f;
+  shotMetrics.brewRatio = (doseWeight > 0.1f) ? weight / doseWeight : 0.0f;
+}
+
+void formatShotSummary(char *buffer, size_t size)
+{
+  int written = snprintf(buffer, size, "%.1fg 1:%.1f PI %.1fs %.1fbar",
+                         shotMetrics.yield,
+                         shotMetrics.brewRatio,
+                         shotMetrics.preinfusionMs / 1000.0f,
+                         shotMetrics.peakPressure);
+  int score = getAdherenceScore();
+  if (score >= 0 && written > 0 && (size_t)written < size)
+  {
+    snprintf(buffer + written, size - written, " fit %d%%", score);
   }
 }
 
-// --- Nextion Event Callbacks ---
-void brewTempSliderRelease()
+void printShotMetrics()
+{
+  float meanPressure = (shotMetrics.pumpOnTimeS > 0) ? shotMetrics.pressureTimeSum / shotMetrics.pumpOnTimeS : 0.0f;
+  float meanFlow = (shotMetrics.flowingTimeS > 0) ? shotMetrics.flowTimeSum / shotMetrics.flowingTimeS : 0.0f;
+  Serial.println("--- Shot Metrics ---");
+  Serial.printf("Pump time:      %.1f s\n", shotMetrics.pumpOnTimeS);
+  Serial.printf("Pre-infusion:   %.1f s\n", shotMetrics.preinfusionMs / 1000.0f);
+  Serial.printf("First drop:     %.1f s\n", shotMetrics.firstDropMs / 1000.0f);
+  Serial.printf("Pressure:       peak %.2f bar, mean %.2f bar\n", shotMetrics.peakPressure, meanPressure);
+  Serial.printf("Flow:           peak %.2f g/s, mean %.2f g/s\n", shotMetrics.peakFlow, meanFlow);
+  Serial.printf("Yield:          %.1f g (dose %.1f g, ratio 1:%.2f)\n", shotMetrics.yield, doseWeight, shotMetrics.brewRatio);
+  Serial.printf("Drip:           %.1f g\n", shotMetrics.drip);
+  Serial.printf("Resistance:     peak %.2f, min %.2f bar s^2/g^2\n", shotMetrics.peakResistance, shotMetrics.minResistance);
+  printProfileAdherence();
+  printPhaseEvents(phaseDetector.events, phaseDetector.eventCount);
+}
+
+// Below the flow guard the last estimate is held instead of dividing by a near-zero flow
+// Smoothing runs on elapsed time, so it does not change with the subscribed telemetry rate
+float stepPuckResistance(PuckResistanceFilter &filter, float pressureBar, float flowGs, float dt)
 {
-  delay(100);
-  int value = slider_brewTemp.value();
-  float valueF = (float)value / 10.;
-  page1_cachedValues[0] = value;
-  char numBuffer[10];
-  dtostrf(valueF, 4, 3, numBuffer);
+  if (flowGs < RESISTANCE_MIN_FLOW_GS)
+  {
+    return filter.value;
+  }
+  float raw = min(pressureBar / (flowGs * flowGs), RESISTANCE_MAX);
+  float alpha = 1.0f - expf(-dt / RESISTANCE_SMOOTHING_TAU_S);
+  filter.value = filter.valid ? filter.value + alpha * (raw - filter.value) : raw;
+  filter.valid = true;
+  return filter.value;
+}
 
-  char payloadBuffer[32];
-  sprintf(payloadBuffer, "tempsetbrew=%s", numBuffer);
+void feedPuckResistance()
+{
+  static unsigned long filterShotStartMs = 0;
+  unsigned long now = hmiMillis();
+  if (shotStartTimeMillis > 0 && shotStartTimeMillis != filterShotStartMs)
+  {
+    puckResistance = {};
+    puckResistance.lastFeedMs = now;
+    filterShotStartMs = shotStartTimeMillis;
+  }
+  float dt = min(now - puckResistance.lastFeedMs, METRICS_MAX_FRAME_GAP_MS) / 1000.0f;
+  puckResistance.lastFeedMs = now;
+  stepPuckResistance(puckResistance, pressure, flowRate, dt);
 
-  Serial.print("Publishing payload: ");
-  Serial.println(payloadBuffer);
-  publishData("tempsetbrew", numBuffer, true);
+  if (shotMetrics.active && !shotMetrics.complete && shotMetrics.firstDropMs > 0 && puckResistance.valid)
+  {
+    shotMetrics.peakResistance = max(shotMetrics.peakResistance, puckResistance.value);
+    shotMetrics.minResistance = (shotMetrics.minResistance > 0.0f) ? min(shotMetrics.minResistance, puckResistance.value)
+                                                                    : puckResistance.value;
+  }
 }
 
-void brewModeButtonRelease()
+void feedPhaseDetector()
 {
-  delay(100);
-  int value = btn_brewModeCoffee.value();
-  char payloadBuffer[32];
-
-  if (value == 0)
+  PhaseDetector &d = phaseDetector;
+  unsigned long now = hmiMillis();
+  if (shotStartTimeMillis > 0 && pumpIsOn && shotStartTimeMillis != d.startMs)
   {
-    sprintf(payloadBuffer, "steam");
+    startPhaseDetector(d, shotStartTimeMillis, now, weight);
+    phaseMarkersDrawn = 0;
   }
-  else
+  if (d.active && d.phase == PHASE_DRIP && !shotMetrics.active)
   {
-    sprintf(payloadBuffer, "coffee");
+    d.active = false;
   }
+  stepPhaseDetector(d, now, pressure, flowRate, weight, pumpIsOn);
+}
 
-  Serial.print("Publishing payload: ");
-  Serial.println(payloadBuffer);
-  publishData("brewmode", payloadBuffer, true);
+void printPhaseEvents(const PhaseEvent *events, int count)
+{
+  for (int i = 0; i < count; i++)
+  {
+    uint8_t phase = min(events[i].phase, (uint8_t)PHASE_DRIP);
+    Serial.printf("  %5.1f s  %-13s %.1f g\n", events[i].timeMs / 1000.0f, SHOT_PHASE_NAMES[phase], events[i].weight);
+  }
 }
 
-void steamBoostButtonRelease()
+void feedProfileAdherence()
 {
-  delay(100);
-  int value = btn_steamBoost.value();
-  char payloadBuffer[32];
-  if (value == 1)
+  unsigned long now = hmiMillis();
+  if (shotStartTimeMillis > 0 && pumpIsOn && shotStartTimeMillis != adherence.startMs)
   {
-    sprintf(payloadBuffer, "true");
+    adherence = {};
+    adherence.active = true;
+    adherence.startMs = shotStartTimeMillis;
+    adherence.lastFeedMs = now;
+  }
+  if (!adherence.active || adherence.complete)
+  {
+    return;
+  }
+  if (!pumpIsOn)
+  {
+    adherence.complete = true;
+    return;
+  }
+
+  float dt = min(now - adherence.lastFeedMs, METRICS_MAX_FRAME_GAP_MS) / 1000.0f;
+  adherence.lastFeedMs = now;
+
+  float target;
+  int stepIndex = 0;
+  if (profilingModeId == PROFILING_MODE_FLAT)
+  {
+    target = flatValue;
+  }
+  else if (profilingModeId == PROFILING_MODE_PROFILE)
+  {
+    float x = profilingTargetIsTime ? (now - adherence.startMs) / 1000.0f : weight;
+    int index = findProfileSegment(x);
+    if (compiledProfile.numSegments == 0)
+    {
+      return;
+    }
+    if (index >= compiledProfile.numSegments)
+    {
+      target = compiledProfile.finalY;
+      index = compiledProfile.numSegments - 1;
+    }
+    else
+    {
+      target = getCompiledTargetAt(x);
+    }
+    stepIndex = compiledProfile.segments[index].stepIndex;
   }
   else
   {
-    sprintf(payloadBuffer, "false");
+    return;
   }
 
-  Serial.print("Publishing payload: ");
-  Serial.println(payloadBuffer);
-  publishData("enablesteamboost", payloadBuffer, true);
+  float measured = profilingSourceIsPressure ? pressure : flowRate;
+  float band = profilingSourceIsPressure ? ADHERENCE_PRESSURE_BAND_BAR : ADHERENCE_FLOW_BAND_GS;
+  float deviation = fabsf(measured - target);
+
+  adherence.trackedS += dt;
+  adherence.sqErrorSum += deviation * deviation * dt;
+  adherence.maxDeviation = max(adherence.maxDeviation, deviation);
+  if (deviation > band)
+  {
+    adherence.outsideBandS += dt;
+  }
+  adherence.stepTrackedS[stepIndex] += dt;
+  adherence.stepSqErrorSum[stepIndex] += deviation * deviation * dt;
 }
 
-void profilingModeManualButtonRelease()
+// Share of tracked time spent inside the tolerance band, or -1 when nothing was tracked
+int getAdherenceScore()
 {
-  char payloadBuffer[32];
-  cleanCurrentPage();
-  strlcpy(profilingMode, "manual", sizeof(profilingMode));
-  sprintf(payloadBuffer, "manual");
-  Serial.print("Publishing payload: ");
-  Serial.println(payloadBuffer);
-  publishData("profiling_mode", payloadBuffer, true);
-  stopProfilePortal();
+  if (!adherence.active || adherence.trackedS < 0.5f)
+  {
+    return -1;
+  }
+  return (int)roundf(100.0f * (1.0f - adherence.outsideBandS / adherence.trackedS));
 }
 
-void profilingModeFlatButtonRelease()
+void printProfileAdherence()
 {
-  delay(100);
-  const char *pFlatString = slt_flat.text();
-  delay(100);
-  if (strcmp(pFlatString, "Error") != 0)
+  int score = getAdherenceScore();
+  if (score < 0)
   {
-    flatValue = atof(pFlatString);
+    return;
+  }
+  const char *unit = profilingSourceIsPressure ? "bar" : "g/s";
+  Serial.printf("Adherence:      %d%% in band, RMS %.2f %s, max %.2f %s, %.1f s outside\n",
+                score,
+                sqrtf(adherence.sqErrorSum / adherence.trackedS), unit,
+                adherence.maxDeviation, unit,
+                adherence.outsideBandS);
+  for (int i = 0; i < 128; i++)
+  {
+    if (adherence.stepTrackedS[i] > 0.0f)
+    {
+      Serial.printf("  Step %d:       RMS %.2f %s over %.1f s\n", i + 1,
+                    sqrtf(adherence.stepSqErrorSum[i] / adherence.stepTrackedS[i]), unit,
+                    adherence.stepTrackedS[i]);
+    }
   }
-  char payloadBuffer[32];
-  cleanCurrentPage();
-  strlcpy(profilingMode, "flat", sizeof(profilingMode));
-  sprintf(payloadBuffer, "flat");
-  Serial.print("Publishing payload: ");
-  Serial.println(payloadBuffer);
-  publishData("profiling_mode", payloadBuffer, true);
-  stopProfilePortal();
 }
 
-void profilingModeProfilingButtonRelease()
+float getTargetYield()
 {
-  delay(100);
-  const char *pValueString = slt_Values.text();
-  delay(100);
-  if (strcmp(pValueString, "Error") != 0)
+  if (profilingModeId == PROFILING_MODE_PROFILE && !profilingTargetIsTime)
   {
-    strncpy(valueString, pValueString, sizeof(valueString) - 1);
-    valueString[sizeof(valueString) - 1] = '\0';
-    parseProfilingData();
+    ensureCompiledProfile();
+    if (compiledProfile.numSegments > 0)
+      return compiledProfile.segments[compiledProfile.numSegments - 1].endX;
   }
-  char payloadBuffer[32];
-  cleanCurrentPage();
-  strlcpy(profilingMode, "profile", sizeof(profilingMode));
-  sprintf(payloadBuffer, "profile");
-  Serial.print("Publishing payload: ");
-  Serial.println(payloadBuffer);
-  publishData("profiling_mode", payloadBuffer, true);
-  pendingSettingIndex = SETTING_ID_PROFILING_VALUE;
-  startProfilePortal();
+  return targetYieldSetting;
 }
 
-void profilingSourceButtonRelease()
+void feedYieldPredictor()
 {
-  delay(100);
-  char payloadBuffer[32];
-
-  if (btn_SourcePressure.value() == 1)
+  YieldPredictor &p = yieldPredictor;
+  if (shotMetrics.active && shotMetrics.startMs != p.startMs)
   {
-    sprintf(payloadBuffer, "pressure");
-    strlcpy(profilingSource, "pressure", sizeof(profilingSource));
+    startYieldPredictor(p, shotMetrics.startMs);
   }
-  else
+  if (!p.active)
+    return;
+
+  if (!shotMetrics.active)
   {
-    sprintf(payloadBuffer, "flow");
-    strlcpy(profilingSource, "flow", sizeof(profilingSource));
+    if (finishYieldPredictor(p, shotMetrics.drip, SHOT_START_THRESHOLD_S, dripPerFlow))
+      Serial.printf("Drip model updated: %.2f g per g/s\n", dripPerFlow);
+    return;
   }
 
-  Serial.print("Publishing payload: ");
-  Serial.println(payloadBuffer);
-  publishData("profiling_source", payloadBuffer, true);
+  float t = (hmiMillis() - p.startMs) / 1000.0f;
+  float target = getTargetYield();
+  if (stepYieldPredictor(p, t, weight, flowRate, pumpIsOn, target, dripPerFlow))
+  {
+    Serial.printf("Target yield %.1fg reached at %.1fs. Prediction error:", target, t);
+    for (int i = 0; i < 3; i++)
+    {
+      if (p.checkpointPredictionS[i] >= 0.0f)
+        Serial.printf(" @%d%% %+.2fs", (int)(YIELD_CHECKPOINTS[i] * 100), p.checkpointPredictionS[i] - t);
+    }
+    Serial.println();
+  }
 }
 
-void systemSettingsButtonRelease()
+bool formatYieldPrediction(char *buffer, size_t size)
 {
-  Serial.println("System Settings Button Pressed.");
-  if (calibrationStep != 0 || cleaningCycleActive)
+  if (yieldPredictor.active && !yieldPredictor.pumpOff && yieldPredictor.etaS > 0.0f)
   {
-    return;
+    snprintf(buffer, size, "%s  %ds to %.0fg", machineState, (int)ceilf(yieldPredictor.etaS), yieldPredictor.predictedFinal);
+    return true;
   }
-
-  if (WiFi.status() == WL_CONNECTED)
+  if (yieldPredictor.active && yieldPredictor.pumpOff)
   {
-    Serial.println("WiFi Connected. Starting MQTT Config Portal for Main Controller.");
+    snprintf(buffer, size, "%s  final ~%.1fg", machineState, yieldPredictor.predictedFinal);
+    return true;
+  }
+  return false;
+}
 
-    char msgBuffer[150];
-    IPAddress ip = WiFi.localIP();
+// --- Binary Telemetry Protocol ---
+bool isBinaryFrame(const uint8_t *data, int len)
+{
+  return len >= (int)sizeof(BinaryFrameHeader) + 2 && len != sizeof(struct_pairing) && len != sizeof(struct_message) &&
+         data[0] == BINARY_FRAME_MAGIC;
+}
 
-    snprintf(msgBuffer, sizeof(msgBuffer),
-             "Espresso Controller MQTT Config:\r\nhttp://%d.%d.%d.%d\nor\r\nhttp://%s.local",
-             ip[0], ip[1], ip[2], ip[3],
-             OTA_HOSTNAME);
+bool isTextFrame(const uint8_t *data, int len)
+{
+  if (len == sizeof(struct_message))
+    return data[0] != BINARY_FRAME_MAGIC;
+  return len >= (int)SHORT_TEXT_MIN_LEN && len < (int)sizeof(struct_message) && data[0] != BINARY_FRAME_MAGIC &&
+         data[len - 1] == '\0';
+}
 
-    t_systemMessage.text(msgBuffer);
-    startConfigurationPortal();
+bool validateBinaryFrame(const uint8_t *data, int len, uint8_t type, size_t payloadLen)
+{
+  BinaryFrameCheck check = checkBinaryFrame(data, len, type, payloadLen);
+  if (check == BINARY_FRAME_MALFORMED)
+  {
+    binaryStats.malformed++;
+    return false;
   }
-  else
+  if (check == BINARY_FRAME_BAD_CRC)
   {
-    Serial.println("WiFi Not Connected. Cannot start MQTT portal.");
-    t_systemMessage.text("Error:\r\nWiFi not connected");
-    systemMessageClearTime = millis() + 5000;
+    binaryStats.crcErrors++;
+    return false;
   }
+  BinaryFrameHeader header;
+  memcpy(&header, data, sizeof(header));
+  noteLinkSeq(binaryStats.seq, header.seq, 256);
+  binaryStats.framesDecoded++;
+  return true;
 }
 
-void cleaningCycleButtonRelease()
+bool parseTelemetryFrame(const uint8_t *data, int len, TelemetryPayload &payload)
 {
-  Serial.println("Cleaning Cycle button pressed.");
-
-  if (portalRunning || calibrationStep != 0)
+  if (!validateBinaryFrame(data, len, MSG_TELEMETRY, sizeof(TelemetryPayload)))
   {
-    return;
+    return false;
   }
+  memcpy(&payload, data + sizeof(BinaryFrameHeader), sizeof(payload));
+  return true;
+}
 
-  if (!isPaired)
+// --- Fragmented Transfers ---
+bool queueFragmentedTransfer(const char *topic, const char *payload)
+{
+  OutgoingTransfer *transfer = nullptr;
+  for (int i = 0; i < FRAGMENT_TRANSFER_SLOTS && transfer == nullptr; i++)
   {
-    t_systemMessage.text("Error:\r\nNot connected to\r\nmain controller");
-    systemMessageClearTime = millis() + 5000;
-    return;
+    if (!outgoingTransfers[i].used)
+      transfer = &outgoingTransfers[i];
+  }
+  if (transfer == nullptr)
+  {
+    txStats.dropped++;
+    Serial.printf("No free transfer slot, dropped '%s'.\n", topic);
+    return false;
   }
 
-  if (cleaningCycleActive)
+  transfer->seq = 0;
+  int written;
+  if (ackedWritesEnabled())
   {
-    return;
+    transfer->seq = nextTxSeq++;
+    if (nextTxSeq == 0)
+      nextTxSeq = 1;
+    written = snprintf(transfer->data, sizeof(transfer->data), "seq=%u|%s=%s", transfer->seq, topic, payload);
+  }
+  else
+  {
+    written = snprintf(transfer->data, sizeof(transfer->data), "%s=%s", topic, payload);
+  }
+  if (written < 0 || written >= (int)sizeof(transfer->data))
+  {
+    txStats.dropped++;
+    Serial.printf("'%s' is too large for a fragmented transfer (%d bytes).\n", topic, written);
+    return false;
   }
 
-  t_systemMessage.text("Cleaning cycle requested...");
-  cleaningCycleCount = 0;
-  systemMessageClearTime = 0;
-  cleaningRequestTime = millis();
+  transfer->used = true;
+  transfer->awaitingAck = false;
+  transfer->transferId = nextTransferId++;
+  if (nextTransferId == 0)
+    nextTransferId = 1; // 0 is reserved for frag_loopback
+  transfer->len = written;
+  transfer->count = fragmentCount(written);
+  transfer->nextIndex = 0;
+  transfer->attempts = 1;
+  txStats.queued++;
+  fragmentStats.transfersSent++;
+  return true;
+}
 
-  Serial.println("Sending cleaning=start command");
-  publishData("start_cleaning", "true", true);
+int buildFragmentFrame(uint8_t *out, const OutgoingTransfer &transfer, uint8_t index)
+{
+  return encodeFragmentFrame(out, binaryTxSeq++, transfer.transferId, transfer.data, transfer.len, index);
 }
 
-void profilingTextRelease()
+// Sends the next fragment of the oldest transfer; acknowledged transfers restart from fragment 0 on timeout
+bool serviceOutgoingTransfers()
 {
-  delay(100);
-  const int row_val = var_row.value();
-  delay(100);
-  const int col_val = var_col.value();
-  delay(100);
-  const int sel_val = var_sel.value();
-  delay(100);
-  const char *xValString = slt_Values.attributeText("txt");
-  bool rerun = false;
-  if (row_val == -1)
-    rerun = true;
-  if (col_val == -1)
-    rerun = true;
-  if (sel_val == -1)
-    rerun = true;
-  if (strcmp(xValString, "Error") == 0)
-    rerun = true;
-  if (rerun)
+  for (int i = 0; i < FRAGMENT_TRANSFER_SLOTS; i++)
   {
-    profilingTextRelease();
-    return;
+    OutgoingTransfer &transfer = outgoingTransfers[i];
+    if (!transfer.used)
+    {
+      continue;
+    }
+    if (transfer.awaitingAck)
+    {
+      if (millis() - transfer.sentMs < ACK_TIMEOUT_MS * 4)
+        continue;
+      if (transfer.attempts >= ACK_MAX_ATTEMPTS)
+      {
+        txStats.ackExpired++;
+        Serial.printf("Transfer seq=%u was never acknowledged, giving up.\n", transfer.seq);
+        transfer.used = false;
+        requestSettingsResync();
+        continue;
+      }
+      transfer.attempts++;
+      transfer.awaitingAck = false;
+      transfer.nextIndex = 0;
+      txStats.ackRetransmits++;
+    }
+
+    txInFlightFrame.attempts = 0;
+    txInFlightFrame.binaryLen = buildFragmentFrame((uint8_t *)txInFlightFrame.payload, transfer, transfer.nextIndex);
+    fragmentStats.fragmentsSent++;
+    if (++transfer.nextIndex >= transfer.count)
+    {
+      transfer.sentMs = millis();
+      transfer.awaitingAck = true;
+      if (transfer.seq == 0)
+        transfer.used = false;
+    }
+    transmitFrame(txInFlightFrame);
+    return true;
   }
-  strncpy(valueString, xValString, sizeof(valueString) - 1);
-  parseProfilingData();
-  selectedItemPage2 = sel_val;
-  rowPage2 = row_val;
-  columnPage2 = col_val;
+  return false;
 }
 
-void profilingFlatRelease()
+// Returns the reassembled message once its last fragment arrives, otherwise nullptr
+char *handleFragmentFrame(const uint8_t *data, int len)
 {
-  delay(50);
-  const char *xValString = slt_flat.attributeText("txt");
-  delay(100);
-  var_row.value(0);
-  var_col.value(0);
-  var_sel.value(0);
-  selectedItemPage2 = 0;
-  rowPage2 = 0;
-  columnPage2 = 0;
-  flatValue = atof(xValString);
+  if (!validateBinaryFrame(data, len, MSG_FRAGMENT, sizeof(FragmentPayload)))
+  {
+    return nullptr;
+  }
+  FragmentPayload fragment;
+  memcpy(&fragment, data + sizeof(BinaryFrameHeader), sizeof(fragment));
+  return reassembleFragment(incomingTransfers, fragment, millis(), fragmentStats);
 }
 
-void profileNameRelease()
+// Round-trips a synthetic profile through the fragment encoder and the reassembly path, without the radio
+void benchmarkFragmentLoopback(int steps)
 {
-  delay(100);
-  var_col.value(2);
-  var_sel.value(1024);
-  selectedItemPage2 = 1024;
-  columnPage2 = 2;
-  strncpy(currentProfile->name, profilingName, sizeof(currentProfile->name) - 1);
-  const char *pProfilingName = t_profile.text();
-  if (strcmp(pProfilingName, "Error") != 0)
+  steps = constrain(steps, 1, 128);
+  JsonDocument doc;
+  doc["id"] = MAX_PROFILES - 1;
+  doc["n"] = "Loopback";
+  doc["m"] = 0;
+  JsonArray stepArray = doc["s"].to<JsonArray>();
+  for (int i = 0; i < steps; i++)
+  {
+    JsonArray step = stepArray.add<JsonArray>();
+    step.add(roundf(random(0, 1200)) / 10.0f);
+    step.add(roundf(random(0, 600)) / 10.0f);
+  }
+  static char jsonBuffer[PROFILE_JSON_MAX];
+  size_t jsonLen = serializeJson(doc, jsonBuffer, sizeof(jsonBuffer));
+
+  OutgoingTransfer &transfer = outgoingTransfers[FRAGMENT_TRANSFER_SLOTS - 1];
+  if (transfer.used)
   {
-    strncpy(profilingName, pProfilingName, sizeof(profilingName) - 1);
-    profilingName[sizeof(profilingName) - 1] = '\0';
-    strncpy(currentProfile->name, profilingName, sizeof(currentProfile->name) - 1);
-    currentProfileDirty = true;
+    Serial.println("Transfer slot busy, try again.");
+    return;
   }
+  int written = snprintf(transfer.data, sizeof(transfer.data), "loopback=%s", jsonBuffer);
+  transfer.transferId = 0;
+  transfer.len = written;
+  transfer.count = fragmentCount(written);
+
+  uint8_t frame[FRAGMENT_FRAME_LEN];
+  char *message = nullptr;
+  BinaryProtocolStats savedStats = binaryStats; // loopback frames are not controller traffic
+  FragmentStats savedFragmentStats = fragmentStats;
+  unsigned long start = micros();
+  for (uint8_t index = 0; index < transfer.count; index++)
+  {
+    buildFragmentFrame(frame, transfer, index);
+    message = handleFragmentFrame(frame, sizeof(frame));
+  }
+  unsigned long elapsed = micros() - start;
+  binaryStats = savedStats;
+  fragmentStats = savedFragmentStats;
+
+  bool intact = message != nullptr && strcmp(message, transfer.data) == 0;
+  Serial.println("--- Fragment Loopback ---");
+  Serial.printf("%d steps, %u JSON bytes, %u fragments of %d bytes on air\n", steps, jsonLen, transfer.count, FRAGMENT_FRAME_LEN);
+  Serial.printf("Round trip %s in %lu us (%.1f kB/s encode+reassemble)\n", intact ? "intact" : "CORRUPTED", elapsed,
+                elapsed > 0 ? (float)written * 1000.0f / elapsed : 0.0f);
 }
 
-void profileSteppedRelease()
+void applyTelemetryPayload(const TelemetryPayload &payload)
 {
-  delay(100);
-  int val = sel_mode.value();
-  bool oldProfilingIsStepped = isProfilingStepped;
-  if (val != -1)
+  boilerTemp = payload.boilerTempDeci / 10.0f;
+  hxTemp = payload.hxTempDeci / 10.0f;
+  pressure = payload.pressureCenti / 100.0f;
+  weight = payload.weightCenti / 100.0f;
+  flowRate = payload.flowRateCenti / 100.0f;
+  pumpIsOn = payload.flags & TELEMETRY_FLAG_PUMP;
+  isHeaterOn = payload.flags & TELEMETRY_FLAG_HEATER;
+  brewLeverLifted = payload.flags & TELEMETRY_FLAG_LEVER;
+  if (payload.timestampMs != 0)
   {
-    isProfilingStepped = (val == 1);
+    updateControllerClock(payload.timestampMs);
+    noteLinkTimestamp(payload.timestampMs);
   }
-  currentProfile->isStepped = isProfilingStepped;
-  if (oldProfilingIsStepped != isProfilingStepped)
+  if (payload.flags & TELEMETRY_FLAG_PUMP_START)
   {
-    currentProfileDirty = true;
-    pendingSettingIndex = SETTING_ID_PROFILING_VALUE;
-    publishSetting();
+    applyControllerPumpStart(payload.pumpStartMs);
   }
 }
 
-void buttonTareRelease()
+// Encodes the current machine state, used by the benchmark and as the reference for the controller side
+int buildTelemetryFrame(uint8_t *out, uint8_t seq)
 {
-  delay(100);
-  publishData("tare_scale", "true", true);
+  TelemetryPayload payload;
+  payload.boilerTempDeci = (int16_t)roundf(boilerTemp * 10.0f);
+  payload.hxTempDeci = (int16_t)roundf(hxTemp * 10.0f);
+  payload.pressureCenti = (int16_t)roundf(pressure * 100.0f);
+  payload.weightCenti = (int32_t)roundf(weight * 100.0f);
+  payload.flowRateCenti = (int16_t)roundf(flowRate * 100.0f);
+  payload.flags = (pumpIsOn ? TELEMETRY_FLAG_PUMP : 0) | (isHeaterOn ? TELEMETRY_FLAG_HEATER : 0) |
+                  (brewLeverLifted ? TELEMETRY_FLAG_LEVER : 0);
+  payload.timestampMs = 0;
+  payload.pumpStartMs = 0;
+  return encodeBinaryFrame(out, MSG_TELEMETRY, seq, &payload, sizeof(payload));
 }
 
-void calibrateScaleButtonRelease()
+void benchmarkTelemetryDecode()
 {
-  Serial.println("Calibrate Scale button pressed.");
-  if (portalRunning || cleaningCycleActive)
-  {
-    return;
-  }
-  if (!isPaired)
-  {
-    t_systemMessage.text("Error:\r\nNot connected to\r\nmain controller");
-    systemMessageClearTime = millis() + 5000;
-    return;
+  const int iterations = 1000;
+  float savedBoiler = boilerTemp, savedHx = hxTemp, savedPressure = pressure, savedWeight = weight, savedFlow = flowRate;
+  bool savedPump = pumpIsOn, savedHeater = isHeaterOn, savedLever = brewLeverLifted;
+
+  struct_message textFrame;
+  memset(&textFrame, 0, sizeof(textFrame));
+  snprintf(textFrame.payload, sizeof(textFrame.payload), "%s=%.1f|%s=%.1f|%s=%.2f|%s=%s|%s=%s|%s=%.2f|%s=%.2f",
+           mqtt_topic_boiler_temp, boilerTemp, mqtt_topic_hx_temp, hxTemp, mqtt_topic_pressure, pressure,
+           mqtt_topic_heater, isHeaterOn ? "ON" : "OFF", mqtt_topic_pump, pumpIsOn ? "ON" : "OFF",
+           mqtt_topic_weight, weight, mqtt_topic_flow_rate, flowRate);
+  size_t textBytes = strlen(textFrame.payload);
+
+  unsigned long start = micros();
+  for (int i = 0; i < iterations; i++)
+  {
+    struct_message scratch;
+    memcpy(&scratch, &textFrame, sizeof(scratch));
+    char *token = strtok(scratch.payload, "|");
+    while (token != NULL)
+    {
+      handleIncomingMessage(token);
+      token = strtok(NULL, "|");
+    }
   }
+  unsigned long textUs = micros() - start;
+
+  uint8_t binaryFrame[TELEMETRY_FRAME_LEN];
+  buildTelemetryFrame(binaryFrame, 0);
+  BinaryProtocolStats savedStats = binaryStats;
+  start = micros();
+  for (int i = 0; i < iterations; i++)
+  {
+    TelemetryPayload telemetry;
+    if (parseTelemetryFrame(binaryFrame, sizeof(binaryFrame), telemetry))
+      applyTelemetryPayload(telemetry);
+  }
+  unsigned long binaryUs = micros() - start;
+  binaryStats = savedStats;
+
+  boilerTemp = savedBoiler;
+  hxTemp = savedHx;
+  pressure = savedPressure;
+  weight = savedWeight;
+  flowRate = savedFlow;
+  pumpIsOn = savedPump;
+  isHeaterOn = savedHeater;
+  brewLeverLifted = savedLever;
+
+  Serial.println("--- Telemetry Decode Benchmark ---");
+  size_t textOnAir = (controllerProtocolCaps & PROTOCOL_CAP_SHORT_TEXT) ? max(textBytes + 1, SHORT_TEXT_MIN_LEN) : sizeof(struct_message);
+  Serial.printf("Text:   %u payload bytes, %u bytes on air, %.2f us/frame\n", textBytes, textOnAir, (float)textUs / iterations);
+  Serial.printf("Binary: %d bytes on air, %.2f us/frame\n", TELEMETRY_FRAME_LEN, (float)binaryUs / iterations);
+  Serial.printf("Binary frames: %lu decoded, %lu CRC errors, %lu malformed, %lu lost\n",
+                (unsigned long)binaryStats.framesDecoded, (unsigned long)binaryStats.crcErrors,
+                (unsigned long)binaryStats.malformed, (unsigned long)binaryStats.seq.lost);
+}
 
-  systemMessageClearTime = 0;
-  char cmdBuffer[10];
+// Runs the real handleIncomingMessage() against the former strcmp chain on the same entries. Values are empty
+// so the handlers do next to nothing and the timing is mostly key dispatch; touched state is restored afterwards.
+void benchmarkKeyDispatch()
+{
+  static const char *const chainOrder[] = {
+      mqtt_topic_boiler_temp, mqtt_topic_hx_temp, mqtt_topic_pressure, mqtt_topic_heater, mqtt_topic_pump,
+      mqtt_topic_timestamp, mqtt_topic_pump_start, mqtt_topic_caps, mqtt_topic_active_profile_id,
+      mqtt_topic_import_profile, "profile_sync", mqtt_topic_brew_mode, mqtt_topic_steam_boost_status,
+      mqtt_topic_state, mqtt_topic_lever, mqtt_topic_setpoint, mqtt_topic_set_profiling_mode,
+      mqtt_topic_set_profiling_source, mqtt_topic_set_profiling_target, mqtt_topic_set_profiling_flat,
+      mqtt_topic_weight, mqtt_topic_flow_rate, mqtt_topic_mqtt_server, mqtt_topic_mqtt_port,
+      mqtt_topic_mqtt_user, mqtt_topic_mqtt_pass, "raw_weight", "filtered_weight", "filtered_flow"};
+  const int topicCount = sizeof(chainOrder) / sizeof(chainOrder[0]);
+  // One telemetry frame during a shot with the debug scale stream enabled; "ts" is left out because its
+  // handler feeds the controller clock and link statistics
+  static const char *const keyMix[] = {
+      mqtt_topic_boiler_temp, mqtt_topic_hx_temp, mqtt_topic_pressure, mqtt_topic_heater, mqtt_topic_pump,
+      mqtt_topic_weight, mqtt_topic_flow_rate, "raw_weight", "filtered_weight", "filtered_flow"};
+  const int mixCount = sizeof(keyMix) / sizeof(keyMix[0]);
+  const int iterations = 1000;
+  char entries[mixCount][24];
+  for (int k = 0; k < mixCount; k++)
+    snprintf(entries[k], sizeof(entries[k]), "%s=", keyMix[k]);
+
+  float savedBoiler = boilerTemp, savedHx = hxTemp, savedPressure = pressure, savedWeight = weight, savedFlow = flowRate;
+  float savedRawWeight = rawWeight, savedFilteredWeight = filteredWeight, savedFilteredFlow = filteredFlow;
+  bool savedPump = pumpIsOn, savedHeater = isHeaterOn;
+  unsigned long savedDebugTime = lastDebugDataTime;
+
+  char scratch[24];
+  unsigned long start = micros();
+  for (int i = 0; i < iterations; i++)
+  {
+    for (int k = 0; k < mixCount; k++)
+    {
+      memcpy(scratch, entries[k], sizeof(scratch));
+      handleIncomingMessage(scratch);
+    }
+  }
+  unsigned long hashUs = micros() - start;
 
-  if (calibrationStep == 0)
+  volatile int sink = 0;
+  start = micros();
+  for (int i = 0; i < iterations; i++)
   {
-    Serial.println("Sending calibratescale command");
-    publishData("calibratescale", "", true);
-
-    t_systemMessage.text("Calibration requested...");
-    calibrationRequestTime = millis();
+    for (int k = 0; k < mixCount; k++)
+    {
+      memcpy(scratch, entries[k], sizeof(scratch));
+      *strchr(scratch, '=') = '\0';
+      int match = 0;
+      while (match < topicCount && strcmp(scratch, chainOrder[match]) != 0)
+        match++;
+      sink += match;
+    }
+  }
+  unsigned long chainUs = micros() - start;
+
+  boilerTemp = savedBoiler;
+  hxTemp = savedHx;
+  pressure = savedPressure;
+  weight = savedWeight;
+  flowRate = savedFlow;
+  rawWeight = savedRawWeight;
+  filteredWeight = savedFilteredWeight;
+  filteredFlow = savedFilteredFlow;
+  pumpIsOn = savedPump;
+  isHeaterOn = savedHeater;
+  lastDebugDataTime = savedDebugTime;
+
+  Serial.println("--- Key Dispatch Benchmark ---");
+  Serial.printf("handleIncomingMessage (hash switch): %.3f us/entry\n", (float)hashUs / (iterations * mixCount));
+  Serial.printf("former strcmp chain, lookup only:    %.3f us/entry\n", (float)chainUs / (iterations * mixCount));
+}
 
-    sprintf(cmdBuffer, "vis %d,0", referenceWeightID);
-    nextion.command(cmdBuffer);
-    sprintf(cmdBuffer, "vis %d,0", referenceWeightUnitID);
-    nextion.command(cmdBuffer);
+// --- Shot History ---
+void initShotHistory()
+{
+  memset(historyIndex, 0, sizeof(historyIndex));
+  historyWriter.pending = false;
+  historyWriter.fileOpen = false;
+  if (!LittleFS.begin(true, "/littlefs", 5, HISTORY_PARTITION_LABEL))
+  {
+    Serial.println("Shot history unavailable: LittleFS mount failed.");
+    return;
   }
-  else if (calibrationStep == 1)
+  LittleFS.mkdir("/shots");
+  historyAvailable = true;
+
+  bool torn[HISTORY_SEGMENTS];
+  for (int segment = 0; segment < HISTORY_SEGMENTS; segment++)
   {
-    Serial.println("Sending calibration_step=0.0 (for tare).");
-    publishData("calibration_step", "0.0", true);
-    t_systemMessage.text("Taring scale...\r\nPlease wait...");
-    calibrationStep = 10;
+    scanHistorySegment(segment, torn[segment]);
   }
-  else if (calibrationStep == 2)
+
+  int storedShots = 0;
+  for (int slot = 0; slot < HISTORY_SLOTS; slot++)
   {
-    float realWeight = referenceWeight;
-    if (realWeight <= 0)
+    if (historyIndex[slot].shotId != 0)
     {
-      t_systemMessage.text("Error: Set reference weight\r\nusing encoder first (e.g., 100)");
-      systemMessageClearTime = millis() + 5000;
-      return;
+      storedShots++;
+      nextShotId = max(nextShotId, historyIndex[slot].shotId + 1);
     }
+  }
+  // Never append behind a half-written record; move on to the next segment instead
+  if (torn[historySegment(nextShotId)] && (nextShotId - 1) % HISTORY_SHOTS_PER_SEGMENT != 0)
+  {
+    nextShotId = ((nextShotId - 1) / HISTORY_SHOTS_PER_SEGMENT + 1) * HISTORY_SHOTS_PER_SEGMENT + 1;
+  }
+  Serial.printf("Shot history ready: %d shots stored, next id %lu\n", storedShots, (unsigned long)nextShotId);
+}
 
-    char weightBuffer[10];
-    snprintf(weightBuffer, sizeof(weightBuffer), "%.1f", realWeight);
-
-    sprintf(cmdBuffer, "vis %d,0", referenceWeightID);
-    nextion.command(cmdBuffer);
-    sprintf(cmdBuffer, "vis %d,0", referenceWeightUnitID);
-    nextion.command(cmdBuffer);
-
-    Serial.printf("Sending calibration_step=%s (for weight)\n", weightBuffer);
-    publishData("calibration_step", weightBuffer, true);
+int historySegment(uint32_t shotId)
+{
+  return ((shotId - 1) / HISTORY_SHOTS_PER_SEGMENT) % HISTORY_SEGMENTS;
+}
 
-    t_systemMessage.text("Weighing... Finishing calibration");
-    calibrationStep = 20;
-  }
+void historySegmentPath(int segment, char *path, size_t size)
+{
+  snprintf(path, size, "/shots/seg%d.bin", segment);
 }
 
-void profilingTargetButtonRelease()
+// Records are self-delimiting, so the RAM index is rebuilt by walking the record headers
+void scanHistorySegment(int segment, bool &torn)
 {
-  delay(100);
-  char payloadBuffer[32];
+  torn = false;
+  char path[24];
+  historySegmentPath(segment, path, sizeof(path));
+  File file = LittleFS.open(path, FILE_READ);
+  if (!file)
+    return;
 
-  if (btn_TargetTime.value() == 1)
+  size_t size = file.size();
+  size_t offset = 0;
+  ShotRecordHeader header;
+  while (offset < size)
   {
-    sprintf(payloadBuffer, "time");
-    strlcpy(profilingTarget, "time", sizeof(profilingTarget));
+    if (!file.seek(offset) || file.read((uint8_t *)&header, sizeof(header)) != sizeof(header) ||
+        header.magic != SHOT_RECORD_MAGIC || header.version != SHOT_RECORD_VERSION || header.shotId == 0 ||
+        offset + sizeof(header) + header.encodedBytes > size)
+    {
+      torn = true;
+      break;
+    }
+    HistoryIndexEntry &entry = historyIndex[header.shotId % HISTORY_SLOTS];
+    if (header.shotId > entry.shotId)
+    {
+      entry.shotId = header.shotId;
+      entry.offset = offset;
+      entry.sampleCount = header.sampleCount;
+      entry.recordBytes = sizeof(header) + header.encodedBytes;
+    }
+    offset += sizeof(header) + header.encodedBytes;
   }
-  else
-  {
-    sprintf(payloadBuffer, "weight");
-    strlcpy(profilingTarget, "weight", sizeof(profilingTarget));
+  file.close();
+}
+
+// A segment holding an older id range is deleted whole before the first record of the new range goes in
+bool openHistorySegment(uint32_t shotId)
+{
+  int segment = historySegment(shotId);
+  char path[24];
+  historySegmentPath(segment, path, sizeof(path));
+
+  File existing = LittleFS.open(path, FILE_READ);
+  if (existing)
+  {
+    ShotRecordHeader first;
+    bool sameRange = existing.read((uint8_t *)&first, sizeof(first)) == sizeof(first) && first.magic == SHOT_RECORD_MAGIC &&
+                     first.shotId != 0 && (first.shotId - 1) / HISTORY_SHOTS_PER_SEGMENT == (shotId - 1) / HISTORY_SHOTS_PER_SEGMENT;
+    existing.close();
+    if (!sameRange)
+    {
+      LittleFS.remove(path);
+      for (int slot = 0; slot < HISTORY_SLOTS; slot++)
+      {
+        if (historyIndex[slot].shotId != 0 && historySegment(historyIndex[slot].shotId) == segment)
+          historyIndex[slot].shotId = 0;
+      }
+    }
   }
 
-  Serial.print("Publishing payload: ");
-  Serial.println(payloadBuffer);
-  publishData("profiling_target", payloadBuffer, true);
+  historyWriter.file = LittleFS.open(path, FILE_APPEND);
+  if (!historyWriter.file)
+    return false;
+  historyWriter.offset = historyWriter.file.size();
+  return true;
 }
 
-void profilingEntryFieldReleased(uint8_t id)
+// Encodes the samples as soon as the chart stops recording, so a new shot never waits on the encoder
+void archiveCompletedShot()
 {
-  isItemSelected = true;
-  currentSelectionIndex = id + 1;
-  lastPageForSelection = currentPage;
+  if (!historyAvailable || !shotMetrics.complete || shotMetrics.archived || shotIsActive || historyWriter.pending)
+    return;
+  shotMetrics.archived = true;
+  if (shotMetrics.pumpOnTimeS < SHOT_START_THRESHOLD_S || shotSampleCount == 0)
+    return;
+
+  ShotRecordHeader header;
+  memset(&header, 0, sizeof(header));
+  header.magic = SHOT_RECORD_MAGIC;
+  header.version = SHOT_RECORD_VERSION;
+  header.sampleIntervalMs = SHOT_SAMPLE_INTERVAL_MS;
+  header.shotId = nextShotId++;
+  header.sampleCount = shotSampleCount;
+  header.profileIndex = currentProfileIndex;
+  strlcpy(header.profileName, currentProfile->name, sizeof(header.profileName));
+  strlcpy(header.profilingMode, profilingMode, sizeof(header.profilingMode));
+  header.dose = doseWeight;
+  header.brewTempSetPoint = brewTempSetPoint / TEMP_SETPOINT_SCALE;
+  header.phaseEventCount = phaseDetector.eventCount;
+  for (int i = 0; i < phaseDetector.eventCount; i++)
+  {
+    header.phaseEvents[i].phase = phaseDetector.events[i].phase;
+    header.phaseEvents[i].timeMs = phaseDetector.events[i].timeMs;
+    header.phaseEvents[i].weight = phaseDetector.events[i].weight;
+  }
+
+  unsigned long encodeStart = micros();
+  header.encodedBytes = encodeShotSamples(shotSamples, shotSampleCount, historyRecordBuffer + sizeof(header),
+                                          HISTORY_MAX_ENCODED_BYTES, header.channelOrders);
+  memcpy(historyRecordBuffer, &header, sizeof(header));
+
+  historyWriter.shotId = header.shotId;
+  historyWriter.written = 0;
+  historyWriter.total = sizeof(header) + header.encodedBytes;
+  historyWriter.fileOpen = false;
+  historyWriter.metricsFinal = false;
+  historyWriter.pending = true;
+
+  // Raw is what the same samples would take as floats; the stored size includes the record header
+  size_t rawBytes = (size_t)shotSampleCount * HISTORY_CHANNELS * sizeof(float);
+  Serial.printf("Shot %lu encoded: %d samples, %u bytes stored (%.1fx vs raw floats) in %lu us\n",
+                (unsigned long)header.shotId, shotSampleCount, (unsigned)historyWriter.total,
+                (float)rawBytes / historyWriter.total, micros() - encodeStart);
 }
 
-// --- Machine Logic & Simulation ---
-void simulateShot()
+// Copies the final yield and drip into the encoded record; runs when the drip window closes or the next shot starts
+void finalizeShotRecord()
 {
-  static bool simulationActive = false;
-  static unsigned long simulationStartTime = 0;
-  static bool pumpCutoffReached = false;
-
-  // --- TIMING CONFIGURATION ---
-  const float pumpDurationS = 34.5;
-  const float flowStartS = 4.0;  // First drips
-  const float rampStartS = 14.0; // Start of the high-flow "Mountain"
+  if (!historyWriter.pending || historyWriter.metricsFinal)
+    return;
+  ShotRecordHeader *header = (ShotRecordHeader *)historyRecordBuffer;
+  ShotRecordMetrics &m = header->metrics;
+  m.preinfusionMs = shotMetrics.preinfusionMs;
+  m.firstDropMs = shotMetrics.firstDropMs;
+  m.pumpOnTimeS = shotMetrics.pumpOnTimeS;
+  m.peakPressure = shotMetrics.peakPressure;
+  m.peakFlow = shotMetrics.peakFlow;
+  m.yield = shotMetrics.yield;
+  m.brewRatio = shotMetrics.brewRatio;
+  m.drip = shotMetrics.drip;
+  m.boilerTempAtStart = shotMetrics.boilerTempAtStart;
+  m.hxTempAtStart = shotMetrics.hxTempAtStart;
+  m.peakResistance = shotMetrics.peakResistance;
+  m.minResistance = shotMetrics.minResistance;
+  historyWriter.metricsFinal = true;
+}
 
-  // --- TARGETS ---
-  const float targetYield = 40.0;
-  const float finalDripYield = 44.5;
+void serviceShotHistory()
+{
+  archiveCompletedShot();
+  if (!historyWriter.pending)
+    return;
+  if (!historyWriter.metricsFinal && hmiMillis() - shotMetrics.pumpOffMs > SHOT_RETENTION_TIME_MS)
+  {
+    finalizeShotRecord();
+  }
+  // Flash writes wait until the shot is over so they never stall the chart
+  if (!historyWriter.metricsFinal || shotIsActive)
+    return;
 
-  // Pressure Profile Targets
-  const float maxPressure = 9.0; // Peak pressure during the "Shelf"
-  const float endPressure = 7.5; // Target pressure at 34.5s (User request: 7-8 bar)
+  if (!historyWriter.fileOpen)
+  {
+    if (!openHistorySegment(historyWriter.shotId))
+    {
+      Serial.println("Failed to open shot history segment for writing.");
+      historyWriter.pending = false;
+      return;
+    }
+    historyWriter.fileOpen = true;
+    historyIndex[historyWriter.shotId % HISTORY_SLOTS].shotId = 0;
+  }
 
-  // Flow Configuration
-  const float shelfFlowRate = 0.6;
+  size_t chunk = min(HISTORY_WRITE_CHUNK, historyWriter.total - historyWriter.written);
+  historyWriter.file.write(historyRecordBuffer + historyWriter.written, chunk);
+  historyWriter.written += chunk;
+  if (historyWriter.written < historyWriter.total)
+    return;
 
-  // --- DYNAMIC FLOW CALCULATION (Same as before) ---
-  const float durationShelf = rampStartS - flowStartS;
-  const float durationRamp = pumpDurationS - rampStartS;
-  const float weightAccumulatedOnShelf = durationShelf * shelfFlowRate;
-  const float weightNeededInRamp = targetYield - weightAccumulatedOnShelf;
-  const float peakFlowRate = (2.0f * weightNeededInRamp / durationRamp) - shelfFlowRate;
+  historyWriter.file.close();
+  historyWriter.fileOpen = false;
+  historyWriter.pending = false;
 
-  unsigned long currentTime = millis();
+  const ShotRecordHeader *header = (const ShotRecordHeader *)historyRecordBuffer;
+  HistoryIndexEntry &entry = historyIndex[historyWriter.shotId % HISTORY_SLOTS];
+  entry.shotId = historyWriter.shotId;
+  entry.offset = historyWriter.offset;
+  entry.sampleCount = header->sampleCount;
+  entry.recordBytes = historyWriter.total;
+}
 
-  // Start Logic
-  if (!simulationActive && (pumpIsOn || shotTime > 0))
+// Residuals use a Gorilla-style prefix code: 0 | 10+2b | 110+4b | 1110+8b | 1111+20b
+static void writeBits(uint8_t *out, size_t capacity, size_t &bitPos, uint32_t value, int bits)
+{
+  for (int i = bits - 1; i >= 0; i--)
   {
-    simulationActive = true;
-    simulationStartTime = currentTime;
-    pumpCutoffReached = false;
-    weight = 0.0f;
-    flowRate = 0.0f;
-    pressure = 0.0f;
-
-    strlcpy(machineState, "BREWING", sizeof(machineState));
-    strlcpy(profilingMode, "profile", sizeof(profilingMode));
+    size_t byteIndex = bitPos >> 3;
+    if (byteIndex >= capacity)
+      return;
+    if (value & (1UL << i))
+      out[byteIndex] |= (0x80 >> (bitPos & 7));
+    bitPos++;
   }
+}
 
-  if (simulationActive)
+static uint32_t readBits(const uint8_t *data, size_t size, size_t &bitPos, int bits)
+{
+  uint32_t value = 0;
+  for (int i = 0; i < bits; i++)
   {
-    float t = (currentTime - simulationStartTime) / 1000.0f;
+    size_t byteIndex = bitPos >> 3;
+    uint32_t bit = (byteIndex < size) ? (data[byteIndex] >> (7 - (bitPos & 7))) & 1 : 0;
+    value = (value << 1) | bit;
+    bitPos++;
+  }
+  return value;
+}
 
-    // ============================================================
-    // 1. PRESSURE (Physics-Based Decay)
-    // ============================================================
-    if (t <= pumpDurationS)
-    {
-      pumpIsOn = true;
-      float baseP = 0.0f;
+static int residualBits(int32_t residual)
+{
+  uint32_t zigzag = ((uint32_t)residual << 1) ^ (uint32_t)(residual >> 31);
+  if (zigzag == 0)
+    return 1;
+  if (zigzag <= 4)
+    return 4;
+  if (zigzag <= 20)
+    return 7;
+  if (zigzag <= 276)
+    return 12;
+  return 24;
+}
 
-      if (t < 2.0)
-      {
-        // Phase 0: Chaotic fill
-        baseP = t + (random(-20, 20) / 100.0f);
-      }
-      else if (t < 5.0)
-      {
-        // Phase 1: Ramp to Max
-        baseP = mapf(t, 2.0, 5.0, 2.0, maxPressure);
-      }
-      else if (t < rampStartS)
-      {
-        // Phase 2: The "Shelf" -> High resistance, maintain Max Pressure
-        baseP = maxPressure;
-      }
-      else
-      {
-        // Phase 3: The "Mountain" -> Resistance drops, Pressure decays
-        // Linearly interpolate from 9.0 down to 7.5 over the ramp duration
-        baseP = mapf(t, rampStartS, pumpDurationS, maxPressure, endPressure);
-      }
+static void writeResidual(uint8_t *out, size_t capacity, size_t &bitPos, int32_t residual)
+{
+  uint32_t zigzag = ((uint32_t)residual << 1) ^ (uint32_t)(residual >> 31);
+  if (zigzag == 0)
+    writeBits(out, capacity, bitPos, 0, 1);
+  else if (zigzag <= 4)
+    writeBits(out, capacity, bitPos, (0x2 << 2) | (zigzag - 1), 4);
+  else if (zigzag <= 20)
+    writeBits(out, capacity, bitPos, (0x6 << 4) | (zigzag - 5), 7);
+  else if (zigzag <= 276)
+    writeBits(out, capacity, bitPos, (0xE << 8) | (zigzag - 21), 12);
+  else
+  {
+    writeBits(out, capacity, bitPos, 0xF, 4);
+    writeBits(out, capacity, bitPos, zigzag, 20);
+  }
+}
 
-      // Add vibratory pump noise
-      pressure = baseP + (random(-15, 15) / 100.0f);
-      pressure = max(0.0f, pressure);
-    }
-    else
-    {
-      // Pump Cutoff
-      if (!pumpCutoffReached)
-      {
-        pumpIsOn = false;
-        pumpCutoffReached = true;
-      }
-      pressure = max(0.0f, pressure * 0.85f); // Solenoid release
-    }
+static int32_t readResidual(const uint8_t *data, size_t size, size_t &bitPos)
+{
+  uint32_t zigzag;
+  if (readBits(data, size, bitPos, 1) == 0)
+    zigzag = 0;
+  else if (readBits(data, size, bitPos, 1) == 0)
+    zigzag = readBits(data, size, bitPos, 2) + 1;
+  else if (readBits(data, size, bitPos, 1) == 0)
+    zigzag = readBits(data, size, bitPos, 4) + 5;
+  else if (readBits(data, size, bitPos, 1) == 0)
+    zigzag = readBits(data, size, bitPos, 8) + 21;
+  else
+    zigzag = readBits(data, size, bitPos, 20);
+  return (int32_t)(zigzag >> 1) ^ -(int32_t)(zigzag & 1);
+}
 
-    // ============================================================
-    // 2. FLOW PROFILE ("Mara X" Shape)
-    // ============================================================
-    float intendedFlow = 0.0f;
+static int32_t quantizeChannel(const ShotSample &sample, int channel)
+{
+  float value = (channel == 0) ? sample.pressure : (channel == 1) ? sample.flowRate
+                                                                  : sample.weight;
+  return (int32_t)lroundf(value * HISTORY_CHANNEL_SCALE[channel]);
+}
 
-    if (t < flowStartS)
+// Each channel is stored as first (delta) or second order (delta-of-delta) residuals, whichever is smaller
+size_t encodeShotSamples(const ShotSample *samples, int count, uint8_t *out, size_t capacity, uint8_t &channelOrders)
+{
+  memset(out, 0, capacity);
+  size_t bitPos = 0;
+  channelOrders = 0;
+  for (int channel = 0; channel < HISTORY_CHANNELS; channel++)
+  {
+    size_t deltaBits = 0;
+    size_t deltaOfDeltaBits = 0;
+    int32_t prev = 0;
+    int32_t prevDelta = 0;
+    for (int i = 0; i < count; i++)
     {
-      intendedFlow = 0.0f;
+      int32_t q = quantizeChannel(samples[i], channel);
+      int32_t delta = q - prev;
+      deltaBits += residualBits(delta);
+      deltaOfDeltaBits += residualBits(delta - prevDelta);
+      prev = q;
+      prevDelta = delta;
     }
-    else if (t < rampStartS)
+    bool useSecondOrder = deltaOfDeltaBits < deltaBits;
+    if (useSecondOrder)
+      channelOrders |= (1 << channel);
+
+    prev = 0;
+    prevDelta = 0;
+    for (int i = 0; i < count; i++)
     {
-      // The "Shelf"
-      intendedFlow = shelfFlowRate + (random(-5, 6) / 100.0f);
+      int32_t q = quantizeChannel(samples[i], channel);
+      int32_t delta = q - prev;
+      writeResidual(out, capacity, bitPos, useSecondOrder ? delta - prevDelta : delta);
+      prev = q;
+      prevDelta = delta;
     }
-    else if (t <= pumpDurationS)
-    {
-      // The "Mountain"
-      float progress = (t - rampStartS) / durationRamp;
-      float currentRampFlow = shelfFlowRate + (progress * (peakFlowRate - shelfFlowRate));
+  }
+  return min((bitPos + 7) / 8, capacity);
+}
 
-      // Stair-step effect
-      int steps = (int)(currentRampFlow * 10);
-      intendedFlow = (float)steps / 10.0f;
-      intendedFlow += (random(-5, 6) / 200.0f);
-    }
-    else
+bool decodeShotSamples(const uint8_t *data, size_t size, int count, uint8_t channelOrders, ShotSample *out)
+{
+  size_t bitPos = 0;
+  for (int channel = 0; channel < HISTORY_CHANNELS; channel++)
+  {
+    bool useSecondOrder = channelOrders & (1 << channel);
+    int32_t prev = 0;
+    int32_t prevDelta = 0;
+    for (int i = 0; i < count; i++)
     {
-      // Post-Pump Decay
-      float dripTime = t - pumpDurationS;
-      if (dripTime < 3.0)
-      {
-        intendedFlow = peakFlowRate * (1.0 - (dripTime / 3.0));
-      }
+      int32_t residual = readResidual(data, size, bitPos);
+      int32_t delta = useSecondOrder ? prevDelta + residual : residual;
+      int32_t q = prev + delta;
+      float value = q / HISTORY_CHANNEL_SCALE[channel];
+      if (channel == 0)
+        out[i].pressure = value;
+      else if (channel == 1)
+        out[i].flowRate = value;
       else
-      {
-        intendedFlow = 0.0f;
-        simulationActive = false;
-      }
+        out[i].weight = value;
+      out[i].target = NAN;
+      prev = q;
+      prevDelta = delta;
     }
-
-    flowRate = max(0.0f, intendedFlow);
-
-    // ============================================================
-    // 3. WEIGHT INTEGRATION
-    // ============================================================
-    static unsigned long lastLoopTime = 0;
-    float dt = (currentTime - lastLoopTime) / 1000.0f;
-    if (dt > 0.1 || dt < 0)
-      dt = 0.05;
-    lastLoopTime = currentTime;
-
-    weight += flowRate * dt;
-
-    if (t > pumpDurationS && weight > finalDripYield)
-      weight = finalDripYield;
   }
+  PuckResistanceFilter filter = {};
+  for (int i = 0; i < count; i++)
+  {
+    out[i].resistance = stepPuckResistance(filter, out[i].pressure, out[i].flowRate, SHOT_SAMPLE_INTERVAL_MS / 1000.0f);
+  }
+  return bitPos <= size * 8;
 }
 
-int getShotTime(bool pumpStatus)
+bool loadShotRecord(uint32_t shotId, ShotRecordHeader &header, ShotSample *samples)
 {
-  static unsigned long pumpStartTime = 0;
-  static int completedShotTime = 0;
-  static unsigned long leverLoweredTime = 0;
+  if (!historyAvailable || shotId == 0)
+    return false;
+  const HistoryIndexEntry &entry = historyIndex[shotId % HISTORY_SLOTS];
+  if (entry.shotId != shotId)
+    return false;
+
+  char path[24];
+  historySegmentPath(historySegment(shotId), path, sizeof(path));
+  File record = LittleFS.open(path, FILE_READ);
+  if (!record)
+    return false;
+  bool ok = record.seek(entry.offset) && record.read((uint8_t *)&header, sizeof(header)) == sizeof(header) &&
+            header.magic == SHOT_RECORD_MAGIC && header.version == SHOT_RECORD_VERSION && header.shotId == shotId &&
+            header.sampleCount <= MAX_SHOT_SAMPLES;
+  if (ok && samples != nullptr)
+  {
+    uint8_t *encoded = (uint8_t *)malloc(header.encodedBytes);
+    ok = encoded != nullptr && record.read(encoded, header.encodedBytes) == header.encodedBytes &&
+         decodeShotSamples(encoded, header.encodedBytes, header.sampleCount, header.channelOrders, samples);
+    free(encoded);
+  }
+  record.close();
+  return ok;
+}
 
-  unsigned long currentTime = millis();
-  if (pumpStatus && brewLeverLifted)
+void printShotHistory()
+{
+  if (!historyAvailable)
   {
-    leverLoweredTime = 0;
-    chartStopTime = 0;
-    if (pumpStartTime == 0)
-    {
-      pumpStartTime = currentTime;
-      shotStartTimeMillis = currentTime;
-      completedShotTime = 0;
-    }
-    unsigned long duration = currentTime - pumpStartTime;
-    return (duration > SHOT_START_THRESHOLD_S * 1000) ? duration / 1000 : 0;
+    Serial.println("Shot history unavailable.");
+    return;
   }
-  else
+  Serial.println("--- Shot History ---");
+  for (uint32_t id = nextShotId - 1; id > 0 && id + HISTORY_SLOTS >= nextShotId; id--)
   {
-    if (pumpStartTime != 0)
-    {
-      unsigned long duration = currentTime - pumpStartTime;
-      completedShotTime = (duration > SHOT_START_THRESHOLD_S * 1000) ? duration / 1000 : 0;
-      pumpStartTime = 0;
-      if (completedShotTime > 0)
-      {
-        leverLoweredTime = currentTime;
-        chartStopTime = millis() + CHART_RETENTION_TIME_MS;
-      }
-    }
-    if (leverLoweredTime != 0 && (currentTime - leverLoweredTime > SHOT_RETENTION_TIME_MS))
-    {
-      completedShotTime = 0;
-      leverLoweredTime = 0;
-    }
-    return completedShotTime;
+    const HistoryIndexEntry &entry = historyIndex[id % HISTORY_SLOTS];
+    if (entry.shotId != id)
+      continue;
+    Serial.printf("#%lu: %u samples (%.1f s), %u bytes\n", (unsigned long)id, entry.sampleCount,
+                  entry.sampleCount * SHOT_SAMPLE_INTERVAL_MS / 1000.0f, entry.recordBytes);
+  }
+}
+
+void printShotRecord(uint32_t shotId)
+{
+  ShotRecordHeader header;
+  if (!loadShotRecord(shotId, header, nullptr))
+  {
+    Serial.println("Shot not found in history.");
+    return;
   }
+  Serial.printf("Shot #%lu: profile %d '%s' (%s), setpoint %.1f C, HX %.1f C, boiler %.1f C\n",
+                (unsigned long)header.shotId, header.profileIndex, header.profileName, header.profilingMode,
+                header.brewTempSetPoint, header.metrics.hxTempAtStart, header.metrics.boilerTempAtStart);
+  Serial.printf("%u samples every %u ms, %u bytes encoded\n", header.sampleCount, header.sampleIntervalMs, header.encodedBytes);
+  Serial.printf("Yield %.1f g from %.1f g (1:%.2f), PI %.1f s, first drop %.1f s, peak %.2f bar / %.2f g/s, drip %.1f g\n",
+                header.metrics.yield, header.dose, header.metrics.brewRatio,
+                header.metrics.preinfusionMs / 1000.0f, header.metrics.firstDropMs / 1000.0f,
+                header.metrics.peakPressure, header.metrics.peakFlow, header.metrics.drip);
+  Serial.printf("Resistance peak %.2f, min %.2f\n", header.metrics.peakResistance, header.metrics.minResistance);
+  PhaseEvent events[MAX_PHASE_EVENTS];
+  int eventCount = min((int)header.phaseEventCount, MAX_PHASE_EVENTS);
+  for (int i = 0; i < eventCount; i++)
+  {
+    events[i].phase = header.phaseEvents[i].phase;
+    events[i].timeMs = header.phaseEvents[i].timeMs;
+    events[i].weight = header.phaseEvents[i].weight;
+  }
+  printPhaseEvents(events, eventCount);
+}
+
+bool pinReferenceFromHistory(uint32_t shotId)
+{
+  ShotRecordHeader header;
+  ShotSample *samples = (ShotSample *)malloc(sizeof(ShotSample) * MAX_SHOT_SAMPLES);
+  if (samples == nullptr)
+    return false;
+  bool ok = loadShotRecord(shotId, header, samples) && pinReferenceShot(samples, header.sampleCount);
+  free(samples);
+  return ok;
 }
 
 // --- PROFILE WEB SERVER FUNCTIONS ---
@@ -3136,6 +7550,24 @@ void handleProfileWebIndex()
   server.client().stop();
 }
 
+void handleApiReplayLog()
+{
+  if (replay.mode == REPLAY_RECORDING)
+  {
+    server.send(409, "text/plain", "Recording in progress");
+    return;
+  }
+  File logFile = LittleFS.open(REPLAY_LOG_PATH, FILE_READ);
+  if (!logFile)
+  {
+    server.send(404, "text/plain", "No replay log");
+    return;
+  }
+  server.sendHeader("Content-Disposition", "attachment; filename=replay.bin");
+  server.streamFile(logFile, "application/octet-stream");
+  logFile.close();
+}
+
 void handleApiGetProfiles()
 {
   server.sendHeader("Cache-Control", "no-cache, no-store, must-revalidate");
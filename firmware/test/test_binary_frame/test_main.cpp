@@ -0,0 +1,94 @@
+#include <unity.h>
+#include <BinaryFrame.h>
+#include <string.h>
+
+// 93.5 C boiler, 92.1 C HX, 9.12 bar, 36.15 g, 1.87 g/s, pump on with a pump start, as tools/controller_sim.py encodes it
+static const TelemetryPayload SAMPLE = {935, 921, 912, 3615, 187, TELEMETRY_FLAG_PUMP | TELEMETRY_FLAG_PUMP_START, 123456, 120000};
+static const uint8_t SAMPLE_FRAME[] = {0xB5, 0x01, 0x01, 0x2A, 0x15, 0xA7, 0x03, 0x99, 0x03, 0x90, 0x03, 0x1F, 0x0E, 0x00,
+                                       0x00, 0xBB, 0x00, 0x09, 0x40, 0xE2, 0x01, 0x00, 0xC0, 0xD4, 0x01, 0x00, 0x3C, 0xF2};
+
+void test_crc_check_value(void)
+{
+  // CRC-16/CCITT-FALSE check value
+  TEST_ASSERT_EQUAL_UINT32(0x29B1, crc16Ccitt((const uint8_t *)"123456789", 9));
+}
+
+void test_telemetry_encodes_like_the_controller(void)
+{
+  uint8_t frame[TELEMETRY_FRAME_LEN];
+  TEST_ASSERT_EQUAL_INT(sizeof(SAMPLE_FRAME), TELEMETRY_FRAME_LEN);
+  TEST_ASSERT_EQUAL_INT(TELEMETRY_FRAME_LEN, encodeBinaryFrame(frame, MSG_TELEMETRY, 42, &SAMPLE, sizeof(SAMPLE)));
+  TEST_ASSERT_EQUAL_INT(0, memcmp(SAMPLE_FRAME, frame, sizeof(frame)));
+}
+
+void test_telemetry_round_trip(void)
+{
+  uint8_t frame[TELEMETRY_FRAME_LEN];
+  encodeBinaryFrame(frame, MSG_TELEMETRY, 7, &SAMPLE, sizeof(SAMPLE));
+  TEST_ASSERT_EQUAL_INT(BINARY_FRAME_OK, checkBinaryFrame(frame, sizeof(frame), MSG_TELEMETRY, sizeof(TelemetryPayload)));
+
+  BinaryFrameHeader header;
+  TelemetryPayload decoded;
+  memcpy(&header, frame, sizeof(header));
+  memcpy(&decoded, frame + sizeof(header), sizeof(decoded));
+  TEST_ASSERT_EQUAL_UINT8(BINARY_FRAME_MAGIC, header.magic);
+  TEST_ASSERT_EQUAL_UINT8(7, header.seq);
+  TEST_ASSERT_EQUAL_INT(0, memcmp(&SAMPLE, &decoded, sizeof(decoded)));
+}
+
+// A CRC-16 catches every single-bit error; flips in the header may be caught as malformed first
+void test_every_bit_flip_is_rejected(void)
+{
+  uint8_t frame[TELEMETRY_FRAME_LEN];
+  encodeBinaryFrame(frame, MSG_TELEMETRY, 1, &SAMPLE, sizeof(SAMPLE));
+  for (int byte = 1; byte < TELEMETRY_FRAME_LEN; byte++)
+  {
+    for (int bit = 0; bit < 8; bit++)
+    {
+      frame[byte] ^= (1 << bit);
+      BinaryFrameCheck check = checkBinaryFrame(frame, sizeof(frame), MSG_TELEMETRY, sizeof(TelemetryPayload));
+      TEST_ASSERT_TRUE(check != BINARY_FRAME_OK);
+      if (byte >= (int)sizeof(BinaryFrameHeader))
+        TEST_ASSERT_EQUAL_INT(BINARY_FRAME_BAD_CRC, check);
+      frame[byte] ^= (1 << bit);
+    }
+  }
+  TEST_ASSERT_EQUAL_INT(BINARY_FRAME_OK, checkBinaryFrame(frame, sizeof(frame), MSG_TELEMETRY, sizeof(TelemetryPayload)));
+}
+
+void test_wrong_type_or_length_is_malformed(void)
+{
+  uint8_t frame[TELEMETRY_FRAME_LEN];
+  encodeBinaryFrame(frame, MSG_TELEMETRY, 1, &SAMPLE, sizeof(SAMPLE));
+  TEST_ASSERT_EQUAL_INT(BINARY_FRAME_MALFORMED, checkBinaryFrame(frame, sizeof(frame), MSG_FRAGMENT, sizeof(TelemetryPayload)));
+  TEST_ASSERT_EQUAL_INT(BINARY_FRAME_MALFORMED, checkBinaryFrame(frame, sizeof(frame) - 1, MSG_TELEMETRY, sizeof(TelemetryPayload)));
+  TEST_ASSERT_EQUAL_INT(BINARY_FRAME_MALFORMED, checkBinaryFrame(frame, sizeof(frame), MSG_TELEMETRY, sizeof(TelemetryPayload) - 1));
+  TEST_ASSERT_EQUAL_INT(BINARY_FRAME_MALFORMED, checkBinaryFrame(frame, 3, MSG_TELEMETRY, sizeof(TelemetryPayload)));
+}
+
+void test_variable_payload_round_trip(void)
+{
+  uint8_t payload[200];
+  uint8_t frame[sizeof(BinaryFrameHeader) + sizeof(payload) + 2];
+  for (int len = 0; len <= (int)sizeof(payload); len += 25)
+  {
+    for (int i = 0; i < len; i++)
+      payload[i] = (uint8_t)(i * 37 + len);
+    int frameLen = encodeBinaryFrame(frame, MSG_FRAGMENT, (uint8_t)len, payload, len);
+    TEST_ASSERT_EQUAL_INT((int)sizeof(BinaryFrameHeader) + len + 2, frameLen);
+    TEST_ASSERT_EQUAL_INT(BINARY_FRAME_OK, checkBinaryFrame(frame, frameLen, MSG_FRAGMENT, len));
+    TEST_ASSERT_EQUAL_INT(0, memcmp(payload, frame + sizeof(BinaryFrameHeader), len));
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_crc_check_value);
+  RUN_TEST(test_telemetry_encodes_like_the_controller);
+  RUN_TEST(test_telemetry_round_trip);
+  RUN_TEST(test_every_bit_flip_is_rejected);
+  RUN_TEST(test_wrong_type_or_length_is_malformed);
+  RUN_TEST(test_variable_payload_round_trip);
+  return UNITY_END();
+}
@@ -0,0 +1,129 @@
+#include <unity.h>
+#include <ProfileCompiler.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+// Pressure over time: pre-infusion, ramp, hold and decline, with a zero-length step that only sets the start value
+static const ProfileStep TIME_STEPS[] = {{2.0f, 0.0f}, {2.0f, 6.0f}, {9.0f, 4.0f}, {9.0f, 16.0f}, {6.0f, 6.5f}};
+// Flow over weight: grams as control, including fractional weights that do not add up exactly in float
+static const ProfileStep WEIGHT_STEPS[] = {{1.5f, 3.3f}, {2.2f, 7.7f}, {0.0f, 0.0005f}, {2.0f, 18.1f}, {1.1f, 10.9f}};
+
+static CompiledProfile compiled;
+
+static uint32_t floatBits(float value)
+{
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  return bits;
+}
+
+static void assertLookupMatches(const ProfileStep *steps, int numSteps, bool isStepped, float x)
+{
+  float expected = getProfileTargetAt(steps, numSteps, isStepped, x);
+  float actual = getCompiledProfileTargetAt(compiled, x);
+  TEST_ASSERT_EQUAL_HEX32(floatBits(expected), floatBits(actual));
+}
+
+// Sweeps past both ends, then hits every segment boundary and the floats right next to it
+static void assertCompiledMatchesWalk(const ProfileStep *steps, int numSteps, bool isStepped)
+{
+  compileProfile(compiled, steps, numSteps, isStepped);
+  float endX = compiled.numSegments > 0 ? compiled.segments[compiled.numSegments - 1].endX : 0.0f;
+  for (float x = -1.0f; x <= endX + 5.0f; x += 0.01f)
+  {
+    assertLookupMatches(steps, numSteps, isStepped, x);
+  }
+  for (int i = 0; i < compiled.numSegments; i++)
+  {
+    const float boundaries[2] = {compiled.segments[i].startX, compiled.segments[i].endX};
+    for (int b = 0; b < 2; b++)
+    {
+      assertLookupMatches(steps, numSteps, isStepped, boundaries[b]);
+      assertLookupMatches(steps, numSteps, isStepped, nextafterf(boundaries[b], -INFINITY));
+      assertLookupMatches(steps, numSteps, isStepped, nextafterf(boundaries[b], INFINITY));
+    }
+  }
+  assertLookupMatches(steps, numSteps, isStepped, endX + 1000.0f);
+  assertLookupMatches(steps, numSteps, isStepped, INFINITY);
+}
+
+void test_time_profile_stepped(void)
+{
+  assertCompiledMatchesWalk(TIME_STEPS, 5, true);
+}
+
+void test_time_profile_ramped(void)
+{
+  assertCompiledMatchesWalk(TIME_STEPS, 5, false);
+}
+
+void test_weight_profile_stepped(void)
+{
+  assertCompiledMatchesWalk(WEIGHT_STEPS, 5, true);
+}
+
+void test_weight_profile_ramped(void)
+{
+  assertCompiledMatchesWalk(WEIGHT_STEPS, 5, false);
+}
+
+void test_full_length_profile(void)
+{
+  ProfileStep steps[MAX_PROFILE_STEPS];
+  for (int i = 0; i < MAX_PROFILE_STEPS; i++)
+  {
+    steps[i].target = 1.0f + (i % 17) * 0.55f;
+    steps[i].control = (i % 9 == 0) ? 0.0f : 0.1f + (i % 5) * 0.37f;
+  }
+  assertCompiledMatchesWalk(steps, MAX_PROFILE_STEPS, true);
+  assertCompiledMatchesWalk(steps, MAX_PROFILE_STEPS, false);
+}
+
+void test_past_last_step_holds_final_target(void)
+{
+  compileProfile(compiled, TIME_STEPS, 5, false);
+  TEST_ASSERT_EQUAL_INT(compiled.numSegments, findCompiledSegment(compiled, 100.0f));
+  TEST_ASSERT_EQUAL_HEX32(floatBits(6.0f), floatBits(getCompiledProfileTargetAt(compiled, 100.0f)));
+  TEST_ASSERT_EQUAL_INT(4, compiled.segments[compiled.numSegments - 1].stepIndex);
+}
+
+void test_empty_profile(void)
+{
+  compileProfile(compiled, TIME_STEPS, 0, false);
+  TEST_ASSERT_EQUAL_INT(0, compiled.numSegments);
+  TEST_ASSERT_EQUAL_HEX32(floatBits(0.0f), floatBits(getCompiledProfileTargetAt(compiled, 3.0f)));
+  TEST_ASSERT_EQUAL_HEX32(floatBits(0.0f), floatBits(getProfileTargetAt(TIME_STEPS, 0, false, 3.0f)));
+}
+
+// The per-sample table the chart uses for time-based profiles
+void test_time_target_table(void)
+{
+  const int count = 600;
+  const int intervalMs = 100;
+  static float table[count];
+  for (int stepped = 0; stepped < 2; stepped++)
+  {
+    compileProfile(compiled, TIME_STEPS, 5, stepped);
+    fillTimeTargetTable(compiled, table, count, intervalMs);
+    for (int i = 0; i < count; i++)
+    {
+      float expected = getProfileTargetAt(TIME_STEPS, 5, stepped, i * intervalMs / 1000.0f);
+      TEST_ASSERT_EQUAL_HEX32(floatBits(expected), floatBits(table[i]));
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_time_profile_stepped);
+  RUN_TEST(test_time_profile_ramped);
+  RUN_TEST(test_weight_profile_stepped);
+  RUN_TEST(test_weight_profile_ramped);
+  RUN_TEST(test_full_length_profile);
+  RUN_TEST(test_past_last_step_holds_final_target);
+  RUN_TEST(test_empty_profile);
+  RUN_TEST(test_time_target_table);
+  return UNITY_END();
+}
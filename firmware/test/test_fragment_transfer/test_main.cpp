@@ -0,0 +1,207 @@
+#include <unity.h>
+#include <FragmentTransfer.h>
+#include <stdio.h>
+#include <string.h>
+
+static IncomingTransfer slots[FRAGMENT_TRANSFER_SLOTS];
+static FragmentStats stats;
+static char message[FRAGMENT_MAX_TRANSFER + 1];
+static uint8_t frames[32][FRAGMENT_FRAME_LEN];
+
+static void resetReceiver(void)
+{
+  memset(slots, 0, sizeof(slots));
+  memset(&stats, 0, sizeof(stats));
+}
+
+// A full-length profile the way saveProfile() serializes it, behind the topic the controller sends it under
+static int buildProfileMessage(int steps)
+{
+  int len = snprintf(message, sizeof(message), "profile_data={\"id\":4,\"v\":17,\"n\":\"Loopback\",\"m\":0,\"s\":[");
+  for (int i = 0; i < steps; i++)
+  {
+    len += snprintf(message + len, sizeof(message) - len, "%s[%d.%d,%d.%d]", i > 0 ? "," : "", (i * 37) % 120,
+                    i % 10, (i * 11) % 60, (i * 7) % 10);
+  }
+  len += snprintf(message + len, sizeof(message) - len, "]}");
+  return len;
+}
+
+static int encodeMessage(uint8_t transferId, int len)
+{
+  int count = fragmentCount(len);
+  for (int index = 0; index < count; index++)
+  {
+    encodeFragmentFrame(frames[index], index, transferId, message, len, index);
+  }
+  return count;
+}
+
+// What handleFragmentFrame() does with a frame off the radio
+static char *receiveFrame(const uint8_t *frame, unsigned long nowMs)
+{
+  if (checkBinaryFrame(frame, FRAGMENT_FRAME_LEN, MSG_FRAGMENT, sizeof(FragmentPayload)) != BINARY_FRAME_OK)
+    return nullptr;
+  FragmentPayload fragment;
+  memcpy(&fragment, frame + sizeof(BinaryFrameHeader), sizeof(fragment));
+  return reassembleFragment(slots, fragment, nowMs, stats);
+}
+
+void test_full_profile_round_trip(void)
+{
+  resetReceiver();
+  int len = buildProfileMessage(128);
+  TEST_ASSERT_TRUE(len < FRAGMENT_MAX_TRANSFER);
+  int count = encodeMessage(7, len);
+  TEST_ASSERT_TRUE(count > 1);
+  char *received = nullptr;
+  for (int index = 0; index < count; index++)
+  {
+    TEST_ASSERT_EQUAL_INT(BINARY_FRAME_OK,
+                          checkBinaryFrame(frames[index], FRAGMENT_FRAME_LEN, MSG_FRAGMENT, sizeof(FragmentPayload)));
+    received = receiveFrame(frames[index], 1000);
+    if (index < count - 1)
+      TEST_ASSERT_TRUE(received == nullptr);
+  }
+  TEST_ASSERT_TRUE(received != nullptr);
+  TEST_ASSERT_EQUAL_INT(len, strlen(received));
+  TEST_ASSERT_EQUAL_STRING(message, received);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.transfersReceived);
+  TEST_ASSERT_EQUAL_UINT32(count, stats.fragmentsReceived);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.rejected);
+}
+
+void test_out_of_order_and_duplicate_fragments(void)
+{
+  resetReceiver();
+  int len = buildProfileMessage(128);
+  int count = encodeMessage(9, len);
+  char *received = nullptr;
+  for (int index = count - 1; index > 0; index--)
+  {
+    TEST_ASSERT_TRUE(receiveFrame(frames[index], 1000) == nullptr);
+    TEST_ASSERT_TRUE(receiveFrame(frames[index], 1000) == nullptr);
+  }
+  received = receiveFrame(frames[0], 1000);
+  TEST_ASSERT_TRUE(received != nullptr);
+  TEST_ASSERT_EQUAL_STRING(message, received);
+}
+
+// Two transfers in flight at once each reassemble into their own slot
+void test_interleaved_transfers(void)
+{
+  resetReceiver();
+  static uint8_t shortFrames[32][FRAGMENT_FRAME_LEN];
+  static char shortMessage[FRAGMENT_MAX_TRANSFER + 1];
+  int shortLen = buildProfileMessage(40);
+  memcpy(shortMessage, message, shortLen + 1);
+  int shortCount = encodeMessage(1, shortLen);
+  memcpy(shortFrames, frames, sizeof(frames));
+  int len = buildProfileMessage(128);
+  int count = encodeMessage(2, len);
+
+  char *shortReceived = nullptr;
+  char *received = nullptr;
+  for (int index = 0; index < count; index++)
+  {
+    if (index < shortCount)
+      shortReceived = receiveFrame(shortFrames[index], 1000);
+    if (index == shortCount - 1)
+    {
+      TEST_ASSERT_TRUE(shortReceived != nullptr);
+      TEST_ASSERT_EQUAL_STRING(shortMessage, shortReceived);
+    }
+    received = receiveFrame(frames[index], 1000);
+  }
+  TEST_ASSERT_TRUE(received != nullptr);
+  TEST_ASSERT_EQUAL_STRING(message, received);
+  TEST_ASSERT_EQUAL_UINT32(2, stats.transfersReceived);
+}
+
+void test_stalled_transfer_times_out(void)
+{
+  resetReceiver();
+  int len = buildProfileMessage(128);
+  int count = encodeMessage(3, len);
+  for (int index = 0; index < count - 1; index++)
+    receiveFrame(frames[index], 1000);
+  TEST_ASSERT_TRUE(receiveFrame(frames[count - 1], 1000 + FRAGMENT_REASSEMBLY_TIMEOUT_MS + 1) == nullptr);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.timeouts);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.transfersReceived);
+}
+
+// A third transfer has no slot while two are still being reassembled
+void test_no_free_slot_is_rejected(void)
+{
+  resetReceiver();
+  int len = buildProfileMessage(128);
+  encodeMessage(1, len);
+  receiveFrame(frames[0], 1000);
+  encodeMessage(2, len);
+  receiveFrame(frames[0], 1000);
+  encodeMessage(3, len);
+  TEST_ASSERT_TRUE(receiveFrame(frames[0], 1000) == nullptr);
+  TEST_ASSERT_EQUAL_UINT32(1, stats.rejected);
+}
+
+void test_inconsistent_fragments_are_rejected(void)
+{
+  resetReceiver();
+  int len = buildProfileMessage(128);
+  encodeMessage(5, len);
+  FragmentPayload fragment;
+  memcpy(&fragment, frames[0] + sizeof(BinaryFrameHeader), sizeof(fragment));
+
+  FragmentPayload bad = fragment;
+  bad.count++;
+  TEST_ASSERT_TRUE(reassembleFragment(slots, bad, 1000, stats) == nullptr);
+  bad = fragment;
+  bad.index = bad.count;
+  TEST_ASSERT_TRUE(reassembleFragment(slots, bad, 1000, stats) == nullptr);
+  bad = fragment;
+  bad.totalLen = 0;
+  bad.count = 0;
+  TEST_ASSERT_TRUE(reassembleFragment(slots, bad, 1000, stats) == nullptr);
+  bad = fragment;
+  bad.totalLen = FRAGMENT_MAX_TRANSFER + 1;
+  bad.count = fragmentCount(bad.totalLen);
+  TEST_ASSERT_TRUE(reassembleFragment(slots, bad, 1000, stats) == nullptr);
+  TEST_ASSERT_EQUAL_UINT32(4, stats.rejected);
+  TEST_ASSERT_EQUAL_UINT32(0, stats.fragmentsReceived);
+
+  // A fragment claiming a different length than the transfer it joins
+  TEST_ASSERT_TRUE(reassembleFragment(slots, fragment, 1000, stats) == nullptr);
+  bad = fragment;
+  bad.index = 1;
+  bad.totalLen -= FRAGMENT_DATA_BYTES;
+  bad.count = fragmentCount(bad.totalLen);
+  TEST_ASSERT_TRUE(reassembleFragment(slots, bad, 1000, stats) == nullptr);
+  TEST_ASSERT_EQUAL_UINT32(5, stats.rejected);
+}
+
+void test_largest_transfer_round_trip(void)
+{
+  resetReceiver();
+  for (int i = 0; i < FRAGMENT_MAX_TRANSFER; i++)
+    message[i] = 'a' + i % 26;
+  message[FRAGMENT_MAX_TRANSFER] = '\0';
+  int count = encodeMessage(11, FRAGMENT_MAX_TRANSFER);
+  char *received = nullptr;
+  for (int index = 0; index < count; index++)
+    received = receiveFrame(frames[index], 1000);
+  TEST_ASSERT_TRUE(received != nullptr);
+  TEST_ASSERT_EQUAL_STRING(message, received);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_full_profile_round_trip);
+  RUN_TEST(test_out_of_order_and_duplicate_fragments);
+  RUN_TEST(test_interleaved_transfers);
+  RUN_TEST(test_stalled_transfer_times_out);
+  RUN_TEST(test_no_free_slot_is_rejected);
+  RUN_TEST(test_inconsistent_fragments_are_rejected);
+  RUN_TEST(test_largest_transfer_round_trip);
+  return UNITY_END();
+}
@@ -0,0 +1,90 @@
+#include <unity.h>
+#include <ShotPhase.h>
+#include <ShotSimulator.h>
+
+// Runs a seeded simulated shot through the detector at a fixed telemetry period, starting at t=0
+static void runSimulatedShot(PhaseDetector &d, uint32_t seed, unsigned long frameMs)
+{
+  SimulatedShot sim;
+  startSimulatedShot(sim, 0, seed);
+  stepSimulatedShot(sim, 0);
+  startPhaseDetector(d, 0, 0, sim.weight);
+  for (unsigned long now = frameMs; sim.active; now += frameMs)
+  {
+    stepSimulatedShot(sim, now);
+    stepPhaseDetector(d, now, sim.pressure, sim.flowRate, sim.weight, sim.pumpOn);
+  }
+}
+
+static void assertPhasesInOrder(const PhaseDetector &d)
+{
+  const ShotPhase expected[] = {PHASE_FILL, PHASE_PREINFUSION, PHASE_RAMP, PHASE_MAIN, PHASE_DECLINE, PHASE_DRIP};
+  const int expectedCount = sizeof(expected) / sizeof(expected[0]);
+  TEST_ASSERT_EQUAL_INT(expectedCount, d.eventCount);
+  for (int i = 0; i < expectedCount; i++)
+  {
+    TEST_ASSERT_EQUAL_STRING(SHOT_PHASE_NAMES[expected[i]], SHOT_PHASE_NAMES[d.events[i].phase]);
+    if (i > 0)
+      TEST_ASSERT_TRUE(d.events[i].timeMs > d.events[i - 1].timeMs);
+  }
+}
+
+// The simulator fills for 2 s, ramps to 9 bar by 5 s, decays from 14 s and cuts the pump at 34.5 s
+static void assertPhaseTimes(const PhaseDetector &d)
+{
+  TEST_ASSERT_EQUAL_UINT32(0, d.events[0].timeMs);
+  TEST_ASSERT_UINT32_WITHIN(500, 1800, d.events[1].timeMs);
+  TEST_ASSERT_UINT32_WITHIN(500, 2500, d.events[2].timeMs);
+  TEST_ASSERT_UINT32_WITHIN(1000, 6000, d.events[3].timeMs);
+  TEST_ASSERT_TRUE(d.events[4].timeMs > 14000 && d.events[4].timeMs < 34500);
+  TEST_ASSERT_UINT32_WITHIN(300, 34600, d.events[5].timeMs);
+  TEST_ASSERT_FLOAT_WITHIN(1.5f, 40.0f, d.events[5].weight);
+}
+
+void test_seeded_shots_detect_every_phase(void)
+{
+  const uint32_t seeds[] = {1, 7, 42, 1234, 987654321};
+  for (uint32_t seed : seeds)
+  {
+    PhaseDetector d;
+    runSimulatedShot(d, seed, 100);
+    assertPhasesInOrder(d);
+    assertPhaseTimes(d);
+  }
+}
+
+void test_detection_does_not_depend_on_frame_rate(void)
+{
+  const unsigned long framePeriods[] = {50, 100, 250};
+  for (unsigned long frameMs : framePeriods)
+  {
+    PhaseDetector d;
+    runSimulatedShot(d, 42, frameMs);
+    assertPhasesInOrder(d);
+    assertPhaseTimes(d);
+  }
+}
+
+void test_same_seed_gives_same_events(void)
+{
+  PhaseDetector first;
+  PhaseDetector second;
+  runSimulatedShot(first, 1234, 100);
+  runSimulatedShot(second, 1234, 100);
+  TEST_ASSERT_EQUAL_INT(first.eventCount, second.eventCount);
+  for (int i = 0; i < first.eventCount; i++)
+  {
+    TEST_ASSERT_EQUAL_UINT8(first.events[i].phase, second.events[i].phase);
+    TEST_ASSERT_EQUAL_UINT32(first.events[i].timeMs, second.events[i].timeMs);
+    TEST_ASSERT_EQUAL_FLOAT(first.events[i].weight, second.events[i].weight);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_seeded_shots_detect_every_phase);
+  RUN_TEST(test_detection_does_not_depend_on_frame_rate);
+  RUN_TEST(test_same_seed_gives_same_events);
+  return UNITY_END();
+}
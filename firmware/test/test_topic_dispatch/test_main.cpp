@@ -0,0 +1,96 @@
+#include <unity.h>
+#include <TopicKeys.h>
+#include <string.h>
+
+// The strcmp chain handleIncomingMessage used before the hash switch, as a reference
+static IncomingTopic lookupByStrcmp(const char *key)
+{
+  for (int topic = 1; topic < TOPIC_COUNT; topic++)
+  {
+    if (strcmp(key, INCOMING_TOPIC_KEYS[topic]) == 0)
+      return (IncomingTopic)topic;
+  }
+  return TOPIC_UNKNOWN;
+}
+
+// The telemetry frame dispatch_bench replays (a shot with the debug scale stream), plus the controller timestamp
+static const char *const KEY_MIX[] = {mqtt_topic_boiler_temp, mqtt_topic_hx_temp, mqtt_topic_pressure, mqtt_topic_heater,
+                                      mqtt_topic_pump, mqtt_topic_weight, mqtt_topic_flow_rate, "raw_weight",
+                                      "filtered_weight", "filtered_flow", mqtt_topic_timestamp};
+
+// Outgoing-only topics, typos, prefixes and suffixes of real keys
+static const char *const UNKNOWN_KEYS[] = {"", "request", mqtt_topic_ping, mqtt_topic_subscribe, "weigh", "weightt",
+                                           "Weight", "pump_", "pum", "boiler_temp ", "profile_dat", "profile_data_",
+                                           "caps\x01", "ackk", "filtered", "raw_weight2", "mqtt_", "ts0"};
+
+void test_every_key_dispatches_to_itself(void)
+{
+  for (int topic = 1; topic < TOPIC_COUNT; topic++)
+  {
+    TEST_ASSERT_EQUAL_INT(topic, lookupIncomingTopic(INCOMING_TOPIC_KEYS[topic]));
+  }
+}
+
+void test_key_mix_matches_strcmp_chain(void)
+{
+  const int mixCount = sizeof(KEY_MIX) / sizeof(KEY_MIX[0]);
+  for (int k = 0; k < mixCount; k++)
+  {
+    TEST_ASSERT_TRUE(lookupByStrcmp(KEY_MIX[k]) != TOPIC_UNKNOWN);
+    TEST_ASSERT_EQUAL_INT(lookupByStrcmp(KEY_MIX[k]), lookupIncomingTopic(KEY_MIX[k]));
+  }
+}
+
+void test_unknown_keys_match_nothing(void)
+{
+  const int unknownCount = sizeof(UNKNOWN_KEYS) / sizeof(UNKNOWN_KEYS[0]);
+  for (int k = 0; k < unknownCount; k++)
+  {
+    TEST_ASSERT_EQUAL_INT(TOPIC_UNKNOWN, lookupByStrcmp(UNKNOWN_KEYS[k]));
+    TEST_ASSERT_EQUAL_INT(TOPIC_UNKNOWN, lookupIncomingTopic(UNKNOWN_KEYS[k]));
+  }
+}
+
+// Every one- and two-character edit of every key must agree with the strcmp chain
+void test_edited_keys_match_strcmp_chain(void)
+{
+  char edited[32];
+  for (int topic = 1; topic < TOPIC_COUNT; topic++)
+  {
+    const char *key = INCOMING_TOPIC_KEYS[topic];
+    size_t len = strlen(key);
+    for (size_t pos = 0; pos < len; pos++)
+    {
+      for (int c = 0x20; c < 0x7F; c++)
+      {
+        strcpy(edited, key);
+        edited[pos] = (char)c;
+        TEST_ASSERT_EQUAL_INT(lookupByStrcmp(edited), lookupIncomingTopic(edited));
+        edited[(pos + 1) % len] = (char)(0x7E - (c - 0x20));
+        TEST_ASSERT_EQUAL_INT(lookupByStrcmp(edited), lookupIncomingTopic(edited));
+      }
+    }
+  }
+}
+
+void test_hashes_are_distinct(void)
+{
+  for (int a = 1; a < TOPIC_COUNT; a++)
+  {
+    for (int b = a + 1; b < TOPIC_COUNT; b++)
+    {
+      TEST_ASSERT_TRUE(topicHash(INCOMING_TOPIC_KEYS[a]) != topicHash(INCOMING_TOPIC_KEYS[b]));
+    }
+  }
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_every_key_dispatches_to_itself);
+  RUN_TEST(test_key_mix_matches_strcmp_chain);
+  RUN_TEST(test_unknown_keys_match_nothing);
+  RUN_TEST(test_edited_keys_match_strcmp_chain);
+  RUN_TEST(test_hashes_are_distinct);
+  return UNITY_END();
+}
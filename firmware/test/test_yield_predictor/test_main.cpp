@@ -0,0 +1,97 @@
+#include <unity.h>
+#include <YieldPredictor.h>
+#include <ShotSimulator.h>
+#include <math.h>
+
+static const uint32_t SEEDS[] = {1, 7, 42, 1234, 987654321, 5, 99, 31337};
+static const int SEED_COUNT = sizeof(SEEDS) / sizeof(SEEDS[0]);
+static const unsigned long FRAME_PERIODS_MS[] = {50, 100, 250};
+static const float TARGET_YIELD_G = 36.0f;
+
+struct ShotOutcome
+{
+  int reachedReports;
+  float pumpOffWeight;
+  float pumpOffPrediction;
+  float finalWeight;
+};
+
+// Runs a seeded simulated shot through the predictor the way feedYieldPredictor() does, starting at t=0
+static ShotOutcome runSimulatedShot(YieldPredictor &p, uint32_t seed, unsigned long frameMs, float &dripPerFlow)
+{
+  ShotOutcome outcome = {0, -1.0f, 0.0f, 0.0f};
+  SimulatedShot sim;
+  startSimulatedShot(sim, 0, seed);
+  startYieldPredictor(p, 0);
+  for (unsigned long now = 0; sim.active; now += frameMs)
+  {
+    stepSimulatedShot(sim, now);
+    if (stepYieldPredictor(p, now / 1000.0f, sim.weight, sim.flowRate, sim.pumpOn, TARGET_YIELD_G, dripPerFlow))
+      outcome.reachedReports++;
+    if (p.pumpOff && outcome.pumpOffWeight < 0.0f)
+    {
+      outcome.pumpOffWeight = sim.weight;
+      outcome.pumpOffPrediction = p.predictedFinal;
+    }
+  }
+  outcome.finalWeight = sim.weight;
+  finishYieldPredictor(p, outcome.finalWeight - outcome.pumpOffWeight, 1.0f, dripPerFlow);
+  return outcome;
+}
+
+// The 25 % checkpoint falls on the low-flow shelf before the simulator's flow ramp, so it can only be rough
+void test_eta_error_at_checkpoints(void)
+{
+  const float maxErrorS[3] = {8.0f, 2.0f, 1.0f};
+  for (int f = 0; f < 3; f++)
+  {
+    for (int s = 0; s < SEED_COUNT; s++)
+    {
+      YieldPredictor p;
+      float dripPerFlow = 1.0f;
+      runSimulatedShot(p, SEEDS[s], FRAME_PERIODS_MS[f], dripPerFlow);
+      TEST_ASSERT_TRUE(p.targetReachedS > 0.0f);
+      for (int i = 0; i < 3; i++)
+      {
+        TEST_ASSERT_TRUE(p.checkpointPredictionS[i] >= 0.0f);
+        TEST_ASSERT_FLOAT_WITHIN(maxErrorS[i], 0.0f, p.checkpointPredictionS[i] - p.targetReachedS);
+      }
+    }
+  }
+}
+
+// After pump-off the prediction is the weight plus the learned drip, which converges over a few shots
+void test_final_weight_error(void)
+{
+  for (int f = 0; f < 3; f++)
+  {
+    float dripPerFlow = 1.0f;
+    for (int s = 0; s < SEED_COUNT; s++)
+    {
+      YieldPredictor p;
+      ShotOutcome outcome = runSimulatedShot(p, SEEDS[s], FRAME_PERIODS_MS[f], dripPerFlow);
+      TEST_ASSERT_TRUE(outcome.pumpOffWeight > 0.0f);
+      TEST_ASSERT_FLOAT_WITHIN(s < 5 ? 1.5f : 0.4f, outcome.finalWeight, outcome.pumpOffPrediction);
+    }
+  }
+}
+
+void test_target_reached_reported_once(void)
+{
+  YieldPredictor p;
+  float dripPerFlow = 1.0f;
+  ShotOutcome outcome = runSimulatedShot(p, 42, 100, dripPerFlow);
+  TEST_ASSERT_EQUAL_INT(1, outcome.reachedReports);
+  TEST_ASSERT_TRUE(p.learned);
+  TEST_ASSERT_TRUE(!p.active);
+  TEST_ASSERT_TRUE(dripPerFlow > 1.0f);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_eta_error_at_checkpoints);
+  RUN_TEST(test_final_weight_error);
+  RUN_TEST(test_target_reached_reported_once);
+  return UNITY_END();
+}
@@ -0,0 +1,355 @@
+#!/usr/bin/env python3
+"""Main-controller stand-in for benchmarking the HMI without the machine.
+
+Speaks the HMI's ESP-NOW frame formats over UDP. Frames to the HMI are
+prefixed with the simulated controller MAC; frames from the HMI are raw.
+On the HMI, type `transport=udp` on the serial console, then run this on a
+host in the same network. `frame_cost` on the HMI reports the per-frame
+processing cost.
+
+    python3 controller_sim.py --rate 10 --binary --shot-every 60
+"""
+import argparse
+import json
+import math
+import random
+import socket
+import struct
+import time
+import zlib
+
+# --- Wire format (mirrors HMIFirmware.cpp) ---
+HMI_PORT = 4210
+CONTROLLER_PORT = 4211
+SIM_MAC = bytes([0x02, 0x53, 0x49, 0x4D, 0x00, 0x01])  # locally administered
+IDENTIFIER = b"espresso"
+PAIR_REQUEST = 1
+PAIR_RESPONSE = 2
+PAIRING_LEN = 18
+TEXT_LEN = 250
+
+BINARY_MAGIC = 0xB5
+BINARY_VERSION = 1
+MSG_TELEMETRY = 1
+MSG_FRAGMENT = 2
+FRAGMENT_DATA_BYTES = 200
+
+CAP_BINARY_TELEMETRY = 0x01
+CAP_ACKED_WRITES = 0x02
+CAP_FRAGMENTS = 0x04
+CAP_PROFILE_DELTA = 0x08
+CAP_SNAPSHOT = 0x10
+CAP_LINK_PING = 0x20
+CAP_SUBSCRIBE = 0x40
+CAP_SHORT_TEXT = 0x80  # text frames end at their NUL, at least PAIRING_LEN + 1 bytes
+
+SIM_HZ = 50  # machine model step rate; telemetry goes out at --rate or the subscribed rates
+CHANNELS = ("temps", "pressure", "flow", "weight", "debug")
+
+FLAG_PUMP = 0x01
+FLAG_HEATER = 0x02
+FLAG_LEVER = 0x04
+FLAG_PUMP_START = 0x08
+
+
+def crc16_ccitt(data):
+    crc = 0xFFFF
+    for byte in data:
+        crc ^= byte << 8
+        for _ in range(8):
+            crc = ((crc << 1) ^ 0x1021) if crc & 0x8000 else crc << 1
+            crc &= 0xFFFF
+    return crc
+
+
+def binary_frame(msg_type, seq, payload):
+    body = struct.pack("<BBBBB", BINARY_MAGIC, BINARY_VERSION, msg_type, seq & 0xFF, len(payload)) + payload
+    return body + struct.pack("<H", crc16_ccitt(body))
+
+
+START = time.monotonic()
+
+
+def millis():
+    return int((time.monotonic() - START) * 1000) & 0xFFFFFFFF
+
+
+class Controller:
+    def __init__(self, args):
+        self.args = args
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.setsockopt(socket.SOL_SOCKET, socket.SO_BROADCAST, 1)
+        self.sock.bind(("", CONTROLLER_PORT))
+        self.sock.setblocking(False)
+        self.hmi = (args.hmi, HMI_PORT) if args.hmi else None
+        self.paired = False
+        self.hmi_caps = 0
+        self.binary_seq = 0
+        self.frame_seq = 0
+        self.transfer_id = 0
+        self.frames_sent = 0
+        self.bytes_sent = 0
+        self.subscription = None  # channel -> Hz once the HMI subscribes
+        self.channel_due = {}
+
+        # Machine state
+        self.boiler = 118.0
+        self.hx = 92.0
+        self.pressure = 0.0
+        self.weight = 0.0
+        self.flow = 0.0
+        self.pump = False
+        self.heater = False
+        self.lever = False
+        self.state = "IDLE"
+        self.shot_started = None
+        self.pump_start_ms = None
+        self.state_script = []  # (due time, state) for cleaning and calibration
+        self.settings = {
+            "tempsetbrew": "93.0",
+            "brew_mode": "COFFEE",
+            "steam_boost": "false",
+            "profiling_mode": "manual",
+            "profiling_source": "pressure",
+            "profiling_target": "time",
+            "profiling_flat_value": "9.0",
+            "active_profile_id": "0",
+        }
+        self.profiles = {0: {"id": 0, "v": 1, "n": "Simulated", "m": 0,
+                             "s": [[2.0, 6.0], [9.0, 4.0], [9.0, 16.0], [6.0, 6.0]]}}
+
+    # --- Transmit ---
+    def send(self, frame):
+        if self.hmi is None:
+            return
+        self.sock.sendto(SIM_MAC + frame, self.hmi)
+        self.frames_sent += 1
+        self.bytes_sent += len(frame)
+
+    def send_text(self, text):
+        data = text.encode()
+        if len(data) < TEXT_LEN:
+            length = max(len(data) + 1, PAIRING_LEN + 1) if self.hmi_caps & CAP_SHORT_TEXT else TEXT_LEN
+            self.send(data + b"\0" * (length - len(data)))
+        elif self.hmi_caps & CAP_FRAGMENTS:
+            self.send_fragmented(data)
+        else:
+            print(f"Dropping {len(data)}-byte message: HMI cannot reassemble")
+
+    def send_fragmented(self, data):
+        self.transfer_id = (self.transfer_id + 1) & 0xFF or 1
+        count = math.ceil(len(data) / FRAGMENT_DATA_BYTES)
+        for index in range(count):
+            chunk = data[index * FRAGMENT_DATA_BYTES:(index + 1) * FRAGMENT_DATA_BYTES]
+            payload = struct.pack("<BBBH", self.transfer_id, index, count, len(data)) + chunk.ljust(FRAGMENT_DATA_BYTES, b"\0")
+            self.send(binary_frame(MSG_FRAGMENT, self.binary_seq, payload))
+            self.binary_seq += 1
+
+    def due_channels(self, now):
+        due = set()
+        for channel, hz in self.subscription.items():
+            if hz > 0 and now >= self.channel_due.get(channel, 0):
+                self.channel_due[channel] = max(self.channel_due.get(channel, 0) + 1.0 / hz, now)
+                due.add(channel)
+        return due
+
+    def send_telemetry(self, channels):
+        now = millis()
+        if self.args.binary and self.hmi_caps & CAP_BINARY_TELEMETRY and channels - {"debug"}:
+            flags = (FLAG_PUMP if self.pump else 0) | (FLAG_HEATER if self.heater else 0) | (FLAG_LEVER if self.lever else 0)
+            if self.pump_start_ms is not None:
+                flags |= FLAG_PUMP_START
+            payload = struct.pack("<hhhihBII", round(self.boiler * 10), round(self.hx * 10), round(self.pressure * 100),
+                                  round(self.weight * 100), round(self.flow * 100), flags, now, self.pump_start_ms or 0)
+            self.send(binary_frame(MSG_TELEMETRY, self.binary_seq, payload))
+            self.binary_seq += 1
+            return
+        on_off = lambda flag: "ON" if flag else "OFF"
+        entries = [f"pump={on_off(self.pump)}"]
+        if "temps" in channels:
+            entries += [f"boiler_temp={self.boiler:.1f}", f"hx_temp={self.hx:.1f}", f"heater={on_off(self.heater)}"]
+        if "pressure" in channels:
+            entries.append(f"pressure={self.pressure:.2f}")
+        if "weight" in channels:
+            entries.append(f"weight={self.weight:.2f}")
+        if "flow" in channels:
+            entries.append(f"flow_rate={self.flow:.2f}")
+        if "debug" in channels:
+            entries += [f"raw_weight={self.weight + random.gauss(0, 0.3):.2f}", f"filtered_weight={self.weight:.2f}",
+                        f"filtered_flow={self.flow:.2f}"]
+        entries += [f"ts={now}", f"fseq={self.frame_seq & 0xFFFF}"]
+        if self.pump_start_ms is not None:
+            entries.append(f"pump_start={self.pump_start_ms}")
+        self.frame_seq += 1
+        self.send_text("|".join(entries))
+
+    def snapshot_text(self):
+        body = "|".join(f"{key}={value}" for key, value in self.settings.items())
+        profile = json.dumps(self.profiles[int(self.settings["active_profile_id"])], separators=(",", ":"))
+        body += f"|profile_data={profile}"
+        return body, zlib.crc32(body.encode()) or 1
+
+    # --- Receive ---
+    def handle_frame(self, frame, address):
+        if len(frame) == PAIRING_LEN:
+            msg_id, hmi_mac, channel, identifier = struct.unpack("<B6sB10s", frame)
+            if msg_id == PAIR_REQUEST and identifier.rstrip(b"\0") == IDENTIFIER:
+                self.hmi = (address[0], HMI_PORT)
+                self.paired = True
+                self.subscription = None
+                print(f"Pairing request from {hmi_mac.hex(':')} at {address[0]}")
+                self.send(struct.pack("<B6sB10s", PAIR_RESPONSE, SIM_MAC, channel, IDENTIFIER))
+            return
+        if frame[0] == BINARY_MAGIC or not (len(frame) == TEXT_LEN or frame[-1] == 0):
+            return
+        text = frame.split(b"\0", 1)[0].decode(errors="replace")
+        entries = text.split("|")
+        if entries and entries[0].startswith("seq="):
+            self.send_text(f"ack={entries.pop(0)[4:]}")
+        for entry in entries:
+            key, _, value = entry.partition("=")
+            self.handle_entry(key, value)
+
+    def handle_entry(self, key, value):
+        if key == "caps":
+            self.hmi_caps = int(value)
+            caps = (CAP_ACKED_WRITES | CAP_FRAGMENTS | CAP_PROFILE_DELTA | CAP_SNAPSHOT | CAP_LINK_PING | CAP_SUBSCRIBE |
+                    CAP_SHORT_TEXT)
+            if self.args.binary:
+                caps |= CAP_BINARY_TELEMETRY
+            self.send_text(f"caps={caps & self.hmi_caps}")
+        elif key == "request":
+            self.handle_request(value)
+        elif key == "subscribe":
+            self.subscription = {channel: int(hz) for channel, hz in
+                                 (item.split(":") for item in value.split(",")) if channel in CHANNELS}
+            self.channel_due = {}
+            print(f"HMI subscribed: {value}")
+        elif key == "ping":
+            self.send_text(f"pong={value},{millis()}")
+        elif key in ("tempsetbrew", "brewmode", "profiling_mode", "profiling_source", "profiling_target",
+                     "profiling_flat_value", "active_profile_id"):
+            self.settings[{"brewmode": "brew_mode"}.get(key, key)] = value
+        elif key == "enablesteamboost":
+            self.settings["steam_boost"] = value
+        elif key == "profile_data":
+            profile = json.loads(value)
+            self.profiles[profile["id"]] = profile
+        elif key == "profile_delta":
+            self.apply_profile_delta(value)
+        elif key == "profile_resync":
+            profile = self.profiles.get(int(value))
+            if profile:
+                self.send_text("profile_data=" + json.dumps(profile, separators=(",", ":")))
+        elif key == "start_cleaning":
+            script = [(0.5, "CLEANING_START")]
+            for cycle in range(10):
+                script += [(1.5 + cycle * 4, "CLEANING_PUMPING"), (3.5 + cycle * 4, "CLEANING_PAUSE")]
+            self.run_script(script + [(42.0, "IDLE")])
+        elif key == "calibratescale":
+            self.run_script([(0.5, "CALIBRATION_EMPTY")])
+        elif key == "tare_scale" and self.state == "CALIBRATION_EMPTY":
+            self.run_script([(0.5, "CALIBRATION_TEST_WEIGHT")])
+        elif key == "calibration_step":
+            self.run_script([(0.5, "IDLE")])
+
+    def handle_request(self, value):
+        if value.startswith("snapshot:"):
+            body, digest = self.snapshot_text()
+            if int(value[9:], 16) == digest:
+                self.send_text("snapshot=unchanged")
+            else:
+                self.send_text(f"snapshot={digest:08x}|{body}")
+            return
+        replies = {"tempsetbrew": "tempsetbrew", "brewmode": "brew_mode", "steamboost": "steam_boost",
+                   "prof_mode": "profiling_mode", "prof_src": "profiling_source", "prof_trg": "profiling_target",
+                   "prof_flat": "profiling_flat_value"}
+        if value in replies:
+            key = replies[value]
+            self.send_text(f"{key}={self.settings[key]}")
+        elif value == "profile":
+            for profile in self.profiles.values():
+                self.send_text("profile_data=" + json.dumps(profile, separators=(",", ":")))
+            self.send_text(f"active_profile_id={self.settings['active_profile_id']}|profile_sync=complete")
+
+    def apply_profile_delta(self, value):
+        fields = value.split(",", 2)
+        profile = self.profiles.get(int(fields[0]))
+        if profile is None or int(fields[1]) != profile.get("v", 0):
+            self.send_text(f"profile_resync={fields[0]}")
+            return
+        for cell in fields[2].split(";"):
+            step, target, control = cell.split(":")
+            profile["s"][int(step)] = [float(target), float(control)]
+        profile["v"] = int(fields[1]) + 1
+
+    def run_script(self, steps):
+        now = time.monotonic()
+        self.state_script = sorted((now + delay, state) for delay, state in steps)
+
+    # --- Simulation ---
+    def step_machine(self, now):
+        while self.state_script and self.state_script[0][0] <= now:
+            self.state = self.state_script.pop(0)[1]
+            self.send_text(f"state={self.state}")
+
+        if self.args.shot_every and self.shot_started is None and now % self.args.shot_every < 0.05:
+            self.shot_started = now
+            self.pump_start_ms = millis()
+            self.lever = self.pump = True
+        if self.shot_started is not None:
+            t = now - self.shot_started
+            self.pressure = min(9.0, t * 1.5) + random.gauss(0, 0.05)
+            self.flow = max(0.0, 2.0 * (1 - math.exp(-max(0.0, t - 6) / 3))) + random.gauss(0, 0.05)
+            self.weight += self.flow / SIM_HZ
+            if t > self.args.shot_length:
+                self.shot_started = self.pump_start_ms = None
+                self.lever = self.pump = False
+                self.pressure = self.flow = 0.0
+        else:
+            self.weight = max(0.0, self.weight - 0.5)
+        self.heater = self.boiler < 119.0
+        self.boiler += (0.2 if self.heater else -0.05) + random.gauss(0, 0.02)
+        self.hx = 92.0 + random.gauss(0, 0.1)
+
+    def run(self):
+        interval = 1.0 / SIM_HZ
+        next_tick = time.monotonic()
+        next_frame = next_tick
+        report_at = time.monotonic() + 5
+        end = time.monotonic() + self.args.duration if self.args.duration else None
+        while end is None or time.monotonic() < end:
+            try:
+                while True:
+                    datagram, address = self.sock.recvfrom(512)
+                    self.handle_frame(datagram, address)
+            except BlockingIOError:
+                pass
+
+            now = time.monotonic()
+            if now >= next_tick:
+                next_tick += interval
+                self.step_machine(now)
+                if self.paired and self.subscription is not None:
+                    channels = self.due_channels(now)
+                    if channels:
+                        self.send_telemetry(channels)
+                elif self.paired and now >= next_frame:
+                    next_frame = max(next_frame + 1.0 / self.args.rate, now)
+                    self.send_telemetry(set(CHANNELS[:4]))
+            if now >= report_at:
+                print(f"{self.frames_sent / 5:.1f} frames/s, {self.bytes_sent / 5:.0f} B/s, state {self.state}")
+                self.frames_sent = self.bytes_sent = 0
+                report_at += 5
+            time.sleep(min(0.002, max(0.0, next_tick - time.monotonic())))
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--hmi", help="HMI IP address (default: learned from its pairing broadcast)")
+    parser.add_argument("--rate", type=float, default=10.0, help="telemetry frames per second until the HMI subscribes")
+    parser.add_argument("--binary", action="store_true", help="send binary telemetry when the HMI supports it")
+    parser.add_argument("--shot-every", type=float, default=0, help="start a simulated shot every N seconds")
+    parser.add_argument("--shot-length", type=float, default=30.0, help="simulated shot length in seconds")
+    parser.add_argument("--duration", type=float, default=0, help="stop after N seconds")
+    Controller(parser.parse_args()).run()
@@ -0,0 +1,103 @@
+#!/usr/bin/env python3
+"""Inspect an HMI record/replay log and feed its radio frames to an HMI over UDP.
+
+Record on the HMI with `record=on` / `record=off`, then download the log from
+http://<hmi>/api/replay_log while a web portal is running. On-device replay
+(`replay=1`, `replay=4`, `replay=max`) covers radio frames and display returns;
+this tool replays the radio side from a host against an HMI on `transport=udp`.
+
+    python3 replay_log.py replay.bin
+    python3 replay_log.py replay.bin --send 192.168.1.50 --speed 4
+"""
+import argparse
+import socket
+import struct
+import time
+
+# --- Log format (mirrors HMIFirmware.cpp) ---
+LOG_MAGIC = 0x594C5052
+LOG_VERSION = 2
+# magic, version, paired, MAC, caps, page, then the HMI state the replay restores first
+LOG_HEADER = struct.Struct("<IBB6sBBbff20s20s20s64sffffffffBB")
+RECORD_HEADER = struct.Struct("<BHH")
+REPLAY_RADIO = 0
+REPLAY_RADIO_TEXT = 1
+REPLAY_NEXTION = 2
+KIND_NAMES = {REPLAY_RADIO: "radio", REPLAY_RADIO_TEXT: "text", REPLAY_NEXTION: "nextion"}
+TEXT_LEN = 250
+HMI_PORT = 4210
+
+
+def read_log(path):
+    with open(path, "rb") as f:
+        data = f.read()
+    if len(data) < LOG_HEADER.size:
+        raise SystemExit(f"{path}: not a version {LOG_VERSION} replay log")
+    (magic, version, paired, mac, caps, page, profile, setpoint, flat, mode, source, target, state,
+     dose, target_yield, drip_per_flow, boiler, hx, pressure, flow, weight, lever, chart_aux) = LOG_HEADER.unpack_from(data)
+    if magic != LOG_MAGIC or version != LOG_VERSION:
+        raise SystemExit(f"{path}: not a version {LOG_VERSION} replay log")
+    text = lambda raw: raw.split(b"\0", 1)[0].decode(errors="replace")
+    header = {"paired": bool(paired), "mac": mac, "caps": caps, "page": page, "profile": profile,
+              "setpoint": setpoint / 10, "mode": text(mode), "source": text(source), "target": text(target),
+              "state": text(state), "dose": dose, "target_yield": target_yield, "weight": weight}
+    records = []
+    offset = LOG_HEADER.size
+    at_ms = 0
+    while offset + RECORD_HEADER.size <= len(data):
+        kind, delta_ms, length = RECORD_HEADER.unpack_from(data, offset)
+        offset += RECORD_HEADER.size
+        at_ms += delta_ms
+        records.append((at_ms, kind, data[offset:offset + length]))
+        offset += length
+    return header, records
+
+
+def describe(record):
+    at_ms, kind, body = record
+    if kind == REPLAY_NEXTION:
+        return f"{at_ms:9d} nextion {body.hex(' ')}"
+    mac, frame = body[:6].hex(":"), body[6:]
+    if kind == REPLAY_RADIO_TEXT:
+        return f"{at_ms:9d} {mac} {frame.decode(errors='replace')}"
+    return f"{at_ms:9d} {mac} {len(frame)}-byte frame {frame[:4].hex(' ')}"
+
+
+def send(records, hmi, speed):
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    start = time.monotonic()
+    sent = 0
+    for at_ms, kind, body in records:
+        if kind == REPLAY_NEXTION:
+            continue
+        if speed:
+            time.sleep(max(0.0, start + at_ms / 1000 / speed - time.monotonic()))
+        frame = body[6:]
+        if kind == REPLAY_RADIO_TEXT:
+            frame = frame.ljust(TEXT_LEN, b"\0")
+        sock.sendto(body[:6] + frame, (hmi, HMI_PORT))
+        sent += 1
+    print(f"Sent {sent} frames in {time.monotonic() - start:.2f} s")
+
+
+if __name__ == "__main__":
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", help="replay log downloaded from the HMI")
+    parser.add_argument("--dump", action="store_true", help="print every record")
+    parser.add_argument("--send", metavar="HMI_IP", help="send the radio frames to an HMI on the UDP transport")
+    parser.add_argument("--speed", type=float, default=1.0, help="replay speed multiplier, 0 for no pacing")
+    args = parser.parse_args()
+
+    header, records = read_log(args.log)
+    counts = {name: sum(1 for _, kind, _ in records if kind == value) for value, name in KIND_NAMES.items()}
+    duration = records[-1][0] / 1000 if records else 0
+    print(f"Controller {header['mac'].hex(':')} (paired: {header['paired']}, caps {header['caps']:#04x}), page {header['page']}")
+    print(f"Started in {header['state'] or 'unknown state'}: profile {header['profile']}, {header['mode'] or 'no'} mode "
+          f"({header['source']} by {header['target']}), setpoint {header['setpoint']:.1f} C, "
+          f"dose {header['dose']:.1f} g, target {header['target_yield']:.1f} g")
+    print(f"{len(records)} records over {duration:.1f} s: " + ", ".join(f"{n} {name}" for name, n in counts.items()))
+    if args.dump:
+        for record in records:
+            print(describe(record))
+    if args.send:
+        send(records, args.send, args.speed)